@@ -0,0 +1,630 @@
+/*
+    pmacct (Promiscuous mode IP Accounting package)
+    pmacct is Copyright (C) 2003-2020 by Paolo Lucente
+*/
+
+/*
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/*
+   bgp_fib_bench: loads a unicast table for one BGP peer, as the BGP thread
+   would when parsing UPDATEs (with 'bgp_table_fib' set), then compares
+   longest prefix match via bgp_node_match() against bgp_fib_match(), for
+   IPv4 and IPv6, checking both agree. Finally churns the table (withdraw
+   + re-announce) while a reader thread keeps looking up through the FIB,
+   as the collector thread does, to exercise memory reclamation.
+
+   The table is either synthetic, with prefix lengths roughly shaped as in
+   full tables, or read off a file (-f): an uncompressed MRT TABLE_DUMP_V2
+   RIB dump (ie. from RouteViews or RIPE RIS) or a bgp_table_dump_file.
+   Half of the addresses looked up fall within a loaded prefix, half are
+   random (within 2000::/3 for IPv6). Lookups are timed both over all of
+   the addresses, mostly missing CPU caches, and over a hot set of them
+   (-H), closer to what recurring flows cost.
+*/
+
+/* includes */
+#include "pmacct.h"
+#include "bgp/bgp.h"
+
+#define BENCH_DEFAULT_PREFIXES	500000
+#define BENCH_DEFAULT_PREFIXES6	200000
+#define BENCH_DEFAULT_LOOKUPS	5000000
+#define BENCH_DEFAULT_CHURN	200000
+#define BENCH_DEFAULT_HOT	4096
+#define BENCH_UPDATE_NLRI	100	/* prefixes per emulated UPDATE message */
+#define BENCH_READER_BATCH	64	/* lookups per emulated packet */
+
+/* MRT, RFC 6396 */
+#define BENCH_MRT_TABLE_DUMP_V2		13
+#define BENCH_MRT_RIB_IPV4_UNICAST	2
+#define BENCH_MRT_RIB_IPV6_UNICAST	4
+#define BENCH_MRT_RIB_IPV4_UNICAST_AP	8	/* RFC 8050 */
+#define BENCH_MRT_RIB_IPV6_UNICAST_AP	10
+
+struct bench_table {
+  struct prefix *p;
+  u_int32_t num;
+  u_int32_t max;
+};
+
+struct bench_reader_args {
+  afi_t afi;
+  struct in6_addr *addrs;
+  u_int32_t num;
+};
+
+static struct bgp_peer bench_peer;
+static struct bench_table bench_tbl[AFI_MAX];
+static u_int32_t bench_seed = 2463534242U;
+static volatile int bench_churn_done;
+
+static void usage_bench(char *prog)
+{
+  printf("Usage: %s [-f file] [-p prefixes] [-P prefixes] [-n lookups] [-H hot] [-c churn]\n\n", prog);
+  printf("  -f\tLoad the table off an MRT TABLE_DUMP_V2 RIB dump (uncompressed) or a bgp_table_dump_file\n");
+  printf("  -p\tSynthetic IPv4 prefixes, if no file is given (default: %u)\n", BENCH_DEFAULT_PREFIXES);
+  printf("  -P\tSynthetic IPv6 prefixes, if no file is given (default: %u)\n", BENCH_DEFAULT_PREFIXES6);
+  printf("  -n\tLookups per method and address family (default: %u)\n", BENCH_DEFAULT_LOOKUPS);
+  printf("  -H\tAddresses in the hot set (default: %u)\n", BENCH_DEFAULT_HOT);
+  printf("  -c\tPrefixes withdrawn and re-announced while looking up (default: %u)\n", BENCH_DEFAULT_CHURN);
+}
+
+static double bench_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (ts.tv_sec + (ts.tv_nsec / 1e9));
+}
+
+/* xorshift32: reproducible across runs */
+static u_int32_t bench_rand(u_int32_t *state)
+{
+  u_int32_t x = (*state);
+
+  x ^= (x << 13);
+  x ^= (x >> 17);
+  x ^= (x << 5);
+
+  return ((*state) = x);
+}
+
+static afi_t bench_afi(struct prefix *p)
+{
+  return ((p->family == AF_INET) ? AFI_IP : AFI_IP6);
+}
+
+static void bench_table_add(struct prefix *p)
+{
+  struct bench_table *tbl = &bench_tbl[bench_afi(p)];
+  struct prefix *new_p;
+
+  if (tbl->num == tbl->max) {
+    tbl->max = (tbl->max ? (tbl->max * 2) : 65536);
+
+    new_p = realloc(tbl->p, (tbl->max * sizeof(struct prefix)));
+    if (!new_p) {
+      fprintf(stderr, "ERROR: unable to allocate memory\n");
+      exit(1);
+    }
+
+    tbl->p = new_p;
+  }
+
+  tbl->p[tbl->num] = (*p);
+  apply_mask(&tbl->p[tbl->num]);
+  tbl->num++;
+}
+
+/* prefix lengths roughly shaped as in a full IPv4 table */
+static u_int8_t bench_prefixlen(u_int32_t r)
+{
+  r %= 100;
+
+  if (r < 60) return 24;
+  if (r < 70) return 23;
+  if (r < 78) return 22;
+  if (r < 90) return (16 + (r % 6));
+  return (8 + (r % 8));
+}
+
+/* same, for a full IPv6 table */
+static u_int8_t bench_prefixlen6(u_int32_t r)
+{
+  r %= 100;
+
+  if (r < 45) return 48;
+  if (r < 60) return (40 + (r % 8));
+  if (r < 70) return 32;
+  if (r < 80) return 44;
+  if (r < 88) return 36;
+  if (r < 95) return (29 + (r % 3));
+  return (56 + (r % 9));
+}
+
+/* random address, within 2000::/3 for IPv6 */
+static void bench_rand_addr(afi_t afi, struct in6_addr *addr)
+{
+  u_int32_t words[4];
+  int idx;
+
+  memset(addr, 0, sizeof(struct in6_addr));
+
+  if (afi == AFI_IP) {
+    words[0] = bench_rand(&bench_seed);
+    memcpy(addr, words, 4);
+  }
+  else {
+    for (idx = 0; idx < 4; idx++) words[idx] = bench_rand(&bench_seed);
+    words[0] = htonl(0x20000000 | (ntohl(words[0]) & 0x1FFFFFFF));
+    memcpy(addr, words, sizeof(words));
+  }
+}
+
+static void bench_synth(afi_t afi, u_int32_t num)
+{
+  struct prefix p;
+  u_int32_t idx;
+
+  for (idx = 0; idx < num; idx++) {
+    memset(&p, 0, sizeof(p));
+    p.family = ((afi == AFI_IP) ? AF_INET : AF_INET6);
+    p.prefixlen = ((afi == AFI_IP) ? bench_prefixlen(bench_rand(&bench_seed)) : bench_prefixlen6(bench_rand(&bench_seed)));
+    bench_rand_addr(afi, &p.u.prefix6);
+
+    bench_table_add(&p);
+  }
+}
+
+static int bench_load_mrt(FILE *file)
+{
+  u_char hdr[12], *rec = NULL, *ptr;
+  u_int32_t len, rec_max = 0;
+  u_int16_t type, subtype;
+  struct prefix p;
+  int num = 0;
+
+  while (fread(hdr, sizeof(hdr), 1, file) == 1) {
+    type = ((hdr[4] << 8) | hdr[5]);
+    subtype = ((hdr[6] << 8) | hdr[7]);
+    len = ((hdr[8] << 24) | (hdr[9] << 16) | (hdr[10] << 8) | hdr[11]);
+
+    if (len > rec_max) {
+      rec_max = len;
+      rec = realloc(rec, rec_max);
+      if (!rec) {
+	fprintf(stderr, "ERROR: unable to allocate memory\n");
+	exit(1);
+      }
+    }
+
+    if (len && fread(rec, len, 1, file) != 1) break;
+    if (type != BENCH_MRT_TABLE_DUMP_V2) continue;
+
+    memset(&p, 0, sizeof(p));
+
+    switch (subtype) {
+    case BENCH_MRT_RIB_IPV4_UNICAST:
+    case BENCH_MRT_RIB_IPV4_UNICAST_AP:
+      p.family = AF_INET;
+      break;
+    case BENCH_MRT_RIB_IPV6_UNICAST:
+    case BENCH_MRT_RIB_IPV6_UNICAST_AP:
+      p.family = AF_INET6;
+      break;
+    default:
+      continue;
+    }
+
+    /* sequence number, then the prefix */
+    if (len < 5) continue;
+    ptr = (rec + 4);
+    p.prefixlen = (*ptr++);
+    if (p.prefixlen > ((p.family == AF_INET) ? IPV4_MAX_PREFIXLEN : IPV6_MAX_PREFIXLEN)) continue;
+    if ((5 + ((p.prefixlen + 7) / 8)) > len) continue;
+    memcpy(&p.u.prefix, ptr, ((p.prefixlen + 7) / 8));
+
+    bench_table_add(&p);
+    num++;
+  }
+
+  if (rec) free(rec);
+
+  return num;
+}
+
+/* unicast entries of a bgp_table_dump_file, JSON format */
+static int bench_load_dump(FILE *file)
+{
+  char buf[SRVBUFLEN * 4], *start, *end;
+  struct prefix p;
+  int num = 0;
+
+  while (fgets(buf, sizeof(buf), file)) {
+    if (strstr(buf, "\"rd\":")) continue;
+
+    start = strstr(buf, "\"ip_prefix\":");
+    if (!start) continue;
+
+    start += strlen("\"ip_prefix\":");
+    while (*start == ' ') start++;
+    if (*start++ != '"') continue;
+
+    end = strchr(start, '"');
+    if (!end) continue;
+    (*end) = '\0';
+
+    memset(&p, 0, sizeof(p));
+    if (!str2prefix(start, &p)) continue;
+
+    bench_table_add(&p);
+    num++;
+  }
+
+  return num;
+}
+
+static void bench_load_file(char *filename)
+{
+  FILE *file;
+  int num, first;
+
+  file = fopen(filename, "r");
+  if (!file) {
+    fprintf(stderr, "ERROR: unable to open %s: %s\n", filename, strerror(errno));
+    exit(1);
+  }
+
+  /* a bgp_table_dump_file is made of JSON objects, one per line */
+  first = fgetc(file);
+  rewind(file);
+
+  if (first == '{') num = bench_load_dump(file);
+  else num = bench_load_mrt(file);
+
+  fclose(file);
+
+  if (!num) {
+    fprintf(stderr, "ERROR: no unicast prefixes found in %s\n", filename);
+    exit(1);
+  }
+
+  printf("file: %s, %u IPv4 and %u IPv6 prefixes\n", filename, bench_tbl[AFI_IP].num, bench_tbl[AFI_IP6].num);
+}
+
+static void bench_setup_bgp(void)
+{
+  afi_t afi;
+  safi_t safi;
+
+  config.name = "default";
+  config.type = "core";
+  config.bgp_daemon = TRUE;
+  config.bgp_table_fib = TRUE;
+  config.bgp_daemon_max_peers = 1;
+  config.bgp_table_peer_buckets = DEFAULT_BGP_INFO_HASH;
+  config.bgp_table_per_peer_buckets = DEFAULT_BGP_INFO_PER_PEER_HASH;
+  config.bgp_table_attr_hash_buckets = HASHTABSIZE;
+
+  bgp_prepare_thread();
+  bgp_route_info_modulo = bgp_route_info_modulo_pathid;
+  bgp_link_misc_structs(bgp_misc_db);
+
+  bgp_routing_db = &inter_domain_routing_dbs[FUNC_TYPE_BGP];
+  memset(bgp_routing_db, 0, sizeof(struct bgp_rt_structs));
+  bgp_attr_init(config.bgp_table_attr_hash_buckets, bgp_routing_db);
+
+  for (afi = AFI_IP; afi < AFI_MAX; afi++) {
+    for (safi = SAFI_UNICAST; safi < SAFI_MAX; safi++) {
+      bgp_routing_db->rib[afi][safi] = bgp_table_init(afi, safi);
+    }
+  }
+
+  bgp_peer_init(&bench_peer, FUNC_TYPE_BGP);
+  bench_peer.status = Established;
+  bench_peer.addr.family = AF_INET;
+  bench_peer.addr.address.ipv4.s_addr = htonl(0xC0000201);
+}
+
+/* one NLRI of an UPDATE; commit is left to the caller, per message */
+static void bench_process(struct prefix *p, u_int32_t nexthop, int withdraw)
+{
+  struct bgp_msg_data bmd;
+  struct bgp_attr attr;
+  struct bgp_attr_extra attr_extra;
+  afi_t afi = bench_afi(p);
+
+  memset(&bmd, 0, sizeof(bmd));
+  memset(&attr, 0, sizeof(attr));
+  memset(&attr_extra, 0, sizeof(attr_extra));
+
+  bmd.peer = &bench_peer;
+  if (afi == AFI_IP) attr.nexthop.s_addr = htonl(nexthop);
+  else {
+    attr.mp_nexthop.family = AF_INET6;
+    attr.mp_nexthop.address.ipv6.s6_addr[0] = 0x20;
+    attr.mp_nexthop.address.ipv6.s6_addr[15] = (nexthop & 0xff);
+  }
+
+  if (!withdraw) bgp_process_update(&bmd, p, &attr, &attr_extra, afi, SAFI_UNICAST, 0);
+  else bgp_process_withdraw(&bmd, p, &attr, &attr_extra, afi, SAFI_UNICAST, 0);
+}
+
+/* end of an UPDATE message, as bgp_parse_msg() does */
+static void bench_commit(void)
+{
+  bgp_fib_commit(&bench_peer);
+  bgp_peer_retired_commit(&bench_peer);
+}
+
+static void bench_node_match(afi_t afi, struct in6_addr *addr, struct bgp_node **result, struct bgp_info **info)
+{
+  struct node_match_cmp_term2 nmct2;
+  rd_t rd;
+
+  memset(&nmct2, 0, sizeof(nmct2));
+  memset(&rd, 0, sizeof(rd));
+  nmct2.peer = &bench_peer;
+  nmct2.afi = afi;
+  nmct2.safi = SAFI_UNICAST;
+  nmct2.rd = &rd;
+
+  if (afi == AFI_IP)
+    bgp_node_match_ipv4(bgp_routing_db->rib[AFI_IP][SAFI_UNICAST], (struct in_addr *) addr, &bench_peer,
+			bgp_misc_db->route_info_modulo, bgp_misc_db->bgp_lookup_node_match_cmp,
+			&nmct2, NULL, result, info);
+  else
+    bgp_node_match_ipv6(bgp_routing_db->rib[AFI_IP6][SAFI_UNICAST], addr, &bench_peer,
+			bgp_misc_db->route_info_modulo, bgp_misc_db->bgp_lookup_node_match_cmp,
+			&nmct2, NULL, result, info);
+}
+
+/* half of the addresses fall within a loaded prefix, half are random */
+static void bench_addresses(afi_t afi, struct in6_addr *addrs, u_int32_t num)
+{
+  struct bench_table *tbl = &bench_tbl[afi];
+  struct in6_addr host;
+  struct prefix *p;
+  u_int32_t idx, byte;
+
+  for (idx = 0; idx < num; idx++) {
+    bench_rand_addr(afi, &addrs[idx]);
+    if (idx & 1) continue;
+
+    /* network bits off a loaded prefix, host bits random */
+    p = &tbl->p[bench_rand(&bench_seed) % tbl->num];
+    host = addrs[idx];
+
+    for (byte = 0; byte < (p->prefixlen / 8); byte++) addrs[idx].s6_addr[byte] = p->u.prefix6.s6_addr[byte];
+    if (p->prefixlen % 8) {
+      u_char mask = (0xFF << (8 - (p->prefixlen % 8)));
+
+      addrs[idx].s6_addr[byte] = ((p->u.prefix6.s6_addr[byte] & mask) | (host.s6_addr[byte] & ~mask));
+    }
+  }
+}
+
+static void bench_load(afi_t afi)
+{
+  struct bench_table *tbl = &bench_tbl[afi];
+  u_int32_t idx;
+  double start, elapsed;
+
+  start = bench_now();
+
+  for (idx = 0; idx < tbl->num; idx++) {
+    bench_process(&tbl->p[idx], ((idx % 64) + 1), FALSE);
+    if (!((idx + 1) % BENCH_UPDATE_NLRI)) bench_commit();
+  }
+
+  bench_commit();
+
+  elapsed = (bench_now() - start);
+  printf("load %s: %u prefixes (%u routes) in %.2fs, %.0f prefixes/s\n", ((afi == AFI_IP) ? "IPv4" : "IPv6"),
+	 tbl->num, bench_peer.routes[afi][SAFI_UNICAST], elapsed, (tbl->num / elapsed));
+}
+
+static void *bench_reader(void *arg)
+{
+  struct bench_reader_args *bra = arg;
+  struct bgp_node *result;
+  struct bgp_info *info;
+  u_int64_t lookups = 0, matches = 0;
+  u_int32_t idx = 0, batch;
+  int reader;
+
+  reader = bgp_mem_reader_register();
+
+  while (!__atomic_load_n(&bench_churn_done, __ATOMIC_RELAXED)) {
+    bgp_mem_reader_online(reader);
+
+    for (batch = 0; batch < BENCH_READER_BATCH; batch++, idx = ((idx + 1) % bra->num)) {
+      bgp_fib_match(&bench_peer, bra->afi, SAFI_UNICAST, &bra->addrs[idx], &result, &info);
+
+      /* touch the path, as enrichment would */
+      if (info && info->attr) matches += (info->attr->nexthop.s_addr != 0 || info->attr->mp_nexthop.family);
+      lookups++;
+    }
+
+    bgp_mem_reader_offline(reader);
+  }
+
+  printf("reader: %" PRIu64 " lookups (%" PRIu64 " matched) during churn\n", lookups, matches);
+
+  return NULL;
+}
+
+/* returns the number of mismatches between bgp_node_match() and bgp_fib_match() */
+static void bench_time(afi_t afi, struct in6_addr *addrs, u_int32_t num, u_int32_t lookups, char *set)
+{
+  struct bgp_node *result;
+  struct bgp_info *info;
+  u_int32_t idx, addr_idx;
+  double start, elapsed;
+
+  start = bench_now();
+  for (idx = 0, addr_idx = 0; idx < lookups; idx++, addr_idx = ((addr_idx + 1) % num))
+    bench_node_match(afi, &addrs[addr_idx], &result, &info);
+  elapsed = bench_now() - start;
+  printf("%-18s %-10s %-14.0f %-14.1f\n", "bgp_node_match", set, (lookups / elapsed), ((elapsed * 1e9) / lookups));
+
+  start = bench_now();
+  for (idx = 0, addr_idx = 0; idx < lookups; idx++, addr_idx = ((addr_idx + 1) % num))
+    bgp_fib_match(&bench_peer, afi, SAFI_UNICAST, &addrs[addr_idx], &result, &info);
+  elapsed = bench_now() - start;
+  printf("%-18s %-10s %-14.0f %-14.1f\n", "bgp_fib_match", set, (lookups / elapsed), ((elapsed * 1e9) / lookups));
+}
+
+static u_int32_t bench_run(afi_t afi, u_int32_t lookups, u_int32_t hot, u_int32_t churn)
+{
+  struct bench_table *tbl = &bench_tbl[afi];
+  struct bench_reader_args bra;
+  struct in6_addr *addrs;
+  struct bgp_node *result, *fib_result;
+  struct bgp_info *info, *fib_info;
+  u_int32_t idx, mismatches = 0, matched = 0;
+  pthread_t reader;
+  double start, elapsed;
+
+  if (!hot) hot = 1;
+
+  addrs = calloc(lookups, sizeof(struct in6_addr));
+  if (!addrs) {
+    fprintf(stderr, "ERROR: unable to allocate memory\n");
+    exit(1);
+  }
+
+  bench_addresses(afi, addrs, lookups);
+
+  /* correctness */
+  for (idx = 0; idx < lookups; idx++) {
+    bench_node_match(afi, &addrs[idx], &result, &info);
+    bgp_fib_match(&bench_peer, afi, SAFI_UNICAST, &addrs[idx], &fib_result, &fib_info);
+
+    if (result != fib_result || info != fib_info) mismatches++;
+    if (result) matched++;
+  }
+
+  printf("check %s: %u lookups, %u matched, %u mismatches\n\n", ((afi == AFI_IP) ? "IPv4" : "IPv6"),
+	 lookups, matched, mismatches);
+
+  /* lookup speed */
+  printf("%-18s %-10s %-14s %-14s\n", "method", "set", "lookups/s", "ns/lookup");
+  bench_time(afi, addrs, lookups, lookups, "all");
+  bench_time(afi, addrs, MIN(hot, lookups), lookups, "hot");
+  printf("\n");
+
+  /* churn, with a concurrent reader */
+  if (churn) {
+    bra.afi = afi;
+    bra.addrs = addrs;
+    bra.num = lookups;
+    bench_churn_done = FALSE;
+
+    if (pthread_create(&reader, NULL, bench_reader, &bra)) {
+      fprintf(stderr, "ERROR: unable to start reader thread\n");
+      exit(1);
+    }
+
+    start = bench_now();
+
+    for (idx = 0; idx < churn; idx++) {
+      struct prefix *p = &tbl->p[bench_rand(&bench_seed) % tbl->num];
+
+      bench_process(p, 0, TRUE);
+      bench_process(p, (idx % 64) + 1, FALSE);
+      if (!((idx + 1) % BENCH_UPDATE_NLRI)) bench_commit();
+    }
+
+    bench_commit();
+    elapsed = bench_now() - start;
+
+    __atomic_store_n(&bench_churn_done, TRUE, __ATOMIC_RELAXED);
+    pthread_join(reader, NULL);
+
+    bench_commit();
+
+    printf("churn: %u withdraw+announce in %.2fs, %.0f prefixes/s; retired paths pending=%u, memory pending=%d\n\n",
+	   churn, elapsed, (churn / elapsed), bench_peer.retired_num, bgp_mem_retired_pending());
+  }
+
+  free(addrs);
+
+  return mismatches;
+}
+
+int main(int argc, char **argv)
+{
+  char *filename = NULL;
+  u_int32_t prefixes = BENCH_DEFAULT_PREFIXES, prefixes6 = BENCH_DEFAULT_PREFIXES6;
+  u_int32_t lookups = BENCH_DEFAULT_LOOKUPS, churn = BENCH_DEFAULT_CHURN, mismatches = 0;
+  u_int32_t hot = BENCH_DEFAULT_HOT;
+  afi_t afi;
+  int cp;
+
+  while ((cp = getopt(argc, argv, "f:p:P:n:H:c:h")) != -1) {
+    switch (cp) {
+    case 'f':
+      filename = optarg;
+      break;
+    case 'p':
+      prefixes = atoi(optarg);
+      break;
+    case 'P':
+      prefixes6 = atoi(optarg);
+      break;
+    case 'n':
+      lookups = atoi(optarg);
+      break;
+    case 'H':
+      hot = atoi(optarg);
+      break;
+    case 'c':
+      churn = atoi(optarg);
+      break;
+    default:
+      usage_bench(argv[0]);
+      exit(0);
+    }
+  }
+
+  if (!lookups) {
+    usage_bench(argv[0]);
+    exit(1);
+  }
+
+  bench_setup_bgp();
+
+  if (filename) bench_load_file(filename);
+  else {
+    bench_synth(AFI_IP, prefixes);
+    bench_synth(AFI_IP6, prefixes6);
+  }
+
+  for (afi = AFI_IP; afi <= AFI_IP6; afi++) {
+    if (bench_tbl[afi].num) bench_load(afi);
+  }
+
+  printf("\n");
+
+  for (afi = AFI_IP; afi <= AFI_IP6; afi++) {
+    if (bench_tbl[afi].num) mismatches += bench_run(afi, lookups, hot, churn);
+  }
+
+  return (mismatches ? 1 : 0);
+}
@@ -0,0 +1,277 @@
+/*
+    pmacct (Promiscuous mode IP Accounting package)
+    pmacct is Copyright (C) 2003-2020 by Paolo Lucente
+*/
+
+/*
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/*
+   exec_plugins_bench: drives exec_plugins() with synthetic IPv4 packet_ptrs
+   over 1..N channels sharing a global pre_tag_map that sets a label, as the
+   Core Process of pmacctd would do. Reports records/s per channel count and
+   the number of heap allocations per record: malloc() and friends are
+   wrapped at link time (see Makefile.am). Plugins are not forked: rings are
+   drained in place as if each plugin kept up with the Core Process.
+*/
+
+/* includes */
+#include "pmacct.h"
+#include "pmacct-data.h"
+#include "plugin_hooks.h"
+#include "pkt_handlers.h"
+#include "pretag.h"
+
+#define BENCH_DEFAULT_RECORDS	1000000
+#define BENCH_DEFAULT_CHANNELS	8
+
+/* allocation counters */
+static u_int64_t bench_allocs;
+
+extern void *__real_malloc(size_t);
+extern void *__real_calloc(size_t, size_t);
+extern void *__real_realloc(void *, size_t);
+extern char *__real_strdup(const char *);
+
+void *__wrap_malloc(size_t size)
+{
+  bench_allocs++;
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+  bench_allocs++;
+  return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+  bench_allocs++;
+  return __real_realloc(ptr, size);
+}
+
+char *__wrap_strdup(const char *s)
+{
+  bench_allocs++;
+  return __real_strdup(s);
+}
+
+static struct plugins_list_entry bench_plugins[MAX_N_PLUGINS];
+static struct plugin_requests bench_req;
+
+static void usage_bench(char *prog)
+{
+  printf("Usage: %s [-n records] [-c max channels] [-L]\n\n", prog);
+  printf("  -n\tRecords to push through exec_plugins() per run (default: %u)\n", BENCH_DEFAULT_RECORDS);
+  printf("  -c\tRuns with 1, 2, 4, .. up to this many channels (default: %u)\n", BENCH_DEFAULT_CHANNELS);
+  printf("  -L\tDisable the label-setting pre_tag_map\n");
+}
+
+static double bench_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (ts.tv_sec + (ts.tv_nsec / 1e9));
+}
+
+static void bench_setup_channels(int num, char *map)
+{
+  struct channels_list_entry *chptr;
+  int index;
+
+  memset(channels_list, 0, sizeof(struct channels_list_entry) * MAX_N_PLUGINS);
+
+  for (index = 0; index < num; index++) {
+    struct plugins_list_entry *list = &bench_plugins[index];
+
+    if (!list->cfg.name) {
+      snprintf(list->name, sizeof(list->name), "bench%u", index);
+      list->id = (index + 1);
+      list->type.id = PLUGIN_ID_MEMORY;
+      strlcpy(list->type.string, "memory", sizeof(list->type.string));
+
+      list->cfg.name = list->name;
+      list->cfg.type = list->type.string;
+      list->cfg.type_id = list->type.id;
+      list->cfg.acct_type = ACCT_PM;
+      list->cfg.what_to_count = (COUNT_SRC_HOST|COUNT_DST_HOST|COUNT_SRC_PORT|COUNT_DST_PORT|COUNT_IP_PROTO);
+      list->cfg.data_type = PIPE_TYPE_METADATA;
+      list->cfg.buffer_size = 10240;
+      list->cfg.pipe_size = 4096000;
+
+      if (map) {
+        list->cfg.what_to_count_2 = COUNT_LABEL;
+        list->cfg.data_type |= PIPE_TYPE_VLEN;
+        list->cfg.pre_tag_map = map;
+        list->cfg.ptm_global = TRUE;
+        load_pre_tag_map(ACCT_PM, map, &list->cfg.ptm, &bench_req, &list->cfg.ptm_alloc, 0, 0);
+      }
+    }
+
+    chptr = insert_pipe_channel(list->type.id, &list->cfg, -1);
+    if (!chptr) {
+      fprintf(stderr, "ERROR: unable to setup channel #%u\n", index);
+      exit(1);
+    }
+
+    chptr->plugin = list;
+    chptr->clean_func = pkt_data_clean;
+    chptr->datasize = sizeof(struct pkt_data);
+
+    if (map) {
+      chptr->extras.off_pkt_vlen_hdr_primitives = sizeof(struct pkt_data);
+      chptr->datasize += sizeof(struct pkt_vlen_hdr_primitives);
+    }
+  }
+
+  evaluate_packet_handlers();
+}
+
+static void bench_teardown_channels(int num)
+{
+  int index;
+
+  for (index = 0; index < num; index++) {
+    munmap(channels_list[index].rg.base, channels_list[index].plugin->cfg.pipe_size+PKT_MSG_SIZE);
+    munmap(channels_list[index].status, sizeof(struct ch_status));
+  }
+}
+
+/* emulates plugins instantly consuming whatever was committed */
+static void bench_drain_channels(int num)
+{
+  int index;
+
+  for (index = 0; index < num; index++)
+    channels_list[index].status->tail = channels_list[index].status->head;
+}
+
+int main(int argc, char **argv)
+{
+  u_char pkt[64];
+  struct pcap_pkthdr pkthdr;
+  struct packet_ptrs pptrs;
+  char map[] = "/tmp/exec_plugins_bench.map.XXXXXX", *map_ptr = map;
+  u_int32_t records = BENCH_DEFAULT_RECORDS, max_channels = BENCH_DEFAULT_CHANNELS;
+  u_int32_t idx, arena_size, arena_live;
+  u_int64_t allocs;
+  double start, elapsed;
+  int cp, num, fd;
+
+  while ((cp = getopt(argc, argv, "n:c:Lh")) != -1) {
+    switch (cp) {
+    case 'n':
+      records = atoi(optarg);
+      break;
+    case 'c':
+      max_channels = atoi(optarg);
+      break;
+    case 'L':
+      map_ptr = NULL;
+      break;
+    default:
+      usage_bench(argv[0]);
+      exit(0);
+    }
+  }
+
+  if (!records || !max_channels || max_channels >= MAX_N_PLUGINS) {
+    usage_bench(argv[0]);
+    exit(1);
+  }
+
+  config.name = "default";
+  config.type = "core";
+  config.acct_type = ACCT_PM;
+  find_id_func = PM_find_id;
+  compute_once();
+
+  if (map_ptr) {
+    const char *line = "set_label=bench_label\n";
+
+    fd = mkstemp(map);
+    if (fd < 0 || write(fd, line, strlen(line)) != strlen(line)) {
+      fprintf(stderr, "ERROR: unable to write pre_tag_map: %s\n", strerror(errno));
+      exit(1);
+    }
+    close(fd);
+  }
+
+  /* Ethernet + IPv4 + UDP, addresses get rotated per record */
+  memset(pkt, 0, sizeof(pkt));
+  pkt[12] = 0x08; pkt[13] = 0x00;
+  pkt[14] = 0x45; pkt[16] = 0x00; pkt[17] = 46; pkt[22] = 64; pkt[23] = IPPROTO_UDP;
+  pkt[26] = 10; pkt[30] = 192; pkt[31] = 168;
+  pkt[34] = 0x30; pkt[35] = 0x39; pkt[36] = 0x00; pkt[37] = 0x35;
+
+  memset(&pkthdr, 0, sizeof(pkthdr));
+  pkthdr.caplen = pkthdr.len = sizeof(pkt);
+
+  memset(&pptrs, 0, sizeof(pptrs));
+  pptrs.pkthdr = &pkthdr;
+  pptrs.packet_ptr = pkt;
+  pptrs.mac_ptr = pkt;
+  pptrs.iph_ptr = pkt + ETHER_HDRLEN;
+  pptrs.tlh_ptr = pptrs.iph_ptr + IP4HdrSz;
+  pptrs.payload_ptr = pptrs.tlh_ptr + UDPHdrSz;
+  pptrs.l3_proto = ETHERTYPE_IP;
+  pptrs.l4_proto = IPPROTO_UDP;
+  pptrs.flow_type = PM_FTYPE_IPV4;
+
+  printf("%-10s %-14s %-14s %-14s\n", "channels", "records/s", "ns/record", "allocs/record");
+
+  for (num = 1; num <= max_channels; num *= 2) {
+    bench_setup_channels(num, map_ptr);
+
+    /* warm-up: lets the label arena and the rings settle */
+    for (idx = 0; idx < 1000; idx++) {
+      exec_plugins(&pptrs, &bench_req);
+      bench_drain_channels(num);
+    }
+
+    allocs = bench_allocs;
+    start = bench_now();
+
+    for (idx = 0; idx < records; idx++) {
+      pkt[28] = (idx >> 8);
+      pkt[29] = idx;
+      pkt[33] = (idx % 251);
+      gettimeofday(&pkthdr.ts, NULL);
+
+      exec_plugins(&pptrs, &bench_req);
+      bench_drain_channels(num);
+    }
+
+    elapsed = bench_now() - start;
+    allocs = bench_allocs - allocs;
+
+    printf("%-10u %-14.0f %-14.1f %-14.3f\n", num, (records / elapsed), ((elapsed * 1e9) / records),
+	   ((double) allocs / records));
+
+    bench_teardown_channels(num);
+  }
+
+  if (map_ptr) {
+    pretag_label_arena_stats(&arena_size, &arena_live);
+    printf("\nlabel arena: size=%u live=%u\n", arena_size, arena_live);
+    unlink(map);
+  }
+
+  return 0;
+}
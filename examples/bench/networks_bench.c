@@ -0,0 +1,471 @@
+/*
+    pmacct (Promiscuous mode IP Accounting package)
+    pmacct is Copyright (C) 2003-2020 by Paolo Lucente
+*/
+
+/*
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/*
+   networks_bench: writes a synthetic IPv4 networks_file, loads it as the
+   daemons do and checks networks_search() against a brute-force longest
+   prefix match. Then times lookups, with and without networks_cache, over
+   uniformly random addresses and over smaller sets of hot addresses, as
+   seen in traffic, against the binary search (and cache) the trie replaced.
+   Finally reloads the file while failing a malloc() of
+   the trie build (malloc() is wrapped at link time, see Makefile.am): the
+   old table has to be kept in place.
+*/
+
+/* includes */
+#include "pmacct.h"
+#include "pmacct-data.h"
+#include "net_aggr.h"
+
+#define BENCH_DEFAULT_PREFIXES	500000
+#define BENCH_DEFAULT_LOOKUPS	5000000
+#define BENCH_VERIFY_LOOKUPS	100000
+#define BENCH_RUNS		3
+
+static struct networks_table bench_nt;
+static struct networks_cache bench_nc;
+static u_int32_t *bench_addrs;
+static volatile u_int32_t bench_sink;
+static u_int32_t bench_seed = 2463534242U;
+
+/* malloc() of trie nodes failing at the given count, if set */
+static u_int64_t bench_trie_allocs, bench_trie_fail_at;
+
+extern void *__real_malloc(size_t);
+
+void *__wrap_malloc(size_t size)
+{
+  if (size == sizeof(struct lpm_trie_node)) {
+    bench_trie_allocs++;
+    if (bench_trie_fail_at && bench_trie_allocs == bench_trie_fail_at) return NULL;
+  }
+
+  return __real_malloc(size);
+}
+
+static void usage_bench(char *prog)
+{
+  printf("Usage: %s [-p prefixes] [-n lookups]\n\n", prog);
+  printf("  -p\tPrefixes in the networks_file (default: %u)\n", BENCH_DEFAULT_PREFIXES);
+  printf("  -n\tLookups per run (default: %u)\n", BENCH_DEFAULT_LOOKUPS);
+}
+
+static double bench_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (ts.tv_sec + (ts.tv_nsec / 1e9));
+}
+
+/* xorshift32: reproducible across runs */
+static u_int32_t bench_rand(u_int32_t *state)
+{
+  u_int32_t x = (*state);
+
+  x ^= (x << 13);
+  x ^= (x >> 17);
+  x ^= (x << 5);
+
+  return ((*state) = x);
+}
+
+/* prefix lengths roughly shaped as in a full IPv4 table */
+static u_int8_t bench_prefixlen(u_int32_t r)
+{
+  r %= 100;
+
+  if (r < 55) return 24;
+  if (r < 65) return 23;
+  if (r < 73) return 22;
+  if (r < 85) return (16 + (r % 6));
+  if (r < 95) return (25 + (r % 8));
+  return (8 + (r % 8));
+}
+
+static void bench_write_file(char *filename, u_int32_t prefixes)
+{
+  FILE *file;
+  u_int32_t idx, net;
+  u_int8_t len;
+  int fd;
+
+  fd = mkstemp(filename);
+  if (fd < 0 || !(file = fdopen(fd, "w"))) {
+    fprintf(stderr, "ERROR: unable to write networks_file: %s\n", strerror(errno));
+    exit(1);
+  }
+
+  for (idx = 0; idx < prefixes; idx++) {
+    net = bench_rand(&bench_seed);
+    len = bench_prefixlen(bench_rand(&bench_seed));
+
+    fprintf(file, "%u_%u,%u.%u.%u.%u/%u\n", (65000 + (idx % 1000)), (100000 + idx),
+	    (net >> 24), ((net >> 16) & 0xff), ((net >> 8) & 0xff), (net & 0xff), len);
+  }
+
+  fclose(file);
+}
+
+/* longest prefix match by probing the (sorted) table for each length */
+static struct networks_table_entry *bench_brute_search(struct networks_table *nt, u_int32_t addrh)
+{
+  struct networks_table_entry *ret = NULL;
+  u_int32_t low, high, mid, net, mask;
+  int len;
+
+  for (len = 32; len >= 0 && !ret; len--) {
+    mask = ((len == 32) ? 0xffffffffUL : ~(0xffffffffUL >> len));
+    net = (addrh & mask);
+
+    for (low = 0, high = nt->num; low < high;) {
+      mid = ((low + high) / 2);
+
+      if (nt->table[mid].net < net || (nt->table[mid].net == net && nt->table[mid].masknum < len)) low = (mid + 1);
+      else high = mid;
+    }
+
+    if (low < nt->num && nt->table[low].net == net && nt->table[low].masknum == len) ret = &nt->table[low];
+  }
+
+  return ret;
+}
+
+/*
+   baseline: networks_file lookups as they were done before the trie, ie.
+   binary search through a hierarchy of sorted tables, networks nested in
+   another network making a child table of it, preceded by a direct-mapped
+   cache. Layouts are the original ones, cache line footprint matters.
+*/
+struct bench_base_table {
+  struct bench_base_entry *table;
+  unsigned int num;
+  void *table6;
+  unsigned int num6;
+  u_int32_t maskbits[4];
+  time_t timestamp;
+};
+
+struct bench_base_entry {
+  u_int32_t net;
+  u_int32_t mask;
+  u_int8_t masknum;
+  as_t peer_as;
+  as_t as;
+  struct host_addr nh;
+  struct bench_base_table childs_table;
+};
+
+struct bench_base_cache_entry {
+  u_int32_t key;
+  struct bench_base_entry *result;
+};
+
+static struct bench_base_table bench_base_nt;
+static struct bench_base_cache_entry *bench_base_nc;
+static struct bench_base_entry bench_base_dummy;
+
+/* builds the hierarchy off the sorted table, as load_networks4() did */
+static void bench_base_build(struct networks_table *nt)
+{
+  struct { u_int8_t level; u_int32_t childs; } *mdt;
+  struct bench_base_entry *tmp;
+  u_int32_t index, x, eff_rows, net;
+  int prev[128], current, next, eff_childs;
+
+  tmp = calloc(nt->num, sizeof(struct bench_base_entry));
+  mdt = calloc(nt->num, sizeof(*mdt));
+  bench_base_nt.table = calloc(nt->num, sizeof(struct bench_base_entry));
+  bench_base_nc = calloc(NETWORKS_CACHE_ENTRIES, sizeof(struct bench_base_cache_entry));
+  if (!tmp || !mdt || !bench_base_nt.table || !bench_base_nc) {
+    fprintf(stderr, "ERROR: malloc() failed\n");
+    exit(1);
+  }
+
+  for (index = 0; index < nt->num; index++) {
+    tmp[index].net = nt->table[index].net;
+    tmp[index].mask = nt->table[index].mask;
+    tmp[index].masknum = nt->table[index].masknum;
+    tmp[index].peer_as = nt->table[index].peer_as;
+    tmp[index].as = nt->table[index].as;
+  }
+
+  for (index = 0; index < (nt->num - 1); index++) {
+    for (x = (index + 1); x < nt->num; x++) {
+      net = (tmp[x].net & tmp[index].mask);
+      if (net != tmp[index].net) break;
+      mdt[x].level++;
+    }
+  }
+
+  for (index = 0, eff_rows = 0; index < nt->num; index++) {
+    if (!mdt[index].level) eff_rows++;
+  }
+
+  for (index = 0; index < nt->num; index++) {
+    for (x = (index + 1), eff_childs = 0; x < nt->num; x++) {
+      if (mdt[index].level == mdt[x].level) break;
+      else if (mdt[index].level == (mdt[x].level - 1)) eff_childs++;
+    }
+    mdt[index].childs = eff_childs;
+  }
+
+  memset(prev, 0, sizeof(prev));
+
+  for (index = 0, current = 0, next = eff_rows; index < nt->num; index++) {
+    if (index) {
+      if (mdt[index].level == mdt[index - 1].level) current++;
+      else if (mdt[index].level > mdt[index - 1].level) {
+	bench_base_nt.table[current].childs_table.table = &bench_base_nt.table[next];
+	bench_base_nt.table[current].childs_table.num = mdt[index - 1].childs;
+	prev[mdt[index - 1].level] = current;
+	current = next;
+	next += mdt[index - 1].childs;
+      }
+      else current = (prev[mdt[index].level] + 1);
+    }
+
+    memcpy(&bench_base_nt.table[current], &tmp[index], offsetof(struct bench_base_entry, childs_table));
+  }
+
+  bench_base_nt.num = eff_rows;
+  bench_base_dummy.masknum = 255;
+
+  free(tmp);
+  free(mdt);
+}
+
+/* not inlined into the timing loop: the daemons call it from another unit */
+static __attribute__ ((noinline)) struct bench_base_entry *bench_base_search(struct bench_base_table *nt, struct bench_base_cache_entry *nc, u_int32_t addr)
+{
+  int low = 0, mid, high = (nt->num - 1);
+  u_int32_t net, addrh = ntohl(addr);
+  struct bench_base_cache_entry *ptr;
+  struct bench_base_entry *ret;
+
+  if (nc) {
+    ptr = &nc[addr % NETWORKS_CACHE_ENTRIES];
+    if (ptr->key == addr && ptr->result) return ((ptr->result->masknum == 255) ? NULL : ptr->result);
+  }
+
+  while (low <= high) {
+    mid = ((low + high) / 2);
+    net = (addrh & nt->table[mid].mask);
+
+    if (net < nt->table[mid].net) high = (mid - 1);
+    else if (net > nt->table[mid].net) low = (mid + 1);
+    else {
+      if (nt->table[mid].childs_table.table && (ret = bench_base_search(&nt->table[mid].childs_table, nc, addr)))
+	return ret;
+
+      ret = &nt->table[mid];
+
+      if (nc) {
+	ptr = &nc[addr % NETWORKS_CACHE_ENTRIES];
+	ptr->key = addr;
+	ptr->result = ret;
+      }
+
+      return ret;
+    }
+  }
+
+  if (nc) {
+    ptr = &nc[addr % NETWORKS_CACHE_ENTRIES];
+    ptr->key = addr;
+    ptr->result = &bench_base_dummy;
+  }
+
+  return NULL;
+}
+
+static u_int32_t bench_verify(u_int32_t lookups, u_int32_t *base_mismatches)
+{
+  struct networks_table_entry *ret, *expected;
+  struct bench_base_entry *base;
+  struct host_addr a;
+  u_int32_t idx, mismatches = 0, seed = 88172645;
+
+  memset(&a, 0, sizeof(a));
+  a.family = AF_INET;
+
+  for (idx = 0; idx < lookups; idx++) {
+    a.address.ipv4.s_addr = bench_rand(&seed);
+
+    ret = networks_search(&bench_nt, &bench_nc, &a);
+    expected = bench_brute_search(&bench_nt, ntohl(a.address.ipv4.s_addr));
+
+    if ((!ret) != (!expected) || (ret && (ret->net != expected->net || ret->masknum != expected->masknum)))
+      mismatches++;
+
+    if (base_mismatches) {
+      base = bench_base_search(&bench_base_nt, NULL, a.address.ipv4.s_addr);
+
+      if ((!base) != (!expected) || (base && (base->net != expected->net || base->masknum != expected->masknum)))
+	(*base_mismatches)++;
+    }
+  }
+
+  return mismatches;
+}
+
+/* one pass over the addresses, in seconds */
+static double bench_pass(u_int32_t lookups, int method)
+{
+  struct host_addr a;
+  u_int32_t idx, addrh;
+  double start;
+
+  memset(&a, 0, sizeof(a));
+  a.family = AF_INET;
+
+  start = bench_now();
+
+  for (idx = 0; idx < lookups; idx++) {
+    switch (method) {
+    case 0:
+      a.address.ipv4.s_addr = bench_addrs[idx];
+      bench_sink += (networks_search(&bench_nt, &bench_nc, &a) != NULL);
+      break;
+    case 1:
+      addrh = ntohl(bench_addrs[idx]);
+      bench_sink += (lpm_trie_match(bench_nt.trie, &addrh, 1) != NULL);
+      break;
+    case 2:
+      bench_sink += (bench_base_search(&bench_base_nt, bench_base_nc, bench_addrs[idx]) != NULL);
+      break;
+    case 3:
+      bench_sink += (bench_base_search(&bench_base_nt, NULL, bench_addrs[idx]) != NULL);
+      break;
+    }
+  }
+
+  return (bench_now() - start);
+}
+
+/* best of BENCH_RUNS passes, in ns per lookup */
+static double bench_time(u_int32_t lookups, int method)
+{
+  double elapsed, best = 0;
+  int run;
+
+  for (run = 0; run < BENCH_RUNS; run++) {
+    elapsed = bench_pass(lookups, method);
+    if (!run || elapsed < best) best = elapsed;
+  }
+
+  return ((best * 1e9) / lookups);
+}
+
+static void bench_run(char *label, u_int32_t lookups, u_int32_t hot)
+{
+  u_int32_t idx;
+
+  for (idx = 0; idx < lookups; idx++) {
+    if (hot) bench_addrs[idx] = ((bench_rand(&bench_seed) % hot) * 2654435761U);
+    else bench_addrs[idx] = bench_rand(&bench_seed);
+  }
+
+  printf("%-12s %-10.1f %-10.1f %-10.1f %-10.1f\n", label, bench_time(lookups, 0), bench_time(lookups, 1),
+	 bench_time(lookups, 2), bench_time(lookups, 3));
+}
+
+int main(int argc, char **argv)
+{
+  char filename[] = "/tmp/networks_bench.lst.XXXXXX";
+  u_int32_t prefixes = BENCH_DEFAULT_PREFIXES, lookups = BENCH_DEFAULT_LOOKUPS;
+  u_int32_t mismatches, base_mismatches, old_num;
+  struct lpm_trie_node *old_trie;
+  double start;
+  int cp;
+
+  while ((cp = getopt(argc, argv, "p:n:h")) != -1) {
+    switch (cp) {
+    case 'p':
+      prefixes = atoi(optarg);
+      break;
+    case 'n':
+      lookups = atoi(optarg);
+      break;
+    default:
+      usage_bench(argv[0]);
+      exit(0);
+    }
+  }
+
+  if (!prefixes || !lookups) {
+    usage_bench(argv[0]);
+    exit(1);
+  }
+
+  config.name = "default";
+  config.type = "core";
+  compute_once();
+
+  bench_write_file(filename, prefixes);
+
+  start = bench_now();
+  load_networks4(filename, &bench_nt, &bench_nc);
+  printf("load: %u entries in %.3f s\n", bench_nt.num, (bench_now() - start));
+
+  if (!bench_nt.trie) {
+    fprintf(stderr, "ERROR: networks_file not loaded\n");
+    exit(1);
+  }
+
+  bench_base_build(&bench_nt);
+
+  base_mismatches = 0;
+  mismatches = bench_verify(BENCH_VERIFY_LOOKUPS, &base_mismatches);
+  printf("verify: %u lookups, %u mismatches (baseline: %u)\n\n", BENCH_VERIFY_LOOKUPS, mismatches, base_mismatches);
+
+  bench_addrs = malloc(lookups * sizeof(u_int32_t));
+  if (!bench_addrs) {
+    fprintf(stderr, "ERROR: malloc() failed\n");
+    exit(1);
+  }
+
+  printf("ns per lookup: networks_search() with networks_cache, trie alone, baseline with\n"
+	 "its cache, baseline binary search alone\n");
+  printf("%-12s %-10s %-10s %-10s %-10s\n", "addresses", "cached", "trie", "base cache", "base");
+  bench_run("uniform", lookups, 0);
+  bench_run("hot 200000", lookups, 200000);
+  bench_run("hot 5000", lookups, 5000);
+
+  /* reload running out of memory halfway through the trie */
+  old_num = bench_nt.num;
+  old_trie = bench_nt.trie;
+  bench_trie_fail_at = (bench_trie_allocs + (bench_trie_allocs / 2));
+
+  printf("\n");
+  load_networks4(filename, &bench_nt, &bench_nc);
+  bench_trie_fail_at = 0;
+
+  mismatches += bench_verify(BENCH_VERIFY_LOOKUPS, NULL);
+  printf("failed reload: old table %s, %u mismatches\n",
+	 ((bench_nt.num == old_num && bench_nt.trie == old_trie) ? "kept" : "NOT kept"), mismatches);
+
+  unlink(filename);
+  free(bench_addrs);
+
+  return ((mismatches || bench_nt.trie != old_trie) ? 1 : 0);
+}
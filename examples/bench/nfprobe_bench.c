@@ -0,0 +1,274 @@
+/*
+    pmacct (Promiscuous mode IP Accounting package)
+    pmacct is Copyright (C) 2003-2020 by Paolo Lucente
+*/
+
+/*
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/*
+   nfprobe_bench: replays a synthetic flow mix through the flow cache of the
+   nfprobe plugin, as its main loop would: records go to process_packet(),
+   expiry runs every 1000 records and flows get forced out when over
+   max_flows. The mix is half new flows, half packets of a hot set of
+   recent ones; TCP, UDP and ICMP, some TCP flows closing via FIN or RST.
+   Time is faked, one second passing every -r records.
+
+   The plugin is compiled in, its functions being static. Exported flows
+   are not sent but hashed: the digest and the expiry counters only depend
+   on the flow mix and the timeouts, so they have to match across versions
+   of the flow cache. To compare against the tree-based one, build this
+   file, and Makefile.am, in a checkout of it.
+*/
+
+/* includes */
+#include "pmacct.h"
+
+static u_int32_t bench_clock;
+
+static int bench_gettimeofday(struct timeval *tv)
+{
+  tv->tv_sec = bench_clock;
+  tv->tv_usec = 0;
+
+  return 0;
+}
+
+#define gettimeofday(tv, tz) bench_gettimeofday(tv)
+#include "nfprobe_plugin/nfprobe_plugin.c"
+#undef gettimeofday
+
+#define BENCH_DEFAULT_RECORDS	1000000
+#define BENCH_DEFAULT_MAX_FLOWS	1000000
+#define BENCH_DEFAULT_RATE	2000
+#define BENCH_HOT_FLOWS		50000
+#define BENCH_EXPIRY_EVERY	1000
+
+static u_int64_t bench_digest = 1469598103934665603ULL; /* FNV-1a */
+static u_int64_t bench_exported;
+
+static void usage_bench(char *prog)
+{
+  printf("Usage: %s [-n records] [-m max flows] [-r records/s]\n\n", prog);
+  printf("  -n\tRecords to replay (default: %u)\n", BENCH_DEFAULT_RECORDS);
+  printf("  -m\tnfprobe_maxflows (default: %u)\n", BENCH_DEFAULT_MAX_FLOWS);
+  printf("  -r\tRecords per (fake) second (default: %u)\n", BENCH_DEFAULT_RATE);
+}
+
+static double bench_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (ts.tv_sec + (ts.tv_nsec / 1e9));
+}
+
+/* xorshift32: reproducible across runs */
+static u_int32_t bench_rand(u_int32_t *state)
+{
+  u_int32_t x = (*state);
+
+  x ^= (x << 13);
+  x ^= (x >> 17);
+  x ^= (x << 5);
+
+  return ((*state) = x);
+}
+
+static void bench_hash(const void *ptr, size_t len)
+{
+  const u_char *byte = ptr;
+
+  while (len--) {
+    bench_digest ^= (*byte++);
+    bench_digest *= 1099511628211ULL;
+  }
+}
+
+/* stands for send_netflow_v9() */
+static int bench_export(struct FLOW **flows, int num, int fd, u_int64_t *flows_exported, struct timeval *system_boot_time,
+			int verbose_flag, u_int8_t engine_type, u_int32_t engine_id)
+{
+  struct FLOW *flow;
+  int idx;
+
+  for (idx = 0; idx < num; idx++) {
+    flow = flows[idx];
+
+    bench_hash(&flow->af, sizeof(flow->af));
+    bench_hash(flow->addr, sizeof(flow->addr));
+    bench_hash(flow->port, sizeof(flow->port));
+    bench_hash(&flow->protocol, sizeof(flow->protocol));
+    bench_hash(flow->octets, sizeof(flow->octets));
+    bench_hash(flow->packets, sizeof(flow->packets));
+    bench_hash(flow->tcp_flags, sizeof(flow->tcp_flags));
+    bench_hash(&flow->flow_start.tv_sec, sizeof(flow->flow_start.tv_sec));
+    bench_hash(&flow->flow_last.tv_sec, sizeof(flow->flow_last.tv_sec));
+    bench_hash(&flow->flow_seq, sizeof(flow->flow_seq));
+  }
+
+  bench_exported += num;
+  (*flows_exported) += num;
+
+  return num;
+}
+
+static void bench_record(u_int32_t id, u_int32_t r, struct pkt_data *data, struct pkt_extras *extras)
+{
+  memset(data, 0, sizeof(struct pkt_data));
+  memset(extras, 0, sizeof(struct pkt_extras));
+
+  data->primitives.src_ip.family = AF_INET;
+  data->primitives.dst_ip.family = AF_INET;
+  data->primitives.src_ip.address.ipv4.s_addr = htonl(0x0a000000 | (id & 0xffffff));
+  data->primitives.dst_ip.address.ipv4.s_addr = htonl(0xc0a80000 | ((id * 7) & 0xffff));
+  data->primitives.src_port = (1024 + (id % 60000));
+  data->primitives.dst_port = ((id % 3) ? 443 : 53);
+
+  if (!(id % 20)) data->primitives.proto = IPPROTO_ICMP;
+  else if (id % 3) data->primitives.proto = IPPROTO_TCP;
+  else data->primitives.proto = IPPROTO_UDP;
+
+  if (data->primitives.proto == IPPROTO_TCP) {
+    if ((r % 100) < 2) extras->tcp_flags = TH_FIN;
+    else if ((r % 100) < 3) extras->tcp_flags = TH_RST;
+    else extras->tcp_flags = TH_ACK;
+  }
+
+  data->pkt_len = (64 + ((r >> 8) % 1400));
+  data->pkt_num = 1;
+  data->time_start.tv_sec = bench_clock;
+}
+
+int main(int argc, char **argv)
+{
+  static struct FLOWTRACK ft;
+  struct NETFLOW_SENDER sender = { 9, bench_export, 1 };
+  struct NETFLOW_TARGET target;
+  struct pkt_data data;
+  struct pkt_extras extras;
+  struct primitives_ptrs prim_ptrs;
+  struct timeval tv;
+  u_int32_t records = BENCH_DEFAULT_RECORDS, max_flows = BENCH_DEFAULT_MAX_FLOWS, rate = BENCH_DEFAULT_RATE;
+  u_int32_t idx, id, r, next_id = 0, seed = 2463534242U;
+  double start, expiry_start, elapsed, expiry = 0;
+  int cp;
+
+  while ((cp = getopt(argc, argv, "n:m:r:h")) != -1) {
+    switch (cp) {
+    case 'n':
+      records = atoi(optarg);
+      break;
+    case 'm':
+      max_flows = atoi(optarg);
+      break;
+    case 'r':
+      rate = atoi(optarg);
+      break;
+    default:
+      usage_bench(argv[0]);
+      exit(0);
+    }
+  }
+
+  if (!records || !max_flows || !rate) {
+    usage_bench(argv[0]);
+    exit(1);
+  }
+
+  config.name = "default";
+  config.type = "nfprobe";
+  config.nfprobe_version = 9;
+  IP6AddrSz = sizeof(struct in6_addr);
+
+  bench_clock = 1700000000;
+  init_flowtrack(&ft);
+
+  /* a busy probe: timeouts short enough for flows to expire along the run */
+  ft.tcp_timeout = 300;
+  ft.tcp_rst_timeout = 10;
+  ft.tcp_fin_timeout = 20;
+  ft.udp_timeout = 60;
+  ft.icmp_timeout = 30;
+  ft.general_timeout = 120;
+  ft.maximum_lifetime = 600;
+
+#ifdef FLOW_TABLE_MIN_SLOTS
+  if (flow_table_alloc(&ft.flows, max_flows) == -1) {
+    fprintf(stderr, "ERROR: unable to allocate the flow table\n");
+    exit(1);
+  }
+#endif
+
+  /* any valid descriptor, bench_export() does not write to it */
+  target.fd = open("/dev/null", O_WRONLY);
+  target.dialect = &sender;
+
+  memset(&prim_ptrs, 0, sizeof(prim_ptrs));
+  prim_ptrs.data = &data;
+  prim_ptrs.pextras = &extras;
+
+  start = bench_now();
+
+  for (idx = 0; idx < records; idx++) {
+    r = bench_rand(&seed);
+
+    if ((r & 1) && next_id > BENCH_HOT_FLOWS) id = (next_id - 1 - (bench_rand(&seed) % BENCH_HOT_FLOWS));
+    else id = next_id++;
+
+    bench_record(id, r, &data, &extras);
+
+    tv.tv_sec = bench_clock;
+    tv.tv_usec = 0;
+    process_packet(&ft, &prim_ptrs, &tv);
+
+    if (!((idx + 1) % rate)) bench_clock++;
+
+    if (!((idx + 1) % BENCH_EXPIRY_EVERY)) {
+      expiry_start = bench_now();
+
+      if (ft.num_flows > max_flows || next_expire(&ft) == 0) {
+	check_expired(&ft, &target, CE_EXPIRE_NORMAL, 0, 0);
+
+	while (ft.num_flows > max_flows) {
+	  force_expire(&ft, ft.num_flows - max_flows);
+	  check_expired(&ft, &target, CE_EXPIRE_NORMAL, 0, 0);
+	}
+      }
+
+      expiry += (bench_now() - expiry_start);
+    }
+  }
+
+  expiry_start = bench_now();
+  check_expired(&ft, &target, CE_EXPIRE_ALL, 0, 0);
+  expiry += (bench_now() - expiry_start);
+
+  elapsed = (bench_now() - start);
+
+  printf("records: %u, flows: %lu, exported: %lu, digest: %016lx\n", records, (unsigned long) ft.next_flow_seq - 1,
+	 (unsigned long) bench_exported, (unsigned long) bench_digest);
+  printf("expired: general=%lu tcp=%lu tcp_rst=%lu tcp_fin=%lu udp=%lu icmp=%lu maxlife=%lu maxflows=%lu flush=%lu forced=%lu\n",
+	 (unsigned long) ft.expired_general, (unsigned long) ft.expired_tcp, (unsigned long) ft.expired_tcp_rst,
+	 (unsigned long) ft.expired_tcp_fin, (unsigned long) ft.expired_udp, (unsigned long) ft.expired_icmp,
+	 (unsigned long) ft.expired_maxlife, (unsigned long) ft.expired_maxflows, (unsigned long) ft.expired_flush,
+	 (unsigned long) ft.flows_force_expired);
+  printf("time: %.2f s total, %.1f ns/record in process_packet(), %.2f s in expiry\n", elapsed,
+	 (((elapsed - expiry) * 1e9) / records), expiry);
+
+  return 0;
+}
@@ -0,0 +1,392 @@
+/*
+    pmacct (Promiscuous mode IP Accounting package)
+    pmacct is Copyright (C) 2003-2020 by Paolo Lucente
+*/
+
+/*
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/* includes */
+#include "pmacct.h"
+#include "afpacket.h"
+#if defined HAVE_TPACKET_V3
+#include <poll.h>
+#include <net/if_arp.h>
+#include <net/ethernet.h>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
+#endif
+
+#if defined HAVE_TPACKET_V3
+int PM_afpacket_open(struct pm_pcap_device *dev_ptr, char *ifname, int snaplen, int promisc, int protocol, int direction, char *errbuf)
+{
+  struct pm_afpacket *afp;
+  struct tpacket_req3 req;
+  struct sockaddr_ll sll;
+  struct ifreq ifr;
+  int fd, version = TPACKET_V3, loopback = FALSE;
+  u_int16_t proto = (protocol ? protocol : ETH_P_ALL);
+
+  if ((fd = socket(AF_PACKET, SOCK_RAW, htons(proto))) == -1) {
+    snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s: socket(): %s", ifname, strerror(errno));
+    return ERR;
+  }
+
+  memset(&ifr, 0, sizeof(ifr));
+  strlcpy(ifr.ifr_name, ifname, sizeof(ifr.ifr_name));
+
+  if (ioctl(fd, SIOCGIFINDEX, &ifr) == -1) {
+    snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s: SIOCGIFINDEX: %s", ifname, strerror(errno));
+    goto err;
+  }
+
+  memset(&sll, 0, sizeof(sll));
+  sll.sll_family = AF_PACKET;
+  sll.sll_protocol = htons(proto);
+  sll.sll_ifindex = ifr.ifr_ifindex;
+
+  /* Ethernet framing only; anything else is left to libpcap */
+  if (ioctl(fd, SIOCGIFHWADDR, &ifr) == -1) {
+    snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s: SIOCGIFHWADDR: %s", ifname, strerror(errno));
+    goto err;
+  }
+
+  if (ifr.ifr_hwaddr.sa_family == ARPHRD_LOOPBACK) loopback = TRUE;
+  else if (ifr.ifr_hwaddr.sa_family != ARPHRD_ETHER) {
+    snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s: ARPHRD type %u not supported by pmacctd_afpacket", ifname, ifr.ifr_hwaddr.sa_family);
+    goto err;
+  }
+
+  if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1) {
+    snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s: PACKET_VERSION: %s", ifname, strerror(errno));
+    goto err;
+  }
+
+  memset(&req, 0, sizeof(req));
+  req.tp_block_size = (config.pmacctd_afpacket_block_size ? config.pmacctd_afpacket_block_size : AFPACKET_DEFAULT_BLOCK_SIZE);
+  req.tp_block_nr = (config.pmacctd_afpacket_block_num ? config.pmacctd_afpacket_block_num : AFPACKET_DEFAULT_BLOCK_NUM);
+  req.tp_frame_size = MIN(AFPACKET_FRAME_SIZE, req.tp_block_size);
+  req.tp_frame_nr = ((req.tp_block_size / req.tp_frame_size) * req.tp_block_nr);
+  req.tp_retire_blk_tov = (config.pmacctd_afpacket_block_timeout ? config.pmacctd_afpacket_block_timeout : AFPACKET_DEFAULT_BLOCK_TIMEOUT);
+  req.tp_feature_req_word = TP_FT_REQ_FILL_RXHASH;
+
+  if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) == -1) {
+    snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s: PACKET_RX_RING (block_size=%u block_num=%u): %s", ifname,
+	     req.tp_block_size, req.tp_block_nr, strerror(errno));
+    goto err;
+  }
+
+  afp = malloc(sizeof(struct pm_afpacket));
+  if (!afp) {
+    snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s: unable to allocate AF_PACKET ring", ifname);
+    goto err;
+  }
+  else memset(afp, 0, sizeof(struct pm_afpacket));
+
+  afp->fd = fd;
+  afp->ifindex = sll.sll_ifindex;
+  afp->loopback = loopback;
+  afp->snaplen = snaplen;
+  afp->direction = direction;
+  afp->block_size = req.tp_block_size;
+  afp->block_num = req.tp_block_nr;
+  afp->ring_len = ((size_t) req.tp_block_size * req.tp_block_nr);
+
+  afp->ring = mmap(NULL, afp->ring_len, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  afp->vlan_buf = malloc(snaplen + 4);
+
+  if (afp->ring == MAP_FAILED || !afp->vlan_buf) {
+    snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s: unable to map AF_PACKET ring (%zu bytes): %s", ifname, afp->ring_len, strerror(errno));
+    if (afp->ring != MAP_FAILED) munmap(afp->ring, afp->ring_len);
+    free(afp->vlan_buf);
+    free(afp);
+    goto err;
+  }
+
+  if (bind(fd, (struct sockaddr *) &sll, sizeof(sll)) == -1) {
+    snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s: bind(): %s", ifname, strerror(errno));
+    goto err_ring;
+  }
+
+  if (promisc) {
+    struct packet_mreq mr;
+
+    memset(&mr, 0, sizeof(mr));
+    mr.mr_ifindex = sll.sll_ifindex;
+    mr.mr_type = PACKET_MR_PROMISC;
+
+    if (setsockopt(fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mr, sizeof(mr)) == -1) {
+      snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s: PACKET_MR_PROMISC: %s", ifname, strerror(errno));
+      goto err_ring;
+    }
+  }
+
+  /* all workers join the group named after the workers supervisor;
+     hashing reassembles fragments first so they go together */
+  if (core_workers_num > 1) {
+    int fanout;
+
+    if (config.pmacctd_afpacket_fanout == AFPACKET_FANOUT_CPU) fanout = PACKET_FANOUT_CPU;
+    else fanout = (PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG);
+
+    fanout = ((core_workers_supervisor & 0xffff) | (fanout << 16));
+
+    if (setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) == -1) {
+      snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s: PACKET_FANOUT: %s", ifname, strerror(errno));
+      goto err_ring;
+    }
+  }
+
+  dev_ptr->dev_desc = NULL;
+  dev_ptr->afpacket = afp;
+  dev_ptr->fd = fd;
+  dev_ptr->link_type = DLT_EN10MB;
+
+  Log(LOG_INFO, "INFO ( %s/core ): [%s] AF_PACKET TPACKET_V3 ring: block_size=%u block_num=%u block_timeout=%u\n",
+      config.name, ifname, req.tp_block_size, req.tp_block_nr, req.tp_retire_blk_tov);
+
+  return SUCCESS;
+
+  err_ring:
+  munmap(afp->ring, afp->ring_len);
+  free(afp->vlan_buf);
+  free(afp);
+
+  err:
+  close(fd);
+
+  return ERR;
+}
+
+/*
+  The filter is compiled against a live libpcap handle on the same interface
+  and then handed to the kernel: TPACKET_V3 strips 802.1Q tags off packets,
+  'vlan' primitives only match via the BPF extensions libpcap makes use of
+  for live Linux handles. The handle is closed straight after.
+*/
+void PM_afpacket_add_filter(struct pm_pcap_device *dev_ptr)
+{
+  struct pm_afpacket *afp = dev_ptr->afpacket;
+  struct bpf_program filter;
+  struct sock_fprog fprog;
+  char errbuf[PCAP_ERRBUF_SIZE];
+  pcap_t *p;
+
+  if (!config.clbuf || !strlen(config.clbuf)) return;
+
+  p = pcap_create(dev_ptr->str, errbuf);
+  if (!p) {
+    Log(LOG_WARNING, "WARN ( %s/core ): %s (going on without a filter)\n", config.name, errbuf);
+    return;
+  }
+
+  pcap_set_snaplen(p, afp->snaplen);
+  pcap_set_buffer_size(p, AFPACKET_FILTER_BUFFER_SIZE);
+
+  if (pcap_activate(p) < 0) {
+    Log(LOG_WARNING, "WARN ( %s/core ): %s: %s (going on without a filter)\n", config.name, dev_ptr->str, pcap_geterr(p));
+    pcap_close(p);
+    return;
+  }
+
+  memset(&filter, 0, sizeof(filter));
+  if (pcap_compile(p, &filter, config.clbuf, 0, PCAP_NETMASK_UNKNOWN) < 0) {
+    Log(LOG_WARNING, "WARN ( %s/core ): %s (going on without a filter)\n", config.name, pcap_geterr(p));
+  }
+  else {
+    fprog.len = filter.bf_len;
+    fprog.filter = (struct sock_filter *) filter.bf_insns;
+
+    if (setsockopt(afp->fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) == -1) {
+      Log(LOG_WARNING, "WARN ( %s/core ): SO_ATTACH_FILTER: %s (going on without a filter)\n", config.name, strerror(errno));
+    }
+
+    pcap_freecode(&filter);
+  }
+
+  pcap_close(p);
+}
+
+/*
+  Walks the ring block by block, feeding each packet to pm_pcap_cb() and
+  handing each block back to the kernel once done; returns on error, ie.
+  the interface went away, so that the caller can re-open it.
+*/
+void PM_afpacket_loop(struct pm_pcap_device *dev_ptr, struct pm_pcap_callback_data *cb_data)
+{
+  struct pm_afpacket *afp = dev_ptr->afpacket;
+  struct tpacket_block_desc *block;
+  struct tpacket3_hdr *hdr;
+  struct sockaddr_ll *sll;
+  struct pcap_pkthdr pkthdr;
+  struct pollfd pfd;
+  u_char *pkt;
+  u_int32_t idx;
+  int ret;
+
+  memset(&pfd, 0, sizeof(pfd));
+  pfd.fd = afp->fd;
+  pfd.events = (POLLIN|POLLERR);
+
+  for (;;) {
+    block = (struct tpacket_block_desc *) (afp->ring + ((size_t) afp->block_cur * afp->block_size));
+
+    if (!(block->hdr.bh1.block_status & TP_STATUS_USER)) {
+      ret = poll(&pfd, 1, -1);
+
+      if (ret < 0) {
+	if (errno == EINTR) continue;
+
+	Log(LOG_ERR, "ERROR ( %s/core ): [%s] poll(): %s\n", config.name, dev_ptr->str, strerror(errno));
+	return;
+      }
+
+      if (pfd.revents & (POLLERR|POLLHUP|POLLNVAL)) {
+	Log(LOG_ERR, "ERROR ( %s/core ): [%s] AF_PACKET socket error (revents: %x)\n", config.name, dev_ptr->str, pfd.revents);
+	return;
+      }
+
+      continue;
+    }
+
+    /* block_status is written by the kernel last */
+    __sync_synchronize();
+
+    hdr = (struct tpacket3_hdr *) ((u_char *) block + block->hdr.bh1.offset_to_first_pkt);
+
+    for (idx = 0; idx < block->hdr.bh1.num_pkts; idx++) {
+      sll = (struct sockaddr_ll *) ((u_char *) hdr + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+
+      /* on loopback every packet shows up twice, outgoing and incoming */
+      if (sll->sll_pkttype == PACKET_OUTGOING) {
+	if (afp->loopback || afp->direction == PCAP_D_IN) goto next_pkt;
+      }
+      else if (afp->direction == PCAP_D_OUT) goto next_pkt;
+
+      pkthdr.ts.tv_sec = hdr->tp_sec;
+      pkthdr.ts.tv_usec = (hdr->tp_nsec / 1000);
+      pkthdr.caplen = MIN(hdr->tp_snaplen, afp->snaplen);
+      pkthdr.len = hdr->tp_len;
+      pkt = ((u_char *) hdr + hdr->tp_mac);
+
+      /* 802.1Q tags are stripped by the kernel, put them back in place */
+      if ((hdr->tp_status & TP_STATUS_VLAN_VALID) && pkthdr.caplen >= (2 * ETH_ALEN)) {
+	u_int16_t tpid, tci;
+
+	if (hdr->tp_status & TP_STATUS_VLAN_TPID_VALID) tpid = htons(hdr->hv1.tp_vlan_tpid);
+	else tpid = htons(ETH_P_8021Q);
+	tci = htons(hdr->hv1.tp_vlan_tci);
+
+	pkthdr.caplen = MIN((pkthdr.caplen + 4), afp->snaplen);
+	pkthdr.len += 4;
+
+	memcpy(afp->vlan_buf, pkt, (2 * ETH_ALEN));
+	memcpy(afp->vlan_buf + (2 * ETH_ALEN), &tpid, 2);
+	memcpy(afp->vlan_buf + (2 * ETH_ALEN) + 2, &tci, 2);
+	memcpy(afp->vlan_buf + (2 * ETH_ALEN) + 4, pkt + (2 * ETH_ALEN), (pkthdr.caplen - (2 * ETH_ALEN) - 4));
+	pkt = afp->vlan_buf;
+      }
+
+      afp->processed++;
+      pm_pcap_cb((u_char *) cb_data, &pkthdr, pkt);
+
+      next_pkt:
+      hdr = (struct tpacket3_hdr *) ((u_char *) hdr + hdr->tp_next_offset);
+    }
+
+    __sync_synchronize();
+    block->hdr.bh1.block_status = TP_STATUS_KERNEL;
+    afp->block_cur = ((afp->block_cur + 1) % afp->block_num);
+  }
+}
+
+void PM_afpacket_close(struct pm_pcap_device *dev_ptr)
+{
+  struct pm_afpacket *afp = dev_ptr->afpacket;
+
+  if (!afp) return;
+
+  munmap(afp->ring, afp->ring_len);
+  close(afp->fd);
+  free(afp->vlan_buf);
+  free(afp);
+
+  dev_ptr->afpacket = NULL;
+  dev_ptr->fd = 0;
+}
+
+void PM_afpacket_stats(struct pm_pcap_device *dev_ptr, struct pcap_stat *stats)
+{
+  struct pm_afpacket *afp = dev_ptr->afpacket;
+  struct tpacket_stats_v3 kstats;
+  socklen_t len = sizeof(kstats);
+
+  memset(stats, 0, sizeof(struct pcap_stat));
+  if (!afp) return;
+
+  /* tp_packets includes tp_drops */
+  memset(&kstats, 0, sizeof(kstats));
+  if (!getsockopt(afp->fd, SOL_PACKET, PACKET_STATISTICS, &kstats, &len)) {
+    afp->recv += kstats.tp_packets;
+    afp->drops += kstats.tp_drops;
+    afp->freezes += kstats.tp_freeze_q_cnt;
+  }
+
+  stats->ps_recv = afp->recv;
+  stats->ps_drop = afp->drops;
+}
+
+void PM_afpacket_print_stats(struct pm_pcap_device *dev_ptr, time_t now)
+{
+  struct pm_afpacket *afp = dev_ptr->afpacket;
+  struct pcap_stat stats;
+
+  PM_afpacket_stats(dev_ptr, &stats);
+  if (!afp) return;
+
+  Log(LOG_NOTICE, "NOTICE ( %s/%s ): stats [%s,%u] time=%ld worker=%d received_packets=%" PRIu64 " dropped_packets=%" PRIu64
+      " processed_packets=%" PRIu64 " ring_freezes=%" PRIu64 "\n", config.name, config.type, dev_ptr->str, dev_ptr->id,
+      (long)now, core_worker_id, afp->recv, afp->drops, afp->processed, afp->freezes);
+}
+#else
+int PM_afpacket_open(struct pm_pcap_device *dev_ptr, char *ifname, int snaplen, int promisc, int protocol, int direction, char *errbuf)
+{
+  snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s: pmacctd_afpacket requires Linux TPACKET_V3 support", ifname);
+
+  return ERR;
+}
+
+void PM_afpacket_add_filter(struct pm_pcap_device *dev_ptr)
+{
+}
+
+void PM_afpacket_loop(struct pm_pcap_device *dev_ptr, struct pm_pcap_callback_data *cb_data)
+{
+}
+
+void PM_afpacket_close(struct pm_pcap_device *dev_ptr)
+{
+}
+
+void PM_afpacket_stats(struct pm_pcap_device *dev_ptr, struct pcap_stat *stats)
+{
+  memset(stats, 0, sizeof(struct pcap_stat));
+}
+
+void PM_afpacket_print_stats(struct pm_pcap_device *dev_ptr, time_t now)
+{
+}
+#endif
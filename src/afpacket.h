@@ -0,0 +1,72 @@
+/*
+    pmacct (Promiscuous mode IP Accounting package)
+    pmacct is Copyright (C) 2003-2020 by Paolo Lucente
+*/
+
+/*
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#ifndef _AFPACKET_H_
+#define _AFPACKET_H_
+
+/* defines */
+#define AFPACKET_MIN_BLOCK_SIZE		4096
+#define AFPACKET_DEFAULT_BLOCK_SIZE	(1 << 20)
+#define AFPACKET_DEFAULT_BLOCK_NUM	64
+#define AFPACKET_DEFAULT_BLOCK_TIMEOUT	10	/* msecs */
+#define AFPACKET_FRAME_SIZE		2048
+#define AFPACKET_FILTER_BUFFER_SIZE	65536	/* short-lived handle compiling the filter */
+
+#define AFPACKET_FANOUT_HASH		1
+#define AFPACKET_FANOUT_CPU		2
+
+/* structures */
+/*
+  Native Linux capture: a TPACKET_V3 ring of block_num blocks, block_size
+  bytes each, mmap()'ed off an AF_PACKET socket. Blocks are handed over to
+  userspace as soon as full or block_timeout old. When pmacctd_workers is
+  greater than 1, the sockets of all workers join the same PACKET_FANOUT
+  group.
+*/
+struct pm_afpacket {
+  int fd;
+  int ifindex;
+  int loopback;
+  int snaplen;
+  int direction;
+  u_char *ring;
+  size_t ring_len;
+  u_int32_t block_size;
+  u_int32_t block_num;
+  u_int32_t block_cur;
+  u_char *vlan_buf;		/* room to re-insert stripped 802.1Q tags */
+
+  /* stats; kernel counters are reset each time they are read */
+  u_int64_t recv;
+  u_int64_t drops;
+  u_int64_t freezes;
+  u_int64_t processed;
+};
+
+/* prototypes */
+extern int PM_afpacket_open(struct pm_pcap_device *, char *, int, int, int, int, char *);
+extern void PM_afpacket_add_filter(struct pm_pcap_device *);
+extern void PM_afpacket_loop(struct pm_pcap_device *, struct pm_pcap_callback_data *);
+extern void PM_afpacket_close(struct pm_pcap_device *);
+extern void PM_afpacket_stats(struct pm_pcap_device *, struct pcap_stat *);
+extern void PM_afpacket_print_stats(struct pm_pcap_device *, time_t);
+
+#endif /* _AFPACKET_H_ */
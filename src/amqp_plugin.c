@@ -39,22 +39,18 @@ void amqp_plugin(int pipe_fd, struct configuration *cfgptr, void *ptr)
 {
   struct pkt_data *data;
   struct ports_table pt;
-  unsigned char *pipebuf;
+  unsigned char *pipebuf = NULL;
   struct pollfd pfd;
   struct insert_data idata;
   time_t avro_schema_deadline = 0;
   int timeout, refresh_timeout, avro_schema_timeout = 0;
   int ret, num, recv_budget, poll_bypass;
-  struct ring *rg = &((struct channels_list_entry *)ptr)->rg;
-  struct ch_status *status = ((struct channels_list_entry *)ptr)->status;
+  struct channels_list_entry *chptr = (struct channels_list_entry *) ptr;
   int datasize = ((struct channels_list_entry *)ptr)->datasize;
-  u_int32_t bufsz = ((struct channels_list_entry *)ptr)->bufsize;
   pid_t core_pid = ((struct channels_list_entry *)ptr)->core_pid;
   struct networks_file_data nfd;
 
-  unsigned char *rgptr;
-  int pollagain = TRUE;
-  u_int32_t seq = 1, rg_err_count = 0;
+  u_int32_t seq = 1;
 
   struct extra_primitives extras;
   struct primitives_ptrs prim_ptrs;
@@ -84,8 +80,10 @@ void amqp_plugin(int pipe_fd, struct configuration *cfgptr, void *ptr)
   P_set_signals();
   P_init_default_values();
   P_config_checks();
-  pipebuf = (unsigned char *) pm_malloc(config.buffer_size);
-  memset(pipebuf, 0, config.buffer_size);
+  if (config.pipe_zmq) {
+    pipebuf = (unsigned char *) pm_malloc(config.buffer_size);
+    memset(pipebuf, 0, config.buffer_size);
+  }
 
   timeout = config.sql_refresh_time*1000;
 
@@ -211,7 +209,6 @@ void amqp_plugin(int pipe_fd, struct configuration *cfgptr, void *ptr)
   /* plugin main loop */
   for(;;) {
     poll_again:
-    status->wakeup = TRUE;
     poll_bypass = FALSE;
 
     calc_refresh_timeout(refresh_deadline, idata.now, &refresh_timeout);
@@ -220,7 +217,8 @@ void amqp_plugin(int pipe_fd, struct configuration *cfgptr, void *ptr)
     pfd.fd = pipe_fd;
     pfd.events = POLLIN;
     timeout = MIN(refresh_timeout, (avro_schema_timeout ? avro_schema_timeout : INT_MAX));
-    ret = poll(&pfd, (pfd.fd == ERR ? 0 : 1), timeout);
+    if (config.pipe_homegrown && !arm_pipe_wakeup(chptr)) ret = TRUE; /* data is pending, do not sleep */
+    else ret = poll(&pfd, (pfd.fd == ERR ? 0 : 1), timeout);
 
     if (ret <= 0) {
       if (getppid() != core_pid) {
@@ -263,40 +261,16 @@ void amqp_plugin(int pipe_fd, struct configuration *cfgptr, void *ptr)
       }
 
       if (config.pipe_homegrown) {
-        if (!pollagain) {
-          seq++;
-          seq %= MAX_SEQNUM;
-          if (seq == 0) rg_err_count = FALSE;
-        }
-        else {
-          if ((ret = read(pipe_fd, &rgptr, sizeof(rgptr))) == 0) 
+	if (!recv_budget) {
+	  if (drain_pipe_wakeup(pipe_fd) == ERR)
 	    exit_gracefully(1); /* we exit silently; something happened at the write end */
-        }
 
-        if ((rg->ptr + bufsz) > rg->end) rg->ptr = rg->base;
-
-        if (((struct ch_buf_hdr *)rg->ptr)->seq != seq) {
-          if (!pollagain) {
-            pollagain = TRUE;
-            goto poll_again;
-          }
-          else {
-            rg_err_count++;
-            if (config.debug || (rg_err_count > MAX_RG_COUNT_ERR)) {
-              Log(LOG_WARNING, "WARN ( %s/%s ): Missing data detected (plugin_buffer_size=%" PRIu64 " plugin_pipe_size=%" PRIu64 ").\n",
-			config.name, config.type, config.buffer_size, config.pipe_size);
-              Log(LOG_WARNING, "WARN ( %s/%s ): Increase values or look for plugin_buffer_size, plugin_pipe_size in CONFIG-KEYS document.\n\n",
-			config.name, config.type);
-            }
-
-	    rg->ptr = (rg->base + status->last_buf_off);
-            seq = ((struct ch_buf_hdr *)rg->ptr)->seq;
-          }
-        }
+	  check_pipe_lost_data(chptr);
+	}
 
-        pollagain = FALSE;
-        memcpy(pipebuf, rg->ptr, bufsz);
-        rg->ptr += bufsz;
+	/* buffers are read in place and released to the Core Process once processed */
+	if (!(pipebuf = get_pipe_buffer(chptr))) goto poll_again;
+	seq = ((struct ch_buf_hdr *)pipebuf)->seq;
       }
 #ifdef WITH_ZMQ
       else if (config.pipe_zmq) {
@@ -344,6 +318,7 @@ void amqp_plugin(int pipe_fd, struct configuration *cfgptr, void *ptr)
 	}
       }
 
+      if (config.pipe_homegrown) release_pipe_buffer(chptr);
       recv_budget++;
       goto read_data;
     }
@@ -19,6 +19,9 @@
     Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 */
 
+/* PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP */
+#define _GNU_SOURCE
+
 /* includes */
 #include "pmacct.h"
 #include "addr.h"
@@ -40,11 +43,15 @@
 #include "plugin_cmn_avro.h"
 #endif
 #include "bgp_lg.h"
+#if defined LINUX
+#include <sys/epoll.h>
+#endif
 
 /* Global variables */
 thread_pool_t *bgp_pool;
 struct bgp_peer *peers;
-struct bgp_peer_cache_bucket *peers_cache, *peers_port_cache;
+struct bgp_peer_cache_bucket *peers_cache, *peers_port_cache, *peers_id_cache;
+u_int32_t peers_cache_gen;
 char *std_comm_patterns[MAX_BGP_COMM_PATTERNS];
 char *ext_comm_patterns[MAX_BGP_COMM_PATTERNS];
 char *lrg_comm_patterns[MAX_BGP_COMM_PATTERNS];
@@ -57,6 +64,25 @@ struct bgp_rt_structs inter_domain_routing_dbs[FUNC_TYPE_MAX], *bgp_routing_db;
 struct bgp_misc_structs inter_domain_misc_dbs[FUNC_TYPE_MAX], *bgp_misc_db;
 struct bgp_xconnects bgp_xcs_map;
 
+/* BGP worker threads, see bgp_daemon_threads */
+static int bgp_workers_num;
+/* workers re-take it for reading per message: unless writers are preferred
+   the main BGP thread may never get to admit sessions or fork dumps */
+#if defined PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP
+static pthread_rwlock_t bgp_workers_rwlock = PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP;
+#else
+static pthread_rwlock_t bgp_workers_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+#endif
+static int bgp_rib_shared; /* RIB accessed by multiple threads, ie. workers, dump writers */
+
+static void bgp_daemon_locks_init();
+#if defined LINUX
+static struct bgp_daemon_worker bgp_workers[BGP_DAEMON_THREADS_MAX];
+
+static void bgp_daemon_workers_init(int);
+static void bgp_daemon_worker_add(struct bgp_peer *);
+#endif
+
 /* Functions */
 void bgp_daemon_wrapper()
 {
@@ -98,7 +124,6 @@ void skinny_bgp_daemon_online()
   struct host_addr addr;
   struct bgp_peer *peer;
   struct bgp_peer_buf *peer_buf;
-  char bgp_reply_pkt[BGP_BUFFER_SIZE], *bgp_reply_pkt_ptr;
   char bgp_peer_str[INET6_ADDRSTRLEN], bgp_xconnect_peer_str[BGP_XCONNECT_STRLEN];
   struct sockaddr_storage server, client;
   afi_t afi;
@@ -115,7 +140,7 @@ void skinny_bgp_daemon_online()
   /* select() stuff */
   fd_set read_descs, bkp_read_descs; 
   int fd, select_fd, bkp_select_fd, recalc_fds, select_num;
-  int recv_fd, send_fd;
+  int recv_fd, send_fd, xconnect_fd;
 
   /* initial cleanups */
   reload_map_bgp_thread = FALSE;
@@ -158,7 +183,9 @@ void skinny_bgp_daemon_online()
   }
   memset(peers, 0, config.bgp_daemon_max_peers*sizeof(struct bgp_peer));
 
-  if (config.bgp_lg) {
+  /* caches are used to resolve peers by address (flows, Looking Glass)
+     and by BGP Router-ID (flows) */
+  if (!config.bgp_xconnect_map) {
     peers_cache = malloc(config.bgp_daemon_max_peers*sizeof(struct bgp_peer_cache_bucket));
     if (!peers_cache) {
       Log(LOG_ERR, "ERROR ( %s/%s ): Unable to malloc() BGP peers cache structure. Terminating thread.\n", config.name, bgp_misc_db->log_str);
@@ -174,10 +201,19 @@ void skinny_bgp_daemon_online()
     }
 
     bgp_peer_cache_init(peers_port_cache, config.bgp_daemon_max_peers);
+
+    peers_id_cache = malloc(config.bgp_daemon_max_peers*sizeof(struct bgp_peer_cache_bucket));
+    if (!peers_id_cache) {
+      Log(LOG_ERR, "ERROR ( %s/%s ): Unable to malloc() BGP peers cache structure (3). Terminating thread.\n", config.name, bgp_misc_db->log_str);
+      exit_gracefully(1);
+    }
+
+    bgp_peer_cache_init(peers_id_cache, config.bgp_daemon_max_peers);
   }
   else {
     peers_cache = NULL;
     peers_port_cache = NULL;
+    peers_id_cache = NULL;
   }
 
   if (config.bgp_xconnect_map) {
@@ -210,6 +246,11 @@ void skinny_bgp_daemon_online()
   }
 
   if (config.rpki_roas_file || config.rpki_rtr_cache) {
+    if (config.bgp_table_fib) {
+      Log(LOG_WARNING, "WARN ( %s/%s ): 'bgp_table_fib' is not compatible with RPKI. Disabling.\n", config.name, bgp_misc_db->log_str);
+      config.bgp_table_fib = FALSE;
+    }
+
     rpki_daemon_wrapper();
 
     /* Let's give the RPKI thread some advantage to create its structures */
@@ -556,6 +597,36 @@ void skinny_bgp_daemon_online()
 
   bgp_link_misc_structs(bgp_misc_db);
 
+  if (config.bgp_daemon_threads > 1) {
+#if defined LINUX
+    if (config.bgp_xconnect_map || config.bgp_blackhole_stdcomm_list || config.rpki_roas_file || config.rpki_rtr_cache) {
+      Log(LOG_WARNING, "WARN ( %s/%s ): 'bgp_daemon_threads' is not supported in conjunction with xconnects, blackhole and RPKI features. Using 1 thread.\n",
+	  config.name, bgp_misc_db->log_str);
+      config.bgp_daemon_threads = 1;
+    }
+    else bgp_daemon_workers_init(config.bgp_daemon_threads);
+#else
+    Log(LOG_WARNING, "WARN ( %s/%s ): 'bgp_daemon_threads' is only supported on Linux. Using 1 thread.\n", config.name, bgp_misc_db->log_str);
+    config.bgp_daemon_threads = 1;
+#endif
+  }
+
+  if (config.bgp_table_dump_workers) {
+    if (config.rpki_roas_file || config.rpki_rtr_cache) {
+      Log(LOG_WARNING, "WARN ( %s/%s ): 'bgp_table_dump_workers' is not supported in conjunction with RPKI features. Forking dumps.\n",
+	  config.name, bgp_misc_db->log_str);
+      config.bgp_table_dump_workers = 0;
+    }
+    else if (config.bgp_table_dump_workers > 1 && (!config.bgp_table_dump_file || !strstr(config.bgp_table_dump_file, "$peer_src_ip") ||
+	     config.bgp_table_dump_amqp_routing_key || config.bgp_table_dump_kafka_topic)) {
+      Log(LOG_WARNING, "WARN ( %s/%s ): multiple 'bgp_table_dump_workers' require a per-peer 'bgp_table_dump_file' ($peer_src_ip). Using 1 writer.\n",
+	  config.name, bgp_misc_db->log_str);
+      config.bgp_table_dump_workers = 1;
+    }
+
+    if (config.bgp_table_dump_workers && !bgp_rib_shared) bgp_daemon_locks_init();
+  }
+
   sigemptyset(&signal_set);
   sigaddset(&signal_set, SIGCHLD);
   sigaddset(&signal_set, SIGHUP);
@@ -608,10 +679,21 @@ void skinny_bgp_daemon_online()
     }
     else drt_ptr = NULL;
 
+    /* wake up periodically to free memory retired from the RIB and to
+       reap table dump writers */
+    if ((bgp_mem_retired_pending() || bgp_table_dump_writers_running()) && (!drt_ptr || dump_refresh_timeout.tv_sec > BGP_MEM_RECLAIM_INTERVAL)) {
+      dump_refresh_timeout.tv_sec = BGP_MEM_RECLAIM_INTERVAL;
+      dump_refresh_timeout.tv_usec = 0;
+      drt_ptr = &dump_refresh_timeout;
+    }
+
     select_num = select(select_fd, &read_descs, NULL, NULL, drt_ptr);
     if (select_num < 0) goto select_again;
     now = time(NULL);
 
+    bgp_mem_reclaim();
+    bgp_table_dump_writers_reap();
+
     /* signals handling */
     if (reload_map_bgp_thread) {
       if (config.bgp_daemon_allow_file) load_allow_file(config.bgp_daemon_allow_file, &allow);
@@ -639,6 +721,8 @@ void skinny_bgp_daemon_online()
     }
 
     if (reload_log_bgp_thread) {
+      if (bgp_workers_num) pthread_rwlock_wrlock(&bgp_workers_rwlock);
+
       for (peers_idx = 0; peers_idx < config.bgp_daemon_max_peers; peers_idx++) {
 	if (bgp_misc_db->peers_log[peers_idx].fd) {
 	  fclose(bgp_misc_db->peers_log[peers_idx].fd);
@@ -648,15 +732,27 @@ void skinny_bgp_daemon_online()
 	else break;
       }
 
+      if (bgp_workers_num) pthread_rwlock_unlock(&bgp_workers_rwlock);
+
       reload_log_bgp_thread = FALSE;
     }
 
+    if (print_stats_bgp_thread) {
+      if (bgp_workers_num) pthread_rwlock_wrlock(&bgp_workers_rwlock);
+      bgp_mem_report(peers, config.bgp_daemon_max_peers, FUNC_TYPE_BGP);
+      if (bgp_workers_num) pthread_rwlock_unlock(&bgp_workers_rwlock);
+
+      print_stats_bgp_thread = FALSE;
+    }
+
     if (reload_log && !bgp_misc_db->is_thread) {
       reload_logs();
       reload_log = FALSE;
     }
 
     if (bgp_misc_db->msglog_backend_methods || bgp_misc_db->dump_backend_methods) {
+      if (bgp_misc_db->log_mutex) pthread_mutex_lock(bgp_misc_db->log_mutex);
+
       gettimeofday(&bgp_misc_db->log_tstamp, NULL);
       compose_timestamp(bgp_misc_db->log_tstamp_str, SRVBUFLEN, &bgp_misc_db->log_tstamp, TRUE,
 			config.timestamps_since_epoch, config.timestamps_rfc3339, config.timestamps_utc);
@@ -667,6 +763,8 @@ void skinny_bgp_daemon_online()
 	  bgp_peer_log_seq_init(&bgp_misc_db->log_seq);
       }
 
+      if (bgp_misc_db->log_mutex) pthread_mutex_unlock(bgp_misc_db->log_mutex);
+
       if (bgp_misc_db->dump_backend_methods) {
 	while (bgp_misc_db->log_tstamp.tv_sec > dump_refresh_deadline) {
 	  bgp_misc_db->dump.tstamp.tv_sec = dump_refresh_deadline;
@@ -678,7 +776,9 @@ void skinny_bgp_daemon_online()
 	  if (bgp_peer_log_seq_has_ro_bit(&bgp_misc_db->log_seq))
 	    bgp_peer_log_seq_init(&bgp_misc_db->log_seq);
 
+	  if (bgp_workers_num) pthread_rwlock_wrlock(&bgp_workers_rwlock);
 	  bgp_handle_dump_event();
+	  if (bgp_workers_num) pthread_rwlock_unlock(&bgp_workers_rwlock);
 
 	  dump_refresh_deadline += config.bgp_table_dump_refresh_time;
 	}
@@ -712,6 +812,9 @@ void skinny_bgp_daemon_online()
     */ 
     if (!select_num) goto select_again;
 
+    /* Workers are kept off the shared peers table while sessions get admitted */
+    if (bgp_workers_num) pthread_rwlock_wrlock(&bgp_workers_rwlock);
+
     /* New connection is coming in */ 
     if (FD_ISSET(config.bgp_sock, &read_descs)) {
       int peers_check_idx, peers_num;
@@ -785,7 +888,7 @@ void skinny_bgp_daemon_online()
 
       peer->fd = fd;
       peer->idx = peers_idx; 
-      FD_SET(peer->fd, &bkp_read_descs);
+      if (!bgp_workers_num) FD_SET(peer->fd, &bkp_read_descs);
       sa_to_addr((struct sockaddr *) &client, &peer->addr, &peer->tcp_port);
 
       if (peers_cache && peers_port_cache) {
@@ -875,10 +978,20 @@ void skinny_bgp_daemon_online()
       }
 
       if (config.bgp_daemon_neighbors_file) write_neighbors_file(config.bgp_daemon_neighbors_file, FUNC_TYPE_BGP);
+
+#if defined LINUX
+      /* Hand the session over to its worker thread */
+      if (bgp_workers_num) bgp_daemon_worker_add(peer);
+#endif
     }
 
     read_data:
 
+    if (bgp_workers_num) {
+      pthread_rwlock_unlock(&bgp_workers_rwlock);
+      goto select_again;
+    }
+
     /*
        We have something coming in: let's lookup which peer is that.
        FvD: To avoid starvation of the "later established" peers, we
@@ -913,132 +1026,306 @@ void skinny_bgp_daemon_online()
 
     if (!peer) goto select_again;
 
-    if (!peer_buf->exp_len) {
-      ret = recv(recv_fd, &peer_buf->base[peer_buf->cur_len], (BGP_HEADER_SIZE - peer_buf->cur_len), 0);
+    fd = peer->fd;
+    xconnect_fd = peer->xconnect_fd;
 
-      if (ret > 0) {
-	peer_buf->cur_len += ret;
+    ret = bgp_daemon_read_msg(peer, peer_buf, recv_fd, send_fd, now);
+    if (ret == ERR) {
+      FD_CLR(fd, &bkp_read_descs);
+      if (config.bgp_xconnect_map) FD_CLR(xconnect_fd, &bkp_read_descs);
 
-	if (peer_buf->cur_len == BGP_HEADER_SIZE) {
-	  struct bgp_header *bhdr = (struct bgp_header *) peer_buf->base;
+      recalc_fds = TRUE;
+    }
+  }
+}
 
-	  if (bgp_marker_check(bhdr, BGP_MARKER_SIZE) == ERR) {
-	    bgp_peer_print(peer, bgp_peer_str, INET6_ADDRSTRLEN);
-	    Log(LOG_INFO, "INFO ( %s/%s ): [%s] Received malformed BGP packet (marker check failed).\n",
-		config.name, bgp_misc_db->log_str, bgp_peer_str);
+/*
+  Reads from recv_fd and, once a full BGP message is buffered in peer_buf,
+  processes it: either parsed or, if x-connecting, relayed to send_fd.
+  Returns BGP_DAEMON_READ_MSG if a message was consumed, BGP_DAEMON_READ_AGAIN
+  if more data is needed and ERR if the session was closed along the way.
+*/
+int bgp_daemon_read_msg(struct bgp_peer *peer, struct bgp_peer_buf *peer_buf, int recv_fd, int send_fd, time_t now)
+{
+  char bgp_reply_pkt[BGP_BUFFER_SIZE], *bgp_reply_pkt_ptr;
+  char bgp_peer_str[INET6_ADDRSTRLEN], bgp_xconnect_peer_str[BGP_XCONNECT_STRLEN];
+  int ret = 0;
 
-	    peer->msglen = 0;
-	    peer_buf->cur_len = 0;
-	    peer_buf->exp_len = 0;
-	    ret = ERR;
-	  }
-	  else {
-	    peer_buf->exp_len = ntohs(bhdr->bgpo_len);
+  if (!peer_buf->exp_len) {
+    ret = recv(recv_fd, &peer_buf->base[peer_buf->cur_len], (BGP_HEADER_SIZE - peer_buf->cur_len), 0);
 
-	    /* commit */
-	    if (peer_buf->cur_len == peer_buf->exp_len) {
-	      peer->msglen = peer_buf->exp_len;
-	      peer_buf->cur_len = 0;
-	      peer_buf->exp_len = 0;
-	    }
-	  }
-	}
-	else {
-	  goto select_again;
-	}
-      }
-    }
+    if (ret > 0) {
+      peer_buf->cur_len += ret;
 
-    if (peer_buf->exp_len) {
-      ret = recv(recv_fd, &peer_buf->base[peer_buf->cur_len], (peer_buf->exp_len - peer_buf->cur_len), 0);
+      if (peer_buf->cur_len == BGP_HEADER_SIZE) {
+	struct bgp_header *bhdr = (struct bgp_header *) peer_buf->base;
 
-      if (ret > 0) {
-	peer_buf->cur_len += ret;
+	if (bgp_marker_check(bhdr, BGP_MARKER_SIZE) == ERR) {
+	  bgp_peer_print(peer, bgp_peer_str, INET6_ADDRSTRLEN);
+	  Log(LOG_INFO, "INFO ( %s/%s ): [%s] Received malformed BGP packet (marker check failed).\n",
+	      config.name, bgp_misc_db->log_str, bgp_peer_str);
 
-	/* commit */
-        if (peer_buf->cur_len == peer_buf->exp_len) {
-	  peer->msglen = peer_buf->exp_len;
+	  peer->msglen = 0;
 	  peer_buf->cur_len = 0;
 	  peer_buf->exp_len = 0;
+	  ret = ERR;
 	}
 	else {
-	  goto select_again;
+	  peer_buf->exp_len = ntohs(bhdr->bgpo_len);
+
+	  /* commit */
+	  if (peer_buf->cur_len == peer_buf->exp_len) {
+	    peer->msglen = peer_buf->exp_len;
+	    peer_buf->cur_len = 0;
+	    peer_buf->exp_len = 0;
+	  }
 	}
       }
+      else return BGP_DAEMON_READ_AGAIN;
     }
+  }
 
-    if (ret <= 0) {
-      if (!config.bgp_xconnect_map) {
-	bgp_peer_print(peer, bgp_peer_str, INET6_ADDRSTRLEN);
-	Log(LOG_INFO, "INFO ( %s/%s ): [%s] BGP connection reset by peer (%d).\n", config.name, bgp_misc_db->log_str, bgp_peer_str, errno);
-	FD_CLR(peer->fd, &bkp_read_descs);
-      }
-      else {
-	bgp_peer_xconnect_print(peer, bgp_xconnect_peer_str, BGP_XCONNECT_STRLEN);
+  if (peer_buf->exp_len) {
+    ret = recv(recv_fd, &peer_buf->base[peer_buf->cur_len], (peer_buf->exp_len - peer_buf->cur_len), 0);
 
-	if (recv_fd == peer->fd)
-	  Log(LOG_INFO, "INFO ( %s/%s ): [%s] recv(): BGP xconnect reset by src peer (%d).\n",
-		config.name, bgp_misc_db->log_str, bgp_xconnect_peer_str, errno);
-	else if (recv_fd == peer->xconnect_fd)
-	  Log(LOG_INFO, "INFO ( %s/%s ): [%s] recv(): BGP xconnect reset by dst peer (%d).\n",
-		config.name, bgp_misc_db->log_str, bgp_xconnect_peer_str, errno);
+    if (ret > 0) {
+      peer_buf->cur_len += ret;
 
-	FD_CLR(peer->fd, &bkp_read_descs);
-	FD_CLR(peer->xconnect_fd, &bkp_read_descs);
+      /* commit */
+      if (peer_buf->cur_len == peer_buf->exp_len) {
+	peer->msglen = peer_buf->exp_len;
+	peer_buf->cur_len = 0;
+	peer_buf->exp_len = 0;
       }
+      else return BGP_DAEMON_READ_AGAIN;
+    }
+  }
 
-      bgp_peer_close(peer, FUNC_TYPE_BGP, FALSE, FALSE, FALSE, FALSE, NULL);
+  /* non-blocking sockets (worker threads): nothing more to read for now */
+  if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return BGP_DAEMON_READ_AGAIN;
 
-      recalc_fds = TRUE;
-      goto select_again;
+  if (ret <= 0) {
+    if (!config.bgp_xconnect_map) {
+      bgp_peer_print(peer, bgp_peer_str, INET6_ADDRSTRLEN);
+      Log(LOG_INFO, "INFO ( %s/%s ): [%s] BGP connection reset by peer (%d).\n", config.name, bgp_misc_db->log_str, bgp_peer_str, errno);
     }
     else {
-      if (!config.bgp_xconnect_map) {
-	/* Appears a valid peer with a valid BGP message: before
-	   continuing let's see if it's time to send a KEEPALIVE
-	   back */
-	if (peer->status == Established && ((now - peer->last_keepalive) > (peer->ht / 2))) {
-	  bgp_reply_pkt_ptr = bgp_reply_pkt;
-	  bgp_reply_pkt_ptr += bgp_write_keepalive_msg(bgp_reply_pkt_ptr);
-	  ret = send(recv_fd, bgp_reply_pkt, bgp_reply_pkt_ptr - bgp_reply_pkt, 0);
-	  peer->last_keepalive = now;
-	} 
-
-	ret = bgp_parse_msg(peer, now, TRUE);
-	if (ret) {
-	  FD_CLR(recv_fd, &bkp_read_descs);
-
-	  if (ret < 0) bgp_peer_close(peer, FUNC_TYPE_BGP, FALSE, FALSE, FALSE, FALSE, NULL);
-	  else bgp_peer_close(peer, FUNC_TYPE_BGP, FALSE, TRUE, ret, BGP_NOTIFY_SUBCODE_UNSPECIFIC, NULL);
-
-	  recalc_fds = TRUE;
-	  goto select_again;
-	}
+      bgp_peer_xconnect_print(peer, bgp_xconnect_peer_str, BGP_XCONNECT_STRLEN);
+
+      if (recv_fd == peer->fd)
+	Log(LOG_INFO, "INFO ( %s/%s ): [%s] recv(): BGP xconnect reset by src peer (%d).\n",
+	    config.name, bgp_misc_db->log_str, bgp_xconnect_peer_str, errno);
+      else if (recv_fd == peer->xconnect_fd)
+	Log(LOG_INFO, "INFO ( %s/%s ): [%s] recv(): BGP xconnect reset by dst peer (%d).\n",
+	    config.name, bgp_misc_db->log_str, bgp_xconnect_peer_str, errno);
+    }
+
+    bgp_peer_close(peer, FUNC_TYPE_BGP, FALSE, FALSE, FALSE, FALSE, NULL);
+
+    return ERR;
+  }
+
+  if (!config.bgp_xconnect_map) {
+    /* Appears a valid peer with a valid BGP message: before
+       continuing let's see if it's time to send a KEEPALIVE
+       back */
+    if (peer->status == Established && ((now - peer->last_keepalive) > (peer->ht / 2))) {
+      bgp_reply_pkt_ptr = bgp_reply_pkt;
+      bgp_reply_pkt_ptr += bgp_write_keepalive_msg(bgp_reply_pkt_ptr);
+      ret = send(recv_fd, bgp_reply_pkt, bgp_reply_pkt_ptr - bgp_reply_pkt, 0);
+      peer->last_keepalive = now;
+    } 
+
+    ret = bgp_parse_msg(peer, now, TRUE);
+    if (ret) {
+      if (ret < 0) bgp_peer_close(peer, FUNC_TYPE_BGP, FALSE, FALSE, FALSE, FALSE, NULL);
+      else bgp_peer_close(peer, FUNC_TYPE_BGP, FALSE, TRUE, ret, BGP_NOTIFY_SUBCODE_UNSPECIFIC, NULL);
+
+      return ERR;
+    }
+  }
+  else {
+    ret = send(send_fd, peer_buf->base, peer->msglen, 0);
+    if (ret <= 0) {
+      bgp_peer_xconnect_print(peer, bgp_xconnect_peer_str, BGP_XCONNECT_STRLEN);
+
+      if (send_fd == peer->fd)
+	Log(LOG_INFO, "INFO ( %s/%s ): [%s] send(): BGP xconnect reset by src peer (%d).\n",
+	    config.name, bgp_misc_db->log_str, bgp_xconnect_peer_str, errno);
+      else if (send_fd == peer->xconnect_fd)
+	Log(LOG_INFO, "INFO ( %s/%s ): [%s] send(): BGP xconnect reset by dst peer (%d).\n",
+	    config.name, bgp_misc_db->log_str, bgp_xconnect_peer_str, errno);
+
+      bgp_peer_close(peer, FUNC_TYPE_BGP, FALSE, FALSE, FALSE, FALSE, NULL);
+
+      return ERR;
+    }
+  }
+
+  return BGP_DAEMON_READ_MSG;
+}
+
+static pthread_mutex_t *bgp_daemon_mutex_new(int num)
+{
+  pthread_mutexattr_t attr;
+  pthread_mutex_t *mutex;
+  int idx;
+
+  mutex = malloc(num * sizeof(pthread_mutex_t));
+  if (!mutex) {
+    Log(LOG_ERR, "ERROR ( %s/%s ): malloc() failed (bgp_daemon_mutex_new). Exiting ..\n", config.name, bgp_misc_db->log_str);
+    exit_gracefully(1);
+  }
+
+  /* recursive: ie. bgp_table_info_delete() deletes paths with the node locked */
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  for (idx = 0; idx < num; idx++) pthread_mutex_init(&mutex[idx], &attr);
+  pthread_mutexattr_destroy(&attr);
+
+  return mutex;
+}
+
+static pthread_rwlock_t *bgp_daemon_rwlock_new()
+{
+  pthread_rwlockattr_t attr;
+  pthread_rwlock_t *rwlock;
+
+  rwlock = malloc(sizeof(pthread_rwlock_t));
+  if (!rwlock) {
+    Log(LOG_ERR, "ERROR ( %s/%s ): malloc() failed (bgp_daemon_rwlock_new). Exiting ..\n", config.name, bgp_misc_db->log_str);
+    exit_gracefully(1);
+  }
+
+  /* nodes are looked up far more often than they are linked or unlinked:
+     unless writers are preferred, these may never get their turn */
+  pthread_rwlockattr_init(&attr);
+#if defined PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP
+  pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+  pthread_rwlock_init(rwlock, &attr);
+  pthread_rwlockattr_destroy(&attr);
+
+  return rwlock;
+}
+
+static void bgp_daemon_locks_init()
+{
+  afi_t afi;
+  safi_t safi;
+
+  for (afi = AFI_IP; afi < AFI_MAX; afi++) {
+    for (safi = SAFI_UNICAST; safi < SAFI_MAX; safi++) {
+      if (bgp_routing_db->rib[afi][safi]) {
+	bgp_routing_db->rib[afi][safi]->rwlock = bgp_daemon_rwlock_new();
+	bgp_routing_db->rib[afi][safi]->node_mutex = bgp_daemon_mutex_new(BGP_TABLE_NODE_LOCKS);
       }
-      else {
-	ret = send(send_fd, peer_buf->base, peer->msglen, 0);
-	if (ret <= 0) {
-	  bgp_peer_xconnect_print(peer, bgp_xconnect_peer_str, BGP_XCONNECT_STRLEN);
+    }
+  }
 
-	  if (send_fd == peer->fd)
-	    Log(LOG_INFO, "INFO ( %s/%s ): [%s] send(): BGP xconnect reset by src peer (%d).\n",
-		config.name, bgp_misc_db->log_str, bgp_xconnect_peer_str, errno);
-	  else if (send_fd == peer->xconnect_fd)
-	    Log(LOG_INFO, "INFO ( %s/%s ): [%s] send(): BGP xconnect reset by dst peer (%d).\n",
-		config.name, bgp_misc_db->log_str, bgp_xconnect_peer_str, errno);
+  bgp_routing_db->hash_mutex = bgp_daemon_mutex_new(1);
+  bgp_misc_db->log_mutex = bgp_daemon_mutex_new(1);
+  bgp_misc_db->peers_mutex = bgp_daemon_mutex_new(1);
 
-	  FD_CLR(peer->fd, &bkp_read_descs);
-	  FD_CLR(peer->xconnect_fd, &bkp_read_descs);
+  bgp_rib_shared = TRUE;
+}
 
-	  bgp_peer_close(peer, FUNC_TYPE_BGP, FALSE, FALSE, FALSE, FALSE, NULL);
+#if defined LINUX
+static void *bgp_daemon_worker(void *arg)
+{
+  struct bgp_daemon_worker *worker = arg;
+  struct epoll_event events[BGP_DAEMON_WORKER_EVENTS];
+  struct bgp_peer *peer;
+  int events_num, idx, burst, peers_idx, fd, ret;
+  time_t now;
 
-	  recalc_fds = TRUE;
-	  goto select_again;
-	}
+  for (;;) {
+    events_num = epoll_wait(worker->efd, events, BGP_DAEMON_WORKER_EVENTS, -1);
+    if (events_num < 0) {
+      if (errno == EINTR) continue;
+
+      Log(LOG_ERR, "ERROR ( %s/%s ): worker #%d: epoll_wait() failed (errno: %d). Exiting ..\n", config.name, bgp_misc_db->log_str, worker->id, errno);
+      exit_gracefully(1);
+    }
+
+    now = time(NULL);
+
+    for (idx = 0; idx < events_num; idx++) {
+      peers_idx = (events[idx].data.u64 >> 32);
+      fd = (events[idx].data.u64 & 0xFFFFFFFF);
+      peer = &peers[peers_idx];
+
+      /* drain a few messages per peer, then yield to the next ready one */
+      for (burst = 0; burst < BGP_DAEMON_WORKER_BURST; burst++) {
+	pthread_rwlock_rdlock(&bgp_workers_rwlock);
+
+	/* session may have been closed (and slot re-used) meanwhile */
+	if (peer->fd != fd) ret = ERR;
+	else ret = bgp_daemon_read_msg(peer, &peer->buf, fd, 0, now);
+
+	pthread_rwlock_unlock(&bgp_workers_rwlock);
+
+	if (ret != BGP_DAEMON_READ_MSG) break;
       }
     }
   }
+
+  return NULL;
+}
+
+static void bgp_daemon_workers_init(int num)
+{
+  sigset_t signal_set, old_signal_set;
+  int idx;
+
+  bgp_daemon_locks_init();
+
+  /* signals are left to the main BGP thread */
+  sigfillset(&signal_set);
+  pthread_sigmask(SIG_BLOCK, &signal_set, &old_signal_set);
+
+  for (idx = 0; idx < num; idx++) {
+    bgp_workers[idx].id = idx;
+    bgp_workers[idx].efd = epoll_create(BGP_DAEMON_WORKER_EVENTS);
+    if (bgp_workers[idx].efd < 0) {
+      Log(LOG_ERR, "ERROR ( %s/%s ): epoll_create() failed (errno: %d). Exiting ..\n", config.name, bgp_misc_db->log_str, errno);
+      exit_gracefully(1);
+    }
+
+    if (pthread_create(&bgp_workers[idx].thread, NULL, bgp_daemon_worker, &bgp_workers[idx])) {
+      Log(LOG_ERR, "ERROR ( %s/%s ): pthread_create() failed (bgp_daemon_worker). Exiting ..\n", config.name, bgp_misc_db->log_str);
+      exit_gracefully(1);
+    }
+  }
+
+  pthread_sigmask(SIG_SETMASK, &old_signal_set, NULL);
+
+  bgp_workers_num = num;
+  Log(LOG_INFO, "INFO ( %s/%s ): %d worker thread(s) initialized\n", config.name, bgp_misc_db->log_str, num);
+}
+
+static void bgp_daemon_worker_add(struct bgp_peer *peer)
+{
+  struct bgp_daemon_worker *worker = &bgp_workers[peer->idx % bgp_workers_num];
+  struct epoll_event ev;
+  int flags;
+
+  flags = fcntl(peer->fd, F_GETFL, 0);
+  fcntl(peer->fd, F_SETFL, (flags | O_NONBLOCK));
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.u64 = (((u_int64_t) peer->idx) << 32) | ((u_int32_t) peer->fd);
+
+  if (epoll_ctl(worker->efd, EPOLL_CTL_ADD, peer->fd, &ev) < 0) {
+    char bgp_peer_str[INET6_ADDRSTRLEN];
+
+    bgp_peer_print(peer, bgp_peer_str, INET6_ADDRSTRLEN);
+    Log(LOG_ERR, "ERROR ( %s/%s ): [%s] epoll_ctl() failed (errno: %d).\n", config.name, bgp_misc_db->log_str, bgp_peer_str, errno);
+    bgp_peer_close(peer, FUNC_TYPE_BGP, FALSE, FALSE, FALSE, FALSE, NULL);
+  }
 }
+#endif
 
 void bgp_prepare_thread()
 {
@@ -23,6 +23,7 @@
 #include <sys/poll.h>
 #include "bgp_prefix.h"
 #include "bgp_packet.h"
+#include "bgp_slab.h"
 #include "bgp_table.h"
 #include "bgp_logdump.h"
 
@@ -92,6 +93,14 @@
 #define BGP_DAEMON_TRUE		1
 #define BGP_DAEMON_ONLINE	1
 
+#define BGP_DAEMON_THREADS_MAX		64
+#define BGP_DAEMON_WORKER_EVENTS	64
+#define BGP_DAEMON_WORKER_BURST		16
+
+/* bgp_daemon_read_msg() return codes */
+#define BGP_DAEMON_READ_AGAIN	0
+#define BGP_DAEMON_READ_MSG	1
+
 #define BGP_MSG_EXTRA_DATA_NONE	0
 #define BGP_MSG_EXTRA_DATA_BMP	1
 
@@ -123,8 +132,15 @@ struct bgp_rt_structs {
   struct hash *ecomhash;
   struct hash *lcomhash;
   struct bgp_table *rib[AFI_MAX][SAFI_MAX];
+
+  /* set if the RIB is updated by multiple threads (bgp_daemon_threads);
+     recursive, serializes interning of attributes, AS-PATHs, etc. */
+  pthread_mutex_t *hash_mutex;
 };
 
+#define BGP_HASH_LOCK(db)	do { if ((db)->hash_mutex) pthread_mutex_lock((db)->hash_mutex); } while (0)
+#define BGP_HASH_UNLOCK(db)	do { if ((db)->hash_mutex) pthread_mutex_unlock((db)->hash_mutex); } while (0)
+
 struct bgp_peer_cache {
   struct bgp_peer *ptr;
   struct bgp_peer_cache *next;
@@ -193,6 +209,17 @@ struct bgp_peer {
   struct bgp_peer_stats stats;
   struct bgp_peer_buf buf;
   struct bgp_peer_log *log;
+  struct bgp_fib *fib[AFI_MAX];
+  struct bgp_info_retired *retired; /* see bgp_info_retire() */
+  u_int32_t retired_num;
+  u_int32_t retired_max;
+  u_int32_t retired_tagged; /* entries before this one carry an epoch */
+  u_int32_t rib_gen; /* bumped on changes to the peer paths, see bgp_lookup_cache_get() */
+
+  /* RIB memory held by the peer, see bgp_mem_report() */
+  struct bgp_slab info_slab;
+  struct bgp_slab attr_extra_slab;
+  u_int32_t routes[AFI_MAX][SAFI_MAX];
 
   /*
      bmp_peer.self.bmp_se:		pointer to struct bmp_dump_se_ll
@@ -212,8 +239,16 @@ struct bgp_msg_data {
   int is_blackhole;
 };
 
+struct bgp_daemon_worker {
+  pthread_t thread;
+  int efd;
+  int id;
+};
+
 struct bgp_misc_structs {
   struct bgp_peer_log *peers_log;
+  pthread_mutex_t *log_mutex; /* set if msglogs are written by multiple threads */
+  pthread_mutex_t *peers_mutex; /* set if peers caches are updated by multiple threads */
   u_int64_t log_seq;
   struct timeval log_tstamp;
   char log_tstamp_str[SRVBUFLEN];
@@ -238,6 +273,7 @@ struct bgp_misc_structs {
   int max_peers;
   void *peers_cache;
   void *peers_port_cache;
+  void *peers_id_cache;
   struct log_notification *peers_limit_log;
   void *xconnects;
 
@@ -365,18 +401,22 @@ struct bgp_lg_rep_gp_data {
 
 #include "bgp_msg.h"
 #include "bgp_lookup.h"
+#include "bgp_mem.h"
 #include "bgp_util.h"
+#include "bgp_fib.h"
 
 /* prototypes */
 extern void bgp_daemon_wrapper();
 extern void skinny_bgp_daemon();
 extern void skinny_bgp_daemon_online();
+extern int bgp_daemon_read_msg(struct bgp_peer *, struct bgp_peer_buf *, int, int, time_t);
 extern void bgp_prepare_thread();
 extern void bgp_prepare_daemon();
 
 /* global variables */
 extern struct bgp_peer *peers;
-extern struct bgp_peer_cache_bucket *peers_cache, *peers_port_cache;
+extern struct bgp_peer_cache_bucket *peers_cache, *peers_port_cache, *peers_id_cache;
+extern u_int32_t peers_cache_gen;
 extern char *std_comm_patterns[MAX_BGP_COMM_PATTERNS];
 extern char *ext_comm_patterns[MAX_BGP_COMM_PATTERNS];
 extern char *lrg_comm_patterns[MAX_BGP_COMM_PATTERNS];
@@ -277,6 +277,8 @@ aspath_unintern(struct bgp_peer *peer, struct aspath *aspath)
 
   if (!inter_domain_routing_db) return;
 
+  BGP_HASH_LOCK(inter_domain_routing_db);
+
   if (aspath->refcnt)
     aspath->refcnt--;
 
@@ -286,6 +288,8 @@ aspath_unintern(struct bgp_peer *peer, struct aspath *aspath)
     assert (ret != NULL);
     aspath_free (aspath);
   }
+
+  BGP_HASH_UNLOCK(inter_domain_routing_db);
 }
 
 /* Add new as segment to the as path. */
@@ -620,6 +624,7 @@ aspath_intern (struct bgp_peer *peer, struct aspath *aspath)
   assert (aspath->refcnt == 0);
 
   /* Check AS path hash. */
+  BGP_HASH_LOCK(inter_domain_routing_db);
   find = hash_get(peer, inter_domain_routing_db->ashash, aspath, hash_alloc_intern);
 
   if (find != aspath)
@@ -630,6 +635,8 @@ aspath_intern (struct bgp_peer *peer, struct aspath *aspath)
   if (! find->str)
     find->str = aspath_make_str_count (find);
 
+  BGP_HASH_UNLOCK(inter_domain_routing_db);
+
   return find;
 }
 
@@ -768,6 +775,7 @@ struct aspath *aspath_parse(struct bgp_peer *peer, char *s, size_t length, int u
   as.segments = assegments_parse(s, length, use32bit);
   
   /* If already same aspath exist then return it. */
+  BGP_HASH_LOCK(inter_domain_routing_db);
   find = hash_get (peer, inter_domain_routing_db->ashash, &as, aspath_hash_alloc);
   
   /* aspath_hash_alloc dupes segments too. that probably could be
@@ -777,9 +785,8 @@ struct aspath *aspath_parse(struct bgp_peer *peer, char *s, size_t length, int u
   if (as.str)
     free(as.str);
   
-  if (! find)
-    return NULL;
-  find->refcnt++;
+  if (find) find->refcnt++;
+  BGP_HASH_UNLOCK(inter_domain_routing_db);
 
   return find;
 }
@@ -1224,6 +1231,7 @@ aspath_parse_ast(struct bgp_peer *peer, as_t asn)
   if (!inter_domain_routing_db) return NULL;
 
   aspath = aspath_ast2aspath(asn);
+  BGP_HASH_LOCK(inter_domain_routing_db);
   find = hash_get (peer, inter_domain_routing_db->ashash, aspath, aspath_hash_alloc);
 
   /* aspath_hash_alloc dupes stuff */
@@ -1231,9 +1239,8 @@ aspath_parse_ast(struct bgp_peer *peer, as_t asn)
   if (aspath->str) free(aspath->str);
   free(aspath);
 
-  if (!find) return NULL;
-
-  find->refcnt++;
+  if (find) find->refcnt++;
+  BGP_HASH_UNLOCK(inter_domain_routing_db);
 
   return find;
 }
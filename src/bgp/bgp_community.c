@@ -341,6 +341,7 @@ community_intern (struct bgp_peer *peer, struct community *com)
   assert (com->refcnt == 0);
 
   /* Lookup community hash. */
+  BGP_HASH_LOCK(inter_domain_routing_db);
   find = (struct community *) hash_get(peer, inter_domain_routing_db->comhash, com, hash_alloc_intern);
 
   /* Arguemnt com is allocated temporary.  So when it is not used in
@@ -355,6 +356,8 @@ community_intern (struct bgp_peer *peer, struct community *com)
   if (! find->str)
     find->str = community_com2str (peer, find);
 
+  BGP_HASH_UNLOCK(inter_domain_routing_db);
+
   return find;
 }
 
@@ -372,6 +375,8 @@ community_unintern (struct bgp_peer *peer, struct community *com)
 
   if (!inter_domain_routing_db) return;
 
+  BGP_HASH_LOCK(inter_domain_routing_db);
+
   if (com->refcnt)
     com->refcnt--;
 
@@ -383,6 +388,8 @@ community_unintern (struct bgp_peer *peer, struct community *com)
 
     community_free (com);
   }
+
+  BGP_HASH_UNLOCK(inter_domain_routing_db);
 }
 
 /* Create new community attribute. */
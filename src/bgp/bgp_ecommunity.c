@@ -175,6 +175,7 @@ ecommunity_intern (struct bgp_peer *peer, struct ecommunity *ecom)
 
   assert (ecom->refcnt == 0);
 
+  BGP_HASH_LOCK(inter_domain_routing_db);
   find = (struct ecommunity *) hash_get(peer, inter_domain_routing_db->ecomhash, ecom, hash_alloc_intern);
 
   if (find != ecom)
@@ -185,6 +186,8 @@ ecommunity_intern (struct bgp_peer *peer, struct ecommunity *ecom)
   if (! find->str)
     find->str = ecommunity_ecom2str (peer, find, ECOMMUNITY_FORMAT_DISPLAY);
 
+  BGP_HASH_UNLOCK(inter_domain_routing_db);
+
   return find;
 }
 
@@ -202,6 +205,8 @@ ecommunity_unintern (struct bgp_peer *peer, struct ecommunity *ecom)
 
   if (!inter_domain_routing_db) return;
 
+  BGP_HASH_LOCK(inter_domain_routing_db);
+
   if (ecom->refcnt)
     ecom->refcnt--;
 
@@ -213,6 +218,8 @@ ecommunity_unintern (struct bgp_peer *peer, struct ecommunity *ecom)
 
     ecommunity_free(ecom);
   }
+
+  BGP_HASH_UNLOCK(inter_domain_routing_db);
 }
 
 /* Utinity function to make hash key.  */
@@ -0,0 +1,421 @@
+/*
+    pmacct (Promiscuous mode IP Accounting package)
+    pmacct is Copyright (C) 2003-2020 by Paolo Lucente
+*/
+
+/*
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/*
+  Per-peer FIB snapshot: a multibit trie of stride LPM_TRIE_STRIDE over the
+  unicast paths of each BGP peer, used to speed up flow enrichment. It is
+  maintained by the thread handling the peer: UPDATEs mark the trie nodes covering
+  the affected prefixes as dirty and, once the whole message is parsed,
+  dirty nodes are recomputed from the RIB as new read-only compressed
+  views; their ancestors get new views pointing to them, up to the root,
+  which is then published. Lookups from the collector thread take no locks;
+  the views they may still be walking are retired via bgp_mem_retire() once
+  replaced. Likewise paths deleted from the RIB are not freed until the
+  leaves pointing to them were replaced and lookups moved past the epoch,
+  see bgp_info_retire().
+*/
+
+/* includes */
+#include "pmacct.h"
+#include "bgp.h"
+#include "bgp_fib.h"
+
+/* structures */
+struct bgp_fib_paint {
+  struct bgp_peer *peer;
+  u_int32_t modulo;
+  u_int8_t minlen;
+  u_int8_t offset;
+  struct bgp_fib_leaf *leaves;
+};
+
+/* functions */
+/* loads 'addr', in network byte order, as lpm_trie.h wants it; returns the number of words */
+static int bgp_fib_addr_load(afi_t afi, const void *addr, u_int32_t *words)
+{
+  u_int32_t tmp[LPM_TRIE_MAX_WORDS];
+  int idx, num = ((afi == AFI_IP) ? 1 : 4);
+
+  memcpy(tmp, addr, (num * sizeof(u_int32_t)));
+  for (idx = 0; idx < num; idx++) words[idx] = ntohl(tmp[idx]);
+
+  return num;
+}
+
+static u_int8_t bgp_fib_maxlen(afi_t afi)
+{
+  return ((afi == AFI_IP) ? IPV4_MAX_PREFIXLEN : IPV6_MAX_PREFIXLEN);
+}
+
+static struct bgp_fib_node *bgp_fib_node_new(struct bgp_fib_node *parent, u_int8_t slot)
+{
+  struct bgp_fib_node *fn;
+
+  fn = malloc(sizeof(struct bgp_fib_node));
+  if (!fn) {
+    Log(LOG_ERR, "ERROR ( %s/core/BGP ): malloc() failed (bgp_fib_node_new). Exiting ..\n", config.name);
+    exit_gracefully(1);
+  }
+
+  memset(fn, 0, sizeof(struct bgp_fib_node));
+
+  if (parent) {
+    fn->parent = parent;
+    fn->level = (parent->level + 1);
+    fn->slot = slot;
+    memcpy(fn->base, parent->base, sizeof(fn->base));
+    lpm_trie_set_chunk(fn->base, (parent->level * LPM_TRIE_STRIDE), slot);
+  }
+
+  return fn;
+}
+
+static void bgp_fib_node_dirty(struct bgp_fib *fib, struct bgp_fib_node *fn, u_int8_t flags)
+{
+  if (fn->dirty) {
+    fn->dirty |= flags;
+    return;
+  }
+
+  fn->dirty = flags;
+  fn->dirty_next = fib->dirty[fn->level];
+  fib->dirty[fn->level] = fn;
+}
+
+static void bgp_fib_child_set(struct bgp_fib_node *fn, u_int8_t slot, struct bgp_fib_node *child)
+{
+  u_int64_t bit = (1ULL << slot);
+  int idx = lpm_trie_child_idx(fn->child_bm, slot);
+  int num = __builtin_popcountll(fn->child_bm);
+  struct bgp_fib_node **new_child;
+
+  if (child) {
+    new_child = realloc(fn->child, ((num + 1) * sizeof(struct bgp_fib_node *)));
+    if (!new_child) {
+      Log(LOG_ERR, "ERROR ( %s/core/BGP ): realloc() failed (bgp_fib_child_set). Exiting ..\n", config.name);
+      exit_gracefully(1);
+    }
+
+    fn->child = new_child;
+    memmove(&fn->child[idx + 1], &fn->child[idx], ((num - idx) * sizeof(struct bgp_fib_node *)));
+    fn->child[idx] = child;
+    fn->child_bm |= bit;
+  }
+  else {
+    memmove(&fn->child[idx], &fn->child[idx + 1], ((num - idx - 1) * sizeof(struct bgp_fib_node *)));
+    fn->child_bm &= ~bit;
+  }
+}
+
+static struct bgp_fib_node *bgp_fib_child_get(struct bgp_fib_node *fn, u_int8_t slot)
+{
+  if (!(fn->child_bm & (1ULL << slot))) return NULL;
+
+  return fn->child[lpm_trie_child_idx(fn->child_bm, slot)];
+}
+
+static void bgp_fib_paint_node(struct bgp_node *node, void *arg)
+{
+  struct bgp_fib_paint *bfp = (struct bgp_fib_paint *) arg;
+  struct bgp_info *info;
+  u_int32_t addr[LPM_TRIE_MAX_WORDS];
+  int words, span, idx;
+  u_int8_t start;
+
+  if (node->p.prefixlen < bfp->minlen) return;
+
+  /* chains are shared with peers other threads may be updating */
+  BGP_NODE_LOCK(node);
+
+  for (info = BGP_NODE_INFO(node, bfp->modulo); info; info = info->next) {
+    if (info->peer == bfp->peer) break;
+  }
+
+  BGP_NODE_UNLOCK(node);
+
+  if (!info) return;
+
+  words = bgp_fib_addr_load(((node->p.family == AF_INET) ? AFI_IP : AFI_IP6), &node->p.u.prefix, addr);
+  start = lpm_trie_span(addr, words, bfp->offset, node->p.prefixlen, &span);
+
+  /* pre-order walk: more specifics come later and paint over */
+  for (idx = start; idx < (start + span); idx++) {
+    bfp->leaves[idx].node = node;
+    bfp->leaves[idx].info = info;
+  }
+}
+
+/* Recompute the view of a node, from the RIB if its leaves are dirty, and
+   have its parent re-link it (or publish it, if root); returns FALSE if the
+   node turned out to be empty and was detached from its parent */
+static int bgp_fib_node_rebuild(struct bgp_peer *peer, struct bgp_fib *fib, struct bgp_fib_node *fn, u_int8_t dirty)
+{
+  struct bgp_misc_structs *bms = bgp_select_misc_db(peer->type);
+  struct bgp_fib_leaf leaves[LPM_TRIE_SLOTS];
+  struct bgp_fib_cnode *cn, *old_cn = fn->cnode, **cn_child;
+  struct bgp_fib_paint bfp;
+  struct prefix base;
+  u_int32_t base_addr[LPM_TRIE_MAX_WORDS];
+  u_int64_t leaf_bm;
+  int idx, num_child, num_leaf, is_empty = TRUE;
+
+  if ((dirty & BGP_FIB_DIRTY_LEAVES) || !old_cn) {
+    memset(leaves, 0, sizeof(leaves));
+    memset(&bfp, 0, sizeof(bfp));
+    memset(&base, 0, sizeof(base));
+
+    bfp.peer = peer;
+    bfp.modulo = bms->route_info_modulo(peer, NULL, bms->table_per_peer_buckets);
+    bfp.offset = (fn->level * LPM_TRIE_STRIDE);
+    bfp.minlen = (fn->level ? (bfp.offset + 1) : 0);
+    bfp.leaves = leaves;
+
+    base.family = ((fib->afi == AFI_IP) ? AF_INET : AF_INET6);
+    base.prefixlen = bfp.offset;
+    for (idx = 0; idx < LPM_TRIE_MAX_WORDS; idx++) base_addr[idx] = htonl(fn->base[idx]);
+    memcpy(&base.u.prefix, base_addr, ((fib->afi == AFI_IP) ? IPV4_MAX_BYTELEN : IPV6_MAX_BYTELEN));
+
+    bgp_table_walk_subtree(fib->rib, &base, MIN((bfp.offset + LPM_TRIE_STRIDE), bgp_fib_maxlen(fib->afi)),
+			   bgp_fib_paint_node, &bfp);
+
+    num_leaf = lpm_trie_compress(leaves, sizeof(struct bgp_fib_leaf), &leaf_bm);
+  }
+  /* re-linking children only: leaves are carried over */
+  else {
+    leaf_bm = old_cn->leaf_bm;
+    num_leaf = __builtin_popcountll(leaf_bm);
+    memcpy(leaves, old_cn->leaf, (num_leaf * sizeof(struct bgp_fib_leaf)));
+  }
+
+  for (idx = 0; idx < num_leaf; idx++) {
+    if (leaves[idx].node) is_empty = FALSE;
+  }
+
+  if (is_empty && !fn->child_bm && fn->parent) {
+    bgp_fib_child_set(fn->parent, fn->slot, NULL);
+    bgp_fib_node_dirty(fib, fn->parent, BGP_FIB_DIRTY_CHILD);
+
+    /* lookups only ever walk views */
+    if (old_cn) bgp_mem_retire(old_cn);
+    if (fn->child) free(fn->child);
+    free(fn);
+
+    return FALSE;
+  }
+
+  num_child = __builtin_popcountll(fn->child_bm);
+
+  cn = malloc(sizeof(struct bgp_fib_cnode) + (num_leaf * sizeof(struct bgp_fib_leaf)) +
+	      (num_child * sizeof(struct bgp_fib_cnode *)));
+  if (!cn) {
+    Log(LOG_ERR, "ERROR ( %s/core/BGP ): malloc() failed (bgp_fib_node_rebuild). Exiting ..\n", config.name);
+    exit_gracefully(1);
+  }
+
+  cn->child_bm = fn->child_bm;
+  cn->leaf_bm = leaf_bm;
+  memcpy(cn->leaf, leaves, (num_leaf * sizeof(struct bgp_fib_leaf)));
+
+  /* children were rebuilt first, deepest levels going first */
+  cn_child = bgp_fib_cnode_child(cn);
+  for (idx = 0; idx < num_child; idx++) cn_child[idx] = fn->child[idx]->cnode;
+
+  fn->cnode = cn;
+
+  if (fn->parent) bgp_fib_node_dirty(fib, fn->parent, BGP_FIB_DIRTY_CHILD);
+  else __atomic_store_n(&fib->cnode, cn, __ATOMIC_RELEASE);
+
+  if (old_cn) bgp_mem_retire(old_cn);
+
+  return TRUE;
+}
+
+/* Once the trie is unpublished: lookups may still be walking its views */
+static void bgp_fib_node_destroy(struct bgp_fib_node *fn)
+{
+  int idx, num_child = __builtin_popcountll(fn->child_bm);
+
+  for (idx = 0; idx < num_child; idx++) bgp_fib_node_destroy(fn->child[idx]);
+
+  if (fn->child) free(fn->child);
+  if (fn->cnode) bgp_mem_retire(fn->cnode);
+  free(fn);
+}
+
+/* Mark the trie node covering prefix 'p' for recomputation; to be called
+   by the BGP thread after a unicast path of 'peer' was added or removed */
+void bgp_fib_update(struct bgp_peer *peer, afi_t afi, safi_t safi, struct prefix *p, int is_withdraw)
+{
+  struct bgp_rt_structs *inter_domain_routing_db;
+  struct bgp_fib *fib;
+  struct bgp_fib_node *fn, *child;
+  u_int32_t addr[LPM_TRIE_MAX_WORDS];
+  u_int8_t level, target, slot;
+  int words;
+
+  if (!config.bgp_table_fib || !peer || peer->type != FUNC_TYPE_BGP) return;
+  if (safi != SAFI_UNICAST || (afi != AFI_IP && afi != AFI_IP6)) return;
+  if (peer->cap_add_paths[afi][safi]) return;
+
+  fib = peer->fib[afi];
+
+  if (!fib) {
+    if (is_withdraw) return;
+
+    inter_domain_routing_db = bgp_select_routing_db(peer->type);
+    if (!inter_domain_routing_db) return;
+
+    fib = malloc(sizeof(struct bgp_fib));
+    if (!fib) {
+      Log(LOG_ERR, "ERROR ( %s/core/BGP ): malloc() failed (bgp_fib_update). Exiting ..\n", config.name);
+      exit_gracefully(1);
+    }
+
+    memset(fib, 0, sizeof(struct bgp_fib));
+    fib->afi = afi;
+    fib->rib = inter_domain_routing_db->rib[afi][safi];
+    fib->root = bgp_fib_node_new(NULL, 0);
+
+    __atomic_store_n(&peer->fib[afi], fib, __ATOMIC_RELEASE);
+  }
+
+  words = bgp_fib_addr_load(afi, &p->u.prefix, addr);
+
+  target = (p->prefixlen ? ((p->prefixlen - 1) / LPM_TRIE_STRIDE) : 0);
+
+  for (fn = fib->root, level = 0; level < target; level++) {
+    slot = lpm_trie_get_chunk(addr, words, (level * LPM_TRIE_STRIDE));
+    child = bgp_fib_child_get(fn, slot);
+
+    if (!child) {
+      if (is_withdraw) return;
+
+      child = bgp_fib_node_new(fn, slot);
+      bgp_fib_child_set(fn, slot, child);
+      bgp_fib_node_dirty(fib, fn, BGP_FIB_DIRTY_CHILD);
+    }
+
+    fn = child;
+  }
+
+  bgp_fib_node_dirty(fib, fn, BGP_FIB_DIRTY_LEAVES);
+}
+
+/* Publish the nodes marked by bgp_fib_update(), deepest first so that the
+   parent of a node re-links its new view; the root goes last. Paths the
+   old views pointed to are then left to bgp_peer_retired_commit() */
+void bgp_fib_commit(struct bgp_peer *peer)
+{
+  struct bgp_fib *fib;
+  struct bgp_fib_node *fn;
+  u_int8_t dirty;
+  afi_t afi;
+  int level, rebuilt = FALSE;
+
+  if (!config.bgp_table_fib || !peer) return;
+
+  for (afi = AFI_IP; afi <= AFI_IP6; afi++) {
+    fib = peer->fib[afi];
+    if (!fib) continue;
+
+    for (level = (BGP_FIB_MAX_LEVELS - 1); level >= 0; level--) {
+      while ((fn = fib->dirty[level])) {
+	fib->dirty[level] = fn->dirty_next;
+	fn->dirty_next = NULL;
+	dirty = fn->dirty;
+	fn->dirty = FALSE;
+
+	bgp_fib_node_rebuild(peer, fib, fn, dirty);
+	rebuilt = TRUE;
+      }
+    }
+  }
+
+  /* lookups may have been cached off the FIB before it caught up */
+  if (rebuilt) bgp_peer_rib_gen_bump(peer);
+}
+
+/* Unpublish and release the tries of a peer whose paths are being deleted;
+   views are retired, see bgp_peer_retired_flush() for the paths */
+void bgp_fib_destroy(struct bgp_peer *peer)
+{
+  struct bgp_fib *fib;
+  afi_t afi;
+
+  if (!peer) return;
+
+  for (afi = AFI_IP; afi <= AFI_IP6; afi++) {
+    fib = peer->fib[afi];
+    if (!fib) continue;
+
+    __atomic_store_n(&peer->fib[afi], NULL, __ATOMIC_RELEASE);
+
+    bgp_fib_node_destroy(fib->root);
+    bgp_mem_retire(fib);
+  }
+}
+
+/*
+  Longest prefix match of 'addr' among the unicast paths of 'peer'. Returns
+  FALSE, leaving lookup to bgp_node_match(), if no FIB is kept for the
+  peer/afi/safi; otherwise TRUE, with results set (to NULL if no match).
+  Runs concurrently with the BGP thread, without locks.
+*/
+int bgp_fib_match(struct bgp_peer *peer, afi_t afi, safi_t safi, void *addr,
+		  struct bgp_node **result_node, struct bgp_info **result_info)
+{
+  struct bgp_fib *fib;
+  struct bgp_fib_cnode *cn;
+  struct bgp_fib_leaf *leaf;
+  struct bgp_node *matched_node = NULL;
+  struct bgp_info *matched_info = NULL;
+  u_int32_t key[LPM_TRIE_MAX_WORDS];
+  u_int8_t offset, slot;
+  int words;
+
+  if (!peer || safi != SAFI_UNICAST || (afi != AFI_IP && afi != AFI_IP6)) return FALSE;
+
+  fib = __atomic_load_n(&peer->fib[afi], __ATOMIC_ACQUIRE);
+  if (!fib) return FALSE;
+
+  words = bgp_fib_addr_load(afi, addr, key);
+
+  for (cn = __atomic_load_n(&fib->cnode, __ATOMIC_ACQUIRE), offset = 0; cn; offset += LPM_TRIE_STRIDE) {
+    slot = lpm_trie_get_chunk(key, words, offset);
+
+    leaf = &cn->leaf[lpm_trie_leaf_idx(cn->leaf_bm, slot)];
+    if (leaf->node) {
+      matched_node = leaf->node;
+      matched_info = leaf->info;
+    }
+
+    if (!(cn->child_bm & (1ULL << slot))) break;
+
+    cn = bgp_fib_cnode_child(cn)[lpm_trie_child_idx(cn->child_bm, slot)];
+  }
+
+  (*result_node) = matched_node;
+  (*result_info) = matched_info;
+
+  if (matched_node) bgp_lock_node(NULL /* XXX */, matched_node);
+
+  return TRUE;
+}
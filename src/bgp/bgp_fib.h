@@ -0,0 +1,82 @@
+/*
+    pmacct (Promiscuous mode IP Accounting package)
+    pmacct is Copyright (C) 2003-2020 by Paolo Lucente
+*/
+
+/*
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#ifndef BGP_FIB_H
+#define BGP_FIB_H
+
+/* defines */
+#define BGP_FIB_MAX_LEVELS	((IPV6_MAX_PREFIXLEN + LPM_TRIE_STRIDE - 1) / LPM_TRIE_STRIDE)
+
+/* bgp_fib_node dirty flags */
+#define BGP_FIB_DIRTY_LEAVES	0x01	/* leaves to be recomputed from the RIB */
+#define BGP_FIB_DIRTY_CHILD	0x02	/* children to be re-linked */
+
+/* structures */
+struct bgp_fib_leaf {
+  struct bgp_node *node;
+  struct bgp_info *info;
+};
+
+/* Read-only, compressed view of a trie node as seen by lookups, see
+   lpm_trie.h for the bitmaps: leaves are stored inline, followed by the
+   pointers to the views of child nodes, so that lookups dereference a
+   single pointer per level. Views are immutable: a node being recomputed
+   gets a new view, and so do its ancestors, up to the root */
+struct bgp_fib_cnode {
+  u_int64_t child_bm;
+  u_int64_t leaf_bm;
+  struct bgp_fib_leaf leaf[];
+};
+
+/* Trie node, private to the BGP thread */
+struct bgp_fib_node {
+  struct bgp_fib_cnode *cnode;
+  struct bgp_fib_node *parent;
+  struct bgp_fib_node *dirty_next;
+  struct bgp_fib_node **child;
+  u_int64_t child_bm;
+  u_int8_t level;
+  u_int8_t slot;
+  u_int8_t dirty;
+  u_int32_t base[LPM_TRIE_MAX_WORDS];
+};
+
+struct bgp_fib {
+  afi_t afi;
+  struct bgp_table *rib;
+  struct bgp_fib_cnode *cnode; /* published view of the root */
+  struct bgp_fib_node *root;
+  struct bgp_fib_node *dirty[BGP_FIB_MAX_LEVELS];
+};
+
+/* functions */
+Inline struct bgp_fib_cnode **bgp_fib_cnode_child(struct bgp_fib_cnode *cn)
+{
+  return (struct bgp_fib_cnode **) &cn->leaf[__builtin_popcountll(cn->leaf_bm)];
+}
+
+/* prototypes */
+extern void bgp_fib_update(struct bgp_peer *, afi_t, safi_t, struct prefix *, int);
+extern void bgp_fib_commit(struct bgp_peer *);
+extern void bgp_fib_destroy(struct bgp_peer *);
+extern int bgp_fib_match(struct bgp_peer *, afi_t, safi_t, void *, struct bgp_node **, struct bgp_info **);
+
+#endif //BGP_FIB_H
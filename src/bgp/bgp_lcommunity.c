@@ -172,6 +172,7 @@ lcommunity_intern (struct bgp_peer *peer, struct lcommunity *lcom)
 
   assert (lcom->refcnt == 0);
 
+  BGP_HASH_LOCK(inter_domain_routing_db);
   find = (struct lcommunity *) hash_get(peer, inter_domain_routing_db->lcomhash, lcom, hash_alloc_intern);
 
   if (find != lcom)
@@ -182,6 +183,8 @@ lcommunity_intern (struct bgp_peer *peer, struct lcommunity *lcom)
   if (! find->str)
     find->str = lcommunity_lcom2str (peer, find);
 
+  BGP_HASH_UNLOCK(inter_domain_routing_db);
+
   return find;
 }
 
@@ -199,6 +202,8 @@ lcommunity_unintern (struct bgp_peer *peer, struct lcommunity *lcom)
 
   if (!inter_domain_routing_db) return;
 
+  BGP_HASH_LOCK(inter_domain_routing_db);
+
   if (lcom->refcnt)
     lcom->refcnt--;
 
@@ -210,6 +215,8 @@ lcommunity_unintern (struct bgp_peer *peer, struct lcommunity *lcom)
 
     lcommunity_free(lcom);
   }
+
+  BGP_HASH_UNLOCK(inter_domain_routing_db);
 }
 
 /* Utinity function to make hash key.  */
@@ -87,13 +87,16 @@ void bgp_lg_daemon_worker_json(void *zh, void *zs)
   struct p_zmq_sock *sock = zs;
   struct bgp_lg_req req;
   struct bgp_lg_rep ipl_rep, gp_rep;
-  int ret;
+  int ret, mem_reader;
 
   if (!lg_host || !sock) {
     Log(LOG_ERR, "ERROR ( %s/core/lg ): bgp_lg_daemon_worker no lg_host or sock\nExiting.\n", config.name);
     exit_gracefully(1);
   }
 
+  /* replies reference RIB paths, see bgp_mem_reader_online() */
+  mem_reader = bgp_mem_reader_register();
+
   memset(&ipl_rep, 0, sizeof(ipl_rep));
   memset(&gp_rep, 0, sizeof(gp_rep));
 
@@ -111,9 +114,11 @@ void bgp_lg_daemon_worker_json(void *zh, void *zs)
         ret = bgp_lg_daemon_decode_query_ip_lookup_json(sock, req.data);
 
         bgp_lg_rep_init(&ipl_rep);
+        bgp_mem_reader_online(mem_reader);
         if (!ret) ret = bgp_lg_daemon_ip_lookup(req.data, &ipl_rep, FUNC_TYPE_BGP); 
 
         bgp_lg_daemon_encode_reply_ip_lookup_json(sock, &ipl_rep, ret);
+        bgp_mem_reader_offline(mem_reader);
       }
       break;
     case BGP_LG_QT_GET_PEERS:
@@ -53,8 +53,11 @@ int bgp_peer_log_msg(struct bgp_node *route, struct bgp_info *ri, afi_t afi, saf
   peer = ri->peer;
 
   bms = bgp_select_misc_db(peer->type);
+  if (peer->log && peer->log->bms) bms = peer->log->bms;
   if (!bms) return ERR;
 
+  if (bms->log_mutex) pthread_mutex_lock(bms->log_mutex);
+
   if (!strcmp(event_type, "dump")) etype = BGP_LOGDUMP_ET_DUMP;
   else if (!strcmp(event_type, "log")) etype = BGP_LOGDUMP_ET_LOG;
   else if (!strcmp(event_type, "lglass")) etype = BGP_LOGDUMP_ET_LG;
@@ -612,6 +615,8 @@ int bgp_peer_log_msg(struct bgp_node *route, struct bgp_info *ri, afi_t afi, saf
 #endif
   }
 
+  if (bms->log_mutex) pthread_mutex_unlock(bms->log_mutex);
+
   return (ret | amqp_ret | kafka_ret);
 }
 
@@ -627,6 +632,8 @@ int bgp_peer_log_init(struct bgp_peer *peer, int output, int type)
 
   if (!bms || !peer) return ERR;
 
+  if (bms->log_mutex) pthread_mutex_lock(bms->log_mutex);
+
   if (bms->msglog_file) {
     bgp_peer_log_dynname(log_filename, SRVBUFLEN, bms->msglog_file, peer); 
   }
@@ -860,6 +867,8 @@ int bgp_peer_log_init(struct bgp_peer *peer, int output, int type)
     }
   }
 
+  if (bms->log_mutex) pthread_mutex_unlock(bms->log_mutex);
+
   return (ret | amqp_ret | kafka_ret);
 }
 
@@ -882,6 +891,8 @@ int bgp_peer_log_close(struct bgp_peer *peer, int output, int type)
 
   if (!bms || !peer || !peer->log) return ERR;
 
+  if (bms->log_mutex) pthread_mutex_lock(bms->log_mutex);
+
 #ifdef WITH_RABBITMQ
   if (bms->msglog_amqp_routing_key) {
     p_amqp_set_routing_key(peer->log->amqp_host, peer->log->filename);
@@ -1088,6 +1099,8 @@ int bgp_peer_log_close(struct bgp_peer *peer, int output, int type)
     }
   }
 
+  if (bms->log_mutex) pthread_mutex_unlock(bms->log_mutex);
+
   return (ret | amqp_ret | kafka_ret);
 }
 
@@ -1230,6 +1243,7 @@ int bgp_peer_dump_init(struct bgp_peer *peer, int output, int type)
 #endif
 
   if (!bms || !peer || !peer->log) return ERR;
+  if (peer->log->bms) bms = peer->log->bms;
 
 #ifdef WITH_RABBITMQ
   if (bms->dump_amqp_routing_key) {
@@ -1437,6 +1451,7 @@ int bgp_peer_dump_close(struct bgp_peer *peer, struct bgp_dump_stats *bds, int o
 #endif
 
   if (!bms || !peer || !peer->log) return ERR;
+  if (peer->log->bms) bms = peer->log->bms;
 
 #ifdef WITH_RABBITMQ
   if (bms->dump_amqp_routing_key) {
@@ -1469,6 +1484,8 @@ int bgp_peer_dump_close(struct bgp_peer *peer, struct bgp_dump_stats *bds, int o
       json_object_set_new_nocheck(obj, "entries", json_integer((json_int_t)bds->entries));
 
       json_object_set_new_nocheck(obj, "tables", json_integer((json_int_t)bds->tables));
+
+      json_object_set_new_nocheck(obj, "duration_ms", json_integer((json_int_t)bds->duration_ms));
     }
 
     json_object_set_new_nocheck(obj, "seq", json_integer((json_int_t) bgp_peer_log_seq_get(&bms->log_seq)));
@@ -1546,6 +1563,10 @@ int bgp_peer_dump_close(struct bgp_peer *peer, struct bgp_dump_stats *bds, int o
       pm_avro_check(avro_value_get_by_name(&p_avro_obj, "tables", &p_avro_field, NULL));
       pm_avro_check(avro_value_set_branch(&p_avro_field, TRUE, &p_avro_branch));
       pm_avro_check(avro_value_set_int(&p_avro_branch, bds->tables)); 
+
+      pm_avro_check(avro_value_get_by_name(&p_avro_obj, "duration_ms", &p_avro_field, NULL));
+      pm_avro_check(avro_value_set_branch(&p_avro_field, TRUE, &p_avro_branch));
+      pm_avro_check(avro_value_set_int(&p_avro_branch, bds->duration_ms));
     }
     else {
       pm_avro_check(avro_value_get_by_name(&p_avro_obj, "entries", &p_avro_field, NULL));
@@ -1553,6 +1574,9 @@ int bgp_peer_dump_close(struct bgp_peer *peer, struct bgp_dump_stats *bds, int o
 
       pm_avro_check(avro_value_get_by_name(&p_avro_obj, "tables", &p_avro_field, NULL));
       pm_avro_check(avro_value_set_branch(&p_avro_field, FALSE, &p_avro_branch));
+
+      pm_avro_check(avro_value_get_by_name(&p_avro_obj, "duration_ms", &p_avro_field, NULL));
+      pm_avro_check(avro_value_set_branch(&p_avro_field, FALSE, &p_avro_branch));
     }
 
     pm_avro_check(avro_value_get_by_name(&p_avro_obj, "writer_id", &p_avro_field, NULL));
@@ -1642,10 +1666,619 @@ int bgp_peer_dump_close(struct bgp_peer *peer, struct bgp_dump_stats *bds, int o
   return (ret | amqp_ret | kafka_ret);
 }
 
+/* table dump writer threads, see bgp_table_dump_workers */
+static struct bgp_dump_writer bgp_dump_writers[BGP_TABLE_DUMP_WORKERS_MAX];
+static struct bgp_dump_peer *bgp_dump_peers;
+static struct bgp_peer *bgp_dump_peers_copy;
+static int bgp_dump_peers_num, bgp_dump_writers_num;
+static int bgp_dump_writers_pending, bgp_dump_writers_active;
+static u_int64_t bgp_dump_entries;
+static u_int32_t bgp_dump_tables;
+static time_t bgp_dump_start;
+
+static int bgp_table_dump_backends_init(struct bgp_misc_structs *bms)
+{
+  int ret = 0;
+
+#ifdef WITH_RABBITMQ
+  if (config.bgp_table_dump_amqp_routing_key) {
+    bgp_table_dump_init_amqp_host();
+    ret = p_amqp_connect_to_publish(&bgp_table_dump_amqp_host);
+    if (ret) return ret;
+  }
+#endif
+
+#ifdef WITH_KAFKA
+  if (config.bgp_table_dump_kafka_topic) {
+    ret = bgp_table_dump_init_kafka_host();
+    if (ret) return ret;
+  }
+#endif
+
+#ifdef WITH_SERDES
+  if (config.bgp_table_dump_kafka_avro_schema_registry) { 
+    if (strchr(config.bgp_table_dump_kafka_topic, '$')) {
+      Log(LOG_ERR, "ERROR ( %s/%s ): dynamic 'bgp_table_dump_kafka_topic' is not compatible with 'bgp_table_dump_kafka_avro_schema_registry'. Exiting.\n",
+	  config.name, bms->log_str);
+      return 1;
+    }
+
+    bgp_table_dump_kafka_host.sd_schema[0] = compose_avro_schema_registry_name_2(config.bgp_table_dump_kafka_topic, FALSE,
+										 bms->dump_avro_schema[0],
+										 "bgp", "dump",
+										 config.bgp_table_dump_kafka_avro_schema_registry);
+
+    bgp_table_dump_kafka_host.sd_schema[BGP_LOG_TYPE_DUMPINIT] = compose_avro_schema_registry_name_2(config.bgp_table_dump_kafka_topic, FALSE,
+										 bms->dump_avro_schema[BGP_LOG_TYPE_DUMPINIT],
+										 "bgp", "dumpinit",
+										 config.bgp_table_dump_kafka_avro_schema_registry);
+
+    bgp_table_dump_kafka_host.sd_schema[BGP_LOG_TYPE_DUMPCLOSE] = compose_avro_schema_registry_name_2(config.bgp_table_dump_kafka_topic, FALSE,
+										 bms->dump_avro_schema[BGP_LOG_TYPE_DUMPCLOSE],
+										 "bgp", "dumpclose",
+										 config.bgp_table_dump_kafka_avro_schema_registry);
+  }
+#endif
+
+  return ret;
+}
+
+static void bgp_table_dump_backends_close()
+{
+#ifdef WITH_RABBITMQ
+  if (config.bgp_table_dump_amqp_routing_key)
+    p_amqp_close(&bgp_table_dump_amqp_host, FALSE);
+#endif
+
+#ifdef WITH_KAFKA
+  if (config.bgp_table_dump_kafka_topic)
+    p_kafka_close(&bgp_table_dump_kafka_host, FALSE);
+#endif
+}
+
+/* points peer->log to the output of the peer: current_filename is composed
+   and, if it differs from last_filename, the file of saved_peer is closed
+   and a new one opened */
+static void bgp_table_dump_peer_open(struct bgp_misc_structs *bms, struct bgp_peer *peer, struct bgp_peer *saved_peer,
+				     char *current_filename, char *last_filename, char *fd_buf)
+{
+  char latest_filename[SRVBUFLEN], tmpbuf[SRVBUFLEN];
+
+  if (config.bgp_table_dump_file) {
+    bgp_peer_log_dynname(current_filename, SRVBUFLEN, config.bgp_table_dump_file, peer);
+  }
+
+  if (config.bgp_table_dump_amqp_routing_key) {
+    bgp_peer_log_dynname(current_filename, SRVBUFLEN, config.bgp_table_dump_amqp_routing_key, peer);
+  }
+
+  if (config.bgp_table_dump_kafka_topic) {
+    bgp_peer_log_dynname(current_filename, SRVBUFLEN, config.bgp_table_dump_kafka_topic, peer);
+  }
+
+  pm_strftime_same(current_filename, SRVBUFLEN, tmpbuf, &bms->dump.tstamp.tv_sec, config.timestamps_utc);
+
+  /*
+     we close last_filename and open current_filename in case they differ;
+     we are safe with this approach until time and BGP peer (IP, port) are
+     the only variables supported as part of bgp_table_dump_file.
+  */
+  if (config.bgp_table_dump_file) {
+    if (strcmp(last_filename, current_filename)) {
+      if (saved_peer && saved_peer->log && strlen(last_filename)) {
+	close_output_file(saved_peer->log->fd);
+
+	if (config.bgp_table_dump_latest_file) {
+	  bgp_peer_log_dynname(latest_filename, SRVBUFLEN, config.bgp_table_dump_latest_file, saved_peer);
+	  link_latest_output_file(latest_filename, last_filename);
+	}
+      }
+      peer->log->fd = open_output_file(current_filename, "w", TRUE);
+      if (fd_buf) {
+	if (setvbuf(peer->log->fd, fd_buf, _IOFBF, OUTPUT_FILE_BUFSZ))
+	  Log(LOG_WARNING, "WARN ( %s/%s ): [%s] setvbuf() failed: %s\n",
+	      config.name, bms->log_str, current_filename, strerror(errno));
+	else memset(fd_buf, 0, OUTPUT_FILE_BUFSZ); 
+      }
+    }
+  }
+
+  /*
+     a bit pedantic maybe but should come at little cost and emulating
+     bgp_table_dump_file behaviour will work
+  */ 
+#ifdef WITH_RABBITMQ
+  if (config.bgp_table_dump_amqp_routing_key) {
+    peer->log->amqp_host = &bgp_table_dump_amqp_host;
+    strcpy(peer->log->filename, current_filename);
+  }
+#endif
+
+#ifdef WITH_KAFKA
+  if (config.bgp_table_dump_kafka_topic) {
+    peer->log->kafka_host = &bgp_table_dump_kafka_host;
+    strcpy(peer->log->filename, current_filename);
+  }
+#endif
+}
+
+static u_int32_t bgp_table_dump_duration_ms(struct timeval *start)
+{
+  struct timeval now;
+
+  gettimeofday(&now, NULL);
+
+  return (((now.tv_sec - start->tv_sec) * 1000) + ((now.tv_usec - start->tv_usec) / 1000));
+}
+
+static void bgp_table_dump_writer_add(struct bgp_dump_writer *writer, struct bgp_node *node, struct bgp_info *ri, struct bgp_peer *peer)
+{
+  struct bgp_dump_entry *entry;
+
+  if (writer->batch_num == writer->batch_max) {
+    writer->batch_max += BGP_TABLE_DUMP_BATCH;
+    writer->batch = realloc(writer->batch, (writer->batch_max * sizeof(struct bgp_dump_entry)));
+    if (!writer->batch) {
+      Log(LOG_ERR, "ERROR ( %s/%s ): realloc() failed (bgp_table_dump_writer_add). Exiting ..\n", config.name, writer->bms->log_str);
+      exit_gracefully(1);
+    }
+  }
+
+  entry = &writer->batch[writer->batch_num];
+  writer->batch_num++;
+
+  memset(entry, 0, sizeof(struct bgp_dump_entry));
+  memcpy(&entry->node.p, &node->p, sizeof(struct prefix));
+  entry->ri.peer = peer;
+
+  /* pinned, the route may be replaced or withdrawn before being written out */
+  if (ri->attr) entry->ri.attr = bgp_attr_intern(peer, ri->attr);
+
+  if (ri->attr_extra) {
+    memcpy(&entry->attr_extra, ri->attr_extra, sizeof(struct bgp_attr_extra));
+    entry->ri.attr_extra = &entry->attr_extra;
+  }
+}
+
+static u_int32_t bgp_table_dump_writer_flush(struct bgp_dump_writer *writer, afi_t afi, safi_t safi)
+{
+  char event_type[] = "dump";
+  struct bgp_dump_entry *entry;
+  u_int32_t idx, entries;
+
+  for (idx = 0; idx < writer->batch_num; idx++) {
+    entry = &writer->batch[idx];
+
+    /* batch may have been moved by realloc() after the entry was taken */
+    if (entry->ri.attr_extra) entry->ri.attr_extra = &entry->attr_extra;
+
+    bgp_peer_log_msg(&entry->node, &entry->ri, afi, safi, event_type, config.bgp_table_dump_output, NULL, BGP_LOG_TYPE_MISC);
+    if (entry->ri.attr) bgp_attr_unintern(entry->ri.peer, entry->ri.attr);
+  }
+
+  entries = writer->batch_num;
+  writer->batch_num = 0;
+
+  return entries;
+}
+
+/* Walks the RIBs for the routes of a peer: these are copied in batches,
+   each node locked in turn while its paths are copied, and then written
+   out with nothing locked, so that BGP sessions keep being served while
+   the dump is in progress */
+static int bgp_table_dump_path_cmp(struct bgp_info *ri, rd_t *rd, path_id_t path_id)
+{
+  rd_t ri_rd;
+  path_id_t ri_path_id = 0;
+  int ret;
+
+  memset(&ri_rd, 0, sizeof(rd_t));
+
+  if (ri->attr_extra) {
+    memcpy(&ri_rd, &ri->attr_extra->rd, sizeof(rd_t));
+    ri_path_id = ri->attr_extra->path_id;
+  }
+
+  if ((ret = memcmp(&ri_rd, rd, sizeof(rd_t)))) return ret;
+
+  return ((ri_path_id > path_id) - (ri_path_id < path_id));
+}
+
+static int bgp_table_dump_path_qsort_cmp(const void *a, const void *b)
+{
+  struct bgp_info *ri_b = *(struct bgp_info **) b;
+  rd_t rd;
+  path_id_t path_id = 0;
+
+  memset(&rd, 0, sizeof(rd_t));
+
+  if (ri_b->attr_extra) {
+    memcpy(&rd, &ri_b->attr_extra->rd, sizeof(rd_t));
+    path_id = ri_b->attr_extra->path_id;
+  }
+
+  return bgp_table_dump_path_cmp(*(struct bgp_info **) a, &rd, path_id);
+}
+
+/* To be called with the node locked: adds the paths of the dumped peer at
+   the node, past the cursor if resuming in the middle of it. If they do not
+   fit in what is left of the batch, as many as fit are added, in RD and
+   path-id order, and the cursor is set past the last one: returns TRUE */
+static int bgp_table_dump_writer_node(struct bgp_dump_writer *writer, struct bgp_dump_peer *dp, struct bgp_node *node,
+				      u_int32_t modulo, struct bgp_dump_cursor *cursor)
+{
+  struct bgp_misc_structs *bms = writer->bms;
+  struct bgp_info *ri;
+  u_int32_t peer_buckets, paths_num = 0, room, idx;
+
+  for (peer_buckets = 0; peer_buckets < bms->table_per_peer_buckets; peer_buckets++) {
+    for (ri = BGP_NODE_INFO(node, (modulo+peer_buckets)); ri; ri = ri->next) {
+      if (ri->peer != dp->live) continue;
+      if (cursor->mid_node && bgp_table_dump_path_cmp(ri, &cursor->rd, cursor->path_id) <= 0) continue;
+
+      if (paths_num == writer->paths_max) {
+	writer->paths_max = (writer->paths_max ? (writer->paths_max * 2) : BGP_TABLE_DUMP_BATCH);
+	writer->paths = realloc(writer->paths, (writer->paths_max * sizeof(struct bgp_info *)));
+	if (!writer->paths) {
+	  Log(LOG_ERR, "ERROR ( %s/%s ): realloc() failed (bgp_table_dump_writer_node). Exiting ..\n", config.name, bms->log_str);
+	  exit_gracefully(1);
+	}
+      }
+
+      writer->paths[paths_num] = ri;
+      paths_num++;
+    }
+  }
+
+  /* never full here: the walk flushes as soon as the batch fills up */
+  room = (BGP_TABLE_DUMP_BATCH - writer->batch_num);
+
+  if (paths_num <= room) {
+    for (idx = 0; idx < paths_num; idx++) bgp_table_dump_writer_add(writer, node, writer->paths[idx], dp->peer);
+    cursor->mid_node = FALSE;
+
+    return FALSE;
+  }
+
+  qsort(writer->paths, paths_num, sizeof(struct bgp_info *), bgp_table_dump_path_qsort_cmp);
+
+  for (idx = 0; idx < room; idx++) bgp_table_dump_writer_add(writer, node, writer->paths[idx], dp->peer);
+
+  ri = writer->paths[room - 1];
+  memcpy(&cursor->p, &node->p, sizeof(struct prefix));
+  memset(&cursor->rd, 0, sizeof(rd_t));
+  cursor->path_id = 0;
+
+  if (ri->attr_extra) {
+    memcpy(&cursor->rd, &ri->attr_extra->rd, sizeof(rd_t));
+    cursor->path_id = ri->attr_extra->path_id;
+  }
+
+  cursor->mid_node = TRUE;
+
+  return TRUE;
+}
+
+/* Walks the tables holding no lock but the one of the node being copied.
+   Every BGP_TABLE_DUMP_YIELD nodes, or as soon as the batch is full, the
+   node is let go, the batch written out and the walk resumed off the cursor:
+   the node may have been deleted meanwhile, in which case the walk carries
+   on from the node that follows it */
+static u_int64_t bgp_table_dump_writer_walk(struct bgp_dump_writer *writer, struct bgp_dump_peer *dp)
+{
+  struct bgp_misc_structs *bms = writer->bms;
+  struct bgp_rt_structs *inter_domain_routing_db = bgp_select_routing_db(FUNC_TYPE_BGP);
+  struct bgp_peer *peer = dp->peer;
+  struct bgp_dump_cursor cursor;
+  struct bgp_table *table;
+  struct bgp_node *node;
+  u_int32_t modulo, walked = 0;
+  u_int64_t dump_elems = 0, nodes = 0;
+  int peer_gone = FALSE, more;
+  afi_t afi;
+  safi_t safi;
+
+  if (!inter_domain_routing_db) return dump_elems;
+
+  modulo = bgp_route_info_modulo(peer, NULL, bms->table_per_peer_buckets);
+
+  for (afi = AFI_IP; afi < AFI_MAX && !peer_gone; afi++) {
+    for (safi = SAFI_UNICAST; safi < SAFI_MAX && !peer_gone; safi++) {
+      table = inter_domain_routing_db->rib[afi][safi];
+      if (!table) continue;
+
+      memset(&cursor, 0, sizeof(cursor));
+      node = bgp_table_top(peer, table);
+
+      while (node) {
+	BGP_NODE_LOCK(node);
+	more = bgp_table_dump_writer_node(writer, dp, node, modulo, &cursor);
+	BGP_NODE_UNLOCK(node);
+
+	if (!more) {
+	  nodes++;
+	  walked++;
+	}
+
+	if (!more && walked < BGP_TABLE_DUMP_YIELD && writer->batch_num < BGP_TABLE_DUMP_BATCH) {
+	  node = bgp_route_next(peer, node);
+	  continue;
+	}
+
+	if (!more) memcpy(&cursor.p, &node->p, sizeof(struct prefix));
+
+	bgp_unlock_node(peer, node);
+	dump_elems += bgp_table_dump_writer_flush(writer, afi, safi);
+	walked = 0;
+
+	__atomic_store_n(&dp->nodes, nodes, __ATOMIC_RELAXED);
+	__atomic_store_n(&dp->entries, dump_elems, __ATOMIC_RELAXED);
+
+	/* session closed meanwhile, its slot may be already re-used */
+	if (dp->live->fd != dp->fd) {
+	  peer_gone = TRUE;
+	  break;
+	}
+
+	node = bgp_table_seek(peer, table, &cursor.p);
+
+	if (node && !prefix_cmp(&node->p, &cursor.p)) {
+	  if (!cursor.mid_node) node = bgp_route_next(peer, node);
+	}
+	/* gone meanwhile, along with its paths left to write out */
+	else if (cursor.mid_node) {
+	  cursor.mid_node = FALSE;
+	  nodes++;
+	}
+      }
+
+      dump_elems += bgp_table_dump_writer_flush(writer, afi, safi);
+    }
+  }
+
+  __atomic_store_n(&dp->nodes, nodes, __ATOMIC_RELAXED);
+  __atomic_store_n(&dp->entries, dump_elems, __ATOMIC_RELAXED);
+  __atomic_store_n(&dp->done, TRUE, __ATOMIC_RELEASE);
+
+  return dump_elems;
+}
+
+static void *bgp_table_dump_writer(void *arg)
+{
+  struct bgp_dump_writer *writer = arg;
+  struct bgp_misc_structs *bms = writer->bms;
+  char current_filename[SRVBUFLEN], last_filename[SRVBUFLEN];
+  char *fd_buf = NULL;
+  struct bgp_peer *peer = NULL, *saved_peer = NULL;
+  struct bgp_dump_peer *dp;
+  struct bgp_dump_stats bds;
+  struct timeval peer_start;
+  u_int64_t dump_elems, writer_elems = 0;
+  int peers_idx, tables_num = 0;
+
+  memset(last_filename, 0, sizeof(last_filename));
+  memset(current_filename, 0, sizeof(current_filename));
+  memset(&bds, 0, sizeof(struct bgp_dump_stats));
+
+  fd_buf = malloc(OUTPUT_FILE_BUFSZ);
+
+  if (bgp_table_dump_backends_init(bms)) {
+    Log(LOG_ERR, "ERROR ( %s/%s ): dump writer #%d: unable to initialize backends. Skipping.\n", config.name, bms->log_str, writer->id);
+  }
+  else {
+    for (peers_idx = writer->id; peers_idx < bgp_dump_peers_num; peers_idx += bgp_dump_writers_num) {
+      dp = &bgp_dump_peers[peers_idx];
+      peer = dp->peer;
+      peer->log = &writer->peer_log;
+
+      bgp_table_dump_peer_open(bms, peer, saved_peer, current_filename, last_filename, fd_buf);
+
+      gettimeofday(&peer_start, NULL);
+      bgp_peer_dump_init(peer, config.bgp_table_dump_output, FUNC_TYPE_BGP);
+      dump_elems = bgp_table_dump_writer_walk(writer, dp);
+
+      saved_peer = peer;
+      tables_num++;
+      writer_elems += dump_elems;
+
+      strlcpy(last_filename, current_filename, SRVBUFLEN);
+      bds.entries = dump_elems;
+      bds.tables = tables_num;
+      bds.duration_ms = bgp_table_dump_duration_ms(&peer_start);
+      bgp_peer_dump_close(peer, &bds, config.bgp_table_dump_output, FUNC_TYPE_BGP);
+    }
+
+    bgp_table_dump_backends_close();
+  }
+
+  if (config.bgp_table_dump_file && writer->peer_log.fd) close_output_file(writer->peer_log.fd);
+
+  /* linking bgp_table_dump_latest_file is left to bgp_table_dump_writers_reap() */
+  strlcpy(writer->last_filename, last_filename, SRVBUFLEN);
+  writer->last_peer = peer;
+
+  if (fd_buf) free(fd_buf);
+  if (writer->batch) free(writer->batch);
+  writer->batch = NULL;
+  writer->batch_max = 0;
+  if (writer->paths) free(writer->paths);
+  writer->paths = NULL;
+  writer->paths_max = 0;
+
+  __atomic_add_fetch(&bgp_dump_entries, writer_elems, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&bgp_dump_tables, tables_num, __ATOMIC_RELAXED);
+  __atomic_sub_fetch(&bgp_dump_writers_pending, 1, __ATOMIC_RELEASE);
+
+  return NULL;
+}
+
+int bgp_table_dump_writers_running()
+{
+  return bgp_dump_writers_active;
+}
+
+/* To be called by the BGP thread: once all writers are done, they are
+   joined and bgp_table_dump_latest_file is linked, just once, to the file
+   of the last peer dumped, as the forked dump would do */
+void bgp_table_dump_writers_reap()
+{
+  struct bgp_misc_structs *bms;
+  struct bgp_dump_writer *writer;
+  char latest_filename[SRVBUFLEN];
+  int idx;
+
+  if (!bgp_dump_writers_active || __atomic_load_n(&bgp_dump_writers_pending, __ATOMIC_ACQUIRE))
+    return;
+
+  for (idx = 0; idx < bgp_dump_writers_num; idx++)
+    pthread_join(bgp_dump_writers[idx].thread, NULL);
+
+  bms = bgp_select_misc_db(FUNC_TYPE_BGP);
+
+  if (config.bgp_table_dump_latest_file && bgp_dump_peers_num) {
+    writer = &bgp_dump_writers[(bgp_dump_peers_num - 1) % bgp_dump_writers_num];
+
+    if (writer->last_peer) {
+      bgp_peer_log_dynname(latest_filename, SRVBUFLEN, config.bgp_table_dump_latest_file, writer->last_peer);
+      link_latest_output_file(latest_filename, writer->last_filename);
+    }
+  }
+
+  Log(LOG_INFO, "INFO ( %s/%s ): *** Dumping BGP tables - END (WRITERS: %u TABLES: %u ENTRIES: %" PRIu64 " ET: %u) ***\n",
+      config.name, bms->log_str, bgp_dump_writers_num, bgp_dump_tables, bgp_dump_entries, (u_int32_t)(time(NULL) - bgp_dump_start));
+
+  bgp_dump_writers_active = FALSE;
+}
+
+static void bgp_table_dump_writers_free()
+{
+  int idx;
+
+  for (idx = 0; idx < bgp_dump_writers_num; idx++) {
+    if (bgp_dump_writers[idx].bms) {
+      if (bgp_dump_writers[idx].bms->avro_buf) free(bgp_dump_writers[idx].bms->avro_buf);
+      free(bgp_dump_writers[idx].bms);
+      bgp_dump_writers[idx].bms = NULL;
+    }
+  }
+
+  if (bgp_dump_peers) free(bgp_dump_peers);
+  if (bgp_dump_peers_copy) free(bgp_dump_peers_copy);
+  bgp_dump_peers = NULL;
+  bgp_dump_peers_copy = NULL;
+  bgp_dump_peers_num = 0;
+}
+
+/* Fork-free dump: peers are copied here (with the BGP worker threads
+   stopped, see bgp_daemon_threads) and shared round-robin among the
+   writer threads; each writer owns its misc structs, ie. log sequence
+   and Avro buffer, and its output files */
+static void bgp_table_dump_writers_start(struct bgp_misc_structs *bms, u_int64_t dump_seqno)
+{
+  sigset_t signal_set, old_signal_set;
+  pthread_attr_t attr;
+  struct bgp_dump_writer *writer;
+  int peers_idx, idx;
+
+  if (bgp_dump_writers_active) {
+    Log(LOG_WARNING, "WARN ( %s/%s ): *** Dumping BGP tables - previous dump still in progress. Skipping ***\n", config.name, bms->log_str);
+
+    for (peers_idx = 0; peers_idx < bgp_dump_peers_num; peers_idx++) {
+      struct bgp_dump_peer *dp = &bgp_dump_peers[peers_idx];
+
+      if (__atomic_load_n(&dp->done, __ATOMIC_ACQUIRE)) continue;
+
+      Log(LOG_INFO, "INFO ( %s/%s ): *** Dumping BGP tables - [%s] in progress (NODES: %" PRIu64 " ENTRIES: %" PRIu64 ") ***\n",
+	  config.name, bms->log_str, dp->peer->addr_str, __atomic_load_n(&dp->nodes, __ATOMIC_RELAXED),
+	  __atomic_load_n(&dp->entries, __ATOMIC_RELAXED));
+    }
+
+    return;
+  }
+
+  bgp_table_dump_writers_free();
+
+  bgp_dump_peers = malloc(config.bgp_daemon_max_peers * sizeof(struct bgp_dump_peer));
+  bgp_dump_peers_copy = malloc(config.bgp_daemon_max_peers * sizeof(struct bgp_peer));
+  if (!bgp_dump_peers || !bgp_dump_peers_copy) {
+    Log(LOG_ERR, "ERROR ( %s/%s ): malloc() failed (bgp_table_dump_writers_start). Exiting ..\n", config.name, bms->log_str);
+    exit_gracefully(1);
+  }
+
+  for (peers_idx = 0; peers_idx < config.bgp_daemon_max_peers; peers_idx++) {
+    if (peers[peers_idx].fd) {
+      struct bgp_dump_peer *dp = &bgp_dump_peers[bgp_dump_peers_num];
+
+      dp->live = &peers[peers_idx];
+      dp->fd = peers[peers_idx].fd;
+      dp->nodes = 0;
+      dp->entries = 0;
+      dp->done = FALSE;
+      dp->peer = &bgp_dump_peers_copy[bgp_dump_peers_num];
+      memcpy(dp->peer, &peers[peers_idx], sizeof(struct bgp_peer));
+      dp->peer->log = NULL;
+
+      bgp_dump_peers_num++;
+    }
+  }
+
+  /* no idle writers */
+  bgp_dump_writers_num = MIN(config.bgp_table_dump_workers, MAX(bgp_dump_peers_num, 1));
+  bgp_dump_writers_pending = bgp_dump_writers_num;
+  bgp_dump_writers_active = TRUE;
+  bgp_dump_entries = 0;
+  bgp_dump_tables = 0;
+  bgp_dump_start = time(NULL);
+
+  Log(LOG_INFO, "INFO ( %s/%s ): *** Dumping BGP tables - START (WRITERS: %u) ***\n", config.name, bms->log_str, bgp_dump_writers_num);
+
+  /* signals are left to the main BGP thread */
+  sigfillset(&signal_set);
+  pthread_sigmask(SIG_BLOCK, &signal_set, &old_signal_set);
+
+  pthread_attr_init(&attr);
+
+  for (idx = 0; idx < bgp_dump_writers_num; idx++) {
+    writer = &bgp_dump_writers[idx];
+    memset(writer, 0, sizeof(struct bgp_dump_writer));
+    writer->id = idx;
+
+    writer->bms = malloc(sizeof(struct bgp_misc_structs));
+    if (!writer->bms) {
+      Log(LOG_ERR, "ERROR ( %s/%s ): malloc() failed (bgp_table_dump_writers_start). Exiting ..\n", config.name, bms->log_str);
+      exit_gracefully(1);
+    }
+
+    memcpy(writer->bms, bms, sizeof(struct bgp_misc_structs));
+    writer->bms->log_mutex = NULL;
+    writer->bms->peers_mutex = NULL;
+    bgp_peer_log_seq_set(&writer->bms->log_seq, dump_seqno);
+
+    if (bms->avro_buf) {
+      writer->bms->avro_buf = malloc(LARGEBUFLEN);
+      if (!writer->bms->avro_buf) {
+	Log(LOG_ERR, "ERROR ( %s/%s ): malloc() failed (avro_buf). Exiting ..\n", config.name, bms->log_str);
+	exit_gracefully(1);
+      }
+      else memset(writer->bms->avro_buf, 0, LARGEBUFLEN);
+    }
+
+    writer->peer_log.bms = writer->bms;
+
+    if (pthread_create(&writer->thread, &attr, bgp_table_dump_writer, writer)) {
+      Log(LOG_ERR, "ERROR ( %s/%s ): pthread_create() failed (bgp_table_dump_writer). Exiting ..\n", config.name, bms->log_str);
+      exit_gracefully(1);
+    }
+  }
+
+  pthread_attr_destroy(&attr);
+  pthread_sigmask(SIG_SETMASK, &old_signal_set, NULL);
+}
+
 void bgp_handle_dump_event()
 {
   struct bgp_misc_structs *bms = bgp_select_misc_db(FUNC_TYPE_BGP);
-  char current_filename[SRVBUFLEN], last_filename[SRVBUFLEN], tmpbuf[SRVBUFLEN];
+  char current_filename[SRVBUFLEN], last_filename[SRVBUFLEN];
   char latest_filename[SRVBUFLEN], event_type[] = "dump", *fd_buf = NULL;
   int ret, peers_idx, duration, tables_num; 
   struct bgp_rt_structs *inter_domain_routing_db;
@@ -1654,6 +2287,7 @@ void bgp_handle_dump_event()
   struct bgp_node *node;
   struct bgp_peer_log peer_log;
   struct bgp_dump_stats bds;
+  struct timeval peer_start;
   afi_t afi;
   safi_t safi;
   pid_t dumper_pid;
@@ -1668,6 +2302,11 @@ void bgp_handle_dump_event()
   dump_seqno = bgp_peer_log_seq_get(&bms->log_seq);
   bgp_peer_log_seq_increment(&bms->log_seq);
 
+  if (config.bgp_table_dump_workers) {
+    bgp_table_dump_writers_start(bms, dump_seqno);
+    return;
+  }
+
   switch (ret = fork()) {
   case 0: /* Child */
     /* we have to ignore signals to avoid loops: because we are already forked */
@@ -1684,113 +2323,22 @@ void bgp_handle_dump_event()
     fd_buf = malloc(OUTPUT_FILE_BUFSZ);
     bgp_peer_log_seq_set(&bms->log_seq, dump_seqno);
 
-#ifdef WITH_RABBITMQ
-    if (config.bgp_table_dump_amqp_routing_key) {
-      bgp_table_dump_init_amqp_host();
-      ret = p_amqp_connect_to_publish(&bgp_table_dump_amqp_host);
-      if (ret) exit_gracefully(ret);
-    }
-#endif
-
-#ifdef WITH_KAFKA
-    if (config.bgp_table_dump_kafka_topic) {
-      ret = bgp_table_dump_init_kafka_host();
-      if (ret) exit_gracefully(ret);
-    }
-#endif
+    ret = bgp_table_dump_backends_init(bms);
+    if (ret) exit_gracefully(ret);
 
     dumper_pid = getpid();
     Log(LOG_INFO, "INFO ( %s/%s ): *** Dumping BGP tables - START (PID: %u) ***\n", config.name, bms->log_str, dumper_pid);
     start = time(NULL);
     tables_num = 0;
 
-#ifdef WITH_SERDES
-    if (config.bgp_table_dump_kafka_avro_schema_registry) { 
-      if (strchr(config.bgp_table_dump_kafka_topic, '$')) {
-        Log(LOG_ERR, "ERROR ( %s/%s ): dynamic 'bgp_table_dump_kafka_topic' is not compatible with 'bgp_table_dump_kafka_avro_schema_registry'. Exiting.\n",
-	    config.name, bms->log_str);
-	exit_gracefully(1);
-      }
-
-      bgp_table_dump_kafka_host.sd_schema[0] = compose_avro_schema_registry_name_2(config.bgp_table_dump_kafka_topic, FALSE,
-										   bms->dump_avro_schema[0],
-										   "bgp", "dump",
-										   config.bgp_table_dump_kafka_avro_schema_registry);
-
-      bgp_table_dump_kafka_host.sd_schema[BGP_LOG_TYPE_DUMPINIT] = compose_avro_schema_registry_name_2(config.bgp_table_dump_kafka_topic, FALSE,
-										   bms->dump_avro_schema[BGP_LOG_TYPE_DUMPINIT],
-										   "bgp", "dumpinit",
-										   config.bgp_table_dump_kafka_avro_schema_registry);
-
-      bgp_table_dump_kafka_host.sd_schema[BGP_LOG_TYPE_DUMPCLOSE] = compose_avro_schema_registry_name_2(config.bgp_table_dump_kafka_topic, FALSE,
-										   bms->dump_avro_schema[BGP_LOG_TYPE_DUMPCLOSE],
-										   "bgp", "dumpclose",
-										   config.bgp_table_dump_kafka_avro_schema_registry);
-    }
-#endif
-
     for (peer = NULL, saved_peer = NULL, peers_idx = 0; peers_idx < config.bgp_daemon_max_peers; peers_idx++) {
       if (peers[peers_idx].fd) {
         peer = &peers[peers_idx];
 	peer->log = &peer_log; /* abusing struct bgp_peer a bit, but we are in a child */
 
-	if (config.bgp_table_dump_file) {
-	  bgp_peer_log_dynname(current_filename, SRVBUFLEN, config.bgp_table_dump_file, peer);
-	}
-
-	if (config.bgp_table_dump_amqp_routing_key) {
-	  bgp_peer_log_dynname(current_filename, SRVBUFLEN, config.bgp_table_dump_amqp_routing_key, peer);
-	}
-
-	if (config.bgp_table_dump_kafka_topic) {
-	  bgp_peer_log_dynname(current_filename, SRVBUFLEN, config.bgp_table_dump_kafka_topic, peer);
-	}
-
-	pm_strftime_same(current_filename, SRVBUFLEN, tmpbuf, &bms->dump.tstamp.tv_sec, config.timestamps_utc);
-
-	/*
-	   we close last_filename and open current_filename in case they differ;
-	   we are safe with this approach until time and BGP peer (IP, port) are
-	   the only variables supported as part of bgp_table_dump_file.
-        */
-	if (config.bgp_table_dump_file) {
-	  if (strcmp(last_filename, current_filename)) {
-	    if (saved_peer && saved_peer->log && strlen(last_filename)) {
-	      close_output_file(saved_peer->log->fd);
-
-	      if (config.bgp_table_dump_latest_file) {
-		bgp_peer_log_dynname(latest_filename, SRVBUFLEN, config.bgp_table_dump_latest_file, saved_peer);
-		link_latest_output_file(latest_filename, last_filename);
-	      }
-	    }
-	    peer->log->fd = open_output_file(current_filename, "w", TRUE);
-	    if (fd_buf) {
-	      if (setvbuf(peer->log->fd, fd_buf, _IOFBF, OUTPUT_FILE_BUFSZ))
-		Log(LOG_WARNING, "WARN ( %s/%s ): [%s] setvbuf() failed: %s\n",
-		    config.name, bms->log_str, current_filename, strerror(errno));
-	      else memset(fd_buf, 0, OUTPUT_FILE_BUFSZ); 
-	    }
-	  }
-	}
-
-	/*
-	   a bit pedantic maybe but should come at little cost and emulating
-	   bgp_table_dump_file behaviour will work
-	*/ 
-#ifdef WITH_RABBITMQ
-	if (config.bgp_table_dump_amqp_routing_key) {
-	  peer->log->amqp_host = &bgp_table_dump_amqp_host;
-	  strcpy(peer->log->filename, current_filename);
-	}
-#endif
-
-#ifdef WITH_KAFKA
-	if (config.bgp_table_dump_kafka_topic) {
-	  peer->log->kafka_host = &bgp_table_dump_kafka_host;
-	  strcpy(peer->log->filename, current_filename);
-	}
-#endif
+	bgp_table_dump_peer_open(bms, peer, saved_peer, current_filename, last_filename, fd_buf);
 
+	gettimeofday(&peer_start, NULL);
 	bgp_peer_dump_init(peer, config.bgp_table_dump_output, FUNC_TYPE_BGP);
         inter_domain_routing_db = bgp_select_routing_db(FUNC_TYPE_BGP);
 	dump_elems = 0;
@@ -1808,7 +2356,7 @@ void bgp_handle_dump_event()
 	      struct bgp_info *ri;
 
 	      for (peer_buckets = 0; peer_buckets < config.bgp_table_per_peer_buckets; peer_buckets++) {
-	        for (ri = node->info[modulo+peer_buckets]; ri; ri = ri->next) {
+	        for (ri = BGP_NODE_INFO(node, (modulo+peer_buckets)); ri; ri = ri->next) {
 		  if (ri->peer == peer) {
 	            bgp_peer_log_msg(node, ri, afi, safi, event_type, config.bgp_table_dump_output, NULL, BGP_LOG_TYPE_MISC);
 	            dump_elems++;
@@ -1827,19 +2375,12 @@ void bgp_handle_dump_event()
         strlcpy(last_filename, current_filename, SRVBUFLEN);
 	bds.entries = dump_elems;
 	bds.tables = tables_num;
+	bds.duration_ms = bgp_table_dump_duration_ms(&peer_start);
         bgp_peer_dump_close(peer, &bds, config.bgp_table_dump_output, FUNC_TYPE_BGP);
       }
     }
 
-#ifdef WITH_RABBITMQ
-    if (config.bgp_table_dump_amqp_routing_key)
-      p_amqp_close(&bgp_table_dump_amqp_host, FALSE);
-#endif
-
-#ifdef WITH_KAFKA
-    if (config.bgp_table_dump_kafka_topic)
-      p_kafka_close(&bgp_table_dump_kafka_host, FALSE);
-#endif
+    bgp_table_dump_backends_close();
 
     if (config.bgp_table_dump_latest_file && peer) {
       bgp_peer_log_dynname(latest_filename, SRVBUFLEN, config.bgp_table_dump_latest_file, peer);
@@ -2068,6 +2609,7 @@ avro_schema_t p_avro_schema_build_bgp_dump_close(int log_type, char *schema_name
   avro_schema_record_field_append(schema, "peer_tcp_port", optint_s);
   avro_schema_record_field_append(schema, "entries", optint_s);
   avro_schema_record_field_append(schema, "tables", optint_s);
+  avro_schema_record_field_append(schema, "duration_ms", optint_s);
 
   avro_schema_decref(optlong_s);
   avro_schema_decref(optstr_s);
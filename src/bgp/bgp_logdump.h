@@ -42,17 +42,65 @@
 #define BGP_LOGSEQ_ROLLOVER_BIT	0x8000000000000000ULL
 #define BGP_LOGSEQ_MASK		0x7FFFFFFFFFFFFFFFULL	
 
+#define BGP_TABLE_DUMP_WORKERS_MAX	64
+#define BGP_TABLE_DUMP_BATCH		256
+#define BGP_TABLE_DUMP_YIELD		1024	/* nodes walked before letting go of the RIB */
+
 struct bgp_peer_log {
   FILE *fd;
   int refcnt;
   char filename[SRVBUFLEN];
   void *amqp_host;
   void *kafka_host;
+  struct bgp_misc_structs *bms; /* private misc structs of a table dump writer thread */
 };
 
 struct bgp_dump_stats {
   u_int64_t entries;
   u_int32_t tables;
+  u_int32_t duration_ms;
+};
+
+/* table dump writer threads, see bgp_table_dump_workers */
+struct bgp_dump_peer {
+  struct bgp_peer *live;
+  struct bgp_peer *peer; /* copy taken at the dump event */
+  int fd;
+
+  /* progress, updated by the writer each time it lets go of the RIB */
+  u_int64_t nodes;
+  u_int64_t entries;
+  int done;
+};
+
+/* where a writer left a table: at 'p', past the path of the dumped peer
+   keyed 'rd', 'path_id' if 'mid_node' is set, past 'p' otherwise */
+struct bgp_dump_cursor {
+  struct prefix p;
+  rd_t rd;
+  path_id_t path_id;
+  int mid_node;
+};
+
+/* route snapshot: taken with the node locked, written out with nothing locked */
+struct bgp_dump_entry {
+  struct bgp_node node;
+  struct bgp_info ri;
+  struct bgp_attr_extra attr_extra;
+};
+
+struct bgp_dump_writer {
+  int id;
+  pthread_t thread;
+  struct bgp_misc_structs *bms;
+  struct bgp_peer_log peer_log;
+  struct bgp_dump_entry *batch;
+  u_int32_t batch_num;
+  u_int32_t batch_max;
+  struct bgp_info **paths;	/* paths of the dumped peer at a node, see bgp_table_dump_writer_node() */
+  u_int32_t paths_max;
+  char last_filename[SRVBUFLEN];
+  struct bgp_peer *last_peer;
 };
 
 /* prototypes */
@@ -70,6 +118,8 @@ extern int bgp_peer_log_seq_has_ro_bit(u_int64_t *);
 extern int bgp_peer_dump_init(struct bgp_peer *, int, int);
 extern int bgp_peer_dump_close(struct bgp_peer *, struct bgp_dump_stats *, int, int);
 extern void bgp_handle_dump_event();
+extern int bgp_table_dump_writers_running();
+extern void bgp_table_dump_writers_reap();
 extern void bgp_daemon_msglog_init_amqp_host();
 extern void bgp_table_dump_init_amqp_host();
 extern int bgp_daemon_msglog_init_kafka_host();
@@ -28,6 +28,11 @@
 #include "bgp.h"
 #include "pmbgpd.h"
 #include "rpki/rpki.h"
+#include "jhash.h"
+
+/* global variables */
+static struct bgp_lookup_cache bgp_lookup_cache;
+static int bgp_lookup_mem_reader = ERR;
 
 void bgp_srcdst_lookup(struct packet_ptrs *pptrs, int type)
 {
@@ -38,6 +43,7 @@ void bgp_srcdst_lookup(struct packet_ptrs *pptrs, int type)
   struct bgp_peer *peer;
   struct bgp_node *default_node, *result;
   struct bgp_info *info = NULL;
+  struct bgp_lookup_cache_entry *cache_slot;
   struct node_match_cmp_term2 nmct2;
   struct prefix default_prefix;
   int compare_bgp_port = config.tmp_bgp_lookup_compare_ports;
@@ -52,6 +58,10 @@ void bgp_srcdst_lookup(struct packet_ptrs *pptrs, int type)
 
   if (!bms || !inter_domain_routing_db) return;
 
+  /* results stay referenced by pptrs until bgp_lookup_offline() */
+  if (bgp_lookup_mem_reader == ERR) bgp_lookup_mem_reader = bgp_mem_reader_register();
+  bgp_mem_reader_online(bgp_lookup_mem_reader);
+
   pptrs->bgp_src = NULL;
   pptrs->bgp_dst = NULL;
   pptrs->bgp_src_info = NULL;
@@ -125,11 +135,16 @@ void bgp_srcdst_lookup(struct packet_ptrs *pptrs, int type)
 	nmct2.peer_dst_ip = NULL;
 
         memcpy(&pref4, &((struct pm_iphdr *)pptrs->iph_ptr)->ip_src, sizeof(struct in_addr));
-	bgp_node_match_ipv4(inter_domain_routing_db->rib[AFI_IP][safi],
-			    &pref4, (struct bgp_peer *) pptrs->bgp_peer,
-		     	    bms->route_info_modulo,
-			    bms->bgp_lookup_node_match_cmp, &nmct2,
-			    bms->bnv, &result, &info);
+	if (!bgp_lookup_cache_get(peer, AFI_IP, safi, &pref4, &cache_slot, &result, &info)) {
+	  if (!bgp_fib_match(peer, AFI_IP, safi, &pref4, &result, &info))
+	    bgp_node_match_ipv4(inter_domain_routing_db->rib[AFI_IP][safi],
+				&pref4, (struct bgp_peer *) pptrs->bgp_peer,
+				bms->route_info_modulo,
+				bms->bgp_lookup_node_match_cmp, &nmct2,
+				bms->bnv, &result, &info);
+
+	  bgp_lookup_cache_set(cache_slot, peer, result, info);
+	}
       }
 
       if (!pptrs->bgp_src_info && result) {
@@ -154,11 +169,16 @@ void bgp_srcdst_lookup(struct packet_ptrs *pptrs, int type)
         nmct2.peer_dst_ip = &peer_dst_ip;
 
 	memcpy(&pref4, &((struct pm_iphdr *)pptrs->iph_ptr)->ip_dst, sizeof(struct in_addr));
-	bgp_node_match_ipv4(inter_domain_routing_db->rib[AFI_IP][safi],
-			    &pref4, (struct bgp_peer *) pptrs->bgp_peer,
-			    bms->route_info_modulo,
-			    bms->bgp_lookup_node_match_cmp, &nmct2,
-			    bms->bnv, &result, &info);
+	if (!bgp_lookup_cache_get(peer, AFI_IP, safi, &pref4, &cache_slot, &result, &info)) {
+	  if (!bgp_fib_match(peer, AFI_IP, safi, &pref4, &result, &info))
+	    bgp_node_match_ipv4(inter_domain_routing_db->rib[AFI_IP][safi],
+				&pref4, (struct bgp_peer *) pptrs->bgp_peer,
+				bms->route_info_modulo,
+				bms->bgp_lookup_node_match_cmp, &nmct2,
+				bms->bnv, &result, &info);
+
+	  bgp_lookup_cache_set(cache_slot, peer, result, info);
+	}
       }
 
       if (!pptrs->bgp_dst_info && result) {
@@ -184,11 +204,16 @@ void bgp_srcdst_lookup(struct packet_ptrs *pptrs, int type)
         nmct2.peer_dst_ip = NULL;
 
         memcpy(&pref6, &((struct ip6_hdr *)pptrs->iph_ptr)->ip6_src, sizeof(struct in6_addr));
-	bgp_node_match_ipv6(inter_domain_routing_db->rib[AFI_IP6][safi],
-		            &pref6, (struct bgp_peer *) pptrs->bgp_peer,
-		            bms->route_info_modulo,
-		            bms->bgp_lookup_node_match_cmp, &nmct2,
-		            bms->bnv, &result, &info);
+	if (!bgp_lookup_cache_get(peer, AFI_IP6, safi, &pref6, &cache_slot, &result, &info)) {
+	  if (!bgp_fib_match(peer, AFI_IP6, safi, &pref6, &result, &info))
+	    bgp_node_match_ipv6(inter_domain_routing_db->rib[AFI_IP6][safi],
+				&pref6, (struct bgp_peer *) pptrs->bgp_peer,
+				bms->route_info_modulo,
+				bms->bgp_lookup_node_match_cmp, &nmct2,
+				bms->bnv, &result, &info);
+
+	  bgp_lookup_cache_set(cache_slot, peer, result, info);
+	}
       }
 
       if (!pptrs->bgp_src_info && result) {
@@ -213,11 +238,16 @@ void bgp_srcdst_lookup(struct packet_ptrs *pptrs, int type)
         nmct2.peer_dst_ip = &peer_dst_ip;
 
         memcpy(&pref6, &((struct ip6_hdr *)pptrs->iph_ptr)->ip6_dst, sizeof(struct in6_addr));
-	bgp_node_match_ipv6(inter_domain_routing_db->rib[AFI_IP6][safi],
-	     		    &pref6, (struct bgp_peer *) pptrs->bgp_peer,
-			    bms->route_info_modulo,
-			    bms->bgp_lookup_node_match_cmp, &nmct2,
-			    bms->bnv, &result, &info);
+	if (!bgp_lookup_cache_get(peer, AFI_IP6, safi, &pref6, &cache_slot, &result, &info)) {
+	  if (!bgp_fib_match(peer, AFI_IP6, safi, &pref6, &result, &info))
+	    bgp_node_match_ipv6(inter_domain_routing_db->rib[AFI_IP6][safi],
+				&pref6, (struct bgp_peer *) pptrs->bgp_peer,
+				bms->route_info_modulo,
+				bms->bgp_lookup_node_match_cmp, &nmct2,
+				bms->bnv, &result, &info);
+
+	  bgp_lookup_cache_set(cache_slot, peer, result, info);
+	}
       }
 
       if (!pptrs->bgp_dst_info && result) {
@@ -419,7 +449,7 @@ void bgp_follow_nexthop_lookup(struct packet_ptrs *pptrs, int type)
     // XXX: to be optimized
     if (result_node) {
       for (local_modulo = modulo, modulo_idx = 0; modulo_idx < modulo_max; local_modulo++, modulo_idx++) {
-        for (info = result_node->info[modulo]; info; info = info->next) {
+        for (info = BGP_NODE_INFO(result_node, local_modulo); info; info = info->next) {
           if (info->peer == nh_peer) break;
 	}
       }
@@ -514,21 +544,73 @@ void bgp_follow_nexthop_lookup(struct packet_ptrs *pptrs, int type)
   pptrs->f_agent = saved_agent;
 }
 
+/*
+  Resolves a BGP peer via the Router-ID and address caches; the (negative)
+  outcome of an unsuccessful lookup is remembered in 'miss' and honoured
+  until a peer is added to the caches.
+*/
+static struct bgp_peer *bgp_lookup_find_bgp_peer_cache(struct sockaddr *sa, struct xflow_status_peer_miss *miss, int compare_bgp_port)
+{
+  struct sockaddr_storage sas;
+  struct bgp_peer *peer = NULL;
+  struct host_addr ha;
+  u_int16_t port;
+  u_int32_t gen;
+
+  memset(&sas, 0, sizeof(sas));
+  if (sa->sa_family == AF_INET) memcpy(&sas, sa, sizeof(struct sockaddr_in));
+  else if (sa->sa_family == AF_INET6) memcpy(&sas, sa, sizeof(struct sockaddr_in6));
+  else return NULL;
+
+  /* peers are indexed with IPv4-mapped addresses converted to IPv4 */
+  ipv4_mapped_to_ipv4(&sas);
+  sa_to_addr((struct sockaddr *) &sas, &ha, &port);
+  if (!compare_bgp_port) port = 0;
+
+  gen = __atomic_load_n(&peers_cache_gen, __ATOMIC_ACQUIRE);
+
+  if (miss && miss->gen == gen && miss->port == port && !host_addr_cmp(&miss->addr, &ha)) return NULL;
+
+  if (!config.bgp_disable_router_id_check) {
+    peer = bgp_peer_cache_search_id(peers_id_cache, addr_hash(&ha, config.bgp_daemon_max_peers), &ha);
+  }
+
+  if (!peer) {
+    if (compare_bgp_port) {
+      peer = bgp_peer_cache_search(peers_port_cache, addr_port_hash(&ha, port, config.bgp_daemon_max_peers), &ha, port);
+    }
+    else {
+      peer = bgp_peer_cache_search(peers_cache, addr_hash(&ha, config.bgp_daemon_max_peers), &ha, FALSE);
+    }
+  }
+
+  if (!peer && miss) {
+    miss->gen = gen;
+    miss->port = port;
+    memcpy(&miss->addr, &ha, sizeof(struct host_addr));
+  }
+
+  return peer;
+}
+
 struct bgp_peer *bgp_lookup_find_bgp_peer(struct sockaddr *sa, struct xflow_status_entry *xs_entry, u_int16_t l3_proto, int compare_bgp_port)
 {
   struct bgp_peer *peer;
+  struct xflow_status_peer_miss *peer_miss;
   u_int32_t peer_idx, *peer_idx_ptr;
   int peers_idx;
 
-  peer_idx = 0; peer_idx_ptr = NULL;
+  peer_idx = 0; peer_idx_ptr = NULL; peer_miss = NULL;
   if (xs_entry) {
     if (l3_proto == ETHERTYPE_IP) {
       peer_idx = xs_entry->peer_v4_idx; 
       peer_idx_ptr = &xs_entry->peer_v4_idx;
+      peer_miss = &xs_entry->peer_v4_miss;
     }
     else if (l3_proto == ETHERTYPE_IPV6) {
       peer_idx = xs_entry->peer_v6_idx; 
       peer_idx_ptr = &xs_entry->peer_v6_idx;
+      peer_miss = &xs_entry->peer_v6_miss;
     }
   }
 
@@ -544,11 +626,15 @@ struct bgp_peer *bgp_lookup_find_bgp_peer(struct sockaddr *sa, struct xflow_stat
       peer = NULL;
     }
   }
+  else if (peers_cache && peers_port_cache && peers_id_cache) {
+    peer = bgp_lookup_find_bgp_peer_cache(sa, peer_miss, compare_bgp_port);
+    if (peer && peer_idx_ptr) *peer_idx_ptr = peer->idx;
+  }
   else {
     for (peer = NULL, peers_idx = 0; peers_idx < config.bgp_daemon_max_peers; peers_idx++) {
       if ((!config.bgp_disable_router_id_check && !sa_addr_cmp(sa, &peers[peers_idx].id)) ||
 	  (!sa_addr_cmp(sa, &peers[peers_idx].addr) && 
-	  (!compare_bgp_port || !sa_port_cmp(sa, peers[peer_idx].tcp_port)))) {
+	  (!compare_bgp_port || !sa_port_cmp(sa, peers[peers_idx].tcp_port)))) {
         peer = &peers[peers_idx];
         if (xs_entry && peer_idx_ptr) *peer_idx_ptr = peers_idx;
         break;
@@ -620,11 +706,93 @@ int bgp_lookup_node_vector_unicast(struct prefix *p, struct bgp_peer *peer, stru
   nmct2.p = p;
 
   bgp_node_match(inter_domain_routing_db->rib[afi][safi], p, peer, bms->route_info_modulo,
-                 bms->bgp_lookup_node_match_cmp, &nmct2, bnv, &result, &info);
+			      bms->bgp_lookup_node_match_cmp, &nmct2, bnv, &result, &info);
 
   return SUCCESS;
 }
 
+/*
+  To be called by the collector thread once done with the results of
+  bgp_srcdst_lookup(), ie. before waiting for the next packet: memory
+  retired from the RIB meanwhile does not have to wait for it.
+*/
+void bgp_lookup_offline()
+{
+  bgp_mem_reader_offline(bgp_lookup_mem_reader);
+}
+
+/*
+  Looks up the result of a recent longest prefix match of 'addr' among the
+  paths of 'peer'. Returns TRUE on a hit; otherwise FALSE, with 'slot' set
+  to the entry the lookup result should be stored to, via
+  bgp_lookup_cache_set(), or to NULL if the lookup is not cacheable. An
+  entry is valid as long as the RIB generation of the peer is unchanged.
+*/
+int bgp_lookup_cache_get(struct bgp_peer *peer, afi_t afi, safi_t safi, void *addr, struct bgp_lookup_cache_entry **slot,
+			 struct bgp_node **result_node, struct bgp_info **result_info)
+{
+  struct bgp_lookup_cache_entry *entry;
+  u_int32_t gen, hash, addr_len;
+
+  (*slot) = NULL;
+
+  /* results must not depend on RD, ADD-PATH next-hop or RPKI node vector */
+  if (!peer || safi != SAFI_UNICAST || (afi != AFI_IP && afi != AFI_IP6)) return FALSE;
+  if (peer->cap_add_paths[afi][safi] || config.rpki_roas_file || config.rpki_rtr_cache) return FALSE;
+
+  if (!bgp_lookup_cache.entries) {
+    bgp_lookup_cache.entries = calloc(BGP_LOOKUP_CACHE_ENTRIES, sizeof(struct bgp_lookup_cache_entry));
+    if (!bgp_lookup_cache.entries) {
+      Log(LOG_ERR, "ERROR ( %s/core ): calloc() failed (bgp_lookup_cache_get). Exiting ..\n", config.name);
+      exit_gracefully(1);
+    }
+  }
+
+  addr_len = ((afi == AFI_IP) ? IPV4_MAX_BYTELEN : IPV6_MAX_BYTELEN);
+  hash = jhash(addr, addr_len, (u_int32_t) (uintptr_t) peer);
+  entry = &bgp_lookup_cache.entries[hash & (BGP_LOOKUP_CACHE_ENTRIES - 1)];
+
+  /* read ahead of the lookup: a RIB change racing with it invalidates the result */
+  gen = __atomic_load_n(&peer->rib_gen, __ATOMIC_ACQUIRE);
+
+  if (entry->peer == peer && entry->gen == gen && entry->afi == afi && !memcmp(entry->addr, addr, addr_len)) {
+    /* node was locked when first matched */
+    (*result_node) = entry->node;
+    (*result_info) = entry->info;
+    bgp_lookup_cache.hits++;
+
+    return TRUE;
+  }
+
+  bgp_lookup_cache.misses++;
+
+  entry->peer = NULL;
+  entry->gen = gen;
+  entry->afi = afi;
+  memcpy(entry->addr, addr, addr_len);
+  (*slot) = entry;
+
+  return FALSE;
+}
+
+void bgp_lookup_cache_set(struct bgp_lookup_cache_entry *slot, struct bgp_peer *peer, struct bgp_node *result_node, struct bgp_info *result_info)
+{
+  if (!slot) return;
+
+  slot->node = result_node;
+  slot->info = result_info;
+  slot->peer = peer;
+}
+
+void bgp_lookup_cache_print_status(time_t now)
+{
+  u_int64_t lookups = (bgp_lookup_cache.hits + bgp_lookup_cache.misses);
+
+  Log(LOG_NOTICE, "NOTICE ( %s/%s ): stats [bgp_lookup_cache] time=%ld entries=%u hits=%" PRIu64 " misses=%" PRIu64 " hit_ratio=%.2f\n",
+	config.name, config.type, (long)now, BGP_LOOKUP_CACHE_ENTRIES, bgp_lookup_cache.hits, bgp_lookup_cache.misses,
+	lookups ? ((float) bgp_lookup_cache.hits / lookups) : 0);
+}
+
 void pkt_to_cache_legacy_bgp_primitives(struct cache_legacy_bgp_primitives *c, struct pkt_legacy_bgp_primitives *p,
 					pm_cfgreg_t what_to_count, pm_cfgreg_t what_to_count_2)
 {
@@ -788,14 +956,14 @@ void free_cache_legacy_bgp_primitives(struct cache_legacy_bgp_primitives **c)
 
 u_int32_t bgp_route_info_modulo_pathid(struct bgp_peer *peer, path_id_t *path_id, int per_peer_buckets)
 {
-  struct bgp_misc_structs *bms = bgp_select_misc_db(peer->type);
   path_id_t local_path_id = 1;
 
   if (path_id && *path_id) local_path_id = *path_id;
 
-  return (((peer->fd * per_peer_buckets) +
-          ((local_path_id - 1) % per_peer_buckets)) %
-          (bms->table_peer_buckets * per_peer_buckets));
+  /* peers[] index is unique and dense: one slot (range) per peer, so that
+     at each node only the paths of the given peer are walked */
+  return ((peer->idx * per_peer_buckets) +
+          ((local_path_id - 1) % per_peer_buckets));
 }
 
 int bgp_lg_daemon_ip_lookup(struct bgp_lg_req_ipl_data *req, struct bgp_lg_rep *rep, int type)
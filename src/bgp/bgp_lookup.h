@@ -22,6 +22,26 @@
 #ifndef _BGP_LOOKUP_H_
 #define _BGP_LOOKUP_H_
 
+/* defines */
+#define BGP_LOOKUP_CACHE_ENTRIES	4096	/* power of 2 */
+
+/* structures */
+struct bgp_lookup_cache_entry {
+  struct bgp_peer *peer;
+  struct bgp_node *node;
+  struct bgp_info *info;
+  u_int32_t gen;
+  afi_t afi;
+  u_char addr[IPV6_MAX_BYTELEN];
+};
+
+/* recent (peer, address) lookup results of the collector thread */
+struct bgp_lookup_cache {
+  struct bgp_lookup_cache_entry *entries;
+  u_int64_t hits;
+  u_int64_t misses;
+};
+
 /* prototypes */
 extern void bgp_srcdst_lookup(struct packet_ptrs *, int);
 extern void bgp_follow_nexthop_lookup(struct packet_ptrs *, int);
@@ -29,6 +49,10 @@ extern struct bgp_peer *bgp_lookup_find_bgp_peer(struct sockaddr *, struct xflow
 extern u_int32_t bgp_route_info_modulo_pathid(struct bgp_peer *, path_id_t *, int);
 extern int bgp_lookup_node_match_cmp_bgp(struct bgp_info *, struct node_match_cmp_term2 *);
 extern int bgp_lookup_node_vector_unicast(struct prefix *, struct bgp_peer *, struct bgp_node_vector *);
+extern int bgp_lookup_cache_get(struct bgp_peer *, afi_t, safi_t, void *, struct bgp_lookup_cache_entry **, struct bgp_node **, struct bgp_info **);
+extern void bgp_lookup_cache_set(struct bgp_lookup_cache_entry *, struct bgp_peer *, struct bgp_node *, struct bgp_info *);
+extern void bgp_lookup_cache_print_status(time_t);
+extern void bgp_lookup_offline();
 
 extern void pkt_to_cache_legacy_bgp_primitives(struct cache_legacy_bgp_primitives *, struct pkt_legacy_bgp_primitives *, pm_cfgreg_t, pm_cfgreg_t);
 extern void cache_to_pkt_legacy_bgp_primitives(struct pkt_legacy_bgp_primitives *, struct cache_legacy_bgp_primitives *);
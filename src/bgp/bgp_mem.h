@@ -0,0 +1,62 @@
+/*  
+    pmacct (Promiscuous mode IP Accounting package)
+    pmacct is Copyright (C) 2003-2020 by Paolo Lucente
+*/
+
+/*
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#ifndef _BGP_MEM_H_
+#define _BGP_MEM_H_
+
+/*
+  Epoch-based reclamation of memory that lock-free readers, ie. lookups
+  off the RIB, the BGP FIB or the IGP FIB, may still be walking; see
+  bgp_util.c. Self-contained, for modules not pulling in bgp.h.
+*/
+
+/* defines */
+#define BGP_MEM_RECLAIM_INTERVAL	1	/* seconds between attempts to free retired memory */
+#define BGP_MEM_READERS_MAX		16
+#define BGP_MEM_READER_OFFLINE		0
+
+/* structures */
+struct bgp_mem_retired {
+  void *ptr;
+  void (*free_func)(void *);
+  u_int64_t epoch;
+};
+
+/* epoch last observed by a lock-free reader, BGP_MEM_READER_OFFLINE if it
+   holds no reference to RIB memory; padded against false sharing */
+struct bgp_mem_reader {
+  u_int64_t epoch;
+  u_char pad[56];
+};
+
+/* prototypes */
+extern int bgp_mem_reader_register();
+extern void bgp_mem_reader_online(int);
+extern void bgp_mem_reader_offline(int);
+extern u_int64_t bgp_mem_epoch_get();
+extern u_int64_t bgp_mem_epoch_safe();
+extern void bgp_mem_synchronize();
+extern void bgp_mem_retire(void *);
+extern void bgp_mem_retire_func(void *, void (*)(void *));
+extern void bgp_mem_reclaim();
+extern int bgp_mem_retired_pending();
+
+#endif //_BGP_MEM_H_
@@ -93,6 +93,10 @@ int bgp_parse_msg(struct bgp_peer *peer, time_t now, int online)
     case BGP_KEEPALIVE:
       bgp_peer_print(peer, bgp_peer_str, INET6_ADDRSTRLEN);
       Log(LOG_DEBUG, "DEBUG ( %s/%s ): [%s] BGP_KEEPALIVE received\n", config.name, bms->log_str, bgp_peer_str);
+
+      /* paths retired by the last UPDATEs, if the session went quiet */
+      bgp_peer_retired_commit(peer);
+
       if (peer->status >= OpenSent) {
         if (peer->status < Established) peer->status = Established;
 
@@ -121,6 +125,9 @@ int bgp_parse_msg(struct bgp_peer *peer, time_t now, int online)
       }
 
       ret = bgp_parse_update_msg(&bmd, bgp_packet_ptr);
+      bgp_fib_commit(peer);
+      bgp_peer_retired_commit(peer);
+
       if (ret < 0) {
         bgp_peer_print(peer, bgp_peer_str, INET6_ADDRSTRLEN);
 	Log(LOG_WARNING, "WARN ( %s/%s ): [%s] BGP UPDATE: malformed.\n", config.name, bms->log_str, bgp_peer_str);
@@ -169,6 +176,13 @@ int bgp_parse_open_msg(struct bgp_msg_data *bmd, char *bgp_packet_ptr, time_t no
 
       remote_as = ntohs(bopen->bgpo_myas);
       peer->ht = MAX(5, ntohs(bopen->bgpo_holdtime));
+
+      if (bms->peers_mutex) pthread_mutex_lock(bms->peers_mutex);
+
+      if (bms->peers_id_cache && peer->id.family) {
+	bgp_peer_cache_delete(bms->peers_id_cache, addr_hash(&peer->id, bms->max_peers), peer);
+      }
+
       peer->id.family = AF_INET; 
       peer->id.address.ipv4.s_addr = bopen->bgpo_id;
       peer->version = BGP_VERSION4;
@@ -178,9 +192,19 @@ int bgp_parse_open_msg(struct bgp_msg_data *bmd, char *bgp_packet_ptr, time_t no
 	int check_ret;
 
 	check_ret = bms->bgp_msg_open_router_id_check(bmd);
-	if (check_ret) return check_ret;
+	if (check_ret) {
+	  if (bms->peers_mutex) pthread_mutex_unlock(bms->peers_mutex);
+	  return check_ret;
+	}
       }
 
+      /* Index by Router-ID for flow lookups; BGP only, ie. no BMP */
+      if (!config.bgp_disable_router_id_check && bms->peers_id_cache) {
+	bgp_peer_cache_insert(bms->peers_id_cache, addr_hash(&peer->id, bms->max_peers), peer);
+      }
+
+      if (bms->peers_mutex) pthread_mutex_unlock(bms->peers_mutex);
+
       /* OPEN options parsing */
       if (bopen->bgpo_optlen && bopen->bgpo_optlen >= 2) {
 	u_int8_t len, opt_type, opt_len;
@@ -1248,8 +1272,11 @@ int bgp_process_update(struct bgp_msg_data *bmd, struct prefix *p, void *attr, s
     modulo = bms->route_info_modulo(peer, &attr_extra->path_id, bms->table_per_peer_buckets);
     route = bgp_node_get(peer, inter_domain_routing_db->rib[afi][safi], p);
 
-    /* Check previously received route. */
-    for (ri = route->info[modulo]; ri; ri = ri->next) {
+    /* Check previously received route. The chain is shared with other
+       peers, hence locked; a path of ours can only be changed by us */
+    BGP_NODE_LOCK(route);
+
+    for (ri = BGP_NODE_INFO(route, modulo); ri; ri = ri->next) {
       if (ri->peer == peer) { 
         if (safi == SAFI_MPLS_VPN) {
 	  if (ri->attr_extra && !memcmp(&ri->attr_extra->rd, &attr_extra->rd, sizeof(rd_t)));
@@ -1270,6 +1297,8 @@ int bgp_process_update(struct bgp_msg_data *bmd, struct prefix *p, void *attr, s
       }
     }
 
+    BGP_NODE_UNLOCK(route);
+
     attr_new = bgp_attr_intern(peer, attr);
 
     if (ri) {
@@ -1284,10 +1313,13 @@ int bgp_process_update(struct bgp_msg_data *bmd, struct prefix *p, void *attr, s
         return SUCCESS;
       }
       else {
-        /* Update to new attribute.  */
-        bgp_attr_unintern(peer, ri->attr);
-        ri->attr = attr_new;
+        /* Update to new attribute; table dump writers and lookups may be
+           reading the old one, which is retired */
+        BGP_NODE_LOCK(route);
+        bgp_info_retire(peer, NULL, NULL, ri->attr);
+        __atomic_store_n(&ri->attr, attr_new, __ATOMIC_RELEASE);
         bgp_attr_extra_process(peer, ri, afi, safi, attr_extra);
+        BGP_NODE_UNLOCK(route);
         if (bms->bgp_extra_data_process) (*bms->bgp_extra_data_process)(&bmd->extra, ri, idx, BGP_NLRI_UPDATE);
 
         bgp_unlock_node (peer, route);
@@ -1311,6 +1343,7 @@ int bgp_process_update(struct bgp_msg_data *bmd, struct prefix *p, void *attr, s
 
     /* Register new BGP information. */
     bgp_info_add(peer, route, new, modulo);
+    bgp_fib_update(peer, afi, safi, p, FALSE);
 
     /* route_node_get lock */
     bgp_unlock_node(peer, route);
@@ -1378,8 +1411,10 @@ int bgp_process_withdraw(struct bgp_msg_data *bmd, struct prefix *p, void *attr,
     /* Lookup node. */
     route = bgp_node_get(peer, inter_domain_routing_db->rib[afi][safi], p);
 
-    /* Check previously received route. */
-    for (ri = route->info[modulo]; ri; ri = ri->next) {
+    /* Check previously received route, see bgp_process_update() */
+    BGP_NODE_LOCK(route);
+
+    for (ri = BGP_NODE_INFO(route, modulo); ri; ri = ri->next) {
       if (ri->peer == peer) {
         if (safi == SAFI_MPLS_VPN) {
           if (ri->attr_extra && !memcmp(&ri->attr_extra->rd, &attr_extra->rd, sizeof(rd_t)));
@@ -1399,6 +1434,8 @@ int bgp_process_withdraw(struct bgp_msg_data *bmd, struct prefix *p, void *attr,
         break;
       }
     }
+
+    BGP_NODE_UNLOCK(route);
   }
   else {
     if (bms->msglog_backend_methods) {
@@ -1423,7 +1460,10 @@ int bgp_process_withdraw(struct bgp_msg_data *bmd, struct prefix *p, void *attr,
 
   if (!bms->skip_rib) {
     /* Withdraw specified route from routing table. */
-    if (ri) bgp_info_delete(peer, route, ri, modulo); 
+    if (ri) {
+      bgp_info_delete(peer, route, ri, modulo);
+      bgp_fib_update(peer, afi, safi, p, TRUE);
+    }
 
     /* Unlock bgp_node_get() lock. */
     bgp_unlock_node(peer, route);
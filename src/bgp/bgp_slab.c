@@ -0,0 +1,108 @@
+/*
+    pmacct (Promiscuous mode IP Accounting package)
+    pmacct is Copyright (C) 2003-2020 by Paolo Lucente
+*/
+
+/*
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/* includes */
+#include "pmacct.h"
+#include "bgp.h"
+
+/* chunk header, keeps objects aligned */
+struct bgp_slab_chunk {
+  void *next;
+  u_int64_t pad;
+};
+
+/* Returns a zeroed object of 'size' bytes; a slab serves one size only */
+void *bgp_slab_alloc(struct bgp_slab *slab, u_int32_t size)
+{
+  struct bgp_slab_chunk *chunk;
+  size_t chunk_size;
+  void *obj;
+
+  if (!slab->obj_size) {
+    slab->obj_size = ((MAX(size, sizeof(void *)) + (BGP_SLAB_ALIGN - 1)) & ~(BGP_SLAB_ALIGN - 1));
+    slab->chunk_objs = BGP_SLAB_CHUNK_MIN;
+  }
+
+  assert(size <= slab->obj_size);
+
+  if (slab->free_list) {
+    obj = slab->free_list;
+    slab->free_list = *(void **) obj;
+  }
+  else {
+    if (!slab->carve_left) {
+      chunk_size = (sizeof(struct bgp_slab_chunk) + ((size_t) slab->chunk_objs * slab->obj_size));
+
+      chunk = malloc(chunk_size);
+      if (!chunk) {
+	Log(LOG_ERR, "ERROR ( %s/core/BGP ): malloc() failed (bgp_slab_alloc). Exiting ..\n", config.name);
+	exit_gracefully(1);
+      }
+
+      chunk->next = slab->chunks;
+      slab->chunks = chunk;
+      slab->carve_ptr = (char *) (chunk + 1);
+      slab->carve_left = slab->chunk_objs;
+      slab->chunks_num++;
+      slab->bytes += chunk_size;
+
+      if (slab->chunk_objs < BGP_SLAB_CHUNK_MAX) slab->chunk_objs *= 2;
+    }
+
+    obj = slab->carve_ptr;
+    slab->carve_ptr += slab->obj_size;
+    slab->carve_left--;
+  }
+
+  memset(obj, 0, slab->obj_size);
+  slab->objs++;
+
+  return obj;
+}
+
+void bgp_slab_free(struct bgp_slab *slab, void *obj)
+{
+  if (!obj) return;
+
+  assert(slab->objs);
+
+  *(void **) obj = slab->free_list;
+  slab->free_list = obj;
+  slab->objs--;
+
+  if (!slab->objs) bgp_slab_destroy(slab);
+}
+
+/* Returns all chunks to the system; the slab can be re-used afterwards */
+void bgp_slab_destroy(struct bgp_slab *slab)
+{
+  struct bgp_slab_chunk *chunk, *next;
+  u_int32_t obj_size = slab->obj_size;
+
+  for (chunk = slab->chunks; chunk; chunk = next) {
+    next = chunk->next;
+    free(chunk);
+  }
+
+  memset(slab, 0, sizeof(struct bgp_slab));
+  slab->obj_size = obj_size;
+  slab->chunk_objs = BGP_SLAB_CHUNK_MIN;
+}
@@ -0,0 +1,56 @@
+/*
+    pmacct (Promiscuous mode IP Accounting package)
+    pmacct is Copyright (C) 2003-2020 by Paolo Lucente
+*/
+
+/*
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#ifndef BGP_SLAB_H
+#define BGP_SLAB_H
+
+/* defines */
+#define BGP_SLAB_CHUNK_MIN	32	/* objects in the first chunk of a slab */
+#define BGP_SLAB_CHUNK_MAX	4096	/* cap to the doubling of chunk sizes */
+#define BGP_SLAB_ALIGN		8
+
+/* structures */
+/*
+  Fixed-size object allocator for RIB structures: objects are carved out of
+  chunks which double in size up to BGP_SLAB_CHUNK_MAX objects, freed ones
+  are kept in a free list for re-use. All chunks are returned to the system
+  once the last object is freed. A zeroed structure is a valid, empty slab.
+  Not thread-safe: callers serialize access (ie. peer owner thread, table
+  lock).
+*/
+struct bgp_slab {
+  u_int32_t obj_size;
+  u_int32_t chunk_objs;	/* objects in the next chunk to be allocated */
+  void *chunks;		/* chunks list, linked via their first word */
+  void *free_list;	/* freed objects, linked via their first word */
+  char *carve_ptr;	/* unused tail of the newest chunk */
+  u_int32_t carve_left;
+  u_int32_t chunks_num;
+  u_int64_t objs;	/* objects in use */
+  u_int64_t bytes;	/* memory held by chunks */
+};
+
+/* prototypes */
+extern void *bgp_slab_alloc(struct bgp_slab *, u_int32_t);
+extern void bgp_slab_free(struct bgp_slab *, void *);
+extern void bgp_slab_destroy(struct bgp_slab *);
+
+#endif //BGP_SLAB_H
@@ -28,12 +28,14 @@ Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
 #include "bgp.h"
 
 static void bgp_node_delete (struct bgp_peer *, struct bgp_node *);
-static struct bgp_node *bgp_node_create (struct bgp_peer *);
+static struct bgp_node *bgp_node_create (struct bgp_peer *, struct bgp_table *);
 static struct bgp_node *bgp_node_set (struct bgp_peer *, struct bgp_table *, struct prefix *);
 static void bgp_node_free (struct bgp_node *);
+static void bgp_table_reclaim (struct bgp_table *, int);
 static void route_common (struct prefix *, struct prefix *, struct prefix *);
 static int check_bit (u_char *, u_char);
 static void set_link (struct bgp_node *, struct bgp_node *);
+static void bgp_table_walk_node (struct bgp_node *, u_int8_t, void (*)(struct bgp_node *, void *), void *);
 
 struct bgp_table *
 bgp_table_init (afi_t afi, safi_t safi)
@@ -55,35 +57,20 @@ bgp_table_init (afi_t afi, safi_t safi)
   return rt;
 }
 
+/* Nodes come from the table slab; route info slots are only allocated
+   once a route is attached (see bgp_node_info_head()), sparing them to
+   the glue nodes of the tree */
 static struct bgp_node *
-bgp_node_create (struct bgp_peer *peer)
+bgp_node_create (struct bgp_peer *peer, struct bgp_table *table)
 {
-  struct bgp_misc_structs *bms;
   struct bgp_node *rn;
 
   if (!peer) return NULL;
 
-  bms = bgp_select_misc_db(peer->type);
-
-  if (!bms) return NULL;
-
-  rn = (struct bgp_node *) malloc (sizeof (struct bgp_node));
-  if (rn) {
-    memset (rn, 0, sizeof (struct bgp_node));
-
-    rn->info = (void **) malloc(sizeof(struct bgp_info *) * (bms->table_peer_buckets * bms->table_per_peer_buckets));
-    if (rn->info) memset (rn->info, 0, sizeof(struct bgp_info *) * (bms->table_peer_buckets * bms->table_per_peer_buckets));
-    else goto malloc_failed;
-  }
-  else goto malloc_failed;
+  rn = (struct bgp_node *) bgp_slab_alloc (&table->node_slab, sizeof (struct bgp_node));
+  rn->table = table;
 
   return rn;
-
-  malloc_failed:
-  Log(LOG_ERR, "ERROR ( %s/%s ): malloc() failed (bgp_node_create). Exiting ..\n", config.name, bms->log_str);
-  exit_gracefully(1);
-
-  return NULL; /* silence compiler warning */
 }
 
 /* Allocate new route node with prefix set. */
@@ -94,24 +81,71 @@ bgp_node_set (struct bgp_peer *peer, struct bgp_table *table, struct prefix *pre
   (void)bms;
   struct bgp_node *node;
   
-  node = bgp_node_create (peer);
+  node = bgp_node_create (peer, table);
 
   prefix_copy (&node->p, prefix);
-  node->table = table;
 
   return node;
 }
 
-/* Free route node. */
+/* Free route node. Lookups may still be walking it, hence it is retired
+   and returned to the slab by bgp_table_reclaim() later on. To be called
+   with the table locked for writing. */
 static void
 bgp_node_free (struct bgp_node *node)
 {
+  struct bgp_table *table = node->table;
+  struct bgp_node_retired *new_retired;
+  u_int32_t new_max;
+
   if (node->info) {
-    free (node->info);
+    __atomic_sub_fetch (&table->info_slots, node->info->num, __ATOMIC_RELAXED);
+    __atomic_sub_fetch (&table->info_maps, 1, __ATOMIC_RELAXED);
+    bgp_mem_retire(node->info);
     node->info = NULL;
   }
+  else if (node->info_one_slot) __atomic_sub_fetch (&table->info_inline, 1, __ATOMIC_RELAXED);
 
-  free (node);
+  if (table->retired_num == table->retired_max) {
+    new_max = (table->retired_max ? (table->retired_max * 2) : 64);
+
+    new_retired = realloc (table->retired, (new_max * sizeof (struct bgp_node_retired)));
+    if (!new_retired) {
+      Log(LOG_ERR, "ERROR ( %s/core/BGP ): realloc() failed (bgp_node_free). Exiting ..\n", config.name);
+      exit_gracefully(1);
+    }
+
+    table->retired = new_retired;
+    table->retired_max = new_max;
+  }
+
+  table->retired[table->retired_num].node = node;
+  table->retired[table->retired_num].epoch = bgp_mem_epoch_get ();
+  table->retired_num++;
+}
+
+/* Return to the slab the nodes lookups moved past, all of them if 'force';
+   to be called with the table locked for writing */
+static void
+bgp_table_reclaim (struct bgp_table *table, int force)
+{
+  u_int64_t safe = 0;
+  u_int32_t idx;
+
+  if (!table->retired_num) return;
+
+  if (!force) safe = bgp_mem_epoch_safe ();
+
+  /* the list is sorted by epoch */
+  for (idx = 0; idx < table->retired_num; idx++) {
+    if (!force && table->retired[idx].epoch >= safe) break;
+    bgp_slab_free (&table->node_slab, table->retired[idx].node);
+  }
+
+  if (idx) {
+    table->retired_num -= idx;
+    memmove (table->retired, &table->retired[idx], (table->retired_num * sizeof (struct bgp_node_retired)));
+  }
 }
 
 /* Utility mask array. */
@@ -195,18 +229,156 @@ set_link (struct bgp_node *node, struct bgp_node *new)
 struct bgp_node *
 bgp_lock_node (struct bgp_peer *peer, struct bgp_node *node)
 {
-  node->lock++;
+  __atomic_add_fetch (&node->lock, 1, __ATOMIC_RELAXED);
   return node;
 }
 
-/* Unlock node. */
+/* Unlock node. Dropping the last reference deletes the node, which needs
+   the table locked for writing; other references are dropped lock-free.
+   Not to be called with the table locked. */
 void
 bgp_unlock_node (struct bgp_peer *peer, struct bgp_node *node)
 {
-  node->lock--;
+  struct bgp_table *table = node->table;
+  unsigned int lock = __atomic_load_n (&node->lock, __ATOMIC_RELAXED);
+
+  while (lock > 1)
+    {
+      if (__atomic_compare_exchange_n (&node->lock, &lock, (lock - 1), FALSE, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	return;
+    }
+
+  BGP_TABLE_WRLOCK (table);
 
-  if (node->lock == 0)
+  if (__atomic_sub_fetch (&node->lock, 1, __ATOMIC_RELAXED) == 0)
     bgp_node_delete (peer, node);
+
+  bgp_table_reclaim (table, FALSE);
+
+  BGP_TABLE_UNLOCK (table);
+}
+
+struct bgp_info *
+bgp_node_info_get (struct bgp_node *node, u_int32_t slot)
+{
+  struct bgp_node_info_map *map = __atomic_load_n(&node->info, __ATOMIC_ACQUIRE);
+  u_int32_t low, high, mid;
+
+  if (!map) {
+    if (__atomic_load_n(&node->info_one_slot, __ATOMIC_ACQUIRE) == (slot + 1))
+      return __atomic_load_n(&node->info_one, __ATOMIC_ACQUIRE);
+
+    return NULL;
+  }
+
+  for (low = 0, high = map->num; low < high;) {
+    mid = ((low + high) / 2);
+
+    if (map->s[mid].slot == slot) return __atomic_load_n(&map->s[mid].info, __ATOMIC_ACQUIRE);
+    else if (map->s[mid].slot < slot) low = (mid + 1);
+    else high = mid;
+  }
+
+  return NULL;
+}
+
+/* Returns a pointer to the head of the chain of paths of a node for 'slot',
+   to be updated in place. If the slot is not in use yet, NULL is returned
+   unless 'create' is set: the first slot of a node is taken inline, others
+   need a map. The map is copied with the new slot in (the inline slot and
+   slots whose chain went empty are folded in or dropped along the way), the
+   copy is published and the old map is retired, as lookups may be walking
+   it at the same time. To be called with the node locked (BGP_NODE_LOCK). */
+struct bgp_info **
+bgp_node_info_head (struct bgp_peer *peer, struct bgp_node *node, u_int32_t slot, int create)
+{
+  struct bgp_misc_structs *bms;
+  struct bgp_node_info_map *old_map = node->info, *new_map;
+  struct bgp_node_info_slot one;
+  struct bgp_info **head = NULL;
+  u_int32_t idx, num = 0, old_num = 0;
+
+  memset(&one, 0, sizeof(one));
+
+  if (old_map) {
+    old_num = old_map->num;
+
+    for (idx = 0; idx < old_num; idx++) {
+      if (old_map->s[idx].slot == slot) return &old_map->s[idx].info;
+      if (old_map->s[idx].info) num++;
+    }
+  }
+  else if (node->info_one_slot) {
+    if (node->info_one_slot == (slot + 1)) return &node->info_one;
+
+    if (node->info_one) {
+      one.slot = (node->info_one_slot - 1);
+      one.info = node->info_one;
+      num++;
+    }
+  }
+  else if (create) {
+    node->info_one = NULL;
+    __atomic_store_n(&node->info_one_slot, (slot + 1), __ATOMIC_RELEASE);
+    __atomic_add_fetch(&node->table->info_inline, 1, __ATOMIC_RELAXED);
+
+    return &node->info_one;
+  }
+
+  if (!create) return NULL;
+
+  new_map = malloc(sizeof(struct bgp_node_info_map) + ((num + 1) * sizeof(struct bgp_node_info_slot)));
+  if (!new_map) {
+    bms = bgp_select_misc_db(peer->type);
+    Log(LOG_ERR, "ERROR ( %s/%s ): malloc() failed (bgp_node_info_head). Exiting ..\n", config.name, (bms ? bms->log_str : "core/BGP"));
+    exit_gracefully(1);
+  }
+
+  new_map->num = 0;
+
+  if (one.info) {
+    if (one.slot > slot) {
+      new_map->s[new_map->num].slot = slot;
+      new_map->s[new_map->num].info = NULL;
+      head = &new_map->s[new_map->num].info;
+      new_map->num++;
+    }
+
+    new_map->s[new_map->num] = one;
+    new_map->num++;
+  }
+
+  for (idx = 0; idx < old_num; idx++) {
+    if (!old_map->s[idx].info) continue;
+
+    if (!head && old_map->s[idx].slot > slot) {
+      new_map->s[new_map->num].slot = slot;
+      new_map->s[new_map->num].info = NULL;
+      head = &new_map->s[new_map->num].info;
+      new_map->num++;
+    }
+
+    new_map->s[new_map->num] = old_map->s[idx];
+    new_map->num++;
+  }
+
+  if (!head) {
+    new_map->s[new_map->num].slot = slot;
+    new_map->s[new_map->num].info = NULL;
+    head = &new_map->s[new_map->num].info;
+    new_map->num++;
+  }
+
+  __atomic_add_fetch(&node->table->info_slots, (new_map->num - old_num), __ATOMIC_RELAXED);
+  if (!old_map) {
+    __atomic_add_fetch(&node->table->info_maps, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&node->table->info_inline, 1, __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&node->info, new_map, __ATOMIC_RELEASE);
+
+  if (old_map) bgp_mem_retire(old_map);
+
+  return head;
 }
 
 void bgp_node_vector_debug(struct bgp_node_vector *bnv, struct prefix *p)
@@ -261,7 +433,7 @@ bgp_node_match (const struct bgp_table *table, struct prefix *p, struct bgp_peer
   /* Walk down tree.  If there is matched route then store it to matched. */
   while (node && node->p.prefixlen <= p->prefixlen && prefix_match(&node->p, p)) {
     for (local_modulo = modulo, modulo_idx = 0; modulo_idx < modulo_max; local_modulo++, modulo_idx++) {
-      for (info = node->info[local_modulo]; info; info = info->next) {
+      for (info = BGP_NODE_INFO(node, local_modulo); info; info = info->next) {
 	if (!cmp_func(info, nmct2)) {
 	  matched_node = node;
 	  matched_info = info;
@@ -327,6 +499,50 @@ bgp_node_match_ipv6 (const struct bgp_table *table, struct in6_addr *addr, struc
   bgp_node_match (table, (struct prefix *) &p, peer, modulo_func, cmp_func, nmct2, bnv, result_node, result_info);
 }
 
+/* Pre-order walk of a subtree, pruned below 'maxlen' */
+static void
+bgp_table_walk_node (struct bgp_node *node, u_int8_t maxlen,
+		     void (*func)(struct bgp_node *, void *), void *arg)
+{
+  if (!node || node->p.prefixlen > maxlen) return;
+
+  func (node, arg);
+
+  bgp_table_walk_node (node->l_left, maxlen, func, arg);
+  bgp_table_walk_node (node->l_right, maxlen, func, arg);
+}
+
+/* Visit the nodes whose prefix falls within 'p' and is not longer than
+   'maxlen'; ancestors are always visited before their descendants. The
+   table is locked for reading meanwhile: 'func' may take node locks, not
+   change the tree. */
+void
+bgp_table_walk_subtree (const struct bgp_table *table, struct prefix *p, u_int8_t maxlen,
+			void (*func)(struct bgp_node *, void *), void *arg)
+{
+  struct bgp_node *node;
+
+  if (!table || !func) return;
+
+  BGP_TABLE_RDLOCK (table);
+
+  node = table->top;
+
+  while (node && node->p.prefixlen < p->prefixlen) {
+    if (!prefix_match (&node->p, p)) {
+      node = NULL;
+      break;
+    }
+
+    node = node->link[check_bit(&p->u.prefix, node->p.prefixlen)];
+  }
+
+  if (node && prefix_match (p, &node->p))
+    bgp_table_walk_node (node, maxlen, func, arg);
+
+  BGP_TABLE_UNLOCK (table);
+}
+
 /* Add node to routing table. */
 struct bgp_node *
 bgp_node_get (struct bgp_peer *peer, struct bgp_table *const table, struct prefix *p)
@@ -337,6 +553,26 @@ bgp_node_get (struct bgp_peer *peer, struct bgp_table *const table, struct prefi
   struct bgp_node *node;
   struct bgp_node *match;
 
+  /* most often the node is there already: no need to hold off others */
+  BGP_TABLE_RDLOCK (table);
+
+  node = table->top;
+  while (node && node->p.prefixlen <= p->prefixlen && prefix_match (&node->p, p))
+    {
+      if (node->p.prefixlen == p->prefixlen)
+	{
+	  bgp_lock_node (peer, node);
+	  BGP_TABLE_UNLOCK (table);
+	  return node;
+	}
+      node = node->link[check_bit(&p->u.prefix, node->p.prefixlen)];
+    }
+
+  BGP_TABLE_UNLOCK (table);
+
+  /* not found: look again, the tree may have changed before write lock */
+  BGP_TABLE_WRLOCK (table);
+
   match = NULL;
   node = table->top;
   while (node && node->p.prefixlen <= p->prefixlen && 
@@ -345,6 +581,7 @@ bgp_node_get (struct bgp_peer *peer, struct bgp_table *const table, struct prefi
       if (node->p.prefixlen == p->prefixlen)
 	{
 	  bgp_lock_node (peer, node);
+	  BGP_TABLE_UNLOCK (table);
 	  return node;
 	}
       match = node;
@@ -361,10 +598,9 @@ bgp_node_get (struct bgp_peer *peer, struct bgp_table *const table, struct prefi
     }
   else
     {
-      new = bgp_node_create (peer);
+      new = bgp_node_create (peer, table);
       route_common (&node->p, p, &new->p);
       new->p.family = p->family;
-      new->table = table;
       set_link (new, node);
 
       if (match)
@@ -382,6 +618,10 @@ bgp_node_get (struct bgp_peer *peer, struct bgp_table *const table, struct prefi
     }
   table->count++;
   bgp_lock_node (peer, new);
+
+  bgp_table_reclaim (table, FALSE);
+
+  BGP_TABLE_UNLOCK (table);
   
   return new;
 }
@@ -390,15 +630,15 @@ bgp_node_get (struct bgp_peer *peer, struct bgp_table *const table, struct prefi
 static void
 bgp_node_delete (struct bgp_peer *peer, struct bgp_node *node)
 {
-  struct bgp_misc_structs *bms = bgp_select_misc_db(peer->type);
   struct bgp_node *child;
   struct bgp_node *parent;
   u_int32_t ri_idx;
 
   assert (node->lock == 0);
 
-  for (ri_idx = 0; ri_idx < (bms->table_peer_buckets * bms->table_per_peer_buckets); ri_idx++)
-    assert (node->info[ri_idx] == NULL);
+  for (ri_idx = 0; node->info && ri_idx < node->info->num; ri_idx++)
+    assert (node->info->s[ri_idx].info == NULL);
+  assert (node->info || node->info_one == NULL);
 
   if (node->l_left && node->l_right)
     return;
@@ -437,60 +677,140 @@ bgp_node_delete (struct bgp_peer *peer, struct bgp_node *node)
 struct bgp_node *
 bgp_table_top (struct bgp_peer *peer, const struct bgp_table *const table)
 {
+  struct bgp_node *top;
+
   if (table) {
+    BGP_TABLE_RDLOCK (table);
+
     /* If there is no node in the routing table return NULL. */
-    if (table->top == NULL)
-      return NULL;
+    top = table->top;
 
     /* Lock the top node and return it. */
-    bgp_lock_node (peer, table->top);
-    return table->top;
+    if (top) bgp_lock_node (peer, top);
+
+    BGP_TABLE_UNLOCK (table);
+
+    return top;
   }
   
   return NULL;
 }
 
-/* Unlock current node and lock next node then return it. */
+/* Unlock current node and lock next node then return it. The step is
+   taken with the table locked for reading: other threads may be inserting
+   or deleting nodes around the current one meanwhile. */
 struct bgp_node *
 bgp_route_next (struct bgp_peer *peer, struct bgp_node *node)
 {
-  struct bgp_node *next;
-  struct bgp_node *start;
+  struct bgp_table *table = node->table;
+  struct bgp_node *next = NULL;
+  struct bgp_node *start = node;
 
-  /* Node may be deleted from bgp_unlock_node so we have to preserve
-     next node's pointer. */
+  BGP_TABLE_RDLOCK (table);
 
   if (node->l_left)
+    next = node->l_left;
+  else if (node->l_right)
+    next = node->l_right;
+  else
     {
-      next = node->l_left;
-      bgp_lock_node (peer, next);
-      bgp_unlock_node (peer, node);
-      return next;
+      while (node->parent)
+	{
+	  if (node->parent->l_left == node && node->parent->l_right)
+	    {
+	      next = node->parent->l_right;
+	      break;
+	    }
+	  node = node->parent;
+	}
     }
-  if (node->l_right)
+
+  if (next)
+    bgp_lock_node (peer, next);
+
+  BGP_TABLE_UNLOCK (table);
+
+  /* may delete the node, hence to be done without the table locked */
+  bgp_unlock_node (peer, start);
+
+  return next;
+}
+
+/* Order of bgp_route_next(): by address bits, a prefix before the ones
+   it covers. */
+static int
+bgp_node_walk_cmp (const struct prefix *p1, const struct prefix *p2)
+{
+  int offset;
+  int shift;
+  int ret;
+  u_char b1, b2;
+
+  const u_char *pp1 = (const u_char *)&p1->u.prefix;
+  const u_char *pp2 = (const u_char *)&p2->u.prefix;
+
+  offset = MIN (p1->prefixlen, p2->prefixlen) / 8;
+  shift = MIN (p1->prefixlen, p2->prefixlen) % 8;
+
+  if (offset && (ret = memcmp (pp1, pp2, offset)))
+    return ret;
+
+  if (shift)
     {
-      next = node->l_right;
-      bgp_lock_node (peer, next);
-      bgp_unlock_node (peer, node);
-      return next;
+      b1 = pp1[offset] & maskbit[shift];
+      b2 = pp2[offset] & maskbit[shift];
+
+      if (b1 != b2)
+	return (b1 < b2 ? -1 : 1);
     }
 
-  start = node;
-  while (node->parent)
+  return (p1->prefixlen - p2->prefixlen);
+}
+
+static struct bgp_node *
+bgp_node_seek (struct bgp_node *node, const struct prefix *p)
+{
+  struct bgp_node *next;
+
+  for (; node; node = node->l_right)
     {
-      if (node->parent->l_left == node && node->parent->l_right)
-	{
-	  next = node->parent->l_right;
-	  bgp_lock_node (peer, next);
-	  bgp_unlock_node (peer, start);
-	  return next;
-	}
-      node = node->parent;
+      /* a node comes before all of its subtree */
+      if (bgp_node_walk_cmp (&node->p, p) >= 0)
+	return node;
+
+      /* then, if it does not cover p, so does its subtree */
+      if (!prefix_match (&node->p, p))
+	return NULL;
+
+      if ((next = bgp_node_seek (node->l_left, p)))
+	return next;
     }
-  bgp_unlock_node (peer, start);
+
   return NULL;
 }
 
+/* Lock and return the node of p or, if not in the table (anymore), the
+   one following it in bgp_route_next() order; NULL if none. Lets a walk
+   let go of its node and carry on from there later. */
+struct bgp_node *
+bgp_table_seek (struct bgp_peer *peer, const struct bgp_table *const table, const struct prefix *p)
+{
+  struct bgp_node *node;
+
+  if (!table)
+    return NULL;
+
+  BGP_TABLE_RDLOCK (table);
+
+  node = bgp_node_seek (table->top, p);
+
+  if (node) bgp_lock_node (peer, node);
+
+  BGP_TABLE_UNLOCK (table);
+
+  return node;
+}
+
 /* Free route table. */
 void bgp_table_free (struct bgp_table *rt)
 {
@@ -541,6 +861,10 @@ void bgp_table_free (struct bgp_table *rt)
  
   assert (rt->count == 0);
 
+  /* no lookups can reach the table anymore */
+  bgp_table_reclaim (rt, TRUE);
+  if (rt->retired) free (rt->retired);
+
   free(rt);
   return;
 }
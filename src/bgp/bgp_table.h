@@ -42,6 +42,62 @@ struct bgp_table
   struct bgp_node *top;
   
   unsigned long count;
+
+  /* set if the table is updated by multiple threads (bgp_daemon_threads,
+     bgp_table_dump_workers). 'rwlock' guards the tree structure: taken for
+     reading to find an existing node or to step a walk, for writing to
+     link or unlink nodes. The chains of paths and the route info slot maps
+     of a node are guarded by one of the 'node_mutex' stripes, picked by
+     node, so that paths of different prefixes are updated concurrently.
+     Lookups take neither, see bgp_mem_reader_online() */
+  pthread_rwlock_t *rwlock;
+  pthread_mutex_t *node_mutex;
+
+  /* nodes unlinked from the tree, freed once lookups moved past them */
+  struct bgp_node_retired *retired;
+  u_int32_t retired_num;
+  u_int32_t retired_max;
+
+  /* memory accounting, see bgp_mem_report() */
+  struct bgp_slab node_slab;
+  u_int64_t info_maps;
+  u_int64_t info_slots;
+  u_int64_t info_inline;
+};
+
+#define BGP_TABLE_NODE_LOCKS	1024	/* power of two */
+
+#define BGP_TABLE_RDLOCK(table)	do { if ((table)->rwlock) pthread_rwlock_rdlock((table)->rwlock); } while (0)
+#define BGP_TABLE_WRLOCK(table)	do { if ((table)->rwlock) pthread_rwlock_wrlock((table)->rwlock); } while (0)
+#define BGP_TABLE_UNLOCK(table)	do { if ((table)->rwlock) pthread_rwlock_unlock((table)->rwlock); } while (0)
+
+/* recursive; may be taken with the table locked, not the other way round */
+#define BGP_NODE_MUTEX(node)	(&(node)->table->node_mutex[((uintptr_t) (node) >> 6) & (BGP_TABLE_NODE_LOCKS - 1)])
+#define BGP_NODE_LOCK(node)	do { if ((node)->table->node_mutex) pthread_mutex_lock(BGP_NODE_MUTEX(node)); } while (0)
+#define BGP_NODE_UNLOCK(node)	do { if ((node)->table->node_mutex) pthread_mutex_unlock(BGP_NODE_MUTEX(node)); } while (0)
+
+/* route info of a node: one chain of paths per slot in use (a peer and
+   path-id bucket, see bgp_route_info_modulo_pathid()), sorted by slot, so
+   that memory scales with the paths actually present at the node. Maps are
+   copied on insert and the old copy retired, as lookups do not lock. The
+   first slot used at a node is kept inline in it, saving the map for the
+   common case of prefixes seen by a single peer */
+struct bgp_node_retired
+{
+  struct bgp_node *node;
+  u_int64_t epoch;
+};
+
+struct bgp_node_info_slot
+{
+  u_int32_t slot;
+  struct bgp_info *info;
+};
+
+struct bgp_node_info_map
+{
+  u_int32_t num;
+  struct bgp_node_info_slot s[];
 };
 
 struct bgp_node
@@ -54,11 +110,16 @@ struct bgp_node
 #define l_left   link[0]
 #define l_right  link[1]
 
-  void **info;
+  struct bgp_node_info_map *info;
+  struct bgp_info *info_one;	/* inline slot, unused once 'info' is set */
 
   unsigned int lock;
+  u_int32_t info_one_slot;	/* slot + 1 of 'info_one', 0 if unused */
 };
 
+/* head of the chain of paths of a node for a given slot, NULL if none */
+#define BGP_NODE_INFO(node, slot) bgp_node_info_get((node), (slot))
+
 struct bgp_msg_extra_data {
   u_int8_t id;
   u_int16_t len;
@@ -84,6 +145,16 @@ struct bgp_info
   struct bgp_msg_extra_data bmed;
 };
 
+/* path unlinked from the RIB, or attributes replaced on a path, that
+   lookups may still be reading; see bgp_peer_retired_commit() */
+struct bgp_info_retired
+{
+  struct bgp_node *node;
+  struct bgp_info *info;
+  struct bgp_attr *attr;
+  u_int64_t epoch;
+};
+
 struct node_match_cmp_term2 {
   struct bgp_peer *peer;
   afi_t afi;
@@ -112,8 +183,13 @@ extern struct bgp_table *bgp_table_init (afi_t, safi_t);
 extern void bgp_unlock_node (struct bgp_peer *, struct bgp_node *node);
 extern struct bgp_node *bgp_table_top (struct bgp_peer *, const struct bgp_table *const);
 extern struct bgp_node *bgp_route_next (struct bgp_peer *, struct bgp_node *);
+extern struct bgp_node *bgp_table_seek (struct bgp_peer *, const struct bgp_table *const, const struct prefix *);
 extern struct bgp_node *bgp_node_get (struct bgp_peer *, struct bgp_table *const, struct prefix *);
 extern struct bgp_node *bgp_lock_node (struct bgp_peer *, struct bgp_node *node);
+extern struct bgp_info *bgp_node_info_get (struct bgp_node *, u_int32_t);
+extern struct bgp_info **bgp_node_info_head (struct bgp_peer *, struct bgp_node *, u_int32_t, int);
+extern void bgp_table_walk_subtree (const struct bgp_table *, struct prefix *, u_int8_t,
+				    void (*)(struct bgp_node *, void *), void *);
 extern void bgp_node_vector_debug(struct bgp_node_vector *, struct prefix *);
 extern void bgp_node_match (const struct bgp_table *, struct prefix *, struct bgp_peer *,
 			 u_int32_t (*modulo_func)(struct bgp_peer *, path_id_t *, int),
@@ -33,6 +33,15 @@
 #include "kafka_common.h"
 #endif
 
+/* variables */
+static struct bgp_mem_retired *bgp_mem_retired_list;
+static int bgp_mem_retired_num, bgp_mem_retired_max;
+static pthread_mutex_t bgp_mem_retired_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct bgp_mem_reader bgp_mem_readers[BGP_MEM_READERS_MAX];
+static int bgp_mem_readers_num;
+static u_int64_t bgp_mem_epoch = 1;
+static u_int32_t bgp_rib_gen_seq;
+
 /* BGP Address Famiy Identifier to UNIX Address Family converter. */
 int bgp_afi2family (int afi)
 {
@@ -216,12 +225,7 @@ struct bgp_attr_extra *bgp_attr_extra_new(struct bgp_info *ri)
 
   if (!bms) return NULL;
 
-  new = malloc(sizeof(struct bgp_attr_extra));
-  if (!new) {
-    Log(LOG_ERR, "ERROR ( %s/%s ): malloc() failed (bgp_attr_extra_new). Exiting ..\n", config.name, bms->log_str);
-    exit_gracefully(1);
-  }
-  else memset(new, 0, sizeof (struct bgp_attr_extra));
+  new = bgp_slab_alloc(&ri->peer->attr_extra_slab, sizeof(struct bgp_attr_extra));
 
   return new;
 }
@@ -235,7 +239,7 @@ void bgp_attr_extra_free(struct bgp_peer *peer, struct bgp_attr_extra **attr_ext
   if (!bms) return;
 
   if (attr_extra && (*attr_extra)) {
-    free(*attr_extra);
+    bgp_slab_free(&peer->attr_extra_slab, (*attr_extra));
     *attr_extra = NULL;
   }
 }
@@ -317,37 +321,216 @@ struct bgp_info *bgp_info_new(struct bgp_peer *peer)
 
   if (!bms) return NULL;
 
-  new = malloc(sizeof(struct bgp_info));
-  if (!new) {
-    Log(LOG_ERR, "ERROR ( %s/%s ): malloc() failed (bgp_info_new). Exiting ..\n", config.name, bms->log_str);
+  new = bgp_slab_alloc(&peer->info_slab, sizeof(struct bgp_info));
+
+  return new;
+}
+
+/*
+  Epoch-based reclamation of memory that lock-free readers (ie. flow
+  lookups from the collector thread) may still be walking although it was
+  already unlinked. Each reader registers a slot and, before it starts
+  looking up, publishes the global epoch it observed (online); when it no
+  longer holds any reference to RIB memory, ie. between packets, it goes
+  offline. Memory retired at epoch 'e' is freed once every online reader
+  has observed an epoch past 'e': no reader can reach it anymore.
+*/
+int bgp_mem_reader_register()
+{
+  int idx;
+
+  pthread_mutex_lock(&bgp_mem_retired_mutex);
+
+  if (bgp_mem_readers_num == BGP_MEM_READERS_MAX) {
+    pthread_mutex_unlock(&bgp_mem_retired_mutex);
+    Log(LOG_ERR, "ERROR ( %s/core/BGP ): too many lock-free RIB readers (bgp_mem_reader_register). Exiting ..\n", config.name);
     exit_gracefully(1);
   }
-  else memset(new, 0, sizeof (struct bgp_info));
-  
-  return new;
+
+  idx = bgp_mem_readers_num;
+  __atomic_store_n(&bgp_mem_readers[idx].epoch, BGP_MEM_READER_OFFLINE, __ATOMIC_RELAXED);
+  __atomic_store_n(&bgp_mem_readers_num, (idx + 1), __ATOMIC_RELEASE);
+
+  pthread_mutex_unlock(&bgp_mem_retired_mutex);
+
+  return idx;
+}
+
+/* Also a quiescent state: references taken before the call are dropped */
+void bgp_mem_reader_online(int reader)
+{
+  struct bgp_mem_reader *r;
+  u_int64_t epoch, check;
+
+  if (reader < 0) return;
+
+  r = &bgp_mem_readers[reader];
+  epoch = __atomic_load_n(&bgp_mem_epoch, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&r->epoch, __ATOMIC_RELAXED) == epoch) return;
+
+  /* re-check the epoch did not move before our slot became visible */
+  for (;;) {
+    __atomic_store_n(&r->epoch, epoch, __ATOMIC_SEQ_CST);
+
+    check = __atomic_load_n(&bgp_mem_epoch, __ATOMIC_SEQ_CST);
+    if (check == epoch) break;
+
+    epoch = check;
+  }
+}
+
+void bgp_mem_reader_offline(int reader)
+{
+  if (reader < 0) return;
+
+  __atomic_store_n(&bgp_mem_readers[reader].epoch, BGP_MEM_READER_OFFLINE, __ATOMIC_RELEASE);
+}
+
+/* Epoch to tag memory with once it was unlinked */
+u_int64_t bgp_mem_epoch_get()
+{
+  return __atomic_load_n(&bgp_mem_epoch, __ATOMIC_SEQ_CST);
+}
+
+/* Starts a new epoch; memory tagged with an epoch lower than the returned
+   one can't be reached by readers anymore and can be freed */
+u_int64_t bgp_mem_epoch_safe()
+{
+  u_int64_t safe, epoch;
+  int idx, num;
+
+  safe = __atomic_add_fetch(&bgp_mem_epoch, 1, __ATOMIC_SEQ_CST);
+  num = __atomic_load_n(&bgp_mem_readers_num, __ATOMIC_ACQUIRE);
+
+  for (idx = 0; idx < num; idx++) {
+    epoch = __atomic_load_n(&bgp_mem_readers[idx].epoch, __ATOMIC_SEQ_CST);
+    if (epoch != BGP_MEM_READER_OFFLINE && epoch < safe) safe = epoch;
+  }
+
+  return safe;
+}
+
+/* Waits for all readers to have dropped references taken before the call */
+void bgp_mem_synchronize()
+{
+  u_int64_t epoch = bgp_mem_epoch_get();
+
+  while (bgp_mem_epoch_safe() <= epoch) usleep(1000);
+}
+
+void bgp_mem_retire(void *ptr)
+{
+  bgp_mem_retire_func(ptr, free);
+}
+
+/* As bgp_mem_retire(), for memory to be released via 'free_func' */
+void bgp_mem_retire_func(void *ptr, void (*free_func)(void *))
+{
+  if (!ptr) return;
+
+  pthread_mutex_lock(&bgp_mem_retired_mutex);
+
+  if (bgp_mem_retired_num == bgp_mem_retired_max) {
+    struct bgp_mem_retired *new_list;
+    int new_max = (bgp_mem_retired_max ? (bgp_mem_retired_max * 2) : 1024);
+
+    new_list = realloc(bgp_mem_retired_list, (new_max * sizeof(struct bgp_mem_retired)));
+    if (!new_list) {
+      Log(LOG_ERR, "ERROR ( %s/core/BGP ): realloc() failed (bgp_mem_retire_func). Exiting ..\n", config.name);
+      exit_gracefully(1);
+    }
+
+    bgp_mem_retired_list = new_list;
+    bgp_mem_retired_max = new_max;
+  }
+
+  bgp_mem_retired_list[bgp_mem_retired_num].ptr = ptr;
+  bgp_mem_retired_list[bgp_mem_retired_num].free_func = free_func;
+  bgp_mem_retired_list[bgp_mem_retired_num].epoch = bgp_mem_epoch_get();
+  __atomic_store_n(&bgp_mem_retired_num, (bgp_mem_retired_num + 1), __ATOMIC_RELAXED);
+
+  pthread_mutex_unlock(&bgp_mem_retired_mutex);
+}
+
+int bgp_mem_retired_pending()
+{
+  return __atomic_load_n(&bgp_mem_retired_num, __ATOMIC_RELAXED);
+}
+
+void bgp_mem_reclaim()
+{
+  u_int64_t safe;
+  int idx;
+
+  if (!bgp_mem_retired_pending()) return;
+
+  pthread_mutex_lock(&bgp_mem_retired_mutex);
+
+  safe = bgp_mem_epoch_safe();
+
+  /* the list is sorted by epoch */
+  for (idx = 0; idx < bgp_mem_retired_num; idx++) {
+    if (bgp_mem_retired_list[idx].epoch >= safe) break;
+    bgp_mem_retired_list[idx].free_func(bgp_mem_retired_list[idx].ptr);
+  }
+
+  if (idx) {
+    memmove(bgp_mem_retired_list, &bgp_mem_retired_list[idx], ((bgp_mem_retired_num - idx) * sizeof(struct bgp_mem_retired)));
+    __atomic_store_n(&bgp_mem_retired_num, (bgp_mem_retired_num - idx), __ATOMIC_RELAXED);
+  }
+
+  pthread_mutex_unlock(&bgp_mem_retired_mutex);
+}
+
+/* Invalidates lookup results cached for the peer; to be called after a
+   path of the peer was linked or unlinked, and before it is freed */
+void bgp_peer_rib_gen_bump(struct bgp_peer *peer)
+{
+  u_int32_t gen;
+
+  if (!peer) return;
+
+  gen = __atomic_add_fetch(&bgp_rib_gen_seq, 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&peer->rib_gen, gen, __ATOMIC_RELEASE);
+
+  /* BMP lookups are keyed on the parent BMP peer, see bgp_lookup_node_match_cmp_bmp() */
+  if (peer->type == FUNC_TYPE_BMP && peer->bmp_se) {
+    struct bgp_peer *bmpp_self = (struct bgp_peer *) peer->bmp_se;
+
+    __atomic_store_n(&bmpp_self->rib_gen, gen, __ATOMIC_RELEASE);
+  }
 }
 
 void bgp_info_add(struct bgp_peer *peer, struct bgp_node *rn, struct bgp_info *ri, u_int32_t modulo)
 {
-  struct bgp_info *top;
+  struct bgp_info **head, *top;
+
+  BGP_NODE_LOCK(rn);
 
-  top = rn->info[modulo];
+  head = bgp_node_info_head(peer, rn, modulo, TRUE);
+  top = (*head);
 
-  ri->next = rn->info[modulo];
+  ri->next = top;
   ri->prev = NULL;
   if (top)
     top->prev = ri;
-  rn->info[modulo] = ri;
+  __atomic_store_n(head, ri, __ATOMIC_RELEASE);
 
   bgp_lock_node(peer, rn);
+
+  BGP_NODE_UNLOCK(rn);
+
+  bgp_peer_rib_gen_bump(ri->peer);
+
   ri->peer->lock++;
+  ri->peer->routes[rn->table->afi][rn->table->safi]++;
 }
 
+/* Unlinks a path from the RIB; freeing it, and unlocking its node, is left
+   to bgp_peer_retired_commit() as lookups may still be reading it */
 void bgp_info_delete(struct bgp_peer *peer, struct bgp_node *rn, struct bgp_info *ri, u_int32_t modulo)
 {
-  struct bgp_misc_structs *bms;
-
-  bms = bgp_select_misc_db(peer->type);
+  BGP_NODE_LOCK(rn);
 
   if (ri->next) {
     ri->next->prev = ri->prev;
@@ -356,12 +539,101 @@ void bgp_info_delete(struct bgp_peer *peer, struct bgp_node *rn, struct bgp_info
     ri->prev->next = ri->next;
   }
   else {
-    rn->info[modulo] = ri->next;
+    struct bgp_info **head = bgp_node_info_head(peer, rn, modulo, FALSE);
+
+    if (head) __atomic_store_n(head, ri->next, __ATOMIC_RELEASE);
   }
 
-  bgp_info_free(peer, ri, bms->bgp_extra_data_free);
+  BGP_NODE_UNLOCK(rn);
+
+  bgp_peer_rib_gen_bump(ri->peer);
+
+  ri->peer->routes[rn->table->afi][rn->table->safi]--;
 
-  bgp_unlock_node(peer, rn);
+  bgp_info_retire(peer, rn, ri, NULL);
+}
+
+/*
+  Paths unlinked from the RIB (and attributes replaced on a path still in
+  it) are queued onto the peer owning them, rather than freed, as lookups
+  run without locks. Entries are tagged with the current epoch on the next
+  bgp_peer_retired_commit(), ie. once the UPDATE message is done with and
+  no published FIB leaf points to them anymore, and freed by the peer
+  owner thread once lookups moved past that epoch.
+*/
+void bgp_info_retire(struct bgp_peer *peer, struct bgp_node *rn, struct bgp_info *ri, struct bgp_attr *attr)
+{
+  struct bgp_misc_structs *bms = bgp_select_misc_db(peer->type);
+  struct bgp_info_retired *new_retired;
+  u_int32_t new_max;
+
+  if (peer->retired_num == peer->retired_max) {
+    new_max = (peer->retired_max ? (peer->retired_max * 2) : 64);
+
+    new_retired = realloc(peer->retired, (new_max * sizeof(struct bgp_info_retired)));
+    if (!new_retired) {
+      Log(LOG_ERR, "ERROR ( %s/%s ): realloc() failed (bgp_info_retire). Exiting ..\n", config.name, (bms ? bms->log_str : "core/BGP"));
+      exit_gracefully(1);
+    }
+
+    peer->retired = new_retired;
+    peer->retired_max = new_max;
+  }
+
+  peer->retired[peer->retired_num].node = rn;
+  peer->retired[peer->retired_num].info = ri;
+  peer->retired[peer->retired_num].attr = attr;
+  peer->retired[peer->retired_num].epoch = 0;
+  peer->retired_num++;
+}
+
+/* Frees retired entries whose epoch lookups moved past, all if 'force' */
+static void bgp_peer_retired_reclaim(struct bgp_peer *peer, u_int64_t safe, int force)
+{
+  struct bgp_misc_structs *bms = bgp_select_misc_db(peer->type);
+  struct bgp_info_retired *bir;
+  u_int32_t idx;
+
+  for (idx = 0; idx < peer->retired_num; idx++) {
+    bir = &peer->retired[idx];
+    if (!force && (idx >= peer->retired_tagged || bir->epoch >= safe)) break;
+
+    if (bir->attr) bgp_attr_unintern(peer, bir->attr);
+
+    if (bir->info) {
+      bgp_info_free(peer, bir->info, (bms ? bms->bgp_extra_data_free : NULL));
+      bgp_unlock_node(peer, bir->node);
+    }
+  }
+
+  if (idx) {
+    peer->retired_num -= idx;
+    peer->retired_tagged -= MIN(idx, peer->retired_tagged);
+    memmove(peer->retired, &peer->retired[idx], (peer->retired_num * sizeof(struct bgp_info_retired)));
+  }
+}
+
+/* Tags entries retired since the last call with the current epoch and
+   frees those lookups moved past; to be called by the thread owning the
+   peer, once done with a message (and with the FIB, see bgp_fib_commit()) */
+void bgp_peer_retired_commit(struct bgp_peer *peer)
+{
+  u_int64_t epoch;
+
+  if (!peer) return;
+
+  if (peer->retired_num) {
+    if (peer->retired_tagged < peer->retired_num) {
+      epoch = bgp_mem_epoch_get();
+
+      for (; peer->retired_tagged < peer->retired_num; peer->retired_tagged++)
+	peer->retired[peer->retired_tagged].epoch = epoch;
+    }
+
+    bgp_peer_retired_reclaim(peer, bgp_mem_epoch_safe(), FALSE);
+  }
+
+  bgp_mem_reclaim();
 }
 
 /* Free bgp route information. */
@@ -369,11 +641,65 @@ void bgp_info_free(struct bgp_peer *peer, struct bgp_info *ri, void (*bgp_extra_
 {
   if (ri->attr) bgp_attr_unintern(peer, ri->attr);
 
-  bgp_attr_extra_free(peer, &ri->attr_extra);
+  bgp_attr_extra_free(ri->peer, &ri->attr_extra);
   if (bgp_extra_data_free) (*bgp_extra_data_free)(&ri->bmed);
 
   ri->peer->lock--;
-  free(ri);
+  bgp_slab_free(&ri->peer->info_slab, ri);
+}
+
+/* Logs the memory held by the RIB: per AFI/SAFI table (nodes and route info
+   slot maps) and per peer (routes by AFI/SAFI, bgp_info and bgp_attr_extra) */
+void bgp_mem_report(struct bgp_peer *peers, int max_peers, int type)
+{
+  struct bgp_rt_structs *inter_domain_routing_db = bgp_select_routing_db(type);
+  struct bgp_misc_structs *bms = bgp_select_misc_db(type);
+  struct bgp_table *table;
+  struct bgp_peer *peer;
+  char peer_str[INET6_ADDRSTRLEN];
+  u_int64_t bytes, tot_bytes = 0;
+  int peers_idx;
+  afi_t afi;
+  safi_t safi;
+
+  if (!inter_domain_routing_db || !bms || !peers) return;
+
+  for (afi = AFI_IP; afi < AFI_MAX; afi++) {
+    for (safi = SAFI_UNICAST; safi < SAFI_MAX; safi++) {
+      table = inter_domain_routing_db->rib[afi][safi];
+      if (!table || !table->node_slab.objs) continue;
+
+      bytes = (table->node_slab.bytes + (table->info_maps * sizeof(struct bgp_node_info_map)) +
+	       (table->info_slots * sizeof(struct bgp_node_info_slot)));
+      tot_bytes += bytes;
+
+      Log(LOG_NOTICE, "NOTICE ( %s/%s ): RIB memory: afi=%u safi=%u nodes=%" PRIu64 " info_inline=%" PRIu64 " info_maps=%" PRIu64 " info_slots=%" PRIu64 " bytes=%" PRIu64 "\n",
+	  config.name, bms->log_str, afi, safi, table->node_slab.objs, table->info_inline, table->info_maps, table->info_slots, bytes);
+    }
+  }
+
+  for (peers_idx = 0; peers_idx < max_peers; peers_idx++) {
+    peer = &peers[peers_idx];
+    if (!peer->fd) continue;
+
+    bgp_peer_print(peer, peer_str, INET6_ADDRSTRLEN);
+    bytes = (peer->info_slab.bytes + peer->attr_extra_slab.bytes);
+    tot_bytes += bytes;
+
+    Log(LOG_NOTICE, "NOTICE ( %s/%s ): [%s] RIB memory: info=%" PRIu64 " attr_extra=%" PRIu64 " bytes=%" PRIu64 "\n",
+	config.name, bms->log_str, peer_str, peer->info_slab.objs, peer->attr_extra_slab.objs, bytes);
+
+    for (afi = AFI_IP; afi < AFI_MAX; afi++) {
+      for (safi = SAFI_UNICAST; safi < SAFI_MAX; safi++) {
+	if (peer->routes[afi][safi]) {
+	  Log(LOG_NOTICE, "NOTICE ( %s/%s ): [%s] RIB memory: afi=%u safi=%u routes=%u\n",
+	      config.name, bms->log_str, peer_str, afi, safi, peer->routes[afi][safi]);
+	}
+      }
+    }
+  }
+
+  Log(LOG_NOTICE, "NOTICE ( %s/%s ): RIB memory: total bytes=%" PRIu64 " (excl. interned attributes)\n", config.name, bms->log_str, tot_bytes);
 }
 
 /* Initialization of attributes */
@@ -446,6 +772,8 @@ struct bgp_attr *bgp_attr_intern(struct bgp_peer *peer, struct bgp_attr *attr)
   inter_domain_routing_db = bgp_select_routing_db(peer->type);
 
   if (!inter_domain_routing_db) return NULL;
+
+  BGP_HASH_LOCK(inter_domain_routing_db);
  
   /* Intern referenced strucutre. */
   if (attr->aspath) {
@@ -476,6 +804,8 @@ struct bgp_attr *bgp_attr_intern(struct bgp_peer *peer, struct bgp_attr *attr)
   find = (struct bgp_attr *) hash_get(peer, inter_domain_routing_db->attrhash, attr, bgp_attr_hash_alloc);
   find->refcnt++;
 
+  BGP_HASH_UNLOCK(inter_domain_routing_db);
+
   return find;
 }
 
@@ -496,6 +826,8 @@ void bgp_attr_unintern(struct bgp_peer *peer, struct bgp_attr *attr)
   bms = bgp_select_misc_db(peer->type);
 
   if (!inter_domain_routing_db || !bms) return;
+
+  BGP_HASH_LOCK(inter_domain_routing_db);
  
   /* Decrement attribute reference. */
   attr->refcnt--;
@@ -521,6 +853,8 @@ void bgp_attr_unintern(struct bgp_peer *peer, struct bgp_attr *attr)
     ecommunity_unintern(peer, ecommunity);
   if (lcommunity)
     lcommunity_unintern(peer, lcommunity);
+
+  BGP_HASH_UNLOCK(inter_domain_routing_db);
 }
 
 void *bgp_attr_hash_alloc(void *p)
@@ -556,22 +890,25 @@ struct bgp_peer_cache *bgp_peer_cache_insert(struct bgp_peer_cache_bucket *cache
 {
   struct bgp_peer_cache *cursor, *last, *new, *ret = NULL;
 
-  pthread_mutex_lock(&peers_cache[bucket].mutex);  
+  pthread_mutex_lock(&cache[bucket].mutex);  
 
-  for (cursor = peers_cache[bucket].e, last = NULL; cursor; cursor = cursor->next) last = cursor;
+  for (cursor = cache[bucket].e, last = NULL; cursor; cursor = cursor->next) last = cursor;
 
   new = malloc(sizeof(struct bgp_peer_cache));
   if (new) {
     new->ptr = peer;
     new->next = NULL;
 
-    if (!last) peers_cache[bucket].e = new;
+    if (!last) cache[bucket].e = new;
     else last->next = new; 
 
     ret = new;
   }
 
-  pthread_mutex_unlock(&peers_cache[bucket].mutex);  
+  pthread_mutex_unlock(&cache[bucket].mutex);  
+
+  /* invalidates negative lookups cached by bgp_lookup_find_bgp_peer() */
+  __atomic_add_fetch(&peers_cache_gen, 1, __ATOMIC_RELEASE);
 
   return ret;
 }
@@ -581,11 +918,11 @@ int bgp_peer_cache_delete(struct bgp_peer_cache_bucket *cache, u_int32_t bucket,
   struct bgp_peer_cache *cursor, *last;
   int ret = ERR;
 
-  pthread_mutex_lock(&peers_cache[bucket].mutex);  
+  pthread_mutex_lock(&cache[bucket].mutex);  
 
-  for (cursor = peers_cache[bucket].e, last = NULL; cursor; cursor = cursor->next) {
+  for (cursor = cache[bucket].e, last = NULL; cursor; cursor = cursor->next) {
     if (cursor->ptr == peer) {
-      if (!last) peers_cache[bucket].e = cursor->next;
+      if (!last) cache[bucket].e = cursor->next;
       else last->next = cursor->next;
 
       free(cursor);
@@ -597,7 +934,7 @@ int bgp_peer_cache_delete(struct bgp_peer_cache_bucket *cache, u_int32_t bucket,
     last = cursor;
   }
 
-  pthread_mutex_unlock(&peers_cache[bucket].mutex);
+  pthread_mutex_unlock(&cache[bucket].mutex);
 
   return ret;
 }
@@ -607,9 +944,9 @@ struct bgp_peer *bgp_peer_cache_search(struct bgp_peer_cache_bucket *cache, u_in
   struct bgp_peer_cache *cursor;
   struct bgp_peer *ret = NULL;
 
-  pthread_mutex_lock(&peers_cache[bucket].mutex);
+  pthread_mutex_lock(&cache[bucket].mutex);
 
-  for (cursor = peers_cache[bucket].e; cursor; cursor = cursor->next) {
+  for (cursor = cache[bucket].e; cursor; cursor = cursor->next) {
     if (port) {
       if (cursor->ptr->tcp_port != port) continue;
     }
@@ -620,7 +957,26 @@ struct bgp_peer *bgp_peer_cache_search(struct bgp_peer_cache_bucket *cache, u_in
     }
   }
 
-  pthread_mutex_unlock(&peers_cache[bucket].mutex);
+  pthread_mutex_unlock(&cache[bucket].mutex);
+
+  return ret;
+}
+
+struct bgp_peer *bgp_peer_cache_search_id(struct bgp_peer_cache_bucket *cache, u_int32_t bucket, struct host_addr *ha)
+{
+  struct bgp_peer_cache *cursor;
+  struct bgp_peer *ret = NULL;
+
+  pthread_mutex_lock(&cache[bucket].mutex);
+
+  for (cursor = cache[bucket].e; cursor; cursor = cursor->next) {
+    if (!host_addr_cmp(&cursor->ptr->id, ha)) {
+      ret = cursor->ptr;
+      break;
+    }
+  }
+
+  pthread_mutex_unlock(&cache[bucket].mutex);
 
   return ret;
 }
@@ -689,6 +1045,8 @@ void bgp_peer_close(struct bgp_peer *peer, int type, int no_quiet, int send_noti
     if (bms->msglog_file || bms->msglog_amqp_routing_key || bms->msglog_kafka_topic)
       bgp_peer_log_close(peer, bms->msglog_output, peer->type);
 
+    if (bms->peers_mutex) pthread_mutex_lock(bms->peers_mutex);
+
     if (bms->peers_cache && bms->peers_port_cache) {
       u_int32_t bucket;
 
@@ -698,6 +1056,15 @@ void bgp_peer_close(struct bgp_peer *peer, int type, int no_quiet, int send_noti
       bucket = addr_port_hash(&peer->addr, peer->tcp_port, bms->max_peers);
       bgp_peer_cache_delete(bms->peers_port_cache, bucket, peer);
     }
+
+    if (bms->peers_id_cache && peer->id.family) {
+      u_int32_t bucket;
+
+      bucket = addr_hash(&peer->id, bms->max_peers);
+      bgp_peer_cache_delete(bms->peers_id_cache, bucket, peer);
+    }
+
+    if (bms->peers_mutex) pthread_mutex_unlock(bms->peers_mutex);
   }
   else {
     if (peer->xconnect_fd && peer->xconnect_fd != ERR) close(peer->xconnect_fd);
@@ -718,7 +1085,9 @@ void bgp_peer_close(struct bgp_peer *peer, int type, int no_quiet, int send_noti
   }
 
   if (bms->neighbors_file) {
+    if (bms->peers_mutex) pthread_mutex_lock(bms->peers_mutex);
     write_neighbors_file(bms->neighbors_file, peer->type);
+    if (bms->peers_mutex) pthread_mutex_unlock(bms->peers_mutex);
   }
 
   if (bms->peers_limit_log) {
@@ -833,6 +1202,26 @@ void bgp_peer_info_delete(struct bgp_peer *peer)
       bgp_table_info_delete(peer, table, afi, safi);
     }
   }
+
+  bgp_fib_destroy(peer);
+  bgp_peer_retired_flush(peer);
+}
+
+/* Frees all of the retired entries of a peer, ie. before it is re-used:
+   waits for lookups to be done with them first */
+void bgp_peer_retired_flush(struct bgp_peer *peer)
+{
+  if (!peer) return;
+
+  if (peer->retired_num) {
+    bgp_mem_synchronize();
+    bgp_peer_rib_gen_bump(peer);
+    bgp_peer_retired_reclaim(peer, 0, TRUE);
+  }
+
+  if (peer->retired) free(peer->retired);
+  peer->retired = NULL;
+  peer->retired_max = 0;
 }
 
 void bgp_table_info_delete(struct bgp_peer *peer, struct bgp_table *table, afi_t afi, safi_t safi)
@@ -840,6 +1229,10 @@ void bgp_table_info_delete(struct bgp_peer *peer, struct bgp_table *table, afi_t
   struct bgp_misc_structs *bms = bgp_select_misc_db(peer->type);
   struct bgp_node *node;
 
+  if (!table) return;
+
+  /* nodes are locked in turn, see bgp_route_next(); chains, which other
+     peers share, while they are walked */
   node = bgp_table_top(peer, table);
 
   while (node) {
@@ -851,8 +1244,10 @@ void bgp_table_info_delete(struct bgp_peer *peer, struct bgp_table *table, afi_t
     if (bms->route_info_modulo) modulo = bms->route_info_modulo(peer, NULL, bms->table_per_peer_buckets);
     else modulo = 0;
 
+    BGP_NODE_LOCK(node);
+
     for (peer_buckets = 0; peer_buckets < bms->table_per_peer_buckets; peer_buckets++) {
-      for (ri = node->info[modulo + peer_buckets]; ri; ri = ri_next) {
+      for (ri = BGP_NODE_INFO(node, (modulo + peer_buckets)); ri; ri = ri_next) {
 	if (ri->peer == peer) {
 	  if (bms->msglog_backend_methods) {
 	    char event_type[] = "log";
@@ -867,6 +1262,8 @@ void bgp_table_info_delete(struct bgp_peer *peer, struct bgp_table *table, afi_t
       }
     }
 
+    BGP_NODE_UNLOCK(node);
+
     node = bgp_route_next(peer, node);
   }
 }
@@ -1439,6 +1836,7 @@ void bgp_link_misc_structs(struct bgp_misc_structs *bms)
   bms->peers = peers;
   bms->peers_cache = peers_cache;
   bms->peers_port_cache = peers_port_cache;
+  bms->peers_id_cache = peers_id_cache;
   bms->peers_limit_log = &log_notifications.bgp_peers_limit;
   bms->xconnects = &bgp_xcs_map;
   bms->neighbors_file = config.bgp_daemon_neighbors_file; 
@@ -56,9 +56,14 @@ extern struct bgp_attr_extra *bgp_attr_extra_get(struct bgp_info *);
 extern struct bgp_attr_extra *bgp_attr_extra_process(struct bgp_peer *, struct bgp_info *, afi_t, safi_t, struct bgp_attr_extra *);
 
 extern struct bgp_info *bgp_info_new(struct bgp_peer *);
+extern void bgp_mem_report(struct bgp_peer *, int, int);
+extern void bgp_peer_rib_gen_bump(struct bgp_peer *);
 extern void bgp_info_add(struct bgp_peer *, struct bgp_node *, struct bgp_info *, u_int32_t);
 extern void bgp_info_delete(struct bgp_peer *, struct bgp_node *, struct bgp_info *, u_int32_t);
 extern void bgp_info_free(struct bgp_peer *, struct bgp_info *, void (*bgp_extra_data_free)(struct bgp_msg_extra_data *));
+extern void bgp_info_retire(struct bgp_peer *, struct bgp_node *, struct bgp_info *, struct bgp_attr *);
+extern void bgp_peer_retired_commit(struct bgp_peer *);
+extern void bgp_peer_retired_flush(struct bgp_peer *);
 extern void bgp_attr_init(int, struct bgp_rt_structs *);
 extern struct bgp_attr *bgp_attr_intern(struct bgp_peer *, struct bgp_attr *);
 extern void bgp_attr_unintern (struct bgp_peer *, struct bgp_attr *);
@@ -76,6 +81,7 @@ extern void bgp_peer_cache_init(struct bgp_peer_cache_bucket *, u_int32_t);
 extern struct bgp_peer_cache *bgp_peer_cache_insert(struct bgp_peer_cache_bucket *, u_int32_t, struct bgp_peer *);
 extern int bgp_peer_cache_delete(struct bgp_peer_cache_bucket *, u_int32_t, struct bgp_peer *);
 extern struct bgp_peer *bgp_peer_cache_search(struct bgp_peer_cache_bucket *, u_int32_t, struct host_addr *, u_int16_t);
+extern struct bgp_peer *bgp_peer_cache_search_id(struct bgp_peer_cache_bucket *, u_int32_t, struct host_addr *);
 
 extern void bgp_batch_init(struct bgp_peer_batch *, int, int);
 extern void bgp_batch_reset(struct bgp_peer_batch *, time_t);
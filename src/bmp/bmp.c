@@ -618,9 +618,18 @@ void skinny_bmp_daemon()
     }
     else drt_ptr = NULL;
 
+    /* wake up periodically to free memory retired from the RIB */
+    if (bgp_mem_retired_pending() && (!drt_ptr || dump_refresh_timeout.tv_sec > BGP_MEM_RECLAIM_INTERVAL)) {
+      dump_refresh_timeout.tv_sec = BGP_MEM_RECLAIM_INTERVAL;
+      dump_refresh_timeout.tv_usec = 0;
+      drt_ptr = &dump_refresh_timeout;
+    }
+
     select_num = select(select_fd, &read_descs, NULL, NULL, drt_ptr);
     if (select_num < 0) goto select_again;
 
+    bgp_mem_reclaim();
+
     if (reload_map_bmp_thread) {
       if (config.bmp_daemon_allow_file) load_allow_file(config.bmp_daemon_allow_file, &allow);
 
@@ -1716,7 +1716,7 @@ void bmp_handle_dump_event()
               struct bgp_info *ri;
 
               for (peer_buckets = 0; peer_buckets < config.bmp_table_per_peer_buckets; peer_buckets++) {
-                for (ri = node->info[modulo+peer_buckets]; ri; ri = ri->next) {
+                for (ri = BGP_NODE_INFO(node, (modulo+peer_buckets)); ri; ri = ri->next) {
 		  struct bmp_peer *local_bmpp = ri->peer->bmp_se;
 
                   if (local_bmpp && (&local_bmpp->self == peer)) {
@@ -2209,6 +2209,7 @@ avro_schema_t p_avro_schema_build_bmp_dump_close(int log_type, char *schema_name
   avro_schema_record_field_append(schema, "bmp_router_port", optint_s);
   avro_schema_record_field_append(schema, "entries", optint_s);
   avro_schema_record_field_append(schema, "tables", optint_s);
+  avro_schema_record_field_append(schema, "duration_ms", optint_s);
 
   avro_schema_decref(optlong_s);
   avro_schema_decref(optstr_s);
@@ -142,6 +142,7 @@ static const struct _dictionary_line dictionary[] = {
   {"print_history_offset", cfg_key_sql_history_offset},
   {"print_history_roundoff", cfg_key_sql_history_roundoff},
   {"print_max_writers", cfg_key_dump_max_writers},
+  {"print_writer_thread", cfg_key_dump_writer_thread},
   {"print_preprocess", cfg_key_sql_preprocess},
   {"print_preprocess_type", cfg_key_sql_preprocess_type},
   {"print_startup_delay", cfg_key_sql_startup_delay},
@@ -207,6 +208,8 @@ static const struct _dictionary_line dictionary[] = {
   {"kafka_partition_key", cfg_key_kafka_partition_key},
   {"kafka_cache_entries", cfg_key_print_cache_entries},
   {"kafka_max_writers", cfg_key_dump_max_writers},
+  {"kafka_writer_thread", cfg_key_dump_writer_thread},
+  {"kafka_purge_workers", cfg_key_kafka_purge_workers},
   {"kafka_preprocess", cfg_key_sql_preprocess},
   {"kafka_preprocess_type", cfg_key_sql_preprocess_type},
   {"kafka_startup_delay", cfg_key_sql_startup_delay},
@@ -229,6 +232,8 @@ static const struct _dictionary_line dictionary[] = {
   {"nfacctd_mcast_groups", cfg_key_nfacctd_mcast_groups},
   {"nfacctd_peer_as", cfg_key_nfprobe_peer_as},
   {"nfacctd_pipe_size", cfg_key_nfacctd_pipe_size},
+  {"nfacctd_workers", cfg_key_nfacctd_workers},
+  {"nfacctd_recv_batch", cfg_key_nfacctd_recv_batch},
   {"nfacctd_pro_rating", cfg_key_nfacctd_pro_rating},
   {"nfacctd_templates_file", cfg_key_nfacctd_templates_file},
   {"nfacctd_templates_receiver", cfg_key_nfacctd_templates_receiver},
@@ -250,6 +255,8 @@ static const struct _dictionary_line dictionary[] = {
   {"pmacctd_frag_buffer_size", cfg_key_pmacctd_frag_buffer_size},
   {"pmacctd_flow_buffer_size", cfg_key_pmacctd_flow_buffer_size},
   {"pmacctd_flow_buffer_buckets", cfg_key_pmacctd_flow_buffer_buckets},
+  {"pmacctd_flow_buffer_load_factor", cfg_key_pmacctd_flow_buffer_load_factor},
+  {"pmacctd_frag_buffer_load_factor", cfg_key_pmacctd_frag_buffer_load_factor},
   {"pmacctd_conntrack_buffer_size", cfg_key_pmacctd_conntrack_buffer_size},
   {"pmacctd_flow_lifetime", cfg_key_pmacctd_flow_lifetime},
   {"pmacctd_flow_tcp_lifetime", cfg_key_pmacctd_flow_tcp_lifetime},
@@ -258,12 +265,20 @@ static const struct _dictionary_line dictionary[] = {
   {"pmacctd_stitching", cfg_key_nfacctd_stitching},
   {"pmacctd_renormalize", cfg_key_sfacctd_renormalize},
   {"pmacctd_nonroot", cfg_key_pmacctd_nonroot},
+  {"pmacctd_workers", cfg_key_nfacctd_workers},
+  {"pmacctd_afpacket", cfg_key_pmacctd_afpacket},
+  {"pmacctd_afpacket_block_size", cfg_key_pmacctd_afpacket_block_size},
+  {"pmacctd_afpacket_block_num", cfg_key_pmacctd_afpacket_block_num},
+  {"pmacctd_afpacket_block_timeout", cfg_key_pmacctd_afpacket_block_timeout},
+  {"pmacctd_afpacket_fanout", cfg_key_pmacctd_afpacket_fanout},
   {"pmacctd_time_new", cfg_key_nfacctd_time_new},
   {"uacctd_proc_name", cfg_key_proc_name},
   {"uacctd_force_frag_handling", cfg_key_pmacctd_force_frag_handling},
   {"uacctd_frag_buffer_size", cfg_key_pmacctd_frag_buffer_size},
   {"uacctd_flow_buffer_size", cfg_key_pmacctd_flow_buffer_size},
   {"uacctd_flow_buffer_buckets", cfg_key_pmacctd_flow_buffer_buckets},
+  {"uacctd_flow_buffer_load_factor", cfg_key_pmacctd_flow_buffer_load_factor},
+  {"uacctd_frag_buffer_load_factor", cfg_key_pmacctd_frag_buffer_load_factor},
   {"uacctd_conntrack_buffer_size", cfg_key_pmacctd_conntrack_buffer_size},
   {"uacctd_flow_lifetime", cfg_key_pmacctd_flow_lifetime},
   {"uacctd_flow_tcp_lifetime", cfg_key_pmacctd_flow_tcp_lifetime},
@@ -354,6 +369,7 @@ static const struct _dictionary_line dictionary[] = {
   {"sfacctd_peer_as", cfg_key_nfprobe_peer_as},
   {"sfacctd_time_new", cfg_key_nfacctd_time_new},
   {"sfacctd_pipe_size", cfg_key_nfacctd_pipe_size},
+  {"sfacctd_recv_batch", cfg_key_nfacctd_recv_batch},
   {"sfacctd_renormalize", cfg_key_sfacctd_renormalize},
   {"sfacctd_disable_checks", cfg_key_nfacctd_disable_checks},
   {"sfacctd_mcast_groups", cfg_key_nfacctd_mcast_groups},
@@ -429,6 +445,8 @@ static const struct _dictionary_line dictionary[] = {
   {"tee_max_receiver_pools", cfg_key_tee_max_receiver_pools},
   {"tee_ipprec", cfg_key_nfprobe_ip_precedence},
   {"tee_pipe_size", cfg_key_tee_pipe_size},
+  {"tee_send_batch", cfg_key_tee_send_batch},
+  {"tee_send_batch_time", cfg_key_tee_send_batch_time},
   {"tee_kafka_config_file", cfg_key_tee_kafka_config_file},
   {"bgp_daemon", cfg_key_bgp_daemon},
   {"bgp_daemon_ip", cfg_key_bgp_daemon_ip},
@@ -437,6 +455,7 @@ static const struct _dictionary_line dictionary[] = {
   {"bgp_daemon_port", cfg_key_bgp_daemon_port},
   {"bgp_daemon_pipe_size", cfg_key_bgp_daemon_pipe_size},
   {"bgp_daemon_max_peers", cfg_key_bgp_daemon_max_peers},
+  {"bgp_daemon_threads", cfg_key_bgp_daemon_threads},
   {"bgp_daemon_msglog_output", cfg_key_bgp_daemon_msglog_output},
   {"bgp_daemon_msglog_file", cfg_key_bgp_daemon_msglog_file},
   {"bgp_daemon_msglog_avro_schema_file", cfg_key_bgp_daemon_msglog_avro_schema_file},
@@ -495,11 +514,13 @@ static const struct _dictionary_line dictionary[] = {
   {"bgp_table_per_peer_buckets", cfg_key_bgp_daemon_table_per_peer_buckets},
   {"bgp_table_attr_hash_buckets", cfg_key_bgp_daemon_table_attr_hash_buckets},
   {"bgp_table_per_peer_hash", cfg_key_bgp_daemon_table_per_peer_hash},
+  {"bgp_table_fib", cfg_key_bgp_daemon_table_fib},
   {"bgp_table_dump_output", cfg_key_bgp_daemon_table_dump_output},
   {"bgp_table_dump_file", cfg_key_bgp_daemon_table_dump_file},
   {"bgp_table_dump_latest_file", cfg_key_bgp_daemon_table_dump_latest_file},
   {"bgp_table_dump_avro_schema_file", cfg_key_bgp_daemon_table_dump_avro_schema_file},
   {"bgp_table_dump_refresh_time", cfg_key_bgp_daemon_table_dump_refresh_time},
+  {"bgp_table_dump_workers", cfg_key_bgp_daemon_table_dump_workers},
   {"bgp_table_dump_amqp_host", cfg_key_bgp_daemon_table_dump_amqp_host},
   {"bgp_table_dump_amqp_vhost", cfg_key_bgp_daemon_table_dump_amqp_vhost},
   {"bgp_table_dump_amqp_user", cfg_key_bgp_daemon_table_dump_amqp_user},
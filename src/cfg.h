@@ -86,6 +86,11 @@ struct configuration {
   int type_id;
   int is_forked;
   int pmacctd_nonroot;
+  int pmacctd_afpacket;
+  int pmacctd_afpacket_block_size;
+  int pmacctd_afpacket_block_num;
+  int pmacctd_afpacket_block_timeout;
+  int pmacctd_afpacket_fanout;
   char *proc_name;
   int proc_priority;
   char *cluster_name;
@@ -113,6 +118,8 @@ struct configuration {
   int frag_bufsz;
   int flow_bufsz;
   int flow_hashsz;
+  int flow_load_factor;
+  int frag_load_factor;
   int conntrack_bufsz;
   int flow_lifetime;
   int flow_tcp_lifetime;
@@ -176,6 +183,7 @@ struct configuration {
   int kafka_partition_dynamic;
   char *kafka_partition_key;
   int kafka_partition_keylen;
+  int kafka_purge_workers;
   char *kafka_avro_schema_topic;
   int kafka_avro_schema_refresh_time;
   char *kafka_avro_schema_registry;
@@ -215,6 +223,8 @@ struct configuration {
   u_int32_t nfacctd_as;
   u_int32_t nfacctd_net;
   int nfacctd_pipe_size;
+  int nfacctd_workers;
+  int nfacctd_recv_batch;
   int sfacctd_renormalize;
   int sfacctd_counter_output;
   char *sfacctd_counter_file;
@@ -337,6 +347,7 @@ struct configuration {
   int bgp_daemon_ipprec;
   char *bgp_daemon_allow_file;
   int bgp_daemon_max_peers;
+  int bgp_daemon_threads;
   int bgp_daemon_aspath_radius;
   char *bgp_daemon_stdcomm_pattern;
   char *bgp_daemon_extcomm_pattern;
@@ -369,11 +380,13 @@ struct configuration {
   int bgp_table_per_peer_buckets;
   int bgp_table_attr_hash_buckets;
   int bgp_table_per_peer_hash;
+  int bgp_table_fib;
   int bgp_table_dump_output;
   char *bgp_table_dump_file;
   char *bgp_table_dump_latest_file;
   char *bgp_table_dump_avro_schema_file;
   int bgp_table_dump_refresh_time;
+  int bgp_table_dump_workers;
   char *bgp_table_dump_amqp_host;
   char *bgp_table_dump_amqp_vhost;
   char *bgp_table_dump_amqp_user;
@@ -574,6 +587,8 @@ struct configuration {
   int tee_max_receiver_pools;
   char *tee_receivers;
   int tee_pipe_size;
+  int tee_send_batch;
+  int tee_send_batch_time;
   char *tee_kafka_config_file;
   int uacctd_group;
   int uacctd_nl_size;
@@ -582,6 +597,7 @@ struct configuration {
   int use_ip_next_hop;
   int decode_arista_trailer;
   int dump_max_writers;
+  int dump_writer_thread;
   int tmp_asa_bi_flow;
   int tmp_bgp_lookup_compare_ports;
   int tmp_bgp_daemon_route_refresh;
@@ -27,6 +27,7 @@
 #include "plugin_hooks.h"
 #include "cfg_handlers.h"
 #include "bgp/bgp.h"
+#include "afpacket.h"
 
 int parse_truefalse(char *value_ptr)
 {
@@ -1357,6 +1358,28 @@ int cfg_key_dump_max_writers(char *filename, char *name, char *value_ptr)
   return changes;
 }
 
+int cfg_key_dump_writer_thread(char *filename, char *name, char *value_ptr)
+{
+  struct plugins_list_entry *list = plugins_list;
+  int value, changes = 0;
+
+  value = parse_truefalse(value_ptr);
+  if (value < 0) return ERR;
+
+  if (!name) for (; list; list = list->next, changes++) list->cfg.dump_writer_thread = value;
+  else {
+    for (; list; list = list->next) {
+      if (!strcmp(name, list->name)) {
+        list->cfg.dump_writer_thread = value;
+        changes++;
+        break;
+      }
+    }
+  }
+
+  return changes;
+}
+
 int cfg_key_sql_trigger_exec(char *filename, char *name, char *value_ptr)
 {
   struct plugins_list_entry *list = plugins_list;
@@ -2113,6 +2136,31 @@ int cfg_key_kafka_partition_dynamic(char *filename, char *name, char *value_ptr)
   return changes;
 }
 
+int cfg_key_kafka_purge_workers(char *filename, char *name, char *value_ptr)
+{
+  struct plugins_list_entry *list = plugins_list;
+  int value, changes = 0;
+
+  value = atoi(value_ptr);
+  if (value < 1 || value > 64) {
+    Log(LOG_WARNING, "WARN: [%s] invalid 'kafka_purge_workers' value. Allowed values are: 1 <= kafka_purge_workers <= 64.\n", filename);
+    return ERR;
+  }
+
+  if (!name) for (; list; list = list->next, changes++) list->cfg.kafka_purge_workers = value;
+  else {
+    for (; list; list = list->next) {
+      if (!strcmp(name, list->name)) {
+        list->cfg.kafka_purge_workers = value;
+        changes++;
+        break;
+      }
+    }
+  }
+
+  return changes;
+}
+
 int cfg_key_kafka_partition_key(char *filename, char *name, char *value_ptr)
 {
   struct plugins_list_entry *list = plugins_list;
@@ -2522,6 +2570,40 @@ int cfg_key_nfacctd_pipe_size(char *filename, char *name, char *value_ptr)
   return changes;
 }
 
+int cfg_key_nfacctd_workers(char *filename, char *name, char *value_ptr)
+{
+  struct plugins_list_entry *list = plugins_list;
+  int value, changes = 0;
+
+  value = atoi(value_ptr);
+  if ((value <= 0) || (value > MAX_NFACCTD_WORKERS)) {
+    Log(LOG_ERR, "WARN: [%s] '[nf|pm]acctd_workers' has to be in the range 1-%u.\n", filename, MAX_NFACCTD_WORKERS);
+    return ERR;
+  }
+
+  for (; list; list = list->next, changes++) list->cfg.nfacctd_workers = value;
+  if (name) Log(LOG_WARNING, "WARN: [%s] plugin name not supported for key '[nf|pm]acctd_workers'. Globalized.\n", filename);
+
+  return changes;
+}
+
+int cfg_key_nfacctd_recv_batch(char *filename, char *name, char *value_ptr)
+{
+  struct plugins_list_entry *list = plugins_list;
+  int value, changes = 0;
+
+  value = atoi(value_ptr);
+  if ((value <= 0) || (value > PM_RECV_BATCH_MAX)) {
+    Log(LOG_ERR, "WARN: [%s] '[nf|sf]acctd_recv_batch' has to be in the range 1-%u.\n", filename, PM_RECV_BATCH_MAX);
+    return ERR;
+  }
+
+  for (; list; list = list->next, changes++) list->cfg.nfacctd_recv_batch = value;
+  if (name) Log(LOG_WARNING, "WARN: [%s] plugin name not supported for key '[nf|sf]acctd_recv_batch'. Globalized.\n", filename);
+
+  return changes;
+}
+
 int cfg_key_nfacctd_pro_rating(char *filename, char *name, char *value_ptr)
 {
   struct plugins_list_entry *list = plugins_list;
@@ -3809,6 +3891,23 @@ int cfg_key_bgp_daemon_max_peers(char *filename, char *name, char *value_ptr)
   return changes;
 }
 
+int cfg_key_bgp_daemon_threads(char *filename, char *name, char *value_ptr)
+{
+  struct plugins_list_entry *list = plugins_list;
+  int value, changes = 0;
+
+  value = atoi(value_ptr);
+  if (value < 1 || value > BGP_DAEMON_THREADS_MAX) {
+    Log(LOG_ERR, "WARN: [%s] 'bgp_daemon_threads' has to be in the range 1-%u.\n", filename, BGP_DAEMON_THREADS_MAX);
+    return ERR;
+  }
+
+  for (; list; list = list->next, changes++) list->cfg.bgp_daemon_threads = value;
+  if (name) Log(LOG_WARNING, "WARN: [%s] plugin name not supported for key 'bgp_daemon_threads'. Globalized.\n", filename);
+
+  return changes;
+}
+
 int cfg_key_bgp_daemon_ip(char *filename, char *name, char *value_ptr)
 {
   struct plugins_list_entry *list = plugins_list;
@@ -4038,6 +4137,20 @@ int cfg_key_bgp_daemon_table_per_peer_hash(char *filename, char *name, char *val
   return changes;
 }
 
+int cfg_key_bgp_daemon_table_fib(char *filename, char *name, char *value_ptr)
+{
+  struct plugins_list_entry *list = plugins_list;
+  int value, changes = 0;
+
+  value = parse_truefalse(value_ptr);
+  if (value < 0) return ERR;
+
+  for (; list; list = list->next, changes++) list->cfg.bgp_table_fib = value;
+  if (name) Log(LOG_WARNING, "WARN: [%s] plugin name not supported for key 'bgp_table_fib'. Globalized.\n", filename);
+
+  return changes;
+}
+
 int cfg_key_bgp_daemon_batch_interval(char *filename, char *name, char *value_ptr)
 {
   struct plugins_list_entry *list = plugins_list;
@@ -4900,6 +5013,40 @@ int cfg_key_pmacctd_flow_buffer_buckets(char *filename, char *name, char *value_
   return changes;
 }
 
+int cfg_key_pmacctd_flow_buffer_load_factor(char *filename, char *name, char *value_ptr)
+{
+  struct plugins_list_entry *list = plugins_list;
+  int value, changes = 0;
+
+  value = atoi(value_ptr);
+  if (value <= 0) {
+    Log(LOG_ERR, "WARN: [%s] 'pmacctd_flow_buffer_load_factor' has to be > 0.\n", filename);
+    return ERR;
+  }
+
+  for (; list; list = list->next, changes++) list->cfg.flow_load_factor = value;
+  if (name) Log(LOG_WARNING, "WARN: [%s] plugin name not supported for key 'pmacctd_flow_buffer_load_factor'. Globalized.\n", filename);
+
+  return changes;
+}
+
+int cfg_key_pmacctd_frag_buffer_load_factor(char *filename, char *name, char *value_ptr)
+{
+  struct plugins_list_entry *list = plugins_list;
+  int value, changes = 0;
+
+  value = atoi(value_ptr);
+  if (value <= 0) {
+    Log(LOG_ERR, "WARN: [%s] 'pmacctd_frag_buffer_load_factor' has to be > 0.\n", filename);
+    return ERR;
+  }
+
+  for (; list; list = list->next, changes++) list->cfg.frag_load_factor = value;
+  if (name) Log(LOG_WARNING, "WARN: [%s] plugin name not supported for key 'pmacctd_frag_buffer_load_factor'. Globalized.\n", filename);
+
+  return changes;
+}
+
 int cfg_key_pmacctd_conntrack_buffer_size(char *filename, char *name, char *value_ptr)
 {
   struct plugins_list_entry *list = plugins_list;
@@ -4982,6 +5129,90 @@ int cfg_key_pmacctd_nonroot(char *filename, char *name, char *value_ptr)
   return changes;
 }
 
+int cfg_key_pmacctd_afpacket(char *filename, char *name, char *value_ptr)
+{
+  struct plugins_list_entry *list = plugins_list;
+  int value, changes = 0;
+
+  value = parse_truefalse(value_ptr);
+  if (value < 0) return ERR;
+
+  for (; list; list = list->next, changes++) list->cfg.pmacctd_afpacket = value;
+  if (name) Log(LOG_WARNING, "WARN: [%s] plugin name not supported for key 'pmacctd_afpacket'. Globalized.\n", filename);
+
+  return changes;
+}
+
+int cfg_key_pmacctd_afpacket_block_size(char *filename, char *name, char *value_ptr)
+{
+  struct plugins_list_entry *list = plugins_list;
+  int value, changes = 0;
+
+  value = atoi(value_ptr);
+  if ((value < AFPACKET_MIN_BLOCK_SIZE) || (value & (value - 1))) {
+    Log(LOG_ERR, "WARN: [%s] 'pmacctd_afpacket_block_size' has to be a power of 2 and >= %u.\n", filename, AFPACKET_MIN_BLOCK_SIZE);
+    return ERR;
+  }
+
+  for (; list; list = list->next, changes++) list->cfg.pmacctd_afpacket_block_size = value;
+  if (name) Log(LOG_WARNING, "WARN: [%s] plugin name not supported for key 'pmacctd_afpacket_block_size'. Globalized.\n", filename);
+
+  return changes;
+}
+
+int cfg_key_pmacctd_afpacket_block_num(char *filename, char *name, char *value_ptr)
+{
+  struct plugins_list_entry *list = plugins_list;
+  int value, changes = 0;
+
+  value = atoi(value_ptr);
+  if (value <= 0) {
+    Log(LOG_ERR, "WARN: [%s] 'pmacctd_afpacket_block_num' has to be > 0.\n", filename);
+    return ERR;
+  }
+
+  for (; list; list = list->next, changes++) list->cfg.pmacctd_afpacket_block_num = value;
+  if (name) Log(LOG_WARNING, "WARN: [%s] plugin name not supported for key 'pmacctd_afpacket_block_num'. Globalized.\n", filename);
+
+  return changes;
+}
+
+int cfg_key_pmacctd_afpacket_block_timeout(char *filename, char *name, char *value_ptr)
+{
+  struct plugins_list_entry *list = plugins_list;
+  int value, changes = 0;
+
+  value = atoi(value_ptr);
+  if (value <= 0) {
+    Log(LOG_ERR, "WARN: [%s] 'pmacctd_afpacket_block_timeout' has to be > 0.\n", filename);
+    return ERR;
+  }
+
+  for (; list; list = list->next, changes++) list->cfg.pmacctd_afpacket_block_timeout = value;
+  if (name) Log(LOG_WARNING, "WARN: [%s] plugin name not supported for key 'pmacctd_afpacket_block_timeout'. Globalized.\n", filename);
+
+  return changes;
+}
+
+int cfg_key_pmacctd_afpacket_fanout(char *filename, char *name, char *value_ptr)
+{
+  struct plugins_list_entry *list = plugins_list;
+  int value, changes = 0;
+
+  lower_string(value_ptr);
+  if (!strcmp(value_ptr, "hash")) value = AFPACKET_FANOUT_HASH;
+  else if (!strcmp(value_ptr, "cpu")) value = AFPACKET_FANOUT_CPU;
+  else {
+    Log(LOG_ERR, "WARN: [%s] Invalid 'pmacctd_afpacket_fanout' value '%s'.\n", filename, value_ptr);
+    return ERR;
+  }
+
+  for (; list; list = list->next, changes++) list->cfg.pmacctd_afpacket_fanout = value;
+  if (name) Log(LOG_WARNING, "WARN: [%s] plugin name not supported for key 'pmacctd_afpacket_fanout'. Globalized.\n", filename);
+
+  return changes;
+}
+
 int cfg_key_sfacctd_renormalize(char *filename, char *name, char *value_ptr)
 {
   struct plugins_list_entry *list = plugins_list;
@@ -6123,6 +6354,56 @@ int cfg_key_tee_pipe_size(char *filename, char *name, char *value_ptr)
   return changes;
 }
 
+int cfg_key_tee_send_batch(char *filename, char *name, char *value_ptr)
+{
+  struct plugins_list_entry *list = plugins_list;
+  int value, changes = 0;
+
+  value = atoi(value_ptr);
+  if ((value <= 0) || (value > PM_SEND_BATCH_MAX)) {
+    Log(LOG_WARNING, "WARN: [%s] 'tee_send_batch' has to be in the range 1-%u.\n", filename, PM_SEND_BATCH_MAX);
+    return ERR;
+  }
+
+  if (!name) for (; list; list = list->next, changes++) list->cfg.tee_send_batch = value;
+  else {
+    for (; list; list = list->next) {
+      if (!strcmp(name, list->name)) {
+        list->cfg.tee_send_batch = value;
+        changes++;
+        break;
+      }
+    }
+  }
+
+  return changes;
+}
+
+int cfg_key_tee_send_batch_time(char *filename, char *name, char *value_ptr)
+{
+  struct plugins_list_entry *list = plugins_list;
+  int value, changes = 0;
+
+  value = atoi(value_ptr);
+  if ((value < 0) || (value > 1000)) {
+    Log(LOG_WARNING, "WARN: [%s] 'tee_send_batch_time' has to be in the range 0-1000.\n", filename);
+    return ERR;
+  }
+
+  if (!name) for (; list; list = list->next, changes++) list->cfg.tee_send_batch_time = value;
+  else {
+    for (; list; list = list->next) {
+      if (!strcmp(name, list->name)) {
+        list->cfg.tee_send_batch_time = value;
+        changes++;
+        break;
+      }
+    }
+  }
+
+  return changes;
+}
+
 int cfg_key_tee_kafka_config_file(char *filename, char *name, char *value_ptr)
 {
   struct plugins_list_entry *list = plugins_list;
@@ -6614,6 +6895,23 @@ int cfg_key_bgp_daemon_table_dump_refresh_time(char *filename, char *name, char
   return changes;
 }
 
+int cfg_key_bgp_daemon_table_dump_workers(char *filename, char *name, char *value_ptr)
+{
+  struct plugins_list_entry *list = plugins_list;
+  int value, changes = 0;
+
+  value = atoi(value_ptr);
+  if (value < 0 || value > BGP_TABLE_DUMP_WORKERS_MAX) {
+    Log(LOG_ERR, "WARN: [%s] 'bgp_table_dump_workers' has to be in the range 0-%u.\n", filename, BGP_TABLE_DUMP_WORKERS_MAX);
+    return ERR;
+  }
+
+  for (; list; list = list->next, changes++) list->cfg.bgp_table_dump_workers = value;
+  if (name) Log(LOG_WARNING, "WARN: [%s] plugin name not supported for key 'bgp_table_dump_workers'. Globalized.\n", filename);
+
+  return changes;
+}
+
 int cfg_key_bgp_daemon_table_dump_amqp_host(char *filename, char *name, char *value_ptr)
 {
   struct plugins_list_entry *list = plugins_list;
@@ -118,6 +118,7 @@ extern int cfg_key_kafka_broker_port(char *, char *, char *);
 extern int cfg_key_kafka_partition(char *, char *, char *);
 extern int cfg_key_kafka_partition_dynamic(char *, char *, char *);
 extern int cfg_key_kafka_partition_key(char *, char *, char *);
+extern int cfg_key_kafka_purge_workers(char *, char *, char *);
 extern int cfg_key_kafka_avro_schema_topic(char *, char *, char *);
 extern int cfg_key_kafka_avro_schema_refresh_time(char *, char *, char *);
 extern int cfg_key_kafka_avro_schema_registry(char *, char *, char *);
@@ -158,6 +159,8 @@ extern int cfg_key_nfacctd_disable_checks(char *, char *, char *);
 extern int cfg_key_nfacctd_disable_opt_scope_check(char *, char *, char *);
 extern int cfg_key_nfacctd_mcast_groups(char *, char *, char *);
 extern int cfg_key_nfacctd_pipe_size(char *, char *, char *);
+extern int cfg_key_nfacctd_workers(char *, char *, char *);
+extern int cfg_key_nfacctd_recv_batch(char *, char *, char *);
 extern int cfg_key_nfacctd_pro_rating(char *, char *, char *);
 extern int cfg_key_nfacctd_templates_file(char *, char *, char *);
 extern int cfg_key_nfacctd_templates_receiver(char *, char *, char *);
@@ -174,11 +177,18 @@ extern int cfg_key_pmacctd_force_frag_handling(char *, char *, char *);
 extern int cfg_key_pmacctd_frag_buffer_size(char *, char *, char *);
 extern int cfg_key_pmacctd_flow_buffer_size(char *, char *, char *);
 extern int cfg_key_pmacctd_flow_buffer_buckets(char *, char *, char *);
+extern int cfg_key_pmacctd_flow_buffer_load_factor(char *, char *, char *);
+extern int cfg_key_pmacctd_frag_buffer_load_factor(char *, char *, char *);
 extern int cfg_key_pmacctd_conntrack_buffer_size(char *, char *, char *);
 extern int cfg_key_pmacctd_flow_lifetime(char *, char *, char *);
 extern int cfg_key_pmacctd_flow_tcp_lifetime(char *, char *, char *);
 extern int cfg_key_pmacctd_ext_sampling_rate(char *, char *, char *);
 extern int cfg_key_pmacctd_nonroot(char *, char *, char *);
+extern int cfg_key_pmacctd_afpacket(char *, char *, char *);
+extern int cfg_key_pmacctd_afpacket_block_size(char *, char *, char *);
+extern int cfg_key_pmacctd_afpacket_block_num(char *, char *, char *);
+extern int cfg_key_pmacctd_afpacket_block_timeout(char *, char *, char *);
+extern int cfg_key_pmacctd_afpacket_fanout(char *, char *, char *);
 extern int cfg_key_sfacctd_renormalize(char *, char *, char *);
 extern int cfg_key_sfacctd_counter_output(char *, char *, char *);
 extern int cfg_key_sfacctd_counter_file(char *, char *, char *);
@@ -306,6 +316,8 @@ extern int cfg_key_tee_transparent(char *, char *, char *);
 extern int cfg_key_tee_max_receivers(char *, char *, char *);
 extern int cfg_key_tee_max_receiver_pools(char *, char *, char *);
 extern int cfg_key_tee_pipe_size(char *, char *, char *);
+extern int cfg_key_tee_send_batch(char *, char *, char *);
+extern int cfg_key_tee_send_batch_time(char *, char *, char *);
 extern int cfg_key_tee_kafka_config_file(char *, char *, char *);
 extern int cfg_key_bgp_daemon(char *, char *, char *);
 extern int cfg_key_bgp_daemon_msglog_output(char *, char *, char *);
@@ -333,6 +345,7 @@ extern int cfg_key_bgp_daemon_msglog_kafka_retry(char *, char *, char *);
 extern int cfg_key_bgp_daemon_msglog_kafka_config_file(char *, char *, char *);
 extern int cfg_key_bgp_daemon_msglog_kafka_avro_schema_registry(char *, char *, char *);
 extern int cfg_key_bgp_daemon_max_peers(char *, char *, char *);
+extern int cfg_key_bgp_daemon_threads(char *, char *, char *);
 extern int cfg_key_bgp_daemon_ip(char *, char *, char *);
 extern int cfg_key_bgp_daemon_id(char *, char *, char *);
 extern int cfg_key_bgp_daemon_as(char *, char *, char *);
@@ -369,11 +382,13 @@ extern int cfg_key_bgp_daemon_table_peer_buckets(char *, char *, char *);
 extern int cfg_key_bgp_daemon_table_per_peer_buckets(char *, char *, char *);
 extern int cfg_key_bgp_daemon_table_attr_hash_buckets(char *, char *, char *);
 extern int cfg_key_bgp_daemon_table_per_peer_hash(char *, char *, char *);
+extern int cfg_key_bgp_daemon_table_fib(char *, char *, char *);
 extern int cfg_key_bgp_daemon_table_dump_output(char *, char *, char *);
 extern int cfg_key_bgp_daemon_table_dump_file(char *, char *, char *);
 extern int cfg_key_bgp_daemon_table_dump_latest_file(char *, char *, char *);
 extern int cfg_key_bgp_daemon_table_dump_avro_schema_file(char *, char *, char *);
 extern int cfg_key_bgp_daemon_table_dump_refresh_time(char *, char *, char *);
+extern int cfg_key_bgp_daemon_table_dump_workers(char *, char *, char *);
 extern int cfg_key_bgp_daemon_table_dump_amqp_host(char *, char *, char *);
 extern int cfg_key_bgp_daemon_table_dump_amqp_vhost(char *, char *, char *);
 extern int cfg_key_bgp_daemon_table_dump_amqp_user(char *, char *, char *);
@@ -487,6 +502,7 @@ extern int cfg_key_uacctd_nl_size(char *, char *, char *);
 extern int cfg_key_uacctd_threshold(char *, char *, char *);
 extern int cfg_key_tunnel_0(char *, char *, char *);
 extern int cfg_key_dump_max_writers(char *, char *, char *);
+extern int cfg_key_dump_writer_thread(char *, char *, char *);
 extern int cfg_key_tmp_asa_bi_flow(char *, char *, char *);
 extern int cfg_key_tmp_bgp_lookup_compare_ports(char *, char *, char *);
 extern int cfg_key_tmp_bgp_daemon_route_refresh(char *, char *, char *);
@@ -32,6 +32,7 @@
 /* Global variables */
 struct pkt_classifier *class;
 u_int32_t class_trivial_hash_rnd = 140281;
+struct pkt_classifier_ac class_ac;
 
 void init_classifiers(char *path)
 {
@@ -82,6 +83,8 @@ void init_classifiers(char *path)
     }
     free(namelist);
     Log(LOG_DEBUG, "DEBUG: %d classifiers successfully loaded.\n", x);
+
+    init_class_ac(&class_ac);
   }
   else {
     Log(LOG_ERR, "ERROR: Unable to open: '%s'\n", path);
@@ -129,22 +132,56 @@ void evaluate_classifiers(struct packet_ptrs *pptrs, struct ip_flow_common *fp,
     return;
   }
 
-  /* We will pre-process the payload section of the snapshot */
   if (pptrs->payload_ptr) {
     int caplen = ((struct pcap_pkthdr *)pptrs->pkthdr)->caplen - (pptrs->payload_ptr - pptrs->packet_ptr), x = 0, y = 0;
- 
-    while (x < caplen && y < plen) {
-      if (pptrs->payload_ptr[x] != '\0') {
-        if (isascii(pptrs->payload_ptr[x])) payload[y] = tolower(pptrs->payload_ptr[x]);
-	else payload[y] = pptrs->payload_ptr[x];
-	y++;
+    int words = (class_ac.words ? class_ac.words : 1), w, built = FALSE;
+    u_int64_t cands[words], *set;
+    u_int32_t state = 0;
+    u_char c, first = '\0';
+
+    /* A single pass over the payload, in place, finds out which pattern
+       classifiers could possibly match; the payload is pre-processed,
+       NULs stripped and lowercased, only if one has to be confirmed */
+    if (class_ac.always) memcpy(cands, class_ac.always, words * sizeof(u_int64_t));
+    else memset(cands, 0xff, words * sizeof(u_int64_t));
+
+    for (; x < caplen && y < plen; x++) {
+      c = pptrs->payload_ptr[x];
+      if (c == '\0') continue;
+
+      if (!y) first = (isascii(c) ? tolower(c) : c);
+      if (!class_ac.delta) break;
+
+      state = class_ac.delta[(state * class_ac.symbols) + class_ac.symbol[c]];
+      if (class_ac.match[state]) {
+	set = &class_ac.sets[(class_ac.match[state] - 1) * words];
+	for (w = 0; w < words; w++) cands[w] |= set[w];
       }
-      x++;
+      y++;
     }
-    payload[y] = '\0';
 
     while (class[j].id && j < max) {
-      if (class[j].pattern) ret = pm_regexec(class[j].pattern, payload);
+      ret = FALSE;
+
+      if (class[j].pattern) {
+	if (!(cands[j / 64] & (1ULL << (j % 64)))) goto next_class;
+	if (class_ac.has_first && class_ac.has_first[j] &&
+	    !(class_ac.first[j][first >> 3] & (1 << (first & 7)))) goto next_class;
+
+	if (!built) {
+	  for (x = 0, y = 0; x < caplen && y < plen; x++) {
+	    if (pptrs->payload_ptr[x] != '\0') {
+	      if (isascii(pptrs->payload_ptr[x])) payload[y] = tolower(pptrs->payload_ptr[x]);
+	      else payload[y] = pptrs->payload_ptr[x];
+	      y++;
+	    }
+	  }
+	  payload[y] = '\0';
+	  built = TRUE;
+	}
+
+	ret = pm_regexec(class[j].pattern, payload);
+      }
       else if (*class[j].func) {
 	cc_node = search_context_chain(fp, idx, class[j].protocol);
 	cc_rev_node = search_context_chain(fp, reverse, class[j].protocol);
@@ -168,6 +205,8 @@ void evaluate_classifiers(struct packet_ptrs *pptrs, struct ip_flow_common *fp,
 	else fp->conntrack_helper = NULL;
         return;
       }
+
+      next_class:
       j++;
     }
   }
@@ -177,6 +216,146 @@ void evaluate_classifiers(struct packet_ptrs *pptrs, struct ip_flow_common *fp,
   handle_class_accumulators(pptrs, fp, idx);
 }
 
+/*
+  init_class_ac(): builds the pattern classifiers prefilter. Classes whose
+  regexp requires no literal always get confirmed; should the automaton
+  grow beyond MAX_CLASS_AC_STATES, all of them do, as before.
+*/
+void init_class_ac(struct pkt_classifier_ac *ac)
+{
+  int max = pmct_get_num_entries(), j, k, y, symbols, bound, head, tail;
+  char (*lits)[PM_REGLIT_LEN+1] = NULL;
+  u_int8_t used[256], *nlits = NULL, c;
+  u_int64_t *out = NULL;
+  u_int32_t *fail = NULL, *queue = NULL, s, t, r, sets;
+
+  memset(ac, 0, sizeof(struct pkt_classifier_ac));
+  ac->words = ((max + 63) / 64);
+  ac->always = calloc(ac->words, sizeof(u_int64_t));
+  ac->first = calloc(max, sizeof(ac->first[0]));
+  ac->has_first = calloc(max, sizeof(u_int8_t));
+  lits = calloc(max * PM_REGLIT_MAX, sizeof(lits[0]));
+  nlits = calloc(max, sizeof(u_int8_t));
+
+  if (!ac->always || !ac->first || !ac->has_first || !lits || !nlits) {
+    Log(LOG_ERR, "ERROR: init_class_ac(): malloc() failed.\n");
+    exit_gracefully(1);
+  }
+
+  /* required literals and alphabet */
+  memset(used, 0, sizeof(used));
+  for (j = 0, bound = 1; j < max; j++) {
+    if (!class[j].id || !class[j].pattern) continue;
+
+    nlits[j] = pm_regliterals(class[j].pattern, &lits[j * PM_REGLIT_MAX]);
+    if (!nlits[j]) ac->always[j / 64] |= (1ULL << (j % 64));
+
+    for (k = 0; k < nlits[j]; k++) {
+      for (y = 0; lits[(j * PM_REGLIT_MAX) + k][y]; y++, bound++) {
+	c = lits[(j * PM_REGLIT_MAX) + k][y];
+	used[isascii(c) ? tolower(c) : c] = TRUE;
+      }
+    }
+
+    ac->has_first[j] = pm_regfirst(class[j].pattern, ac->first[j]);
+  }
+
+  for (y = 0, symbols = 1; y < 256; y++) {
+    if (used[y]) used[y] = symbols++;
+  }
+
+  for (y = 0; y < 256; y++) {
+    c = y;
+    ac->symbol[y] = used[isascii(c) ? tolower(c) : c];
+  }
+
+  if (bound > MAX_CLASS_AC_STATES) {
+    Log(LOG_WARNING, "WARN: classifiers prefilter too large (%d states). Disabled.\n", bound);
+
+    for (j = 0; j < max; j++) {
+      if (class[j].id && class[j].pattern) ac->always[j / 64] |= (1ULL << (j % 64));
+    }
+
+    goto exit_lane;
+  }
+
+  ac->symbols = symbols;
+  ac->delta = calloc(bound * symbols, sizeof(u_int16_t));
+  out = calloc(bound * ac->words, sizeof(u_int64_t));
+  fail = calloc(bound, sizeof(u_int32_t));
+  queue = calloc(bound, sizeof(u_int32_t));
+
+  if (!ac->delta || !out || !fail || !queue) {
+    Log(LOG_ERR, "ERROR: init_class_ac(): malloc() failed.\n");
+    exit_gracefully(1);
+  }
+
+  /* trie; 0 is both the root and 'no transition' */
+  for (j = 0, ac->states = 1; j < max; j++) {
+    for (k = 0; k < nlits[j]; k++) {
+      char *lit = lits[(j * PM_REGLIT_MAX) + k];
+
+      for (s = 0, y = 0; lit[y]; y++) {
+	u_int16_t *next = &ac->delta[(s * symbols) + ac->symbol[(u_char) lit[y]]];
+
+	if (!(*next)) (*next) = ac->states++;
+	s = (*next);
+      }
+
+      out[(s * ac->words) + (j / 64)] |= (1ULL << (j % 64));
+    }
+  }
+
+  /* failure links, breadth-first, folded into a complete transition table */
+  for (y = 0, head = 0, tail = 0; y < symbols; y++) {
+    if ((t = ac->delta[y])) queue[tail++] = t;
+  }
+
+  while (head < tail) {
+    r = queue[head++];
+
+    for (y = 0; y < symbols; y++) {
+      t = ac->delta[(r * symbols) + y];
+
+      if (t) {
+	queue[tail++] = t;
+	fail[t] = ac->delta[(fail[r] * symbols) + y];
+	for (k = 0; k < ac->words; k++) out[(t * ac->words) + k] |= out[(fail[t] * ac->words) + k];
+      }
+      else ac->delta[(r * symbols) + y] = ac->delta[(fail[r] * symbols) + y];
+    }
+  }
+
+  /* compact matching states */
+  ac->match = calloc(ac->states, sizeof(u_int32_t));
+  ac->sets = calloc(ac->states * ac->words, sizeof(u_int64_t));
+
+  if (!ac->match || !ac->sets) {
+    Log(LOG_ERR, "ERROR: init_class_ac(): malloc() failed.\n");
+    exit_gracefully(1);
+  }
+
+  for (s = 0, sets = 0; s < ac->states; s++) {
+    for (k = 0; k < ac->words; k++) {
+      if (out[(s * ac->words) + k]) break;
+    }
+
+    if (k < ac->words) {
+      memcpy(&ac->sets[sets * ac->words], &out[s * ac->words], ac->words * sizeof(u_int64_t));
+      ac->match[s] = ++sets;
+    }
+  }
+
+  Log(LOG_DEBUG, "DEBUG: classifiers prefilter: states=%u symbols=%u\n", ac->states, ac->symbols);
+
+  exit_lane:
+  free(lits);
+  free(nlits);
+  free(out);
+  free(fail);
+  free(queue);
+}
+
 void init_class_accumulators(struct packet_ptrs *pptrs, struct ip_flow_common *fp, unsigned int idx)
 {
   unsigned int reverse = idx ? 0 : 1;
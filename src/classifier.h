@@ -31,6 +31,7 @@
 #define MAX_CLASSIFIERS 256
 #define MAX_PATTERN_LEN 2048
 #define DEFAULT_TENTATIVES 5 
+#define MAX_CLASS_AC_STATES 65535
 
 /* data structures */
 struct pkt_classifier_data {
@@ -55,6 +56,26 @@ struct pkt_classifier {
   void *extra;
 };
 
+/*
+  Prefilter for pattern classifiers: an Aho-Corasick automaton over the
+  literals each regexp requires (see pm_regliterals()). The payload is
+  scanned once; only pattern classifiers whose literals were found, or
+  which have none, are then confirmed by pm_regexec(). Bytes are mapped
+  case-folded onto a reduced alphabet to keep the transition table small.
+*/
+struct pkt_classifier_ac {
+  u_int8_t symbol[256];		/* byte -> alphabet symbol */
+  u_int16_t symbols;
+  u_int32_t states;
+  u_int16_t *delta;		/* [state * symbols + symbol] -> state */
+  u_int32_t *match;		/* state -> 1 + index into sets, 0 if none */
+  u_int64_t *sets;		/* bitmaps of matching classes, 'words' each */
+  u_int16_t words;
+  u_int64_t *always;		/* pattern classes requiring no literal */
+  u_int8_t (*first)[32];	/* anchored classes: bitmap of first bytes */
+  u_int8_t *has_first;
+};
+
 /* All but __CLASSIFIER_C are dummy entries. They are required to export locally
    the 'class' array. This is in order to avoid to link extra C files into nfacctd
    and sfacctd */
@@ -70,6 +91,7 @@ extern int dot_so(char *);
 extern void init_class_accumulators(struct packet_ptrs *, struct ip_flow_common *, unsigned int);
 extern void handle_class_accumulators(struct packet_ptrs *, struct ip_flow_common *, unsigned int);
 extern void link_conntrack_helper(struct pkt_classifier *);
+extern void init_class_ac(struct pkt_classifier_ac *);
 
 extern void *search_context_chain(struct ip_flow_common *, unsigned int, char *);
 extern void insert_context_chain(struct ip_flow_common *, unsigned int, char *, void *);
@@ -48,18 +48,15 @@ void imt_plugin(int pipe_fd, struct configuration *cfgptr, void *ptr)
   unsigned char srvbuf[maxqsize];
   unsigned char *srvbufptr;
   struct query_header *qh;
-  unsigned char *pipebuf, *dataptr;
+  unsigned char *pipebuf = NULL, *dataptr;
   char path[] = "/tmp/collect.pipe";
   short int go_to_clear = FALSE;
   u_int32_t request, sz;
-  struct ch_status *status = ((struct channels_list_entry *)ptr)->status;
+  struct channels_list_entry *chptr = (struct channels_list_entry *) ptr;
   int datasize = ((struct channels_list_entry *)ptr)->datasize;
   pid_t core_pid = ((struct channels_list_entry *)ptr)->core_pid;
   struct extra_primitives extras;
-  unsigned char *rgptr;
-  int pollagain = 0;
   u_int32_t seq = 0;
-  int rg_err_count = 0;
   int ret, lock = FALSE, num, sd, sd2;
   struct pkt_bgp_primitives *pbgp, empty_pbgp;
   struct pkt_legacy_bgp_primitives *plbgp, empty_plbgp;
@@ -109,19 +106,20 @@ void imt_plugin(int pipe_fd, struct configuration *cfgptr, void *ptr)
   }
 
   reload_map = FALSE;
-  status->wakeup = TRUE;
 
   /* a bunch of default definitions and post-checks */
-  pipebuf = (unsigned char *) malloc(config.buffer_size);
-  if (!pipebuf) {
-    Log(LOG_ERR, "ERROR ( %s/%s ): malloc() failed (pipebuf). Exiting ..\n", config.name, config.type);
-    exit_gracefully(1);
-  }
+  if (config.pipe_zmq) {
+    pipebuf = (unsigned char *) malloc(config.buffer_size);
+    if (!pipebuf) {
+      Log(LOG_ERR, "ERROR ( %s/%s ): malloc() failed (pipebuf). Exiting ..\n", config.name, config.type);
+      exit_gracefully(1);
+    }
 
-  if (config.pipe_zmq) P_zmq_pipe_init(zmq_host, &pipe_fd, &seq);
+    memset(pipebuf, 0, config.buffer_size);
+    P_zmq_pipe_init(zmq_host, &pipe_fd, &seq);
+  }
   else setnonblocking(pipe_fd);
 
-  memset(pipebuf, 0, config.buffer_size);
   no_more_space = FALSE;
 
   if (config.what_to_count & (COUNT_SUM_HOST|COUNT_SUM_NET))
@@ -222,6 +220,9 @@ void imt_plugin(int pipe_fd, struct configuration *cfgptr, void *ptr)
     poll_fd[1].fd = sd;
     poll_fd[1].events = POLLIN;
 
+    /* do not sleep if data is already pending in the ring */
+    if (config.pipe_homegrown && !arm_pipe_wakeup(chptr)) poll_timeout = 0;
+
     num = poll(poll_fd, 2, poll_timeout);
 
     gettimeofday(&cycle_stamp, NULL);
@@ -379,37 +380,22 @@ void imt_plugin(int pipe_fd, struct configuration *cfgptr, void *ptr)
       reload_log = FALSE;
     }
 
-    if (poll_fd[0].revents & POLLIN) {
+    if (config.pipe_homegrown || (poll_fd[0].revents & POLLIN)) {
 #ifdef WITH_ZMQ
       read_data:
 #endif
       if (config.pipe_homegrown) {
-        if (!pollagain) {
-          seq++;
-          seq %= MAX_SEQNUM;
-        }
-
-        pollagain = FALSE;
-        if ((num = read(pipe_fd, &rgptr, sizeof(rgptr))) == 0)
+        if ((poll_fd[0].revents & POLLIN) && drain_pipe_wakeup(pipe_fd) == ERR)
           exit_gracefully(1); /* we exit silently; something happened at the write end */
 
-        if (num < 0) {
-          pollagain = TRUE;
-          goto poll_again;
-        }
-
-        memcpy(pipebuf, rgptr, config.buffer_size);
-        if (((struct ch_buf_hdr *)pipebuf)->seq != seq) {
-          rg_err_count++;
-          if (config.debug || (rg_err_count > MAX_RG_COUNT_ERR)) {
-	    Log(LOG_WARNING, "WARN ( %s/%s ): Missing data detected (plugin_buffer_size=%" PRIu64 " plugin_pipe_size=%" PRIu64 ").\n",
-		config.name, config.type, config.buffer_size, config.pipe_size);
-	    Log(LOG_WARNING, "WARN ( %s/%s ): Increase values or look for plugin_buffer_size, plugin_pipe_size in CONFIG-KEYS document.\n\n",
-		config.name, config.type);
-	  }
+	check_pipe_lost_data(chptr);
 
-          seq = ((struct ch_buf_hdr *)pipebuf)->seq;
+	/* one buffer per round, read in place, not to starve client queries */
+	if ((pipebuf = get_pipe_buffer(chptr))) {
+	  seq = ((struct ch_buf_hdr *)pipebuf)->seq;
+	  num = TRUE;
 	}
+	else num = FALSE;
       }
 #ifdef WITH_ZMQ
       else if (config.pipe_zmq) {
@@ -484,6 +470,8 @@ void imt_plugin(int pipe_fd, struct configuration *cfgptr, void *ptr)
             data = (struct pkt_data *) dataptr;
 	  }
         }
+
+	if (config.pipe_homegrown) release_pipe_buffer(chptr);
       }
 
 #ifdef WITH_ZMQ
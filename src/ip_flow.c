@@ -36,14 +36,25 @@ struct ip_flow6 **ip_flow_table6;
 struct flow_lru_l6 flow_lru_list6;
 
 u_int32_t flt_total_nodes;  
-time_t flt_prune_deadline;
+u_int32_t flt_max_nodes;
+u_int32_t flt_hashsz;
+u_int32_t flt_max_hashsz;
+u_int32_t flt_load_factor;
+struct ip_flow *flt_prune_cursor;
+u_int64_t flt_hits;
+u_int64_t flt_misses;
 time_t flt_emergency_prune;
 time_t flow_generic_lifetime;
 time_t flow_tcpest_lifetime;
 u_int32_t flt_trivial_hash_rnd = 140281; /* ummmh */
 
 u_int32_t flt6_total_nodes;
-time_t flt6_prune_deadline;
+u_int32_t flt6_max_nodes;
+u_int32_t flt6_hashsz;
+u_int32_t flt6_max_hashsz;
+struct ip_flow6 *flt6_prune_cursor;
+u_int64_t flt6_hits;
+u_int64_t flt6_misses;
 time_t flt6_emergency_prune;
 
 void init_ip_flow_handler()
@@ -54,21 +65,28 @@ void init_ip_flow_handler()
 
 void init_ip4_flow_handler()
 {
-  int size;
-
   if (config.flow_bufsz) flt_total_nodes = config.flow_bufsz / sizeof(struct ip_flow);
   else flt_total_nodes = DEFAULT_FLOW_BUFFER_SIZE / sizeof(struct ip_flow); 
+  flt_max_nodes = flt_total_nodes;
 
   if (!config.flow_hashsz) config.flow_hashsz = FLOW_TABLE_HASHSZ; 
-  size = sizeof(struct ip_flow) * config.flow_hashsz;
-  ip_flow_table = (struct ip_flow **) malloc(size);
+  if (config.flow_load_factor) flt_load_factor = config.flow_load_factor;
+  else flt_load_factor = FLOW_TABLE_LOAD_FACTOR;
+
+  /* the table starts at flow_hashsz buckets and doubles each time the load
+     factor is exceeded; the buffer size caps how far it is allowed to grow */
+  for (flt_hashsz = 1; flt_hashsz < config.flow_hashsz && flt_hashsz < (1U << 30); flt_hashsz <<= 1);
+  for (flt_max_hashsz = flt_hashsz; flt_max_hashsz * flt_load_factor < flt_max_nodes && flt_max_hashsz < (1U << 30); flt_max_hashsz <<= 1);
+
+  ip_flow_table = (struct ip_flow **) calloc(flt_hashsz, sizeof(struct ip_flow *));
   assert(ip_flow_table);
 
-  memset(ip_flow_table, 0, size);
   flow_lru_list.root = (struct ip_flow *) malloc(sizeof(struct ip_flow)); 
   flow_lru_list.last = flow_lru_list.root;
   memset(flow_lru_list.root, 0, sizeof(struct ip_flow));
-  flt_prune_deadline = time(NULL)+FLOW_TABLE_PRUNE_INTERVAL;
+  flt_prune_cursor = NULL;
+  flt_hits = 0;
+  flt_misses = 0;
   flt_emergency_prune = 0; 
 
   if (config.flow_lifetime) flow_generic_lifetime = config.flow_lifetime;
@@ -87,10 +105,10 @@ void ip_flow_handler(struct packet_ptrs *pptrs)
 
   gettimeofday(&now, NULL);
 
-  if (now.tv_sec > flt_prune_deadline) {
-    prune_old_flows(&now);
-    flt_prune_deadline = now.tv_sec+FLOW_TABLE_PRUNE_INTERVAL;
-  }
+  prune_flows_step(&now);
+
+  if ((flt_max_nodes - flt_total_nodes) > (flt_hashsz * flt_load_factor) && flt_hashsz < flt_max_hashsz)
+    resize_flow_table(flt_hashsz << 1);
 
   find_flow(&now, pptrs);
 }
@@ -144,17 +162,19 @@ void find_flow(struct timeval *now, struct packet_ptrs *pptrs)
   struct pm_iphdr *iphp = &my_iph;
   struct pm_tlhdr *tlhp = (struct pm_tlhdr *) &my_tlh;
   struct ip_flow *fp, *candidate = NULL, *last_seen = NULL;
-  unsigned int idx, bucket;
+  unsigned int idx, hash;
 
   memcpy(&my_iph, pptrs->iph_ptr, IP4HdrSz);
   memcpy(&my_tlh, pptrs->tlh_ptr, MyTCPHdrSz);
   idx = normalize_flow(&iphp->ip_src.s_addr, &iphp->ip_dst.s_addr, &tlhp->src_port, &tlhp->dst_port);
-  bucket = hash_flow(iphp->ip_src.s_addr, iphp->ip_dst.s_addr, tlhp->src_port, tlhp->dst_port, iphp->ip_p);
+  hash = hash_flow(iphp->ip_src.s_addr, iphp->ip_dst.s_addr, tlhp->src_port, tlhp->dst_port, iphp->ip_p);
 
-  for (fp = ip_flow_table[bucket]; fp; fp = fp->next) {
-    if (fp->ip_src == iphp->ip_src.s_addr && fp->ip_dst == iphp->ip_dst.s_addr &&
+  for (fp = ip_flow_table[hash & (flt_hashsz-1)]; fp; fp = fp->next) {
+    if (fp->cmn.hash == hash && fp->ip_src == iphp->ip_src.s_addr && fp->ip_dst == iphp->ip_dst.s_addr &&
 	fp->port_src == tlhp->src_port && fp->port_dst == tlhp->dst_port &&
 	fp->cmn.proto == iphp->ip_p) {
+      flt_hits++;
+
       /* flow found; will check for its lifetime */
       if (!is_expired_uni(now, &fp->cmn, idx)) {
 	/* still valid flow */ 
@@ -180,11 +200,13 @@ void find_flow(struct timeval *now, struct packet_ptrs *pptrs)
     last_seen = fp;
   } 
 
-  if (candidate) create_flow(now, candidate, TRUE, bucket, pptrs, iphp, tlhp, idx);
-  else create_flow(now, last_seen, FALSE, bucket, pptrs, iphp, tlhp, idx); 
+  flt_misses++;
+
+  if (candidate) create_flow(now, candidate, TRUE, hash, pptrs, iphp, tlhp, idx);
+  else create_flow(now, last_seen, FALSE, hash, pptrs, iphp, tlhp, idx); 
 }
 
-void create_flow(struct timeval *now, struct ip_flow *fp, u_int8_t is_candidate, unsigned int bucket, struct packet_ptrs *pptrs, 
+void create_flow(struct timeval *now, struct ip_flow *fp, u_int8_t is_candidate, unsigned int hash, struct packet_ptrs *pptrs, 
 		 struct pm_iphdr *iphp, struct pm_tlhdr *tlhp, unsigned int idx)
 {
   struct ip_flow *newf;
@@ -252,7 +274,7 @@ void create_flow(struct timeval *now, struct ip_flow *fp, u_int8_t is_candidate,
     }
     else flt_total_nodes--;
     memset(fp, 0, sizeof(struct ip_flow));
-    ip_flow_table[bucket] = fp;
+    ip_flow_table[hash & (flt_hashsz-1)] = fp;
     flow_lru_list.last->lru_next = fp; /* placing new node as LRU tail */ 
     fp->lru_prev = flow_lru_list.last;
     flow_lru_list.last = fp;
@@ -263,7 +285,7 @@ void create_flow(struct timeval *now, struct ip_flow *fp, u_int8_t is_candidate,
   fp->port_src = tlhp->src_port;
   fp->port_dst = tlhp->dst_port;
   fp->cmn.proto = iphp->ip_p;
-  fp->cmn.bucket = bucket;
+  fp->cmn.hash = hash;
   evaluate_tcp_flags(now, pptrs, &fp->cmn, idx); 
   fp->cmn.last[idx].tv_sec = now->tv_sec; 
   fp->cmn.last[idx].tv_usec = now->tv_usec; 
@@ -274,49 +296,96 @@ void create_flow(struct timeval *now, struct ip_flow *fp, u_int8_t is_candidate,
 
 void prune_old_flows(struct timeval *now)
 {
-  struct ip_flow *fp, *temp, *last_seen = flow_lru_list.root;
+  struct ip_flow *fp, *temp;
 
   fp = flow_lru_list.root->lru_next;
   while (fp) {
-    if (is_expired(now, &fp->cmn)) {
-      /* we found a stale element; we'll prune it */
-      if (fp->lru_next) temp = fp->lru_next;
-      else temp = NULL;
-
-      /* rearranging bucket's pointers */ 
-      if (fp->prev && fp->next) {
-	fp->prev->next = fp->next;
-        fp->next->prev = fp->prev;
-      }
-      else if (fp->prev) fp->prev->next = NULL;
-      else if (fp->next) {
-	ip_flow_table[fp->cmn.bucket] = fp->next;
-	fp->next->prev = NULL; 
-      }
-      else ip_flow_table[fp->cmn.bucket] = NULL;
+    temp = fp->lru_next;
 
-      /* rearranging LRU pointers */
-      if (fp->lru_next) {
-        fp->lru_next->lru_prev = fp->lru_prev;
-        fp->lru_prev->lru_next = fp->lru_next;
-      }
-      else fp->lru_prev->lru_next = NULL;
+    /* we found a stale element; we'll prune it */
+    if (is_expired(now, &fp->cmn)) delete_flow(fp);
 
-      clear_context_chain(&fp->cmn, 0);
-      clear_context_chain(&fp->cmn, 1);
-      free(fp);
-      flt_total_nodes++;
+    fp = temp;
+  }
+}
 
-      if (temp) fp = temp;
-      else fp = NULL;
-    }
-    else {
-      last_seen = fp;
-      fp = fp->lru_next;
-    }
+/* prune_flows_step() spreads the expiry sweep over the packet stream: each
+   call examines at most FLOW_TABLE_PRUNE_STEP entries of the LRU list, then
+   leaves a cursor to resume from; once the tail is reached the next call
+   restarts from the head */
+void prune_flows_step(struct timeval *now)
+{
+  struct ip_flow *fp;
+  int step;
+
+  if (!flt_prune_cursor) flt_prune_cursor = flow_lru_list.root->lru_next;
+
+  for (step = 0; step < FLOW_TABLE_PRUNE_STEP && flt_prune_cursor; step++) {
+    fp = flt_prune_cursor;
+    flt_prune_cursor = fp->lru_next;
+
+    if (is_expired(now, &fp->cmn)) delete_flow(fp);
+  }
+}
+
+void delete_flow(struct ip_flow *fp)
+{
+  /* rearranging bucket's pointers */ 
+  if (fp->prev) fp->prev->next = fp->next;
+  else ip_flow_table[fp->cmn.hash & (flt_hashsz-1)] = fp->next;
+  if (fp->next) fp->next->prev = fp->prev;
+
+  /* rearranging LRU pointers */
+  fp->lru_prev->lru_next = fp->lru_next;
+  if (fp->lru_next) fp->lru_next->lru_prev = fp->lru_prev;
+  else flow_lru_list.last = fp->lru_prev;
+
+  if (flt_prune_cursor == fp) flt_prune_cursor = fp->lru_next;
+
+  clear_context_chain(&fp->cmn, 0);
+  clear_context_chain(&fp->cmn, 1);
+  free(fp);
+  flt_total_nodes++;
+}
+
+/* resize_flow_table() re-chains all flows into a new bucket array; walking
+   the LRU list avoids touching the old buckets at all */
+void resize_flow_table(u_int32_t hashsz)
+{
+  struct ip_flow **table, *fp;
+  u_int32_t bucket;
+
+  table = (struct ip_flow **) calloc(hashsz, sizeof(struct ip_flow *));
+  if (!table) {
+    Log(LOG_WARNING, "WARN ( %s/core ): Flow/4 buffer unable to grow to %u buckets. Staying at %u.\n", config.name, hashsz, flt_hashsz);
+    flt_max_hashsz = flt_hashsz;
+    return;
   }
 
-  flow_lru_list.last = last_seen;
+  for (fp = flow_lru_list.root->lru_next; fp; fp = fp->lru_next) {
+    bucket = fp->cmn.hash & (hashsz-1);
+    fp->prev = NULL;
+    fp->next = table[bucket];
+    if (fp->next) fp->next->prev = fp;
+    table[bucket] = fp;
+  }
+
+  free(ip_flow_table);
+  ip_flow_table = table;
+  flt_hashsz = hashsz;
+
+  Log(LOG_DEBUG, "DEBUG ( %s/core ): Flow/4 buffer resized: buckets=%u flows=%u\n", config.name, flt_hashsz, flt_max_nodes - flt_total_nodes);
+}
+
+void print_ip_flow_stats(time_t now)
+{
+  Log(LOG_NOTICE, "NOTICE ( %s/%s ): stats [flows/4] time=%ld flows=%u buckets=%u hits=%llu misses=%llu\n",
+      config.name, config.type, (long)now, flt_max_nodes - flt_total_nodes, flt_hashsz,
+      (unsigned long long)flt_hits, (unsigned long long)flt_misses);
+
+  Log(LOG_NOTICE, "NOTICE ( %s/%s ): stats [flows/6] time=%ld flows=%u buckets=%u hits=%llu misses=%llu\n",
+      config.name, config.type, (long)now, flt6_max_nodes - flt6_total_nodes, flt6_hashsz,
+      (unsigned long long)flt6_hits, (unsigned long long)flt6_misses);
 }
 
 unsigned int normalize_flow(u_int32_t *ip_src, u_int32_t *ip_dst,
@@ -355,7 +424,7 @@ unsigned int normalize_flow(u_int32_t *ip_src, u_int32_t *ip_dst,
 unsigned int hash_flow(u_int32_t ip_src, u_int32_t ip_dst,
 		u_int16_t port_src, u_int16_t port_dst, u_int8_t proto)
 {
-  return jhash_3words((u_int32_t)(port_src ^ port_dst) << 16 | proto, ip_src, ip_dst, flt_trivial_hash_rnd) & (config.flow_hashsz-1);
+  return jhash_3words((u_int32_t)(port_src ^ port_dst) << 16 | proto, ip_src, ip_dst, flt_trivial_hash_rnd);
 }
 
 /* is_expired() checks for the expiration of the bi-directional flow; returns: TRUE if
@@ -397,20 +466,26 @@ unsigned int is_expired_uni(struct timeval *now, struct ip_flow_common *fp, unsi
 
 void init_ip6_flow_handler()
 {
-  int size;
-
   if (config.flow_bufsz) flt6_total_nodes = config.flow_bufsz / sizeof(struct ip_flow6);
   else flt6_total_nodes = DEFAULT_FLOW_BUFFER_SIZE / sizeof(struct ip_flow6);
+  flt6_max_nodes = flt6_total_nodes;
 
   if (!config.flow_hashsz) config.flow_hashsz = FLOW_TABLE_HASHSZ;
-  size = sizeof(struct ip_flow6) * config.flow_hashsz;
-  ip_flow_table6 = (struct ip_flow6 **) malloc(size);
+  if (config.flow_load_factor) flt_load_factor = config.flow_load_factor;
+  else flt_load_factor = FLOW_TABLE_LOAD_FACTOR;
+
+  for (flt6_hashsz = 1; flt6_hashsz < config.flow_hashsz && flt6_hashsz < (1U << 30); flt6_hashsz <<= 1);
+  for (flt6_max_hashsz = flt6_hashsz; flt6_max_hashsz * flt_load_factor < flt6_max_nodes && flt6_max_hashsz < (1U << 30); flt6_max_hashsz <<= 1);
+
+  ip_flow_table6 = (struct ip_flow6 **) calloc(flt6_hashsz, sizeof(struct ip_flow6 *));
+  assert(ip_flow_table6);
 
-  memset(ip_flow_table6, 0, size);
   flow_lru_list6.root = (struct ip_flow6 *) malloc(sizeof(struct ip_flow6));
   flow_lru_list6.last = flow_lru_list6.root;
   memset(flow_lru_list6.root, 0, sizeof(struct ip_flow6));
-  flt6_prune_deadline = time(NULL)+FLOW_TABLE_PRUNE_INTERVAL;
+  flt6_prune_cursor = NULL;
+  flt6_hits = 0;
+  flt6_misses = 0;
   flt6_emergency_prune = 0;
 
   if (config.flow_lifetime) flow_generic_lifetime = config.flow_lifetime;
@@ -429,10 +504,10 @@ void ip_flow6_handler(struct packet_ptrs *pptrs)
 
   gettimeofday(&now, NULL);
 
-  if (now.tv_sec > flt6_prune_deadline) {
-    prune_old_flows6(&now);
-    flt6_prune_deadline = now.tv_sec+FLOW_TABLE_PRUNE_INTERVAL;
-  }
+  prune_flows6_step(&now);
+
+  if ((flt6_max_nodes - flt6_total_nodes) > (flt6_hashsz * flt_load_factor) && flt6_hashsz < flt6_max_hashsz)
+    resize_flow_table6(flt6_hashsz << 1);
 
   find_flow6(&now, pptrs);
 }
@@ -461,7 +536,7 @@ unsigned int hash_flow6(u_int32_t id, struct in6_addr *saddr, struct in6_addr *d
         c += id;
         __jhash_mix(a, b, c);
 
-        return c & (config.flow_hashsz - 1);
+        return c;
 }
 
 unsigned int normalize_flow6(struct in6_addr *saddr, struct in6_addr *daddr,
@@ -502,17 +577,19 @@ void find_flow6(struct timeval *now, struct packet_ptrs *pptrs)
   struct ip6_hdr *iphp = &my_iph;
   struct pm_tlhdr *tlhp = (struct pm_tlhdr *) &my_tlh;
   struct ip_flow6 *fp, *candidate = NULL, *last_seen = NULL;
-  unsigned int idx, bucket;
+  unsigned int idx, hash;
 
   memcpy(&my_iph, pptrs->iph_ptr, IP6HdrSz);
   memcpy(&my_tlh, pptrs->tlh_ptr, MyTCPHdrSz);
   idx = normalize_flow6(&iphp->ip6_src, &iphp->ip6_dst, &tlhp->src_port, &tlhp->dst_port);
-  bucket = hash_flow6((tlhp->src_port << 16) | tlhp->dst_port, &iphp->ip6_src, &iphp->ip6_dst);
+  hash = hash_flow6((tlhp->src_port << 16) | tlhp->dst_port, &iphp->ip6_src, &iphp->ip6_dst);
 
-  for (fp = ip_flow_table6[bucket]; fp; fp = fp->next) {
-    if (!ip6_addr_cmp(&fp->ip_src, &iphp->ip6_src) && !ip6_addr_cmp(&fp->ip_dst, &iphp->ip6_dst) &&
+  for (fp = ip_flow_table6[hash & (flt6_hashsz-1)]; fp; fp = fp->next) {
+    if (fp->cmn.hash == hash && !ip6_addr_cmp(&fp->ip_src, &iphp->ip6_src) && !ip6_addr_cmp(&fp->ip_dst, &iphp->ip6_dst) &&
         fp->port_src == tlhp->src_port && fp->port_dst == tlhp->dst_port &&
 	fp->cmn.proto == pptrs->l4_proto) {
+      flt6_hits++;
+
       /* flow found; will check for its lifetime */
       if (!is_expired_uni(now, &fp->cmn, idx)) {
         /* still valid flow */
@@ -538,11 +615,13 @@ void find_flow6(struct timeval *now, struct packet_ptrs *pptrs)
     last_seen = fp;
   }
 
-  if (candidate) create_flow6(now, candidate, TRUE, bucket, pptrs, iphp, tlhp, idx);
-  else create_flow6(now, last_seen, FALSE, bucket, pptrs, iphp, tlhp, idx);
+  flt6_misses++;
+
+  if (candidate) create_flow6(now, candidate, TRUE, hash, pptrs, iphp, tlhp, idx);
+  else create_flow6(now, last_seen, FALSE, hash, pptrs, iphp, tlhp, idx);
 }
 
-void create_flow6(struct timeval *now, struct ip_flow6 *fp, u_int8_t is_candidate, unsigned int bucket,
+void create_flow6(struct timeval *now, struct ip_flow6 *fp, u_int8_t is_candidate, unsigned int hash,
 	          struct packet_ptrs *pptrs, struct ip6_hdr *iphp, struct pm_tlhdr *tlhp, unsigned int idx)
 {
   struct ip_flow6 *newf;
@@ -609,7 +688,7 @@ void create_flow6(struct timeval *now, struct ip_flow6 *fp, u_int8_t is_candidat
     }
     else flt6_total_nodes--;
     memset(fp, 0, sizeof(struct ip_flow6));
-    ip_flow_table6[bucket] = fp;
+    ip_flow_table6[hash & (flt6_hashsz-1)] = fp;
     flow_lru_list6.last->lru_next = fp; /* placing new node as LRU tail */
     fp->lru_prev = flow_lru_list6.last;
     flow_lru_list6.last = fp;
@@ -620,7 +699,7 @@ void create_flow6(struct timeval *now, struct ip_flow6 *fp, u_int8_t is_candidat
   fp->port_src = tlhp->src_port;
   fp->port_dst = tlhp->dst_port;
   fp->cmn.proto = pptrs->l4_proto;
-  fp->cmn.bucket = bucket;
+  fp->cmn.hash = hash;
   evaluate_tcp_flags(now, pptrs, &fp->cmn, idx);
   fp->cmn.last[idx].tv_sec = now->tv_sec;
   fp->cmn.last[idx].tv_usec = now->tv_usec;
@@ -631,47 +710,77 @@ void create_flow6(struct timeval *now, struct ip_flow6 *fp, u_int8_t is_candidat
 
 void prune_old_flows6(struct timeval *now)
 {
-  struct ip_flow6 *fp, *temp, *last_seen = flow_lru_list6.root;
+  struct ip_flow6 *fp, *temp;
 
   fp = flow_lru_list6.root->lru_next;
   while (fp) {
-    if (is_expired(now, &fp->cmn)) {
-      /* we found a stale element; we'll prune it */
-      if (fp->lru_next) temp = fp->lru_next;
-      else temp = NULL;
-
-      /* rearranging bucket's pointers */
-      if (fp->prev && fp->next) {
-        fp->prev->next = fp->next;
-        fp->next->prev = fp->prev;
-      }
-      else if (fp->prev) fp->prev->next = NULL;
-      else if (fp->next) {
-        ip_flow_table6[fp->cmn.bucket] = fp->next;
-        fp->next->prev = NULL;
-      }
-      else ip_flow_table6[fp->cmn.bucket] = NULL;
+    temp = fp->lru_next;
 
-      /* rearranging LRU pointers */
-      if (fp->lru_next) {
-        fp->lru_next->lru_prev = fp->lru_prev;
-        fp->lru_prev->lru_next = fp->lru_next;
-      }
-      else fp->lru_prev->lru_next = NULL;
+    /* we found a stale element; we'll prune it */
+    if (is_expired(now, &fp->cmn)) delete_flow6(fp);
 
-      clear_context_chain(&fp->cmn, 0);
-      clear_context_chain(&fp->cmn, 1);
-      free(fp);
-      flt6_total_nodes++;
+    fp = temp;
+  }
+}
 
-      if (temp) fp = temp;
-      else fp = NULL;
-    }
-    else {
-      last_seen = fp;
-      fp = fp->lru_next;
-    }
+void prune_flows6_step(struct timeval *now)
+{
+  struct ip_flow6 *fp;
+  int step;
+
+  if (!flt6_prune_cursor) flt6_prune_cursor = flow_lru_list6.root->lru_next;
+
+  for (step = 0; step < FLOW_TABLE_PRUNE_STEP && flt6_prune_cursor; step++) {
+    fp = flt6_prune_cursor;
+    flt6_prune_cursor = fp->lru_next;
+
+    if (is_expired(now, &fp->cmn)) delete_flow6(fp);
+  }
+}
+
+void delete_flow6(struct ip_flow6 *fp)
+{
+  /* rearranging bucket's pointers */
+  if (fp->prev) fp->prev->next = fp->next;
+  else ip_flow_table6[fp->cmn.hash & (flt6_hashsz-1)] = fp->next;
+  if (fp->next) fp->next->prev = fp->prev;
+
+  /* rearranging LRU pointers */
+  fp->lru_prev->lru_next = fp->lru_next;
+  if (fp->lru_next) fp->lru_next->lru_prev = fp->lru_prev;
+  else flow_lru_list6.last = fp->lru_prev;
+
+  if (flt6_prune_cursor == fp) flt6_prune_cursor = fp->lru_next;
+
+  clear_context_chain(&fp->cmn, 0);
+  clear_context_chain(&fp->cmn, 1);
+  free(fp);
+  flt6_total_nodes++;
+}
+
+void resize_flow_table6(u_int32_t hashsz)
+{
+  struct ip_flow6 **table, *fp;
+  u_int32_t bucket;
+
+  table = (struct ip_flow6 **) calloc(hashsz, sizeof(struct ip_flow6 *));
+  if (!table) {
+    Log(LOG_WARNING, "WARN ( %s/core ): Flow/6 buffer unable to grow to %u buckets. Staying at %u.\n", config.name, hashsz, flt6_hashsz);
+    flt6_max_hashsz = flt6_hashsz;
+    return;
+  }
+
+  for (fp = flow_lru_list6.root->lru_next; fp; fp = fp->lru_next) {
+    bucket = fp->cmn.hash & (hashsz-1);
+    fp->prev = NULL;
+    fp->next = table[bucket];
+    if (fp->next) fp->next->prev = fp;
+    table[bucket] = fp;
   }
 
-  flow_lru_list6.last = last_seen;
+  free(ip_flow_table6);
+  ip_flow_table6 = table;
+  flt6_hashsz = hashsz;
+
+  Log(LOG_DEBUG, "DEBUG ( %s/core ): Flow/6 buffer resized: buckets=%u flows=%u\n", config.name, flt6_hashsz, flt6_max_nodes - flt6_total_nodes);
 }
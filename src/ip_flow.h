@@ -24,12 +24,13 @@
 
 /* defines */
 #define FLOW_TABLE_HASHSZ 256 
+#define FLOW_TABLE_LOAD_FACTOR 2
+#define FLOW_TABLE_PRUNE_STEP 4 
 #define FLOW_GENERIC_LIFETIME 60 
 #define FLOW_TCPSYN_LIFETIME 60 
 #define FLOW_TCPEST_LIFETIME 432000
 #define FLOW_TCPFIN_LIFETIME 30 
 #define FLOW_TCPRST_LIFETIME 10 
-#define FLOW_TABLE_PRUNE_INTERVAL 3600 
 #define FLOW_TABLE_EMER_PRUNE_INTERVAL 60
 #define DEFAULT_FLOW_BUFFER_SIZE 16384000 /* 16 Mb */
 
@@ -45,7 +46,7 @@ struct ip_flow_common {
      [0] = forward flow data
      [1] = reverse flow data
   */
-  u_int16_t bucket;
+  u_int32_t hash;
   struct timeval last[2];
   u_int32_t last_tcp_seq;
   u_int8_t tcp_flags[2];
@@ -101,6 +102,10 @@ extern void ip_flow_handler(struct packet_ptrs *);
 extern void find_flow(struct timeval *, struct packet_ptrs *); 
 extern void create_flow(struct timeval *, struct ip_flow *, u_int8_t, unsigned int, struct packet_ptrs *, struct pm_iphdr *, struct pm_tlhdr *, unsigned int); 
 extern void prune_old_flows(struct timeval *); 
+extern void prune_flows_step(struct timeval *);
+extern void delete_flow(struct ip_flow *);
+extern void resize_flow_table(u_int32_t);
+extern void print_ip_flow_stats(time_t);
 
 extern unsigned int hash_flow(u_int32_t, u_int32_t, u_int16_t, u_int16_t, u_int8_t);
 extern unsigned int normalize_flow(u_int32_t *, u_int32_t *, u_int16_t *, u_int16_t *);
@@ -116,6 +121,9 @@ extern unsigned int normalize_flow6(struct in6_addr *, struct in6_addr *, u_int1
 extern void find_flow6(struct timeval *, struct packet_ptrs *);
 extern void create_flow6(struct timeval *, struct ip_flow6 *, u_int8_t, unsigned int, struct packet_ptrs *, struct ip6_hdr *, struct pm_tlhdr *, unsigned int);
 extern void prune_old_flows6(struct timeval *); 
+extern void prune_flows6_step(struct timeval *);
+extern void delete_flow6(struct ip_flow6 *);
+extern void resize_flow_table6(u_int32_t);
 
 /* global vars */
 extern struct ip_flow **ip_flow_table;
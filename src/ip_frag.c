@@ -28,19 +28,28 @@
 #include "jhash.h"
 
 /* global variables */
-struct ip_fragment *ipft[IPFT_HASHSZ];
+struct ip_fragment **ipft;
 struct lru_l lru_list;
 
-struct ip6_fragment *ipft6[IPFT_HASHSZ];
+struct ip6_fragment **ipft6;
 struct lru_l6 lru_list6;
 
 u_int32_t ipft_total_nodes;  
-time_t prune_deadline;
+u_int32_t ipft_max_nodes;
+u_int32_t ipft_hashsz;
+u_int32_t ipft_max_hashsz;
+u_int32_t ipft_load_factor;
+u_int64_t ipft_hits;
+u_int64_t ipft_misses;
 time_t emergency_prune;
 u_int32_t trivial_hash_rnd = 140281; /* ummmh */
 
 u_int32_t ipft6_total_nodes;
-time_t prune_deadline6;
+u_int32_t ipft6_max_nodes;
+u_int32_t ipft6_hashsz;
+u_int32_t ipft6_max_hashsz;
+u_int64_t ipft6_hits;
+u_int64_t ipft6_misses;
 time_t emergency_prune6;
 
 void enable_ip_fragment_handler()
@@ -61,12 +70,24 @@ void init_ip4_fragment_handler()
 {
   if (config.frag_bufsz) ipft_total_nodes = config.frag_bufsz / sizeof(struct ip_fragment);
   else ipft_total_nodes = DEFAULT_FRAG_BUFFER_SIZE / sizeof(struct ip_fragment); 
+  ipft_max_nodes = ipft_total_nodes;
+
+  if (config.frag_load_factor) ipft_load_factor = config.frag_load_factor;
+  else ipft_load_factor = IPFT_LOAD_FACTOR;
+
+  /* the table starts at IPFT_HASHSZ buckets and doubles each time the load
+     factor is exceeded; the buffer size caps how far it is allowed to grow */
+  ipft_hashsz = IPFT_HASHSZ;
+  for (ipft_max_hashsz = ipft_hashsz; ipft_max_hashsz * ipft_load_factor < ipft_max_nodes && ipft_max_hashsz < (1U << 30); ipft_max_hashsz <<= 1);
+
+  ipft = (struct ip_fragment **) calloc(ipft_hashsz, sizeof(struct ip_fragment *));
+  assert(ipft);
 
-  memset(ipft, 0, sizeof(ipft));
   lru_list.root = (struct ip_fragment *) malloc(sizeof(struct ip_fragment)); 
   lru_list.last = lru_list.root;
   memset(lru_list.root, 0, sizeof(struct ip_fragment));
-  prune_deadline = time(NULL)+PRUNE_INTERVAL;
+  ipft_hits = 0;
+  ipft_misses = 0;
   emergency_prune = 0;
 }
 
@@ -74,10 +95,11 @@ int ip_fragment_handler(struct packet_ptrs *pptrs)
 {
   u_int32_t now = time(NULL);
 
-  if (now > prune_deadline) {
-    prune_old_fragments(now, PRUNE_OFFSET);
-    prune_deadline = now+PRUNE_INTERVAL;
-  }
+  prune_old_fragments(now, IPFT_PRUNE_STEP);
+
+  if ((ipft_max_nodes - ipft_total_nodes) > (ipft_hashsz * ipft_load_factor) && ipft_hashsz < ipft_max_hashsz)
+    resize_fragment_table(ipft_hashsz << 1);
+
   return find_fragment(now, pptrs);
 }
 
@@ -85,13 +107,15 @@ int find_fragment(u_int32_t now, struct packet_ptrs *pptrs)
 {
   struct pm_iphdr *iphp = (struct pm_iphdr *)pptrs->iph_ptr;
   struct ip_fragment *fp, *candidate = NULL, *last_seen = NULL;
-  unsigned int bucket = hash_fragment(iphp->ip_id, iphp->ip_src.s_addr,
-				      iphp->ip_dst.s_addr, iphp->ip_p);
+  unsigned int hash = hash_fragment(iphp->ip_id, iphp->ip_src.s_addr,
+				    iphp->ip_dst.s_addr, iphp->ip_p);
   int ret;
 
-  for (fp = ipft[bucket]; fp; fp = fp->next) {
-    if (fp->ip_id == iphp->ip_id && fp->ip_src == iphp->ip_src.s_addr &&
+  for (fp = ipft[hash & (ipft_hashsz-1)]; fp; fp = fp->next) {
+    if (fp->hash == hash && fp->ip_id == iphp->ip_id && fp->ip_src == iphp->ip_src.s_addr &&
 	fp->ip_dst == iphp->ip_dst.s_addr && fp->ip_p == iphp->ip_p) {
+      ipft_hits++;
+
       /* fragment found; will check for its deadline */
       if (fp->deadline > now) {
 	if (fp->got_first) {
@@ -139,15 +163,17 @@ int find_fragment(u_int32_t now, struct packet_ptrs *pptrs)
     last_seen = fp;
   } 
 
+  ipft_misses++;
+
   create:
-  if (candidate) ret = create_fragment(now, candidate, TRUE, bucket, pptrs);
-  else ret = create_fragment(now, last_seen, FALSE, bucket, pptrs); 
+  if (candidate) ret = create_fragment(now, candidate, TRUE, hash, pptrs);
+  else ret = create_fragment(now, last_seen, FALSE, hash, pptrs); 
 
   pptrs->frag_first_found = ret;
   return ret;
 }
 
-int create_fragment(u_int32_t now, struct ip_fragment *fp, u_int8_t is_candidate, unsigned int bucket, struct packet_ptrs *pptrs)
+int create_fragment(u_int32_t now, struct ip_fragment *fp, u_int8_t is_candidate, unsigned int hash, struct packet_ptrs *pptrs)
 {
   struct pm_iphdr *iphp = (struct pm_iphdr *)pptrs->iph_ptr;
   struct ip_fragment *newf;
@@ -208,7 +234,7 @@ int create_fragment(u_int32_t now, struct ip_fragment *fp, u_int8_t is_candidate
     }
     else ipft_total_nodes--;
     memset(fp, 0, sizeof(struct ip_fragment));
-    ipft[bucket] = fp;
+    ipft[hash & (ipft_hashsz-1)] = fp;
     lru_list.last->lru_next = fp; /* placing new node as LRU tail */ 
     fp->lru_prev = lru_list.last;
     lru_list.last = fp;
@@ -219,7 +245,7 @@ int create_fragment(u_int32_t now, struct ip_fragment *fp, u_int8_t is_candidate
   fp->ip_p = iphp->ip_p;
   fp->ip_src = iphp->ip_src.s_addr;
   fp->ip_dst = iphp->ip_dst.s_addr;
-  fp->bucket = bucket;
+  fp->hash = hash;
 
   if (!(iphp->ip_off & htons(IP_OFFMASK))) {
     /* it's a first fragment */
@@ -237,35 +263,32 @@ int create_fragment(u_int32_t now, struct ip_fragment *fp, u_int8_t is_candidate
   }
 }
 
-void prune_old_fragments(u_int32_t now, u_int32_t off)
+/* prune_old_fragments() pops expired fragments off the LRU head: deadlines
+   are always set to now+IPF_TIMEOUT as a node is moved to the tail, so the
+   LRU list is also sorted by deadline and the first live node ends the walk.
+   'max' bounds the number of fragments released per call, 0 for no limit */
+void prune_old_fragments(u_int32_t now, u_int32_t max)
 {
   struct ip_fragment *fp, *temp;
-  u_int32_t deadline = now-off;
+  u_int32_t pruned = 0;
 
   fp = lru_list.root->lru_next;
-  while (fp) {
-    if (deadline > fp->deadline) {
+  while (fp && (!max || pruned < max)) {
+    if (now > fp->deadline) {
       /* we found a stale element; we'll prune it */
-      if (fp->lru_next) temp = fp->lru_next;
-      else temp = NULL;
+      temp = fp->lru_next;
+      if (!fp->got_first) notify_orphan_fragment(fp);
 
       /* rearranging bucket's pointers */ 
-      if (fp->prev && fp->next) {
-	fp->prev->next = fp->next;
-        fp->next->prev = fp->prev;
-      }
-      else if (fp->prev) fp->prev->next = NULL;
-      else if (fp->next) {
-	ipft[fp->bucket] = fp->next;
-	fp->next->prev = NULL; 
-      }
-      else ipft[fp->bucket] = NULL;
+      if (fp->prev) fp->prev->next = fp->next;
+      else ipft[fp->hash & (ipft_hashsz-1)] = fp->next;
+      if (fp->next) fp->next->prev = fp->prev;
 
       free(fp);
       ipft_total_nodes++;
+      pruned++;
 
-      if (temp) fp = temp;
-      else fp = NULL;
+      fp = temp;
     }
     else break;
   }
@@ -274,14 +297,57 @@ void prune_old_fragments(u_int32_t now, u_int32_t off)
     fp->lru_prev = lru_list.root;
     lru_list.root->lru_next = fp;
   }
-  else lru_list.last = lru_list.root;
+  else {
+    lru_list.root->lru_next = NULL;
+    lru_list.last = lru_list.root;
+  }
+}
+
+/* resize_fragment_table() re-chains all fragments into a new bucket array;
+   walking the LRU list avoids touching the old buckets at all */
+void resize_fragment_table(u_int32_t hashsz)
+{
+  struct ip_fragment **table, *fp;
+  u_int32_t bucket;
+
+  table = (struct ip_fragment **) calloc(hashsz, sizeof(struct ip_fragment *));
+  if (!table) {
+    Log(LOG_WARNING, "WARN ( %s/core ): Fragment/4 buffer unable to grow to %u buckets. Staying at %u.\n", config.name, hashsz, ipft_hashsz);
+    ipft_max_hashsz = ipft_hashsz;
+    return;
+  }
+
+  for (fp = lru_list.root->lru_next; fp; fp = fp->lru_next) {
+    bucket = fp->hash & (hashsz-1);
+    fp->prev = NULL;
+    fp->next = table[bucket];
+    if (fp->next) fp->next->prev = fp;
+    table[bucket] = fp;
+  }
+
+  free(ipft);
+  ipft = table;
+  ipft_hashsz = hashsz;
+
+  Log(LOG_DEBUG, "DEBUG ( %s/core ): Fragment/4 buffer resized: buckets=%u fragments=%u\n", config.name, ipft_hashsz, ipft_max_nodes - ipft_total_nodes);
+}
+
+void print_ip_fragment_stats(time_t now)
+{
+  Log(LOG_NOTICE, "NOTICE ( %s/%s ): stats [fragments/4] time=%ld fragments=%u buckets=%u hits=%llu misses=%llu\n",
+      config.name, config.type, (long)now, ipft_max_nodes - ipft_total_nodes, ipft_hashsz,
+      (unsigned long long)ipft_hits, (unsigned long long)ipft_misses);
+
+  Log(LOG_NOTICE, "NOTICE ( %s/%s ): stats [fragments/6] time=%ld fragments=%u buckets=%u hits=%llu misses=%llu\n",
+      config.name, config.type, (long)now, ipft6_max_nodes - ipft6_total_nodes, ipft6_hashsz,
+      (unsigned long long)ipft6_hits, (unsigned long long)ipft6_misses);
 }
 
 /* hash_fragment() is taken (it has another name there) from Linux kernel 2.4;
    see full credits contained in jhash.h */ 
 unsigned int hash_fragment(u_int16_t id, u_int32_t src, u_int32_t dst, u_int8_t proto)
 {
-  return jhash_3words((u_int32_t)id << 16 | proto, src, dst, trivial_hash_rnd) & (IPFT_HASHSZ-1);
+  return jhash_3words((u_int32_t)id << 16 | proto, src, dst, trivial_hash_rnd);
 }
 
 void notify_orphan_fragment(struct ip_fragment *frag)
@@ -304,12 +370,22 @@ void init_ip6_fragment_handler()
 {
   if (config.frag_bufsz) ipft6_total_nodes = config.frag_bufsz / sizeof(struct ip6_fragment);
   else ipft6_total_nodes = DEFAULT_FRAG_BUFFER_SIZE / sizeof(struct ip6_fragment);
+  ipft6_max_nodes = ipft6_total_nodes;
+
+  if (config.frag_load_factor) ipft_load_factor = config.frag_load_factor;
+  else ipft_load_factor = IPFT_LOAD_FACTOR;
+
+  ipft6_hashsz = IPFT_HASHSZ;
+  for (ipft6_max_hashsz = ipft6_hashsz; ipft6_max_hashsz * ipft_load_factor < ipft6_max_nodes && ipft6_max_hashsz < (1U << 30); ipft6_max_hashsz <<= 1);
+
+  ipft6 = (struct ip6_fragment **) calloc(ipft6_hashsz, sizeof(struct ip6_fragment *));
+  assert(ipft6);
 
-  memset(ipft6, 0, sizeof(ipft6));
   lru_list6.root = (struct ip6_fragment *) malloc(sizeof(struct ip6_fragment));
   lru_list6.last = lru_list6.root;
   memset(lru_list6.root, 0, sizeof(struct ip6_fragment));
-  prune_deadline6 = time(NULL)+PRUNE_INTERVAL;
+  ipft6_hits = 0;
+  ipft6_misses = 0;
   emergency_prune6 = 0;
 }
 
@@ -317,10 +393,11 @@ int ip6_fragment_handler(struct packet_ptrs *pptrs, struct ip6_frag *fhdr)
 {
   u_int32_t now = time(NULL);
 
-  if (now > prune_deadline6) {
-    prune_old_fragments6(now, PRUNE_OFFSET);
-    prune_deadline6 = now+PRUNE_INTERVAL;
-  }
+  prune_old_fragments6(now, IPFT_PRUNE_STEP);
+
+  if ((ipft6_max_nodes - ipft6_total_nodes) > (ipft6_hashsz * ipft_load_factor) && ipft6_hashsz < ipft6_max_hashsz)
+    resize_fragment_table6(ipft6_hashsz << 1);
+
   return find_fragment6(now, pptrs, fhdr);
 }
 
@@ -348,18 +425,20 @@ unsigned int hash_fragment6(u_int32_t id, struct in6_addr *saddr, struct in6_add
         c += id;
         __jhash_mix(a, b, c);
 
-        return c & (IPFT_HASHSZ - 1);
+        return c;
 }
 
 int find_fragment6(u_int32_t now, struct packet_ptrs *pptrs, struct ip6_frag *fhdr)
 {
   struct ip6_hdr *iphp = (struct ip6_hdr *)pptrs->iph_ptr;
   struct ip6_fragment *fp, *candidate = NULL, *last_seen = NULL;
-  unsigned int bucket = hash_fragment6(fhdr->ip6f_ident, &iphp->ip6_src, &iphp->ip6_dst);
+  unsigned int hash = hash_fragment6(fhdr->ip6f_ident, &iphp->ip6_src, &iphp->ip6_dst);
 
-  for (fp = ipft6[bucket]; fp; fp = fp->next) {
-    if (fp->id == fhdr->ip6f_ident && !ip6_addr_cmp(&fp->src, &iphp->ip6_src) &&
+  for (fp = ipft6[hash & (ipft6_hashsz-1)]; fp; fp = fp->next) {
+    if (fp->hash == hash && fp->id == fhdr->ip6f_ident && !ip6_addr_cmp(&fp->src, &iphp->ip6_src) &&
         !ip6_addr_cmp(&fp->dst, &iphp->ip6_dst)) {
+      ipft6_hits++;
+
       /* fragment found; will check for its deadline */
       if (fp->deadline > now) {
         if (fp->got_first) {
@@ -401,12 +480,14 @@ int find_fragment6(u_int32_t now, struct packet_ptrs *pptrs, struct ip6_frag *fh
     last_seen = fp;
   }
 
+  ipft6_misses++;
+
   create:
-  if (candidate) return create_fragment6(now, candidate, TRUE, bucket, pptrs, fhdr);
-  else return create_fragment6(now, last_seen, FALSE, bucket, pptrs, fhdr);
+  if (candidate) return create_fragment6(now, candidate, TRUE, hash, pptrs, fhdr);
+  else return create_fragment6(now, last_seen, FALSE, hash, pptrs, fhdr);
 }
 
-int create_fragment6(u_int32_t now, struct ip6_fragment *fp, u_int8_t is_candidate, unsigned int bucket,
+int create_fragment6(u_int32_t now, struct ip6_fragment *fp, u_int8_t is_candidate, unsigned int hash,
 			struct packet_ptrs *pptrs, struct ip6_frag *fhdr)
 {
   struct ip6_hdr *iphp = (struct ip6_hdr *)pptrs->iph_ptr;
@@ -468,7 +549,7 @@ int create_fragment6(u_int32_t now, struct ip6_fragment *fp, u_int8_t is_candida
     }
     else ipft6_total_nodes--;
     memset(fp, 0, sizeof(struct ip6_fragment));
-    ipft6[bucket] = fp;
+    ipft6[hash & (ipft6_hashsz-1)] = fp;
     lru_list6.last->lru_next = fp; /* placing new node as LRU tail */
     fp->lru_prev = lru_list6.last;
     lru_list6.last = fp;
@@ -478,7 +559,7 @@ int create_fragment6(u_int32_t now, struct ip6_fragment *fp, u_int8_t is_candida
   fp->id = fhdr->ip6f_ident;
   ip6_addr_cpy(&fp->src, &iphp->ip6_src);
   ip6_addr_cpy(&fp->dst, &iphp->ip6_dst);
-  fp->bucket = bucket;
+  fp->hash = hash;
 
   if (!(fhdr->ip6f_offlg & htons(IP6F_OFF_MASK))) {
     /* it's a first fragment */
@@ -496,35 +577,28 @@ int create_fragment6(u_int32_t now, struct ip6_fragment *fp, u_int8_t is_candida
   }
 }
 
-void prune_old_fragments6(u_int32_t now, u_int32_t off)
+void prune_old_fragments6(u_int32_t now, u_int32_t max)
 {
   struct ip6_fragment *fp, *temp;
-  u_int32_t deadline = now-off;
+  u_int32_t pruned = 0;
 
   fp = lru_list6.root->lru_next;
-  while (fp) {
-    if (deadline > fp->deadline) {
+  while (fp && (!max || pruned < max)) {
+    if (now > fp->deadline) {
       /* we found a stale element; we'll prune it */
-      if (fp->lru_next) temp = fp->lru_next;
-      else temp = NULL;
+      temp = fp->lru_next;
+      if (!fp->got_first) notify_orphan_fragment6(fp);
 
       /* rearranging bucket's pointers */
-      if (fp->prev && fp->next) {
-        fp->prev->next = fp->next;
-        fp->next->prev = fp->prev;
-      }
-      else if (fp->prev) fp->prev->next = NULL;
-      else if (fp->next) {
-        ipft6[fp->bucket] = fp->next;
-        fp->next->prev = NULL;
-      }
-      else ipft6[fp->bucket] = NULL;
+      if (fp->prev) fp->prev->next = fp->next;
+      else ipft6[fp->hash & (ipft6_hashsz-1)] = fp->next;
+      if (fp->next) fp->next->prev = fp->prev;
 
       free(fp);
       ipft6_total_nodes++;
+      pruned++;
 
-      if (temp) fp = temp;
-      else fp = NULL;
+      fp = temp;
     }
     else break;
   }
@@ -533,7 +607,37 @@ void prune_old_fragments6(u_int32_t now, u_int32_t off)
     fp->lru_prev = lru_list6.root;
     lru_list6.root->lru_next = fp;
   }
-  else lru_list6.last = lru_list6.root;
+  else {
+    lru_list6.root->lru_next = NULL;
+    lru_list6.last = lru_list6.root;
+  }
+}
+
+void resize_fragment_table6(u_int32_t hashsz)
+{
+  struct ip6_fragment **table, *fp;
+  u_int32_t bucket;
+
+  table = (struct ip6_fragment **) calloc(hashsz, sizeof(struct ip6_fragment *));
+  if (!table) {
+    Log(LOG_WARNING, "WARN ( %s/core ): Fragment/6 buffer unable to grow to %u buckets. Staying at %u.\n", config.name, hashsz, ipft6_hashsz);
+    ipft6_max_hashsz = ipft6_hashsz;
+    return;
+  }
+
+  for (fp = lru_list6.root->lru_next; fp; fp = fp->lru_next) {
+    bucket = fp->hash & (hashsz-1);
+    fp->prev = NULL;
+    fp->next = table[bucket];
+    if (fp->next) fp->next->prev = fp;
+    table[bucket] = fp;
+  }
+
+  free(ipft6);
+  ipft6 = table;
+  ipft6_hashsz = hashsz;
+
+  Log(LOG_DEBUG, "DEBUG ( %s/core ): Fragment/6 buffer resized: buckets=%u fragments=%u\n", config.name, ipft6_hashsz, ipft6_max_nodes - ipft6_total_nodes);
 }
 
 void notify_orphan_fragment6(struct ip6_fragment *frag)
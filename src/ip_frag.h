@@ -24,10 +24,10 @@
 
 /* defines */
 #define IPFT_HASHSZ 256 
+#define IPFT_LOAD_FACTOR 2
+#define IPFT_PRUNE_STEP 4
 #define IPF_TIMEOUT 60 
-#define PRUNE_INTERVAL 7200
 #define EMER_PRUNE_INTERVAL 60
-#define PRUNE_OFFSET 1800 
 #define DEFAULT_FRAG_BUFFER_SIZE 4096000 /* 4 Mb */
 
 /* structures */
@@ -41,7 +41,7 @@ struct ip_fragment {
   u_int8_t ip_p;
   u_int32_t ip_src;
   u_int32_t ip_dst;
-  u_int16_t bucket;
+  u_int32_t hash;
   struct ip_fragment *lru_next;
   struct ip_fragment *lru_prev;
   struct ip_fragment *next;
@@ -62,7 +62,7 @@ struct ip6_fragment {
   u_int32_t id;
   u_int32_t src[4];
   u_int32_t dst[4];
-  u_int16_t bucket;
+  u_int32_t hash;
   struct ip6_fragment *lru_next;
   struct ip6_fragment *lru_prev;
   struct ip6_fragment *next;
@@ -75,10 +75,10 @@ struct lru_l6 {
 };
 
 /* global vars */
-extern struct ip_fragment *ipft[IPFT_HASHSZ];
+extern struct ip_fragment **ipft;
 extern struct lru_l lru_list;
 
-extern struct ip6_fragment *ipft6[IPFT_HASHSZ];
+extern struct ip6_fragment **ipft6;
 extern struct lru_l6 lru_list6;
 
 /* prototypes */
@@ -90,6 +90,8 @@ extern int find_fragment(u_int32_t, struct packet_ptrs *);
 extern int create_fragment(u_int32_t, struct ip_fragment *, u_int8_t, unsigned int, struct packet_ptrs *); 
 extern unsigned int hash_fragment(u_int16_t, u_int32_t, u_int32_t, u_int8_t);
 extern void prune_old_fragments(u_int32_t, u_int32_t); 
+extern void resize_fragment_table(u_int32_t);
+extern void print_ip_fragment_stats(time_t);
 extern void notify_orphan_fragment(struct ip_fragment *);
 
 extern void init_ip6_fragment_handler();
@@ -98,6 +100,7 @@ extern unsigned int hash_fragment6(u_int32_t, struct in6_addr *, struct in6_addr
 extern int find_fragment6(u_int32_t, struct packet_ptrs *, struct ip6_frag *);
 extern int create_fragment6(u_int32_t, struct ip6_fragment *, u_int8_t, unsigned int, struct packet_ptrs *, struct ip6_frag *);
 extern void prune_old_fragments6(u_int32_t, u_int32_t); 
+extern void resize_fragment_table6(u_int32_t);
 extern void notify_orphan_fragment6(struct ip6_fragment *);
 
 #endif //IP_FRAG_H
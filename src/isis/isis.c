@@ -25,6 +25,7 @@
 #include "addr.h"
 #include "isis.h"
 #include "thread_pool.h"
+#include "jhash.h"
 
 #include "stream.h"
 #include "hash.h"
@@ -51,10 +52,16 @@
 #include "isis_events.h"
 #include "isis_spf.h"
 #include "isis_route.h"
+#include "isis_fib.h"
+#include "bgp/bgp_mem.h"
 
 /* variables to be exported away */
 thread_pool_t *isis_pool;
 
+/* global variables */
+static struct isis_lookup_cache isis_lookup_cache;
+static int isis_lookup_mem_reader = ERR;
+
 /* Functions */
 void nfacctd_isis_wrapper()
 {
@@ -293,6 +300,8 @@ void isis_pdu_runner(u_char *user, const struct pcap_pkthdr *pkthdr, const u_cha
 
     isis_route_validate_merge (circuit->area, AF_INET);
 
+    isis_fib_publish(circuit->area);
+
     dyn_cache_cleanup();
 
     isis_spf_deadline.tv_sec = isis_now.tv_sec + isis_jitter(PERIODIC_SPF_INTERVAL, 10);
@@ -344,12 +353,85 @@ int iso_handler(register struct packet_ptrs *pptrs)
   return FALSE;
 }
 
+/*
+  Looks up the result of a recent longest prefix match of 'addr'. Returns
+  TRUE on a hit; otherwise FALSE, with 'slot' set to the entry the lookup
+  result should be stored to, via isis_lookup_cache_set(). Entries are
+  valid as long as the IGP FIB snapshot they were matched against is the
+  published one.
+*/
+static int isis_lookup_cache_get(struct isis_fib *fib, u_int8_t family, void *addr,
+				 struct isis_lookup_cache_entry **slot, struct isis_fib_entry **result)
+{
+  struct isis_lookup_cache_entry *entry;
+  u_int32_t hash, addr_len;
+
+  (*slot) = NULL;
+
+  if (!isis_lookup_cache.entries) {
+    isis_lookup_cache.entries = calloc(ISIS_LOOKUP_CACHE_ENTRIES, sizeof(struct isis_lookup_cache_entry));
+    if (!isis_lookup_cache.entries) {
+      Log(LOG_ERR, "ERROR ( %s/core/ISIS ): calloc() failed (isis_lookup_cache_get). Exiting ..\n", config.name);
+      exit_gracefully(1);
+    }
+  }
+
+  addr_len = ((family == AF_INET) ? sizeof(struct in_addr) : sizeof(struct in6_addr));
+  hash = jhash(addr, addr_len, family);
+  entry = &isis_lookup_cache.entries[hash & (ISIS_LOOKUP_CACHE_ENTRIES - 1)];
+
+  if (entry->valid && entry->gen == fib->gen && entry->family == family && !memcmp(entry->addr, addr, addr_len)) {
+    (*result) = entry->entry;
+    isis_lookup_cache.hits++;
+
+    return TRUE;
+  }
+
+  isis_lookup_cache.misses++;
+
+  entry->valid = FALSE;
+  entry->gen = fib->gen;
+  entry->family = family;
+  memcpy(entry->addr, addr, addr_len);
+  (*slot) = entry;
+
+  return FALSE;
+}
+
+static void isis_lookup_cache_set(struct isis_lookup_cache_entry *slot, struct isis_fib_entry *result)
+{
+  if (!slot) return;
+
+  slot->entry = result;
+  slot->valid = TRUE;
+}
+
+void isis_lookup_cache_print_status(time_t now)
+{
+  u_int64_t lookups = (isis_lookup_cache.hits + isis_lookup_cache.misses);
+
+  Log(LOG_NOTICE, "NOTICE ( %s/%s ): stats [isis_lookup_cache] time=%ld entries=%u hits=%" PRIu64 " misses=%" PRIu64 " hit_ratio=%.2f\n",
+	config.name, config.type, (long)now, ISIS_LOOKUP_CACHE_ENTRIES, isis_lookup_cache.hits, isis_lookup_cache.misses,
+	lookups ? ((float) isis_lookup_cache.hits / lookups) : 0);
+}
+
+static struct isis_fib_entry *isis_srcdst_match(struct isis_fib *fib, u_int8_t family, void *addr)
+{
+  struct isis_lookup_cache_entry *cache_slot;
+  struct isis_fib_entry *result;
+
+  if (!isis_lookup_cache_get(fib, family, addr, &cache_slot, &result)) {
+    result = isis_fib_match(fib, family, addr);
+    isis_lookup_cache_set(cache_slot, result);
+  }
+
+  return result;
+}
+
 void isis_srcdst_lookup(struct packet_ptrs *pptrs)
 {
-  struct route_node *result;
-  struct isis_area *area;
-  char area_tag[] = "default";
-  int level;
+  struct isis_fib_entry *result;
+  struct isis_fib *fib;
   struct in_addr pref4;
   struct in6_addr pref6;
 
@@ -358,19 +440,22 @@ void isis_srcdst_lookup(struct packet_ptrs *pptrs)
   pptrs->igp_src_info = NULL;
   pptrs->igp_dst_info = NULL;
 
-  area = isis_area_lookup(area_tag);
+  /* routes of the "default" area as of the last SPF run; results stay
+     referenced by pptrs until isis_lookup_offline() */
+  if (isis_lookup_mem_reader == ERR) isis_lookup_mem_reader = bgp_mem_reader_register();
+  bgp_mem_reader_online(isis_lookup_mem_reader);
 
-  if (area) {
-    level = MAX(area->is_type, 2);
+  fib = isis_fib_get();
 
+  if (fib) {
     if (pptrs->l3_proto == ETHERTYPE_IP) {
       if (!pptrs->igp_src) {
 	memcpy(&pref4, &((struct pm_iphdr *)pptrs->iph_ptr)->ip_src, sizeof(struct in_addr));
-	result = route_node_match_ipv4(area->route_table[level-1], &pref4);
+	result = isis_srcdst_match(fib, AF_INET, &pref4);
 
 	if (result) {
 	  pptrs->igp_src = (char *) &result->p;
-	  pptrs->igp_src_info = (char *) result->info;
+	  pptrs->igp_src_info = (char *) &result->info;
 	  if (result->p.prefixlen > pptrs->lm_mask_src) {
 	    pptrs->lm_mask_src = result->p.prefixlen;
 	    pptrs->lm_method_src = NF_NET_IGP;
@@ -380,11 +465,11 @@ void isis_srcdst_lookup(struct packet_ptrs *pptrs)
 
       if (!pptrs->igp_dst) {
 	memcpy(&pref4, &((struct pm_iphdr *)pptrs->iph_ptr)->ip_dst, sizeof(struct in_addr));
-	result = route_node_match_ipv4(area->route_table[level-1], &pref4);
+	result = isis_srcdst_match(fib, AF_INET, &pref4);
 
 	if (result) {
 	  pptrs->igp_dst = (char *) &result->p;
-	  pptrs->igp_dst_info = (char *) result->info;
+	  pptrs->igp_dst_info = (char *) &result->info;
           if (result->p.prefixlen > pptrs->lm_mask_dst) {
             pptrs->lm_mask_dst = result->p.prefixlen;
             pptrs->lm_method_dst = NF_NET_IGP;
@@ -392,14 +477,14 @@ void isis_srcdst_lookup(struct packet_ptrs *pptrs)
 	}
       }
     }
-    else if (area && pptrs->l3_proto == ETHERTYPE_IPV6) {
+    else if (pptrs->l3_proto == ETHERTYPE_IPV6) {
       if (!pptrs->igp_src) {
         memcpy(&pref6, &((struct ip6_hdr *)pptrs->iph_ptr)->ip6_src, sizeof(struct in6_addr));
-        result = route_node_match_ipv6(area->route_table6[level-1], &pref6);
+	result = isis_srcdst_match(fib, AF_INET6, &pref6);
 
         if (result) {
           pptrs->igp_src = (char *) &result->p;
-          pptrs->igp_src_info = (char *) result->info;
+          pptrs->igp_src_info = (char *) &result->info;
           if (result->p.prefixlen > pptrs->lm_mask_src) {
             pptrs->lm_mask_src = result->p.prefixlen;
             pptrs->lm_method_src = NF_NET_IGP;
@@ -409,11 +494,11 @@ void isis_srcdst_lookup(struct packet_ptrs *pptrs)
 
       if (!pptrs->igp_dst) {
         memcpy(&pref6, &((struct ip6_hdr *)pptrs->iph_ptr)->ip6_dst, sizeof(struct in6_addr));
-        result = route_node_match_ipv6(area->route_table6[level-1], &pref6);
+	result = isis_srcdst_match(fib, AF_INET6, &pref6);
 
 	if (result) {
 	  pptrs->igp_dst = (char *) &result->p;
-	  pptrs->igp_dst_info = (char *) result->info;
+	  pptrs->igp_dst_info = (char *) &result->info;
           if (result->p.prefixlen > pptrs->lm_mask_dst) {
             pptrs->lm_mask_dst = result->p.prefixlen;
             pptrs->lm_method_dst = NF_NET_IGP;
@@ -424,6 +509,12 @@ void isis_srcdst_lookup(struct packet_ptrs *pptrs)
   }
 }
 
+/* As bgp_lookup_offline(), for snapshots retired by isis_fib_publish() */
+void isis_lookup_offline()
+{
+  bgp_mem_reader_offline(isis_lookup_mem_reader);
+}
+
 int igp_daemon_map_node_handler(char *filename, struct id_entry *e, char *value, struct plugin_requests *req, int acct_type)
 {
   struct igp_map_entry *entry = (struct igp_map_entry *) req->key_value_table;
@@ -30,6 +30,7 @@
 /* defines */
 #define MAX_IGP_MAP_ELEM 64
 #define MAX_IGP_MAP_NODES 4096
+#define ISIS_LOOKUP_CACHE_ENTRIES 4096 /* power of 2 */
 
 /* Flag manipulation macros. */
 #define CHECK_FLAG(V,F)      ((V) & (F))
@@ -68,6 +69,21 @@ struct igp_map_entry {
   u_int8_t reach6_metric_num;
 };
 
+struct isis_lookup_cache_entry {
+  struct isis_fib_entry *entry;
+  u_int32_t gen;
+  u_int8_t family;
+  u_int8_t valid;
+  u_char addr[16];
+};
+
+/* recent address lookup results of the collector thread */
+struct isis_lookup_cache {
+  struct isis_lookup_cache_entry *entries;
+  u_int64_t hits;
+  u_int64_t misses;
+};
+
 struct sysid_fragment {
   u_char sysid[ISIS_SYS_ID_LEN];
   u_char frag_num;
@@ -91,6 +107,8 @@ extern void igp_daemon_map_finalize(char *, struct plugin_requests *);
 extern int igp_daemon_map_handle_len(int *, int, struct plugin_requests *, char *);
 extern int igp_daemon_map_handle_lsp_id(u_char *, struct host_addr *);
 extern void isis_srcdst_lookup(struct packet_ptrs *);
+extern void isis_lookup_offline();
+extern void isis_lookup_cache_print_status(time_t);
 
 /* global variables */
 extern struct thread_master *master;
@@ -0,0 +1,195 @@
+/*
+    pmacct (Promiscuous mode IP Accounting package)
+    pmacct is Copyright (C) 2003-2020 by Paolo Lucente
+*/
+
+/*
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/*
+  IGP FIB snapshot: once SPF has run and routes have been validated, the
+  IS-IS thread flattens the routes of the area into read-only multibit
+  tries and publishes them with a single pointer swap. Flow enrichment in
+  the collector thread then takes no locks and does not touch the zebra
+  route tables, which the IS-IS thread keeps modifying. Unpublished
+  snapshots are retired via bgp_mem_retire_func() and only freed once no
+  lookup can still be walking them, see isis_srcdst_lookup().
+*/
+
+/* includes */
+#include "pmacct.h"
+#include "isis.h"
+
+#include "prefix.h"
+#include "table.h"
+#include "dict.h"
+#include "thread.h"
+#include "isis_constants.h"
+#include "isis_common.h"
+#include "isisd.h"
+#include "isis_route.h"
+#include "isis_fib.h"
+#include "bgp/bgp_mem.h"
+
+/* variables */
+static struct isis_fib *isis_fib_current;
+static u_int32_t isis_fib_gen;
+
+/* functions */
+static int isis_fib_addr_load(u_int8_t family, void *addr, u_int32_t *words)
+{
+  u_int32_t tmp[4];
+  int idx;
+
+  if (family == AF_INET) {
+    memcpy(tmp, addr, sizeof(struct in_addr));
+    words[0] = ntohl(tmp[0]);
+
+    return 1;
+  }
+  else if (family == AF_INET6) {
+    memcpy(tmp, addr, sizeof(struct in6_addr));
+    for (idx = 0; idx < 4; idx++) words[idx] = ntohl(tmp[idx]);
+
+    return 4;
+  }
+
+  return 0;
+}
+
+static u_int32_t isis_fib_count(struct route_table *rt)
+{
+  struct route_node *rnode;
+  u_int32_t num = 0;
+
+  for (rnode = route_top(rt); rnode; rnode = route_next(rnode)) {
+    if (rnode->info) num++;
+  }
+
+  return num;
+}
+
+/* Prefixes come in route table order, ie. sorted by network then length,
+   as lpm_trie_build() wants them */
+static int isis_fib_build_table(struct isis_fib *fib, int af, struct route_table *rt, struct lpm_trie_prefix *pfx)
+{
+  struct isis_fib_entry *entry;
+  struct route_node *rnode;
+  int num = 0;
+
+  for (rnode = route_top(rt); rnode; rnode = route_next(rnode)) {
+    if (!rnode->info) continue;
+
+    entry = &fib->entries[fib->entries_num++];
+    memcpy(&entry->p, &rnode->p, sizeof(struct isis_prefix));
+    memcpy(&entry->info, rnode->info, sizeof(struct isis_route_info));
+    entry->info.nexthops = NULL;
+    entry->info.nexthops6 = NULL;
+
+    memset(pfx[num].net, 0, sizeof(pfx[num].net));
+    isis_fib_addr_load(rnode->p.family, &rnode->p.u.prefix, pfx[num].net);
+    pfx[num].len = rnode->p.prefixlen;
+    pfx[num].entry = entry;
+    num++;
+  }
+
+  fib->trie[af] = lpm_trie_build(pfx, num, ((af == ISIS_FIB_AF_IP) ? 1 : 4));
+
+  return (fib->trie[af] ? TRUE : FALSE);
+}
+
+static void isis_fib_free(void *ptr)
+{
+  struct isis_fib *fib = ptr;
+  int af;
+
+  if (!fib) return;
+
+  for (af = 0; af < ISIS_FIB_AF_MAX; af++) lpm_trie_free(fib->trie[af]);
+
+  if (fib->entries) free(fib->entries);
+  free(fib);
+}
+
+/* Snapshots the routes of 'area' and makes them the ones flows are matched against */
+void isis_fib_publish(struct isis_area *area)
+{
+  struct route_table *rt[ISIS_FIB_AF_MAX];
+  struct lpm_trie_prefix *pfx = NULL;
+  struct isis_fib *fib, *old_fib;
+  u_int32_t num[ISIS_FIB_AF_MAX];
+  int af, level;
+
+  /* same level flows were matched against by isis_srcdst_lookup() */
+  level = MIN(MAX(area->is_type, 2), ISIS_LEVELS);
+  rt[ISIS_FIB_AF_IP] = area->route_table[level - 1];
+  rt[ISIS_FIB_AF_IP6] = area->route_table6[level - 1];
+
+  fib = calloc(1, sizeof(struct isis_fib));
+  if (!fib) goto malloc_failed;
+
+  fib->area = area;
+
+  for (af = 0; af < ISIS_FIB_AF_MAX; af++) num[af] = isis_fib_count(rt[af]);
+
+  if (num[ISIS_FIB_AF_IP] + num[ISIS_FIB_AF_IP6]) {
+    fib->entries = malloc((num[ISIS_FIB_AF_IP] + num[ISIS_FIB_AF_IP6]) * sizeof(struct isis_fib_entry));
+    pfx = malloc(MAX(num[ISIS_FIB_AF_IP], num[ISIS_FIB_AF_IP6]) * sizeof(struct lpm_trie_prefix));
+    if (!fib->entries || !pfx) goto malloc_failed;
+  }
+
+  for (af = 0; af < ISIS_FIB_AF_MAX; af++) {
+    if (!isis_fib_build_table(fib, af, rt[af], pfx)) goto malloc_failed;
+  }
+
+  if (pfx) free(pfx);
+
+  fib->gen = ++isis_fib_gen;
+
+  old_fib = isis_fib_current;
+  __atomic_store_n(&isis_fib_current, fib, __ATOMIC_RELEASE);
+
+  /* lookups may still be walking the previous snapshot */
+  bgp_mem_retire_func(old_fib, isis_fib_free);
+  bgp_mem_reclaim();
+
+  Log(LOG_DEBUG, "DEBUG ( %s/core/ISIS ): IGP FIB (tag: %s, gen: %u): %u IPv4 routes, %u IPv6 routes\n",
+	config.name, area->area_tag, fib->gen, num[ISIS_FIB_AF_IP], num[ISIS_FIB_AF_IP6]);
+
+  return;
+
+  malloc_failed:
+  Log(LOG_ERR, "ERROR ( %s/core/ISIS ): malloc() failed (isis_fib_publish). Exiting ..\n", config.name);
+  exit_gracefully(1);
+}
+
+/* Returns the latest published snapshot, if any; safe from any thread */
+struct isis_fib *isis_fib_get()
+{
+  return __atomic_load_n(&isis_fib_current, __ATOMIC_ACQUIRE);
+}
+
+/* Longest prefix match of 'addr', in network byte order, against 'fib' */
+struct isis_fib_entry *isis_fib_match(struct isis_fib *fib, u_int8_t family, void *addr)
+{
+  u_int32_t words[4];
+  int words_num;
+
+  words_num = isis_fib_addr_load(family, addr, words);
+  if (!words_num) return NULL;
+
+  return lpm_trie_match(fib->trie[(family == AF_INET) ? ISIS_FIB_AF_IP : ISIS_FIB_AF_IP6], words, words_num);
+}
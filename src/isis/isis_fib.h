@@ -0,0 +1,51 @@
+/*
+    pmacct (Promiscuous mode IP Accounting package)
+    pmacct is Copyright (C) 2003-2020 by Paolo Lucente
+*/
+
+/*
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#ifndef _ISIS_FIB_H_
+#define _ISIS_FIB_H_
+
+/* defines */
+#define ISIS_FIB_AF_IP		0
+#define ISIS_FIB_AF_IP6		1
+#define ISIS_FIB_AF_MAX		2
+
+/* structures */
+/* A route as of the SPF run the snapshot was taken at; next-hop lists are not carried over */
+struct isis_fib_entry {
+  struct isis_prefix p;
+  struct isis_route_info info;
+};
+
+/* Immutable snapshot of the routes of an area, published after each SPF run */
+struct isis_fib {
+  struct isis_area *area;
+  u_int32_t gen;
+  struct isis_fib_entry *entries;
+  u_int32_t entries_num;
+  struct lpm_trie_node *trie[ISIS_FIB_AF_MAX];
+};
+
+/* prototypes */
+extern void isis_fib_publish(struct isis_area *);
+extern struct isis_fib *isis_fib_get();
+extern struct isis_fib_entry *isis_fib_match(struct isis_fib *, u_int8_t, void *);
+
+#endif /* _ISIS_FIB_H_ */
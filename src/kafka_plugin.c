@@ -37,21 +37,17 @@ void kafka_plugin(int pipe_fd, struct configuration *cfgptr, void *ptr)
 {
   struct pkt_data *data;
   struct ports_table pt;
-  unsigned char *pipebuf;
+  unsigned char *pipebuf = NULL;
   struct pollfd pfd;
   struct insert_data idata;
   int timeout, refresh_timeout;
   int ret, num, recv_budget, poll_bypass;
-  struct ring *rg = &((struct channels_list_entry *)ptr)->rg;
-  struct ch_status *status = ((struct channels_list_entry *)ptr)->status;
+  struct channels_list_entry *chptr = (struct channels_list_entry *) ptr;
   int datasize = ((struct channels_list_entry *)ptr)->datasize;
-  u_int32_t bufsz = ((struct channels_list_entry *)ptr)->bufsize;
   pid_t core_pid = ((struct channels_list_entry *)ptr)->core_pid;
   struct networks_file_data nfd;
 
-  unsigned char *rgptr;
-  int pollagain = TRUE;
-  u_int32_t seq = 1, rg_err_count = 0;
+  u_int32_t seq = 1;
 
   struct extra_primitives extras;
   struct primitives_ptrs prim_ptrs;
@@ -75,8 +71,10 @@ void kafka_plugin(int pipe_fd, struct configuration *cfgptr, void *ptr)
   P_set_signals();
   P_init_default_values();
   P_config_checks();
-  pipebuf = (unsigned char *) pm_malloc(config.buffer_size);
-  memset(pipebuf, 0, config.buffer_size);
+  if (config.pipe_zmq) {
+    pipebuf = (unsigned char *) pm_malloc(config.buffer_size);
+    memset(pipebuf, 0, config.buffer_size);
+  }
 
   timeout = config.sql_refresh_time*1000;
 
@@ -192,7 +190,6 @@ void kafka_plugin(int pipe_fd, struct configuration *cfgptr, void *ptr)
   /* plugin main loop */
   for(;;) {
     poll_again:
-    status->wakeup = TRUE;
     poll_bypass = FALSE;
 
     calc_refresh_timeout(refresh_deadline, idata.now, &refresh_timeout);
@@ -200,7 +197,8 @@ void kafka_plugin(int pipe_fd, struct configuration *cfgptr, void *ptr)
     pfd.fd = pipe_fd;
     pfd.events = POLLIN;
     timeout = refresh_timeout; /* in case we have more timeouts to factor in */
-    ret = poll(&pfd, (pfd.fd == ERR ? 0 : 1), timeout);
+    if (config.pipe_homegrown && !arm_pipe_wakeup(chptr)) ret = TRUE; /* data is pending, do not sleep */
+    else ret = poll(&pfd, (pfd.fd == ERR ? 0 : 1), timeout);
 
     if (ret <= 0) {
       if (getppid() != core_pid) {
@@ -233,40 +231,16 @@ void kafka_plugin(int pipe_fd, struct configuration *cfgptr, void *ptr)
       }
 
       if (config.pipe_homegrown) {
-        if (!pollagain) {
-          seq++;
-          seq %= MAX_SEQNUM;
-          if (seq == 0) rg_err_count = FALSE;
-        }
-        else {
-          if ((ret = read(pipe_fd, &rgptr, sizeof(rgptr))) == 0) 
+	if (!recv_budget) {
+	  if (drain_pipe_wakeup(pipe_fd) == ERR)
 	    exit_gracefully(1); /* we exit silently; something happened at the write end */
-        }
 
-        if ((rg->ptr + bufsz) > rg->end) rg->ptr = rg->base;
-
-        if (((struct ch_buf_hdr *)rg->ptr)->seq != seq) {
-          if (!pollagain) {
-            pollagain = TRUE;
-            goto poll_again;
-          }
-          else {
-            rg_err_count++;
-            if (config.debug || (rg_err_count > MAX_RG_COUNT_ERR)) {
-              Log(LOG_WARNING, "WARN ( %s/%s ): Missing data detected (plugin_buffer_size=%" PRIu64 " plugin_pipe_size=%" PRIu64 ").\n",
-                        config.name, config.type, config.buffer_size, config.pipe_size);
-              Log(LOG_WARNING, "WARN ( %s/%s ): Increase values or look for plugin_buffer_size, plugin_pipe_size in CONFIG-KEYS document.\n\n",
-                        config.name, config.type);
-            }
-
-	    rg->ptr = (rg->base + status->last_buf_off);
-            seq = ((struct ch_buf_hdr *)rg->ptr)->seq;
-          }
-        }
+	  check_pipe_lost_data(chptr);
+	}
 
-        pollagain = FALSE;
-        memcpy(pipebuf, rg->ptr, bufsz);
-        rg->ptr += bufsz;
+	/* buffers are read in place and released to the Core Process once processed */
+	if (!(pipebuf = get_pipe_buffer(chptr))) goto poll_again;
+	seq = ((struct ch_buf_hdr *)pipebuf)->seq;
       }
 #ifdef WITH_ZMQ
       else if (config.pipe_zmq) {
@@ -314,6 +288,7 @@ void kafka_plugin(int pipe_fd, struct configuration *cfgptr, void *ptr)
 	}
       }
 
+      if (config.pipe_homegrown) release_pipe_buffer(chptr);
       recv_budget++;
       goto read_data;
     }
@@ -322,36 +297,16 @@ void kafka_plugin(int pipe_fd, struct configuration *cfgptr, void *ptr)
 
 void kafka_cache_purge(struct chained_cache *queue[], int index, int safe_action)
 {
-  struct pkt_primitives *data = NULL;
-  struct pkt_bgp_primitives *pbgp = NULL;
-  struct pkt_nat_primitives *pnat = NULL;
-  struct pkt_mpls_primitives *pmpls = NULL;
-  struct pkt_tunnel_primitives *ptun = NULL;
-  u_char *pcust = NULL;
-  struct pkt_vlen_hdr_primitives *pvlen = NULL;
-  struct pkt_bgp_primitives empty_pbgp;
-  struct pkt_nat_primitives empty_pnat;
-  struct pkt_mpls_primitives empty_pmpls;
-  struct pkt_tunnel_primitives empty_ptun;
   u_char *empty_pcust = NULL;
   char dyn_kafka_topic[SRVBUFLEN], *orig_kafka_topic = NULL;
-  char elem_part_key[SRVBUFLEN], tmpbuf[SRVBUFLEN];
+  char tmpbuf[SRVBUFLEN];
   int j, stop, is_topic_dyn = FALSE, qn = 0, ret, saved_index = index;
-  int mv_num = 0, mv_num_save = 0;
+  int mv_num = 0, mv_num_save = 0, purge_workers = 1;
   time_t start, duration;
   struct primitives_ptrs prim_ptrs;
   struct pkt_data dummy_data;
   pid_t writer_pid = getpid();
 
-  //TODO solve these warnings correctly
-  (void)pvlen;
-  (void)pcust;
-  (void)ptun;
-  (void)pmpls;
-  (void)pnat;
-  (void)pbgp;
-  (void)data;
-
   char *json_buf = NULL;
   int json_buf_off = 0;
 
@@ -360,10 +315,13 @@ void kafka_cache_purge(struct chained_cache *queue[], int index, int safe_action
   char *p_avro_buf = NULL;
   int p_avro_buffer_full = FALSE;
   size_t p_avro_len = 0;
+  avro_value_iface_t *p_avro_data_iface = NULL;
+  avro_value_t p_avro_value;
+  void *p_avro_data_value = &p_avro_value;
+#else
+  void *p_avro_data_iface = NULL, *p_avro_data_value = NULL;
 #endif
 
-  p_kafka_init_host(&kafkap_kafka_host, config.kafka_config_file);
-
   /* setting some defaults */
   if (!config.sql_host) config.sql_host = default_kafka_broker_host;
   if (!config.kafka_broker_port) config.kafka_broker_port = default_kafka_broker_port;
@@ -378,32 +336,21 @@ void kafka_cache_purge(struct chained_cache *queue[], int index, int safe_action
 
   if (config.amqp_routing_key_rr) orig_kafka_topic = config.sql_table;
 
-  p_kafka_init_topic_rr(&kafkap_kafka_host);
-  p_kafka_set_topic_rr(&kafkap_kafka_host, config.amqp_routing_key_rr);
-
   empty_pcust = malloc(config.cpptrs.len);
   if (!empty_pcust) {
     Log(LOG_ERR, "ERROR ( %s/%s ): Unable to malloc() empty_pcust. Exiting.\n", config.name, config.type);
     exit_gracefully(1);
   }
 
-  memset(&empty_pbgp, 0, sizeof(struct pkt_bgp_primitives));
-  memset(&empty_pnat, 0, sizeof(struct pkt_nat_primitives));
-  memset(&empty_pmpls, 0, sizeof(struct pkt_mpls_primitives));
-  memset(&empty_ptun, 0, sizeof(struct pkt_tunnel_primitives));
   memset(empty_pcust, 0, config.cpptrs.len);
   memset(&prim_ptrs, 0, sizeof(prim_ptrs));
   memset(&dummy_data, 0, sizeof(dummy_data));
   memset(tmpbuf, 0, sizeof(tmpbuf));
-
-  p_kafka_connect_to_produce(&kafkap_kafka_host);
-  p_kafka_set_broker(&kafkap_kafka_host, config.sql_host, config.kafka_broker_port);
+  prim_ptrs.data = &dummy_data;
 
   if (config.kafka_partition_key && strchr(config.kafka_partition_key, '$')) dyn_partition_key = TRUE;
   else dyn_partition_key = FALSE;
 
-  if (!is_topic_dyn && !config.amqp_routing_key_rr) p_kafka_set_topic(&kafkap_kafka_host, config.sql_table);
-
   if (config.kafka_partition_dynamic && !config.kafka_partition_key) {
     Log(LOG_ERR, "ERROR ( %s/%s ): kafka_partition_dynamic needs a kafka_partition_key to operate. Exiting.\n", config.name, config.type);
     exit_gracefully(1);
@@ -415,19 +362,18 @@ void kafka_cache_purge(struct chained_cache *queue[], int index, int safe_action
 
   if (!config.kafka_partition_dynamic) config.kafka_partition = RD_KAFKA_PARTITION_UA;
 
-  p_kafka_set_partition(&kafkap_kafka_host, config.kafka_partition);
-
-  if (!dyn_partition_key)
-    p_kafka_set_key(&kafkap_kafka_host, config.kafka_partition_key, config.kafka_partition_keylen);
-
-  if (config.message_broker_output & PRINT_OUTPUT_JSON) p_kafka_set_content_type(&kafkap_kafka_host, PM_KAFKA_CNT_TYPE_STR);
-  else if (config.message_broker_output & PRINT_OUTPUT_AVRO_BIN) p_kafka_set_content_type(&kafkap_kafka_host, PM_KAFKA_CNT_TYPE_BIN);
-  else if (config.message_broker_output & PRINT_OUTPUT_AVRO_JSON) p_kafka_set_content_type(&kafkap_kafka_host, PM_KAFKA_CNT_TYPE_STR);
-  else {
+  if (!(config.message_broker_output & (PRINT_OUTPUT_JSON|PRINT_OUTPUT_AVRO_BIN|PRINT_OUTPUT_AVRO_JSON))) {
     Log(LOG_ERR, "ERROR ( %s/%s ): Unsupported kafka_output value specified. Exiting.\n", config.name, config.type);
     exit_gracefully(1);
   }
 
+  kafka_purge_init_host(&kafkap_kafka_host, is_topic_dyn);
+
+  /* a static partition key sends all messages to the same partition:
+     preserving their order requires a single producer */
+  if (config.kafka_purge_workers > 1 && !config.sql_multi_values && !config.kafka_avro_schema_registry &&
+      (!config.kafka_partition_key || dyn_partition_key)) purge_workers = config.kafka_purge_workers;
+
   for (j = 0, stop = 0; (!stop) && P_preprocess_funcs[j]; j++)
     stop = P_preprocess_funcs[j](queue, &index, j);
 
@@ -486,6 +432,8 @@ void kafka_cache_purge(struct chained_cache *queue[], int index, int safe_action
     if (config.message_broker_output & PRINT_OUTPUT_AVRO_BIN) {
       p_avro_writer = avro_writer_memory(p_avro_buf, config.avro_buffer_size);
     }
+
+    p_avro_data_iface = avro_generic_class_from_schema(p_avro_acct_schema);
 #endif
   }
 
@@ -547,62 +495,18 @@ void kafka_cache_purge(struct chained_cache *queue[], int index, int safe_action
     }
   }
 
-  for (j = 0; j < index; j++) {
+  if (purge_workers > 1) qn = kafka_purge_workers_run(queue, index, purge_workers, is_topic_dyn, orig_kafka_topic, empty_pcust, writer_pid);
+  else for (j = 0; j < index; j++) {
     char *json_str = NULL;
 
     if (queue[j]->valid != PRINT_CACHE_COMMITTED) continue;
 
-    data = &queue[j]->primitives;
-    if (queue[j]->pbgp) pbgp = queue[j]->pbgp;
-    else pbgp = &empty_pbgp;
-
-    if (queue[j]->pnat) pnat = queue[j]->pnat;
-    else pnat = &empty_pnat;
-
-    if (queue[j]->pmpls) pmpls = queue[j]->pmpls;
-    else pmpls = &empty_pmpls;
-
-    if (queue[j]->ptun) ptun = queue[j]->ptun;
-    else ptun = &empty_ptun;
-
-    if (queue[j]->pcust) pcust = queue[j]->pcust;
-    else pcust = empty_pcust;
-
-    if (queue[j]->pvlen) pvlen = queue[j]->pvlen;
-    else pvlen = NULL;
+    json_str = kafka_purge_compose(&kafkap_kafka_host, queue[j], is_topic_dyn, empty_pcust, writer_pid,
+				   &prim_ptrs, p_avro_data_iface, p_avro_data_value);
 
-    if (queue[j]->valid == PRINT_CACHE_FREE) continue;
-
-    if (dyn_partition_key) {
-      prim_ptrs.data = &dummy_data;
-      primptrs_set_all_from_chained_cache(&prim_ptrs, queue[j]);
-
-      handle_dynname_internal_strings(elem_part_key, SRVBUFLEN, config.kafka_partition_key, &prim_ptrs, DYN_STR_KAFKA_PART);
-      p_kafka_set_key(&kafkap_kafka_host, elem_part_key, strlen(elem_part_key));
-    }
-
-    if (config.message_broker_output & PRINT_OUTPUT_JSON) {
-#ifdef WITH_JANSSON
-      json_t *json_obj = json_object();
-      int idx;
-
-      for (idx = 0; idx < N_PRIMITIVES && cjhandler[idx]; idx++) cjhandler[idx](json_obj, queue[j]);
-      add_writer_name_and_pid_json(json_obj, config.name, writer_pid);
-
-      json_str = compose_json_str(json_obj);
-#endif
-    }
-    else if ((config.message_broker_output & PRINT_OUTPUT_AVRO_BIN) ||
-	     (config.message_broker_output & PRINT_OUTPUT_AVRO_JSON)) {
+    if ((config.message_broker_output & PRINT_OUTPUT_AVRO_BIN) ||
+	(config.message_broker_output & PRINT_OUTPUT_AVRO_JSON)) {
 #ifdef WITH_AVRO
-      avro_value_iface_t *p_avro_iface = avro_generic_class_from_schema(p_avro_acct_schema);
-      avro_value_t p_avro_value = compose_avro_acct_data(config.what_to_count, config.what_to_count_2,
-			   queue[j]->flow_type, &queue[j]->primitives, pbgp, pnat, pmpls, ptun, pcust,
-			   pvlen, queue[j]->bytes_counter, queue[j]->packet_counter,
-			   queue[j]->flow_counter, queue[j]->tcp_flags, &queue[j]->basetime,
-			   queue[j]->stitch, p_avro_iface);
-      add_writer_name_and_pid_avro(p_avro_value, config.name, writer_pid);
-
       if (config.message_broker_output & PRINT_OUTPUT_AVRO_BIN) {
 	size_t p_avro_value_size;
 
@@ -673,7 +577,6 @@ void kafka_cache_purge(struct chained_cache *queue[], int index, int safe_action
       }
 
       avro_value_decref(&p_avro_value);
-      avro_value_iface_decref(p_avro_iface);
 #else
       if (config.debug) Log(LOG_DEBUG, "DEBUG ( %s/%s ): compose_avro_acct_data(): AVRO object not created due to missing --enable-avro\n", config.name, config.type);
 #endif
@@ -708,9 +611,6 @@ void kafka_cache_purge(struct chained_cache *queue[], int index, int safe_action
 
       if (json_str) {
         if (is_topic_dyn) {
-          prim_ptrs.data = &dummy_data;
-          primptrs_set_all_from_chained_cache(&prim_ptrs, queue[j]);
-
 	  handle_dynname_internal_strings(dyn_kafka_topic, SRVBUFLEN, orig_kafka_topic, &prim_ptrs, DYN_STR_KAFKA_TOPIC);
           p_kafka_set_topic(&kafkap_kafka_host, dyn_kafka_topic);
         }
@@ -749,9 +649,6 @@ void kafka_cache_purge(struct chained_cache *queue[], int index, int safe_action
 #ifdef WITH_AVRO
       if (!config.sql_multi_values || (mv_num >= config.sql_multi_values) || p_avro_buffer_full) {
         if (is_topic_dyn) {
-	  prim_ptrs.data = &dummy_data;
-	  primptrs_set_all_from_chained_cache(&prim_ptrs, queue[j]);
-
 	  handle_dynname_internal_strings(dyn_kafka_topic, SRVBUFLEN, orig_kafka_topic, &prim_ptrs, DYN_STR_KAFKA_TOPIC);
           p_kafka_set_topic(&kafkap_kafka_host, dyn_kafka_topic);
         }
@@ -886,5 +783,308 @@ void kafka_cache_purge(struct chained_cache *queue[], int index, int safe_action
 
 #ifdef WITH_AVRO
   if (p_avro_buf) free(p_avro_buf);
+  if (p_avro_data_iface) avro_value_iface_decref(p_avro_data_iface);
+#endif
+}
+
+/* kafka_purge_compose(): per-record serialization, shared by the inline and
+   the parallel purge paths. Sets the dynamic partition key, if any, and fills
+   prim_ptrs whenever a dynamic key or topic needs it. Returns the JSON string,
+   to be freed by the caller; for Avro outputs the record is composed into
+   p_avro_value (an avro_value_t, to be decref'd by the caller) instead and
+   NULL is returned */
+char *kafka_purge_compose(struct p_kafka_host *kafka_host, struct chained_cache *elem, int is_topic_dyn,
+			  u_char *empty_pcust, pid_t writer_pid, struct primitives_ptrs *prim_ptrs,
+			  void *p_avro_iface, void *p_avro_value)
+{
+  /* read-only: safe to share among purge workers */
+  static struct pkt_bgp_primitives empty_pbgp;
+  static struct pkt_nat_primitives empty_pnat;
+  static struct pkt_mpls_primitives empty_pmpls;
+  static struct pkt_tunnel_primitives empty_ptun;
+  char elem_part_key[SRVBUFLEN], *json_str = NULL;
+
+  if (dyn_partition_key || is_topic_dyn) primptrs_set_all_from_chained_cache(prim_ptrs, elem);
+
+  if (dyn_partition_key) {
+    handle_dynname_internal_strings(elem_part_key, SRVBUFLEN, config.kafka_partition_key, prim_ptrs, DYN_STR_KAFKA_PART);
+    p_kafka_set_key(kafka_host, elem_part_key, strlen(elem_part_key));
+  }
+
+  if (config.message_broker_output & PRINT_OUTPUT_JSON) {
+#ifdef WITH_JANSSON
+    json_t *json_obj = json_object();
+    int idx;
+
+    for (idx = 0; idx < N_PRIMITIVES && cjhandler[idx]; idx++) cjhandler[idx](json_obj, elem);
+    add_writer_name_and_pid_json(json_obj, config.name, writer_pid);
+
+    json_str = compose_json_str(json_obj);
+#endif
+  }
+  else if ((config.message_broker_output & PRINT_OUTPUT_AVRO_BIN) ||
+	   (config.message_broker_output & PRINT_OUTPUT_AVRO_JSON)) {
+#ifdef WITH_AVRO
+    avro_value_t *value = (avro_value_t *) p_avro_value;
+
+    (*value) = compose_avro_acct_data(config.what_to_count, config.what_to_count_2,
+		       elem->flow_type, &elem->primitives,
+		       (elem->pbgp ? elem->pbgp : &empty_pbgp),
+		       (elem->pnat ? elem->pnat : &empty_pnat),
+		       (elem->pmpls ? elem->pmpls : &empty_pmpls),
+		       (elem->ptun ? elem->ptun : &empty_ptun),
+		       (elem->pcust ? elem->pcust : empty_pcust),
+		       elem->pvlen, elem->bytes_counter, elem->packet_counter,
+		       elem->flow_counter, elem->tcp_flags, &elem->basetime,
+		       elem->stitch, (avro_value_iface_t *) p_avro_iface);
+    add_writer_name_and_pid_avro((*value), config.name, writer_pid);
+#else
+    (void)empty_pbgp; (void)empty_pnat; (void)empty_pmpls; (void)empty_ptun;
+    (void)empty_pcust; (void)p_avro_iface; (void)p_avro_value;
+#endif
+  }
+
+  return json_str;
+}
+
+void kafka_purge_init_host(struct p_kafka_host *kafka_host, int is_topic_dyn)
+{
+  p_kafka_init_host(kafka_host, config.kafka_config_file);
+
+  p_kafka_init_topic_rr(kafka_host);
+  p_kafka_set_topic_rr(kafka_host, config.amqp_routing_key_rr);
+
+  p_kafka_connect_to_produce(kafka_host);
+  p_kafka_set_broker(kafka_host, config.sql_host, config.kafka_broker_port);
+
+  if (!is_topic_dyn && !config.amqp_routing_key_rr) p_kafka_set_topic(kafka_host, config.sql_table);
+
+  p_kafka_set_partition(kafka_host, config.kafka_partition);
+
+  if (!dyn_partition_key)
+    p_kafka_set_key(kafka_host, config.kafka_partition_key, config.kafka_partition_keylen);
+
+  if (config.message_broker_output & PRINT_OUTPUT_JSON) p_kafka_set_content_type(kafka_host, PM_KAFKA_CNT_TYPE_STR);
+  else if (config.message_broker_output & PRINT_OUTPUT_AVRO_BIN) p_kafka_set_content_type(kafka_host, PM_KAFKA_CNT_TYPE_BIN);
+  else if (config.message_broker_output & PRINT_OUTPUT_AVRO_JSON) p_kafka_set_content_type(kafka_host, PM_KAFKA_CNT_TYPE_STR);
+}
+
+/* serializes and produces a share of the purge queue; kafka_multi_values
+   and kafka_avro_schema_registry are never set here, see kafka_cache_purge() */
+void *kafka_purge_worker(void *arg)
+{
+  struct kafka_purge_worker *kpw = (struct kafka_purge_worker *) arg;
+  struct p_kafka_host *kafka_host = &kpw->kafka_host;
+  char dyn_kafka_topic[SRVBUFLEN];
+  struct primitives_ptrs prim_ptrs;
+  struct pkt_data dummy_data;
+  int j, ret;
+
+#ifdef WITH_AVRO
+  avro_value_iface_t *p_avro_iface = NULL;
+  avro_writer_t p_avro_writer = {0};
+  avro_value_t p_avro_value;
+  void *p_avro_data_value = &p_avro_value;
+  char *p_avro_buf = NULL;
+#else
+  void *p_avro_iface = NULL, *p_avro_data_value = NULL;
+#endif
+
+#ifdef WITH_AVRO
+  if ((config.message_broker_output & PRINT_OUTPUT_AVRO_BIN) ||
+      (config.message_broker_output & PRINT_OUTPUT_AVRO_JSON)) {
+    p_avro_iface = avro_generic_class_from_schema(p_avro_acct_schema);
+
+    if (config.message_broker_output & PRINT_OUTPUT_AVRO_BIN) {
+      p_avro_buf = malloc(config.avro_buffer_size);
+      if (!p_avro_buf) {
+	Log(LOG_ERR, "ERROR ( %s/%s ): malloc() failed (p_avro_buf). Exiting ..\n", config.name, config.type);
+	exit_gracefully(1);
+      }
+
+      p_avro_writer = avro_writer_memory(p_avro_buf, config.avro_buffer_size);
+    }
+  }
+#endif
+
+  memset(&prim_ptrs, 0, sizeof(prim_ptrs));
+  memset(&dummy_data, 0, sizeof(dummy_data));
+  prim_ptrs.data = &dummy_data;
+
+  for (j = 0; j < kpw->num; j++) {
+    char *msg = NULL;
+    size_t msg_len = 0;
+
+    msg = kafka_purge_compose(kafka_host, kpw->queue[j], kpw->is_topic_dyn, kpw->empty_pcust, kpw->writer_pid,
+			      &prim_ptrs, p_avro_iface, p_avro_data_value);
+
+    if (config.message_broker_output & PRINT_OUTPUT_JSON) {
+      if (msg) msg_len = strlen(msg);
+    }
+    else {
+#ifdef WITH_AVRO
+      if (config.message_broker_output & PRINT_OUTPUT_AVRO_BIN) {
+	size_t p_avro_value_size;
+
+	avro_value_sizeof(&p_avro_value, &p_avro_value_size);
+
+	if (p_avro_value_size > config.avro_buffer_size) {
+	  Log(LOG_ERR, "ERROR ( %s/%s ): kafka_cache_purge(): avro_buffer_size too small (%u)\n", config.name, config.type, config.avro_buffer_size);
+	  exit_gracefully(1);
+	}
+	else if (avro_value_write(p_avro_writer, &p_avro_value)) {
+	  Log(LOG_ERR, "ERROR ( %s/%s ): kafka_cache_purge(): avro_value_write() faiiled: %s\n", config.name, config.type, avro_strerror());
+	  exit_gracefully(1);
+	}
+
+	msg = p_avro_buf;
+	msg_len = avro_writer_tell(p_avro_writer);
+      }
+      else if (config.message_broker_output & PRINT_OUTPUT_AVRO_JSON) {
+	msg = write_avro_json_record_to_buf(p_avro_value);
+	if (msg) msg_len = strlen(msg);
+      }
+
+      avro_value_decref(&p_avro_value);
+#endif
+    }
+
+    if (!msg) continue;
+
+    if (kpw->is_topic_dyn) {
+      handle_dynname_internal_strings(dyn_kafka_topic, SRVBUFLEN, kpw->orig_kafka_topic, &prim_ptrs, DYN_STR_KAFKA_TOPIC);
+      p_kafka_set_topic(kafka_host, dyn_kafka_topic);
+    }
+
+    if (config.amqp_routing_key_rr) {
+      P_handle_table_dyn_rr(dyn_kafka_topic, SRVBUFLEN, kpw->orig_kafka_topic, &kafka_host->topic_rr);
+      p_kafka_set_topic(kafka_host, dyn_kafka_topic);
+    }
+
+    if (config.message_broker_output & PRINT_OUTPUT_JSON) Log(LOG_DEBUG, "DEBUG ( %s/%s ): %s\n\n", config.name, config.type, msg);
+    ret = p_kafka_produce_data(kafka_host, msg, msg_len);
+
+#ifdef WITH_AVRO
+    if (config.message_broker_output & PRINT_OUTPUT_AVRO_BIN) {
+      avro_writer_reset(p_avro_writer);
+      msg = NULL;
+    }
+#endif
+    if (msg) free(msg);
+
+    if (!ret) kpw->qn++;
+    else break;
+  }
+
+  p_kafka_close(kafka_host, FALSE);
+
+#ifdef WITH_AVRO
+  if (p_avro_buf) {
+    avro_writer_free(p_avro_writer);
+    free(p_avro_buf);
+  }
+
+  if (p_avro_iface) avro_value_iface_decref(p_avro_iface);
 #endif
+
+  return NULL;
+}
+
+int kafka_purge_workers_run(struct chained_cache *queue[], int index, int workers, int is_topic_dyn,
+			    char *orig_kafka_topic, u_char *empty_pcust, pid_t writer_pid)
+{
+  struct kafka_purge_worker *kpw;
+  struct chained_cache **slots;
+  u_int8_t *slot_wid;
+  char elem_part_key[SRVBUFLEN];
+  struct primitives_ptrs prim_ptrs;
+  struct pkt_data dummy_data;
+  sigset_t mask, saved_mask;
+  int j, wid, num, qn = 0;
+
+  if (!index) return qn;
+
+  kpw = calloc(workers, sizeof(struct kafka_purge_worker));
+  slots = malloc(index * sizeof(struct chained_cache *));
+  slot_wid = malloc(index);
+
+  if (!kpw || !slots || !slot_wid) {
+    Log(LOG_ERR, "ERROR ( %s/%s ): malloc() failed (kafka_purge_workers_run). Exiting ..\n", config.name, config.type);
+    exit_gracefully(1);
+  }
+
+  memset(&prim_ptrs, 0, sizeof(prim_ptrs));
+  memset(&dummy_data, 0, sizeof(dummy_data));
+
+  /* assign committed entries to workers: by partition key, if dynamic, so
+     that per-key (hence per-partition) ordering is kept, else in slices */
+  for (j = 0, num = 0; j < index; j++) {
+    if (queue[j]->valid != PRINT_CACHE_COMMITTED) continue;
+    slots[num++] = queue[j];
+  }
+
+  for (j = 0; j < num; j++) {
+    if (dyn_partition_key) {
+      prim_ptrs.data = &dummy_data;
+      primptrs_set_all_from_chained_cache(&prim_ptrs, slots[j]);
+
+      handle_dynname_internal_strings(elem_part_key, SRVBUFLEN, config.kafka_partition_key, &prim_ptrs, DYN_STR_KAFKA_PART);
+      slot_wid[j] = (hash_mem64(elem_part_key, strlen(elem_part_key), 0) % workers);
+    }
+    else slot_wid[j] = ((u_int64_t) j * workers) / num;
+
+    kpw[slot_wid[j]].num++;
+  }
+
+  /* stable counting sort: each worker sees its entries in queue order */
+  for (wid = 0; wid < workers; wid++) {
+    kpw[wid].queue = malloc((kpw[wid].num ? kpw[wid].num : 1) * sizeof(struct chained_cache *));
+    if (!kpw[wid].queue) {
+      Log(LOG_ERR, "ERROR ( %s/%s ): malloc() failed (kafka_purge_workers_run). Exiting ..\n", config.name, config.type);
+      exit_gracefully(1);
+    }
+
+    kpw[wid].num = 0;
+  }
+
+  for (j = 0; j < num; j++) {
+    wid = slot_wid[j];
+    kpw[wid].queue[kpw[wid].num++] = slots[j];
+  }
+
+  free(slot_wid);
+  free(slots);
+
+  /* signals are to be served by the main thread only */
+  sigfillset(&mask);
+  pthread_sigmask(SIG_SETMASK, &mask, &saved_mask);
+
+  for (wid = 0; wid < workers; wid++) {
+    kpw[wid].is_topic_dyn = is_topic_dyn;
+    kpw[wid].orig_kafka_topic = orig_kafka_topic;
+    kpw[wid].empty_pcust = empty_pcust;
+    kpw[wid].writer_pid = writer_pid;
+
+    if (!kpw[wid].num) continue;
+
+    kafka_purge_init_host(&kpw[wid].kafka_host, is_topic_dyn);
+
+    if (pthread_create(&kpw[wid].thread, NULL, kafka_purge_worker, &kpw[wid])) {
+      Log(LOG_WARNING, "WARN ( %s/%s ): Unable to start purge worker #%u. Purging inline.\n", config.name, config.type, wid);
+      kafka_purge_worker(&kpw[wid]);
+      kpw[wid].num = 0;
+    }
+  }
+
+  pthread_sigmask(SIG_SETMASK, &saved_mask, NULL);
+
+  for (wid = 0; wid < workers; wid++) {
+    if (kpw[wid].num) pthread_join(kpw[wid].thread, NULL);
+    qn += kpw[wid].qn;
+    free(kpw[wid].queue);
+  }
+
+  free(kpw);
+
+  return qn;
 }
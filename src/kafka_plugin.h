@@ -25,12 +25,29 @@
 /* includes */
 #include <librdkafka/rdkafka.h>
 #include <sys/poll.h>
+#include <pthread.h>
 
 /* structures */
+struct kafka_purge_worker {
+  pthread_t thread;
+  struct p_kafka_host kafka_host;
+  struct chained_cache **queue;
+  int num;
+  int qn;
+  int is_topic_dyn;
+  char *orig_kafka_topic;
+  u_char *empty_pcust;
+  pid_t writer_pid;
+};
 
 /* prototypes */
 extern void p_kafka_get_version(void);
 extern void kafka_plugin(int, struct configuration *, void *);
 extern void kafka_cache_purge(struct chained_cache *[], int, int);
+extern void kafka_purge_init_host(struct p_kafka_host *, int);
+extern char *kafka_purge_compose(struct p_kafka_host *, struct chained_cache *, int, u_char *, pid_t,
+				 struct primitives_ptrs *, void *, void *);
+extern void *kafka_purge_worker(void *);
+extern int kafka_purge_workers_run(struct chained_cache *[], int, int, int, char *, u_char *, pid_t);
 
 #endif //KAFKA_PLUGIN_H
@@ -0,0 +1,188 @@
+/*
+    pmacct (Promiscuous mode IP Accounting package)
+    pmacct is Copyright (C) 2003-2020 by Paolo Lucente
+*/
+
+/*
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/*
+  Multibit longest prefix match trie, shared by networks_file lookups, the
+  IGP FIB snapshot and the BGP per-peer FIB. Tries built by lpm_trie_build()
+  are read-only and can be looked up concurrently; the BGP FIB maintains
+  its own nodes incrementally and only makes use of the address and leaf
+  helpers here.
+*/
+
+/* includes */
+#include "pmacct.h"
+#include "lpm_trie.h"
+
+/* functions */
+/* sets the slot of 'addr' at bit 'offset', which must be zeroed */
+void lpm_trie_set_chunk(u_int32_t *addr, u_int8_t offset, u_int8_t chunk)
+{
+  u_int64_t bits = ((u_int64_t) chunk << (64 - (offset % 32) - LPM_TRIE_STRIDE));
+  int idx = (offset / 32);
+
+  addr[idx] |= (bits >> 32);
+  if ((idx + 1) < LPM_TRIE_MAX_WORDS) addr[idx + 1] |= (bits & 0xffffffff);
+}
+
+/* Slots of the node at 'offset' a prefix up to offset + LPM_TRIE_STRIDE
+   long expands onto: returns the first one, 'span' being set to how many */
+u_int8_t lpm_trie_span(const u_int32_t *net, int words, u_int8_t offset, u_int8_t len, int *span)
+{
+  (*span) = (1 << (offset + LPM_TRIE_STRIDE - len));
+
+  return (lpm_trie_get_chunk(net, words, offset) & ~((*span) - 1));
+}
+
+/* Run-length compresses in place the LPM_TRIE_SLOTS leaves, 'size' bytes
+   each, of a node; returns the number of leaves left, 'leaf_bm' being set
+   to where runs start */
+int lpm_trie_compress(void *leaves, size_t size, u_int64_t *leaf_bm)
+{
+  u_char *ptr = leaves;
+  int slot, num = 0;
+
+  (*leaf_bm) = 0;
+
+  for (slot = 0; slot < LPM_TRIE_SLOTS; slot++) {
+    if (!slot || memcmp(&ptr[slot * size], &ptr[(slot - 1) * size], size)) {
+      (*leaf_bm) |= (1ULL << slot);
+      if (num != slot) memcpy(&ptr[num * size], &ptr[slot * size], size);
+      num++;
+    }
+  }
+
+  return num;
+}
+
+/*
+  Builds the trie node at 'offset' out of prefixes [start, end), all sharing
+  the same first 'offset' bits: prefixes up to offset + LPM_TRIE_STRIDE long
+  are expanded onto the slots of the node, shortest first; longer ones are
+  handed over to children. Being prefixes sorted by network then length, the
+  ones belonging to a child are contiguous.
+*/
+static struct lpm_trie_node *lpm_trie_build_node(struct lpm_trie_prefix *pfx, int start, int end, int words, u_int8_t offset)
+{
+  struct lpm_trie_node *node;
+  void *leaf[LPM_TRIE_SLOTS];
+  int child_start[LPM_TRIE_SLOTS], child_end[LPM_TRIE_SLOTS];
+  int idx, len, slot, span, num_leaf, num_child;
+
+  memset(leaf, 0, sizeof(leaf));
+  for (slot = 0; slot < LPM_TRIE_SLOTS; slot++) child_start[slot] = child_end[slot] = ERR;
+
+  for (len = offset; len <= (offset + LPM_TRIE_STRIDE); len++) {
+    for (idx = start; idx < end; idx++) {
+      if (pfx[idx].len != len) continue;
+
+      slot = lpm_trie_span(pfx[idx].net, words, offset, len, &span);
+      for (num_leaf = 0; num_leaf < span; num_leaf++) leaf[slot + num_leaf] = pfx[idx].entry;
+    }
+  }
+
+  for (idx = start, num_child = 0; idx < end; idx++) {
+    if (pfx[idx].len <= (offset + LPM_TRIE_STRIDE)) continue;
+
+    slot = lpm_trie_get_chunk(pfx[idx].net, words, offset);
+    if (child_start[slot] == ERR) {
+      child_start[slot] = idx;
+      num_child++;
+    }
+    child_end[slot] = (idx + 1);
+  }
+
+  node = malloc(sizeof(struct lpm_trie_node));
+  if (!node) return NULL;
+  memset(node, 0, sizeof(struct lpm_trie_node));
+
+  num_leaf = lpm_trie_compress(leaf, sizeof(void *), &node->leaf_bm);
+
+  node->leaf = malloc(num_leaf * sizeof(void *));
+  if (!node->leaf) goto build_failed;
+  memcpy(node->leaf, leaf, (num_leaf * sizeof(void *)));
+
+  if (num_child) {
+    node->child = malloc(num_child * sizeof(struct lpm_trie_node *));
+    if (!node->child) goto build_failed;
+
+    /* children are accounted for as they get built, for a partial node
+       to be freed by lpm_trie_free() */
+    for (slot = 0, num_child = 0; slot < LPM_TRIE_SLOTS; slot++) {
+      if (child_start[slot] == ERR) continue;
+
+      node->child[num_child] = lpm_trie_build_node(pfx, child_start[slot], child_end[slot], words,
+						   (offset + LPM_TRIE_STRIDE));
+      if (!node->child[num_child]) goto build_failed;
+
+      node->child_bm |= (1ULL << slot);
+      num_child++;
+    }
+  }
+
+  return node;
+
+  build_failed:
+  lpm_trie_free(node);
+
+  return NULL;
+}
+
+/* Builds a trie out of 'num' prefixes of 'words' long addresses, sorted by
+   network then length; in case of duplicates the last one wins. Returns
+   NULL if running out of memory */
+struct lpm_trie_node *lpm_trie_build(struct lpm_trie_prefix *pfx, int num, int words)
+{
+  return lpm_trie_build_node(pfx, 0, num, words, 0);
+}
+
+/* returns the entry of the longest prefix matching 'addr', NULL if none */
+void *lpm_trie_match(struct lpm_trie_node *node, const u_int32_t *addr, int words)
+{
+  void *match = NULL, *leaf;
+  u_int8_t offset, slot;
+
+  for (offset = 0; node; offset += LPM_TRIE_STRIDE) {
+    slot = lpm_trie_get_chunk(addr, words, offset);
+
+    leaf = node->leaf[lpm_trie_leaf_idx(node->leaf_bm, slot)];
+    if (leaf) match = leaf;
+
+    if (!(node->child_bm & (1ULL << slot))) break;
+
+    node = node->child[lpm_trie_child_idx(node->child_bm, slot)];
+  }
+
+  return match;
+}
+
+void lpm_trie_free(struct lpm_trie_node *node)
+{
+  int idx, num_child;
+
+  if (!node) return;
+
+  num_child = __builtin_popcountll(node->child_bm);
+  for (idx = 0; idx < num_child; idx++) lpm_trie_free(node->child[idx]);
+
+  if (node->child) free(node->child);
+  if (node->leaf) free(node->leaf);
+  free(node);
+}
@@ -0,0 +1,84 @@
+/*
+    pmacct (Promiscuous mode IP Accounting package)
+    pmacct is Copyright (C) 2003-2020 by Paolo Lucente
+*/
+
+/*
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#ifndef LPM_TRIE_H
+#define LPM_TRIE_H
+
+/* defines */
+#define LPM_TRIE_STRIDE		6
+#define LPM_TRIE_SLOTS		(1 << LPM_TRIE_STRIDE)
+#define LPM_TRIE_MAX_WORDS	4	/* IPv6 */
+
+/* structures */
+/*
+  Longest prefix match trie node, stride LPM_TRIE_STRIDE: slot 's' (a
+  stride worth of address bits) has a child if bit 's' of child_bm is set;
+  leaves are run-length compressed, bit 's' of leaf_bm being set if slot
+  's' starts a new run. Both arrays are indexed via popcount, see
+  lpm_trie_child_idx() and lpm_trie_leaf_idx().
+*/
+struct lpm_trie_node {
+  u_int64_t child_bm;
+  u_int64_t leaf_bm;
+  struct lpm_trie_node **child;
+  void **leaf;
+};
+
+/* addresses are arrays of 32-bit words in host byte order */
+struct lpm_trie_prefix {
+  u_int32_t net[LPM_TRIE_MAX_WORDS];
+  u_int8_t len;
+  void *entry;
+};
+
+/* functions */
+/* slot of 'addr' at bit 'offset'; bits past the end of the address read as zeroes */
+Inline u_int8_t lpm_trie_get_chunk(const u_int32_t *addr, int words, u_int8_t offset)
+{
+  u_int64_t bits;
+  int idx = (offset / 32);
+
+  bits = ((idx < words) ? ((u_int64_t) addr[idx] << 32) : 0);
+  if ((idx + 1) < words) bits |= addr[idx + 1];
+
+  return ((bits >> (64 - (offset % 32) - LPM_TRIE_STRIDE)) & (LPM_TRIE_SLOTS - 1));
+}
+
+Inline int lpm_trie_child_idx(u_int64_t child_bm, u_int8_t slot)
+{
+  return __builtin_popcountll(child_bm & ((1ULL << slot) - 1));
+}
+
+/* leaf of the run 'slot' belongs to */
+Inline int lpm_trie_leaf_idx(u_int64_t leaf_bm, u_int8_t slot)
+{
+  return (__builtin_popcountll(leaf_bm & (((1ULL << slot) << 1) - 1)) - 1);
+}
+
+/* prototypes */
+extern void lpm_trie_set_chunk(u_int32_t *, u_int8_t, u_int8_t);
+extern u_int8_t lpm_trie_span(const u_int32_t *, int, u_int8_t, u_int8_t, int *);
+extern int lpm_trie_compress(void *, size_t, u_int64_t *);
+extern struct lpm_trie_node *lpm_trie_build(struct lpm_trie_prefix *, int, int);
+extern void *lpm_trie_match(struct lpm_trie_node *, const u_int32_t *, int);
+extern void lpm_trie_free(struct lpm_trie_node *);
+
+#endif //LPM_TRIE_H
@@ -49,9 +49,9 @@ void load_networks4(char *filename, struct networks_table *nt, struct networks_c
   FILE *file;
   struct networks_table tmp, *tmpt = &tmp; 
   struct networks_table bkt;
-  struct networks_table_metadata *mdt = NULL;
+  struct lpm_trie_prefix *pfx = NULL;
   char buf[SRVBUFLEN], *bufptr, *delim, *peer_as, *as, *net, *mask, *nh;
-  int rows, eff_rows = 0, j, buflen, fields, prev[128], current, next;
+  int rows, eff_rows = 0, j, buflen, fields;
   unsigned int index, fake_row = 0;
   struct stat st;
 
@@ -68,10 +68,12 @@ void load_networks4(char *filename, struct networks_table *nt, struct networks_c
   if (nt->num) {
     bkt.table = nt->table;
     bkt.num = nt->num;
+    bkt.trie = nt->trie;
     bkt.timestamp = nt->timestamp;
 
     nt->table = NULL;
     nt->num = 0;
+    nt->trie = NULL;
     nt->timestamp = 0;
   }
 
@@ -228,78 +230,35 @@ void load_networks4(char *filename, struct networks_table *nt, struct networks_c
       merge_sort(filename, tmpt->table, 0, eff_rows);
       tmpt->num = eff_rows;
 
-      /* 4th step: collecting informations in the sorted table;
-         we wish to handle networks-in-networks hierarchically */
+      /* 4th step: building final networks table and its lookup trie; being
+         the table sorted by network then mask, in case of duplicate
+         definitions the last one wins */
+      memcpy(nt->table, tmpt->table, tmpt->num*sizeof(struct networks_table_entry));
+      nt->num = tmpt->num;
 
-      /* 4a building hierarchies */
-      mdt = malloc(tmpt->num*sizeof(struct networks_table_metadata));
-      if (!mdt) {
-        Log(LOG_ERR, "ERROR ( %s/%s ): [%s] malloc() failed while building Metadata Networks Table.\n", config.name, config.type, filename);
+      pfx = malloc(nt->num*sizeof(struct lpm_trie_prefix));
+      if (!pfx) {
+        Log(LOG_ERR, "ERROR ( %s/%s ): [%s] malloc() failed while building Networks Trie.\n", config.name, config.type, filename);
         goto handle_error;
       }
-      memset(mdt, 0, tmpt->num*sizeof(struct networks_table_metadata));
-
-      if (tmpt->num) {
-        for (index = 0; index < (tmpt->num-1); index++) {
-	  u_int32_t net;
-	  int x;
-
-	  for (x = index+1; x < tmpt->num; x++) {
-	    net = tmpt->table[x].net;
-	    net &= tmpt->table[index].mask;
-	    if (net == tmpt->table[index].net) {
-	      mdt[x].level++;
-	      mdt[index].childs++; 
-	    }
-	    else break;
-	  }
-        } 
-      }
+      memset(pfx, 0, nt->num*sizeof(struct lpm_trie_prefix));
 
-      /* 4b retrieving root entries number */
-      for (index = 0, eff_rows = 0; index < tmpt->num; index++) {
-        if (mdt[index].level == 0) eff_rows++;
+      for (index = 0; index < nt->num; index++) {
+	pfx[index].net[0] = nt->table[index].net;
+	pfx[index].len = nt->table[index].masknum;
+	pfx[index].entry = &nt->table[index];
       }
 
-      nt->num = eff_rows;
-      /* 4c adjusting child counters: each parent has to know
-         only the number of its directly attached childs and
-	 not the whole hierarchy */ 
-      for (index = 0; index < tmpt->num; index++) {
-        int x, eff_childs = 0;
-
-        for (x = index+1; x < tmpt->num; x++) {
-	  if (mdt[index].level == mdt[x].level) break;
-	  else if (mdt[index].level == (mdt[x].level-1)) eff_childs++; 
-	}
-	mdt[index].childs = eff_childs;
-      }
-
-      /* 5a step: building final networks table */
-      for (index = 0, current = 0, next = 0; index < tmpt->num; index++) {
-        if (!index) {
-	  current = 0; next = eff_rows;
-	  memset(&prev, 0, 32);
-	  memcpy(&nt->table[current], &tmpt->table[index], sizeof(struct networks_table_entry));
-        }
-	else {
-	  if (mdt[index].level == mdt[index-1].level) current++; /* do nothing: we have only to copy our element */ 
-	  else if (mdt[index].level > mdt[index-1].level) { /* we encountered a child */ 
-	    nt->table[current].childs_table.table = &nt->table[next];
-	    nt->table[current].childs_table.num = mdt[index-1].childs;
-	    prev[mdt[index-1].level] = current;
-	    current = next;
-	    next += mdt[index-1].childs;
-	  }
-	  else { /* going back to parent level */
-	    current = prev[mdt[index].level];
-	    current++;
-	  }
-	  memcpy(&nt->table[current], &tmpt->table[index], sizeof(struct networks_table_entry));
-        }
+      nt->trie = lpm_trie_build(pfx, nt->num, 1);
+      if (!nt->trie) {
+        Log(LOG_ERR, "ERROR ( %s/%s ): [%s] malloc() failed while building Networks Trie.\n", config.name, config.type, filename);
+        free(nt->table);
+        nt->table = NULL;
+        nt->num = 0;
+        goto handle_error;
       }
 
-      /* 5b step: debug and default route detection */
+      /* 5th step: debug and default route detection */
       index = 0;
       while (!fake_row && index < tmpt->num) {
         if (config.debug) { 
@@ -328,20 +287,22 @@ void load_networks4(char *filename, struct networks_table *nt, struct networks_c
       if (!nc->cache) {
         if (!config.networks_cache_entries) nc->num = NETWORKS_CACHE_ENTRIES;
         else nc->num = config.networks_cache_entries;
-        nc->cache = (struct networks_cache_entry *) malloc(nc->num*sizeof(struct networks_cache_entry));
+        if (posix_memalign((void **) &nc->cache, sizeof(struct networks_cache_bucket), nc->num*sizeof(struct networks_cache_bucket)))
+          nc->cache = NULL;
         if (!nc->cache) {
           Log(LOG_ERR, "ERROR ( %s/%s ): malloc() failed while building Networks Cache.\n", config.name, config.type);
           goto handle_error;
         }
-	else Log(LOG_DEBUG, "DEBUG ( %s/%s ): [%s] IPv4 Networks Cache successfully created: %u entries.\n",
+	else Log(LOG_DEBUG, "DEBUG ( %s/%s ): [%s] IPv4 Networks Cache successfully created: %u buckets.\n",
 			config.name, config.type, filename, nc->num);
       }
 
       /* 7th step: freeing resources */
-      memset(nc->cache, 0, nc->num*sizeof(struct networks_cache_entry));
+      memset(nc->cache, 0, nc->num*sizeof(struct networks_cache_bucket));
       free(tmpt->table);
-      free(mdt);
+      free(pfx);
       if (bkt.table) free(bkt.table);
+      if (bkt.trie) lpm_trie_free(bkt.trie);
 
       /* 8th step: setting timestamp */
       nt->timestamp = st.st_mtime;
@@ -364,7 +325,7 @@ void load_networks4(char *filename, struct networks_table *nt, struct networks_c
    */
   handle_error:
   if (tmpt->table) free(tmpt->table);
-  if (mdt) free(mdt);
+  if (pfx) free(pfx);
 
   if (bkt.num) {
     if (!nt->table) {
@@ -445,67 +406,68 @@ void merge(char *filename, struct networks_table_entry *table, int start, int mi
   free(v2);
 }
 
-struct networks_table_entry *binsearch(struct networks_table *nt, struct networks_cache *nc, struct host_addr *a)
+/* bucket of a key: multiplicative hash, scaled to the number of buckets
+   by a multiply and shift rather than a (much slower) division */
+Inline struct networks_cache_bucket *networks_cache_bucket(struct networks_cache *nc, u_int32_t key)
 {
-  int low = 0, mid, high = nt->num-1;
-  u_int32_t net, addrh = ntohl(a->address.ipv4.s_addr), addr = a->address.ipv4.s_addr;
-  struct networks_table_entry *ret;
+  return &nc->cache[(((u_int64_t) (key * 2654435761U)) * nc->num) >> 32];
+}
+
+/* a key is in one way at most, as inserted only after a miss: all ways are
+   compared without branching, the way hit being unpredictable. Free ways
+   have a NULL result, so match key 0 harmlessly */
+Inline struct networks_table_entry *networks_cache_get(struct networks_cache *nc, u_int32_t key)
+{
+  struct networks_cache_bucket *ptr = networks_cache_bucket(nc, key);
+  uintptr_t ret = 0;
+  int way;
 
-  ret = networks_cache_search(nc, &addr); 
-  if (ret) {
-    if (ret->masknum == 255) return NULL; /* dummy entry identification */
-    else return ret;
+  for (way = 0; way < NETWORKS_CACHE_WAYS; way++) {
+    ret |= ((uintptr_t) ptr->result[way] & -((uintptr_t) (ptr->key[way] == key)));
   }
 
-  while (low <= high) {
-    mid = (low+high)/2;
-    net = addrh;
-    net &= nt->table[mid].mask;
+  return (struct networks_table_entry *) ret;
+}
 
-    if (net < nt->table[mid].net) {
-      high = mid-1;
-      continue;
-    }
-    else if (net > nt->table[mid].net) {
-      low = mid+1;
-      continue;
-    }
+/* the cache is set associative: a bucket holds NETWORKS_CACHE_WAYS entries,
+   the least recently inserted one being evicted first */
+Inline void networks_cache_put(struct networks_cache *nc, u_int32_t key, struct networks_table_entry *result)
+{
+  struct networks_cache_bucket *ptr = networks_cache_bucket(nc, key);
 
-    /* It's assumed we've found our element */
-    if (nt->table[mid].childs_table.table) {
-      ret = binsearch(&nt->table[mid].childs_table, nc, a);
-      if (!ret) {
-	ret = &nt->table[mid];
-        networks_cache_insert(nc, &addr, &nt->table[mid]);
-      }
-    }
-    else {
-      ret = &nt->table[mid];
-      networks_cache_insert(nc, &addr, &nt->table[mid]);
+  ptr->key[ptr->next] = key;
+  ptr->result[ptr->next] = result;
+  ptr->next = ((ptr->next + 1) % NETWORKS_CACHE_WAYS);
+}
+
+struct networks_table_entry *networks_search(struct networks_table *nt, struct networks_cache *nc, struct host_addr *a)
+{
+  u_int32_t addrh = ntohl(a->address.ipv4.s_addr), addr = a->address.ipv4.s_addr;
+  struct networks_table_entry *ret;
+
+  if (nc->cache) {
+    ret = networks_cache_get(nc, addr); 
+    if (ret) {
+      if (ret->masknum == 255) return NULL; /* dummy entry identification */
+      else return ret;
     }
-    return ret;
   }
 
-  networks_cache_insert(nc, &addr, &dummy_entry);
-  return NULL;
+  ret = lpm_trie_match(nt->trie, &addrh, 1);
+
+  if (nc->cache) networks_cache_put(nc, addr, (ret ? ret : &dummy_entry));
+
+  return ret;
 }
 
 void networks_cache_insert(struct networks_cache *nc, u_int32_t *key, struct networks_table_entry *result)
 {
-  struct networks_cache_entry *ptr;
-
-  ptr = &nc->cache[*key % nc->num];
-  ptr->key = *key;
-  ptr->result = result;
+  networks_cache_put(nc, *key, result);
 }
 
 struct networks_table_entry *networks_cache_search(struct networks_cache *nc, u_int32_t *key)
 {
-  struct networks_cache_entry *ptr;
-
-  ptr = &nc->cache[*key % nc->num];
-  if (ptr->key == *key) return ptr->result;
-  else return NULL;
+  return networks_cache_get(nc, *key);
 }
 
 void set_net_funcs(struct networks_table *nt)
@@ -822,11 +784,11 @@ void search_src_ip(struct networks_table *nt, struct networks_cache *nc, struct
 {
   if (p->src_ip.family == AF_INET) {
     nfd->family = AF_INET;
-    nfd->entry = (u_char *) binsearch(nt, nc, &p->src_ip);
+    nfd->entry = (u_char *) networks_search(nt, nc, &p->src_ip);
   }
   else if (p->src_ip.family == AF_INET6) {
     nfd->family = AF_INET6;
-    nfd->entry = (u_char *) binsearch6(nt, nc, &p->src_ip);
+    nfd->entry = (u_char *) networks_search6(nt, nc, &p->src_ip);
   }
   else {
     nfd->family = 0;
@@ -839,11 +801,11 @@ void search_dst_ip(struct networks_table *nt, struct networks_cache *nc, struct
 {
   if (p->dst_ip.family == AF_INET) {
     nfd->family = AF_INET;
-    nfd->entry = (u_char *) binsearch(nt, nc, &p->dst_ip);
+    nfd->entry = (u_char *) networks_search(nt, nc, &p->dst_ip);
   }
   else if (p->dst_ip.family == AF_INET6) {
     nfd->family = AF_INET6;
-    nfd->entry = (u_char *) binsearch6(nt, nc, &p->dst_ip);
+    nfd->entry = (u_char *) networks_search6(nt, nc, &p->dst_ip);
   }
   else {
     nfd->family = 0;
@@ -1252,14 +1214,14 @@ as_t search_pretag_src_as(struct networks_table *nt, struct networks_cache *nc,
   if (pptrs->l3_proto == ETHERTYPE_IP) { 
     addr.family = AF_INET;
     addr.address.ipv4.s_addr = ((struct pm_iphdr *) pptrs->iph_ptr)->ip_src.s_addr;
-    res = binsearch(nt, nc, &addr);
+    res = networks_search(nt, nc, &addr);
     if (!res) return 0;
     else return res->as;
   }
   else if (pptrs->l3_proto == ETHERTYPE_IPV6) {
     addr.family = AF_INET6;
     memcpy(&addr.address.ipv6, &((struct ip6_hdr *)pptrs->iph_ptr)->ip6_src, IP6AddrSz);
-    res6 = binsearch6(nt, nc, &addr);
+    res6 = networks_search6(nt, nc, &addr);
     if (!res6) return 0;
     else return res6->as;
   }
@@ -1276,14 +1238,14 @@ as_t search_pretag_dst_as(struct networks_table *nt, struct networks_cache *nc,
   if (pptrs->l3_proto == ETHERTYPE_IP) {
     addr.family = AF_INET;
     addr.address.ipv4.s_addr = ((struct pm_iphdr *) pptrs->iph_ptr)->ip_dst.s_addr;
-    res = binsearch(nt, nc, &addr);
+    res = networks_search(nt, nc, &addr);
     if (!res) return 0;
     else return res->as;
   }
   else if (pptrs->l3_proto == ETHERTYPE_IPV6) {
     addr.family = AF_INET6;
     memcpy(&addr.address.ipv6, &((struct ip6_hdr *)pptrs->iph_ptr)->ip6_dst, IP6AddrSz);
-    res6 = binsearch6(nt, nc, &addr);
+    res6 = networks_search6(nt, nc, &addr);
     if (!res6) return 0;
     else return res6->as;
   }
@@ -1296,9 +1258,9 @@ void load_networks6(char *filename, struct networks_table *nt, struct networks_c
   FILE *file;
   struct networks_table tmp, *tmpt = &tmp;
   struct networks_table bkt;
-  struct networks_table_metadata *mdt = 0;
+  struct lpm_trie_prefix *pfx = NULL;
   char buf[SRVBUFLEN], *bufptr, *delim, *peer_as, *as, *net, *mask, *nh;
-  int rows, eff_rows = 0, j, buflen, fields, prev[128], current, next;
+  int rows, eff_rows = 0, j, buflen, fields;
   unsigned int index, fake_row = 0;
   u_int32_t tmpmask[4], tmpnet[4];
   struct stat st;
@@ -1316,10 +1278,12 @@ void load_networks6(char *filename, struct networks_table *nt, struct networks_c
   if (nt->num6) {
     bkt.table6 = nt->table6;
     bkt.num6 = nt->num6;
+    bkt.trie6 = nt->trie6;
     bkt.timestamp = nt->timestamp;
 
     nt->table6 = 0;
     nt->num6 = 0;
+    nt->trie6 = NULL;
     nt->timestamp = 0;
   }
 
@@ -1483,82 +1447,35 @@ void load_networks6(char *filename, struct networks_table *nt, struct networks_c
       merge_sort6(filename, tmpt->table6, 0, eff_rows);
       tmpt->num6 = eff_rows;
 
-      /* 4th step: collecting informations in the sorted table;
-         we wish to handle networks-in-networks hierarchically */
+      /* 4th step: building final networks table and its lookup trie; being
+         the table sorted by network then mask, in case of duplicate
+         definitions the last one wins */
+      memcpy(nt->table6, tmpt->table6, tmpt->num6*sizeof(struct networks6_table_entry));
+      nt->num6 = tmpt->num6;
 
-      /* 4a building hierarchies */
-      mdt = malloc(tmpt->num6*sizeof(struct networks_table_metadata));
-      if (!mdt) {
-        Log(LOG_ERR, "ERROR ( %s/%s ): [%s] malloc() failed while building Metadata Networks Table.\n", config.name, config.type, filename);
+      pfx = malloc(nt->num6*sizeof(struct lpm_trie_prefix));
+      if (!pfx) {
+        Log(LOG_ERR, "ERROR ( %s/%s ): [%s] malloc() failed while building Networks Trie.\n", config.name, config.type, filename);
         goto handle_error;
       }
-      memset(mdt, 0, tmpt->num6*sizeof(struct networks_table_metadata));
-
-      if (tmpt->num6) {
-        for (index = 0; index < (tmpt->num6-1); index++) {
-          u_int32_t net[4];
-          int x, chunk;
-
-          for (x = index+1; x < tmpt->num6; x++) {
-            memcpy(&net, &tmpt->table6[x].net, IP6AddrSz);
-            for (chunk = 0; chunk < 4; chunk++) net[chunk] &= tmpt->table6[index].mask[chunk];
-            for (chunk = 0; chunk < 4; chunk++) {
-	      if (net[chunk] == tmpt->table6[index].net[chunk]) {
-                if (chunk == 3) {
-		  mdt[x].level++;
-		  mdt[index].childs++;
-	        }
-              }
-              else break;
-            }
-          }
-        }
-      }
+      memset(pfx, 0, nt->num6*sizeof(struct lpm_trie_prefix));
 
-      /* 4b retrieving root entries number */
-      for (index = 0, eff_rows = 0; index < tmpt->num6; index++) {
-        if (mdt[index].level == 0) eff_rows++;
+      for (index = 0; index < nt->num6; index++) {
+	memcpy(pfx[index].net, nt->table6[index].net, IP6AddrSz);
+	pfx[index].len = nt->table6[index].masknum;
+	pfx[index].entry = &nt->table6[index];
       }
 
-      nt->num6 = eff_rows;
-      /* 4c adjusting child counters: each parent has to know
-         only the number of its directly attached childs and
-         not the whole hierarchy */
-      for (index = 0; index < tmpt->num6; index++) {
-        int x, eff_childs = 0;
-
-        for (x = index+1; x < tmpt->num6; x++) {
-          if (mdt[index].level == mdt[x].level) break;
-          else if (mdt[index].level == (mdt[x].level-1)) eff_childs++;
-        }
-        mdt[index].childs = eff_childs;
+      nt->trie6 = lpm_trie_build(pfx, nt->num6, 4);
+      if (!nt->trie6) {
+        Log(LOG_ERR, "ERROR ( %s/%s ): [%s] malloc() failed while building Networks Trie.\n", config.name, config.type, filename);
+        free(nt->table6);
+        nt->table6 = NULL;
+        nt->num6 = 0;
+        goto handle_error;
       }
 
-      /* 5a step: building final networks table */
-      for (index = 0, current = 0, next = 0; index < tmpt->num6; index++) {
-        if (!index) {
-          current = 0; next = eff_rows;
-          memset(&prev, 0, 32);
-          memcpy(&nt->table6[current], &tmpt->table6[index], sizeof(struct networks6_table_entry));
-        }
-        else {
-          if (mdt[index].level == mdt[index-1].level) current++; /* do nothing: we have only to copy our element */
-          else if (mdt[index].level > mdt[index-1].level) { /* we encountered a child */
-            nt->table6[current].childs_table.table6 = &nt->table6[next];
-            nt->table6[current].childs_table.num6 = mdt[index-1].childs;
-            prev[mdt[index-1].level] = current;
-            current = next;
-            next += mdt[index-1].childs;
-          }
-          else { /* going back to parent level */
-            current = prev[mdt[index].level];
-            current++;
-          }
-          memcpy(&nt->table6[current], &tmpt->table6[index], sizeof(struct networks6_table_entry));
-        }
-      }
- 
-      /* 5b step: debug and default route detection */
+      /* 5th step: debug and default route detection */
       index = 0;
       while (!fake_row && index < tmpt->num6) {
         if (config.debug) {
@@ -1587,20 +1504,22 @@ void load_networks6(char *filename, struct networks_table *nt, struct networks_c
       if (!nc->cache6) {
         if (!config.networks_cache_entries) nc->num6 = NETWORKS6_CACHE_ENTRIES;
         else nc->num6 = config.networks_cache_entries;
-        nc->cache6 = (struct networks6_cache_entry *) malloc(nc->num6*sizeof(struct networks6_cache_entry));
+        if (posix_memalign((void **) &nc->cache6, sizeof(struct networks6_cache_bucket), nc->num6*sizeof(struct networks6_cache_bucket)))
+          nc->cache6 = NULL;
         if (!nc->cache6) {
           Log(LOG_ERR, "ERROR ( %s/%s ): [%s] malloc() failed while building Networks Cache.\n", config.name, config.type, filename);
           goto handle_error;
         }
-	else Log(LOG_DEBUG, "DEBUG ( %s/%s ): [%s] IPv6 Networks Cache successfully created: %u entries.\n",
+	else Log(LOG_DEBUG, "DEBUG ( %s/%s ): [%s] IPv6 Networks Cache successfully created: %u buckets.\n",
 			config.name, config.type, filename, nc->num6);
       }
 
       /* 7th step: freeing resources */
-      memset(nc->cache6, 0, nc->num6*sizeof(struct networks6_cache_entry));
+      memset(nc->cache6, 0, nc->num6*sizeof(struct networks6_cache_bucket));
       free(tmpt->table6);
-      free(mdt);
+      free(pfx);
       if (bkt.table6) free(bkt.table6);
+      if (bkt.trie6) lpm_trie_free(bkt.trie6);
 
       /* 8th step: setting timestamp */
       nt->timestamp = st.st_mtime;
@@ -1617,7 +1536,7 @@ void load_networks6(char *filename, struct networks_table *nt, struct networks_c
   */
   handle_error:
   if (tmpt->table6) free(tmpt->table6);
-  if (mdt) free(mdt);
+  if (pfx) free(pfx);
 
   if (bkt.num6) {
     if (!nt->table6) {
@@ -1720,100 +1639,60 @@ void merge6(char *filename, struct networks6_table_entry *table, int start, int
   free(v2);
 }
 
-struct networks6_table_entry *binsearch6(struct networks_table *nt, struct networks_cache *nc, struct host_addr *a)
+struct networks6_table_entry *networks_search6(struct networks_table *nt, struct networks_cache *nc, struct host_addr *a)
 {
-  int low = 0, mid, high = nt->num6-1, chunk;
-  u_int32_t net[4], addrh[4], addr[4]; 
+  u_int32_t addrh[4], addr[4]; 
   struct networks6_table_entry *ret;
 
   memcpy(&addr, &a->address.ipv6, IP6AddrSz);
   memcpy(&addrh, &a->address.ipv6, IP6AddrSz);
   memcpy(&addrh, (void *) pm_ntohl6(addrh), IP6AddrSz);
   
-  ret = networks_cache_search6(nc, addr);
-  if (ret) {
-    if (ret->masknum == 255) return NULL; /* dummy entry identification */
-    else return ret;
-  }
-
-  binsearch_loop:
-  while (low <= high) {
-    mid = (low+high)/2;
-    memcpy(&net, &addrh, IP6AddrSz); 
-
-    for (chunk = 0; chunk < 4; chunk++) net[chunk] &= nt->table6[mid].mask[chunk];
-    for (chunk = 0; chunk < 4; chunk++) {
-      if (net[chunk] < nt->table6[mid].net[chunk]) {
-        high = mid-1;
-        goto binsearch_loop;
-      }
-      else if (net[chunk] > nt->table6[mid].net[chunk]) {
-        low = mid+1;
-        goto binsearch_loop;
-      }
+  if (nc->cache6) {
+    ret = networks_cache_search6(nc, addr);
+    if (ret) {
+      if (ret->masknum == 255) return NULL; /* dummy entry identification */
+      else return ret;
     }
-  
-    /* It's assumed we've found our element */
-    if (nt->table6[mid].childs_table.table6) {
-      ret = binsearch6(&nt->table6[mid].childs_table, nc, a);
-      if (!ret) {
-        ret = &nt->table6[mid];
-        networks_cache_insert6(nc, addr, &nt->table6[mid]);
-      }
-    }
-    else {
-      ret = &nt->table6[mid];
-      networks_cache_insert6(nc, addr, &nt->table6[mid]);
-    }
-    return ret;
   }
 
-  networks_cache_insert6(nc, addr, &dummy_entry6);
-  return NULL;
+  ret = lpm_trie_match(nt->trie6, addrh, 4);
+
+  if (nc->cache6) networks_cache_insert6(nc, addr, (ret ? ret : &dummy_entry6));
+
+  return ret;
 }
 
 void networks_cache_insert6(struct networks_cache *nc, void *key, struct networks6_table_entry *result)
 {
-  struct networks6_cache_entry *ptr;
+  struct networks6_cache_bucket *ptr;
   unsigned int hash;
-  u_int32_t *keyptr = key;
 
   hash = networks_cache_hash6(key); 
-  ptr = &nc->cache6[hash % nc->num6];
-  memcpy(ptr->key, keyptr, IP6AddrSz); 
-  ptr->result = result;
+  ptr = &nc->cache6[(((u_int64_t) hash) * nc->num6) >> 32];
+
+  memcpy(ptr->key[ptr->next], key, IP6AddrSz); 
+  ptr->result[ptr->next] = result;
+  ptr->next = ((ptr->next + 1) % NETWORKS_CACHE_WAYS);
 }
 
 struct networks6_table_entry *networks_cache_search6(struct networks_cache *nc, void *key)
 {
-  struct networks6_cache_entry *ptr;
+  struct networks6_cache_bucket *ptr;
   unsigned int hash;
-  u_int32_t *keyptr = key;
-  int chunk;
+  int way;
 
   hash = networks_cache_hash6(key);
-  ptr = &nc->cache6[hash % nc->num6];
-  for (chunk = 0; chunk < 4; chunk++) {
-    if (ptr->key[chunk] == keyptr[chunk]) continue;
-    else return NULL;
-  } 
+  ptr = &nc->cache6[(((u_int64_t) hash) * nc->num6) >> 32];
+
+  for (way = 0; way < NETWORKS_CACHE_WAYS; way++) {
+    if (ptr->result[way] && !memcmp(ptr->key[way], key, IP6AddrSz)) return ptr->result[way];
+  }
 
-  return ptr->result;
+  return NULL;
 }
 
 unsigned int networks_cache_hash6(void *key)
 {
-  u_int32_t a, b, c;
-  u_int32_t *keyptr = (u_int32_t *)key;
-
-  a = keyptr[0];
-  b = keyptr[1];
-  c = keyptr[2];
-
-  a += JHASH_GOLDEN_RATIO;
-  b += JHASH_GOLDEN_RATIO;
-  c += 140281; /* trivial hash rnd */
-  __jhash_mix(a, b, c);
-
-  return c;
+  return jhash2((u_int32_t *) key, 4, 140281 /* trivial hash rnd */);
 }
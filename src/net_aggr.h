@@ -24,20 +24,24 @@
 /* defines */
 #define NETWORKS_CACHE_ENTRIES 99991 
 #define NETWORKS6_CACHE_ENTRIES 32771 
+#define NETWORKS_CACHE_WAYS 4 /* entries per cache bucket */
 #define RETURN_NET 0
 #define RETURN_AS 1
 #define NET_FUNCS_N 32
 
 /* structures */
-struct networks_cache_entry {
-  u_int32_t key;
-  struct networks_table_entry *result;
-};
+/* a bucket of the set associative networks cache, one cache line: ways
+   are replaced round-robin, 'next' being the one to go next */
+struct networks_cache_bucket {
+  u_int32_t key[NETWORKS_CACHE_WAYS];
+  struct networks_table_entry *result[NETWORKS_CACHE_WAYS];
+  u_int8_t next;
+} __attribute__ ((aligned (64)));
 
 struct networks_cache {
-  struct networks_cache_entry *cache;
+  struct networks_cache_bucket *cache;
   unsigned int num;
-  struct networks6_cache_entry *cache6;
+  struct networks6_cache_bucket *cache6;
   unsigned int num6;
 };
 
@@ -46,6 +50,8 @@ struct networks_table {
   unsigned int num;
   struct networks6_table_entry *table6;
   unsigned int num6;
+  struct lpm_trie_node *trie;
+  struct lpm_trie_node *trie6;
   u_int32_t maskbits[4];
   time_t timestamp; 
 };
@@ -57,13 +63,13 @@ struct networks_table_entry {
   as_t peer_as;
   as_t as;
   struct host_addr nh;
-  struct networks_table childs_table;
 };
 
-struct networks6_cache_entry {
-  u_int32_t key[4];
-  struct networks6_table_entry *result;
-};
+struct networks6_cache_bucket {
+  u_int32_t key[NETWORKS_CACHE_WAYS][4];
+  struct networks6_table_entry *result[NETWORKS_CACHE_WAYS];
+  u_int8_t next;
+} __attribute__ ((aligned (64)));
 
 struct networks6_table_entry {
   u_int32_t net[4];
@@ -72,12 +78,6 @@ struct networks6_table_entry {
   as_t peer_as;
   as_t as;
   struct host_addr nh;
-  struct networks_table childs_table;
-};
-
-struct networks_table_metadata {
-  u_int8_t level;
-  u_int32_t childs;
 };
 
 struct networks_file_data {
@@ -122,14 +122,14 @@ extern void load_networks(char *, struct networks_table *, struct networks_cache
 extern void load_networks4(char *, struct networks_table *, struct networks_cache *); 
 extern void merge_sort(char *, struct networks_table_entry *, int, int);
 extern void merge(char *, struct networks_table_entry *, int, int, int);
-extern struct networks_table_entry *binsearch(struct networks_table *, struct networks_cache *, struct host_addr *);
+extern struct networks_table_entry *networks_search(struct networks_table *, struct networks_cache *, struct host_addr *);
 extern void networks_cache_insert(struct networks_cache *, u_int32_t *, struct networks_table_entry *);
 extern struct networks_table_entry *networks_cache_search(struct networks_cache *, u_int32_t *);
 
 extern void load_networks6(char *, struct networks_table *, struct networks_cache *); 
 extern void merge_sort6(char *, struct networks6_table_entry *, int, int);
 extern void merge6(char *, struct networks6_table_entry *, int, int, int);
-extern struct networks6_table_entry *binsearch6(struct networks_table *, struct networks_cache *, struct host_addr *);
+extern struct networks6_table_entry *networks_search6(struct networks_table *, struct networks_cache *, struct host_addr *);
 extern void networks_cache_insert6(struct networks_cache *, void *, struct networks6_table_entry *);
 extern struct networks6_table_entry *networks_cache_search6(struct networks_cache *, void *);
 extern unsigned int networks_cache_hash6(void *);
@@ -19,6 +19,9 @@
     Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 */
 
+/* recvmmsg() and struct mmsghdr */
+#define _GNU_SOURCE
+
 #include "pmacct.h"
 #include "addr.h"
 #include "network.h"
@@ -206,6 +209,113 @@ u_int16_t pm_udp6_checksum(struct ip6_hdr *ip6hdr, struct pm_udphdr *udphdr, u_c
 }
 
 
+/* pm_recv_batch_init(): allocates room for 'depth' datagrams of 'bufsz'
+   bytes each; datagrams are then handed out one at a time by
+   pm_recv_batch_next() which refills the batch, with a single
+   recvmmsg() call, only once it has been fully consumed */
+int pm_recv_batch_init(struct pm_recv_batch *rb, int depth, size_t bufsz)
+{
+  memset(rb, 0, sizeof(struct pm_recv_batch));
+
+  if (depth < 1) depth = 1;
+  if (depth > PM_RECV_BATCH_MAX) depth = PM_RECV_BATCH_MAX;
+
+#if !defined HAVE_RECVMMSG
+  depth = 1;
+#endif
+
+  rb->depth = depth;
+  rb->bufsz = bufsz;
+  rb->bufs = malloc(depth * bufsz);
+  rb->lens = malloc(depth * sizeof(ssize_t));
+  rb->addrs = malloc(depth * sizeof(struct sockaddr_storage));
+  rb->addrlens = malloc(depth * sizeof(socklen_t));
+
+  if (!rb->bufs || !rb->lens || !rb->addrs || !rb->addrlens) return ERR;
+
+#if defined HAVE_RECVMMSG
+  {
+    struct mmsghdr *msgs;
+    struct iovec *iovs;
+    int idx;
+
+    msgs = rb->msgs = malloc(depth * sizeof(struct mmsghdr));
+    iovs = rb->iovs = malloc(depth * sizeof(struct iovec));
+
+    if (!msgs || !iovs) return ERR;
+
+    memset(msgs, 0, depth * sizeof(struct mmsghdr));
+
+    for (idx = 0; idx < depth; idx++) {
+      iovs[idx].iov_base = rb->bufs + (idx * bufsz);
+      iovs[idx].iov_len = bufsz;
+
+      msgs[idx].msg_hdr.msg_iov = &iovs[idx];
+      msgs[idx].msg_hdr.msg_iovlen = 1;
+      msgs[idx].msg_hdr.msg_name = &rb->addrs[idx];
+    }
+  }
+#endif
+
+  return SUCCESS;
+}
+
+ssize_t pm_recv_batch_next(struct pm_recv_batch *rb, int fd, unsigned char **buf, struct sockaddr *sa, socklen_t *salen)
+{
+  if (rb->cur >= rb->num) {
+    rb->cur = 0;
+    rb->num = 0;
+
+#if defined HAVE_RECVMMSG
+    {
+      struct mmsghdr *msgs = rb->msgs;
+      int idx, ret;
+
+      for (idx = 0; idx < rb->depth; idx++) {
+	msgs[idx].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+	msgs[idx].msg_len = 0;
+      }
+
+      /* block for the first datagram, then take whatever else is queued */
+      ret = recvmmsg(fd, msgs, rb->depth, MSG_WAITFORONE, NULL);
+      if (ret <= 0) return ERR;
+
+      for (idx = 0; idx < ret; idx++) {
+	rb->lens[idx] = msgs[idx].msg_len;
+	rb->addrlens[idx] = msgs[idx].msg_hdr.msg_namelen;
+      }
+
+      rb->num = ret;
+    }
+#else
+    rb->addrlens[0] = sizeof(struct sockaddr_storage);
+    rb->lens[0] = recvfrom(fd, rb->bufs, rb->bufsz, 0, (struct sockaddr *) &rb->addrs[0], &rb->addrlens[0]);
+    if (rb->lens[0] <= 0) return ERR;
+
+    rb->num = 1;
+#endif
+
+    rb->batches++;
+    rb->datagrams += rb->num;
+    if (rb->num == rb->depth) rb->full_batches++;
+  }
+
+  (*buf) = rb->bufs + (rb->cur * rb->bufsz);
+  memcpy(sa, &rb->addrs[rb->cur], MIN(rb->addrlens[rb->cur], sizeof(struct sockaddr_storage)));
+  if (salen) (*salen) = rb->addrlens[rb->cur];
+
+  return rb->lens[rb->cur++];
+}
+
+void pm_recv_batch_print_stats(struct pm_recv_batch *rb, time_t now)
+{
+  if (!rb->batches) return;
+
+  Log(LOG_NOTICE, "NOTICE ( %s/%s ): stats [recv_batch] time=%ld depth=%d batches=%" PRIu64 " datagrams=%" PRIu64 " full_batches=%" PRIu64 " avg_batch=%.2f\n",
+	config.name, config.type, (long)now, rb->depth, rb->batches, rb->datagrams, rb->full_batches,
+	((double) rb->datagrams / (double) rb->batches));
+}
+
 #ifdef WITH_GNUTLS
 void pm_dtls_init(pm_dtls_glob_t *dtls_globs, char *files_path)
 {
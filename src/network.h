@@ -331,8 +331,8 @@ struct packet_ptrs {
   char *bgp_nexthop_info; /* record bgp_info of BGP next-hop in case of follow-up */
   u_int8_t src_roa; /* record ROA status for source prefix */
   u_int8_t dst_roa; /* record ROA status for destination prefix */
-  char *igp_src; /* pointer to IGP node structure for source prefix, if any */
-  char *igp_dst; /* pointer to IGP node structure for destination prefix, if any */
+  char *igp_src; /* pointer to IGP prefix structure for source prefix, if any */
+  char *igp_dst; /* pointer to IGP prefix structure for destination prefix, if any */
   char *igp_src_info; /* pointer to IGP node info structure for source prefix, if any */
   char *igp_dst_info; /* pointer to IGP node info structure for destination prefix, if any */
   u_int8_t lm_mask_src; /* Longest match for source prefix (network mask bits) */
@@ -695,6 +695,29 @@ typedef struct {
   };
 } proxy_protocol_header;
 
+/* batched datagram reception, recvmmsg() based */
+#define PM_RECV_BATCH_MAX	1024
+/* batched datagram transmission, sendmmsg() based */
+#define PM_SEND_BATCH_MAX	1024
+
+struct pm_recv_batch {
+  int depth;				/* max datagrams per recvmmsg() call */
+  int num;				/* datagrams in the current batch */
+  int cur;				/* next datagram to be handed out */
+  size_t bufsz;
+  unsigned char *bufs;
+  ssize_t *lens;
+  struct sockaddr_storage *addrs;
+  socklen_t *addrlens;
+  void *msgs;				/* struct mmsghdr, requires _GNU_SOURCE */
+  void *iovs;
+
+  /* stats */
+  u_int64_t batches;
+  u_int64_t datagrams;
+  u_int64_t full_batches;
+};
+
 #ifdef WITH_GNUTLS
 typedef struct {
   gnutls_certificate_credentials_t x509_cred;
@@ -726,6 +749,9 @@ typedef struct {
 extern int parse_proxy_header(int, struct host_addr *, u_int16_t *);
 extern u_int16_t pm_checksum(u_int16_t *, int, u_int32_t *, int);
 extern u_int16_t pm_udp6_checksum(struct ip6_hdr *, struct pm_udphdr *, u_char *, int);
+extern int pm_recv_batch_init(struct pm_recv_batch *, int, size_t);
+extern ssize_t pm_recv_batch_next(struct pm_recv_batch *, int, unsigned char **, struct sockaddr *, socklen_t *);
+extern void pm_recv_batch_print_stats(struct pm_recv_batch *, time_t);
 
 #ifdef WITH_GNUTLS
 extern void pm_dtls_init(pm_dtls_glob_t *, char *);
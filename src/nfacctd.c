@@ -43,6 +43,9 @@
 #include "ndpi/ndpi.h"
 #endif
 #include "tee_plugin/tee_plugin.h"
+#if defined LINUX
+#include <linux/filter.h>
+#endif
 
 /* Global variables */
 struct template_cache tpl_cache;
@@ -156,6 +159,7 @@ int main(int argc,char **argv, char **envp)
 
   struct packet_ptrs recv_pptrs;
   struct pcap_pkthdr recv_pkthdr;
+  struct pm_recv_batch recv_batch;
 
   sigset_t signal_set;
 
@@ -236,6 +240,7 @@ int main(int argc,char **argv, char **envp)
 
   memset(&recv_pptrs, 0, sizeof(recv_pptrs));
   memset(&recv_pkthdr, 0, sizeof(recv_pkthdr));
+  memset(&recv_batch, 0, sizeof(recv_batch));
 
   select_fd = 0;
   bkp_select_fd = 0;
@@ -603,6 +608,32 @@ int main(int argc,char **argv, char **envp)
     exit_gracefully(1);
   }
 
+  if (config.nfacctd_workers > 1) {
+#if (defined LINUX) && (defined HAVE_SO_REUSEPORT)
+    if (capture_methods && !config.nfacctd_port && !config.nfacctd_ip) {
+      Log(LOG_ERR, "ERROR ( %s/core ): nfacctd_workers only applies to live UDP collection (nfacctd_ip, nfacctd_port). Exiting...\n\n", config.name);
+      exit_gracefully(1);
+    }
+
+    if (config.nfacctd_templates_port || config.nfacctd_dtls_port) {
+      Log(LOG_ERR, "ERROR ( %s/core ): nfacctd_workers is mutual exclusive with nfacctd_templates_port and nfacctd_dtls_port. Exiting...\n\n", config.name);
+      exit_gracefully(1);
+    }
+
+    /* BGP, BMP, IS-IS and telemetry daemons are threads of the Core Process
+       and would not be inherited by forked workers */
+    if (config.bgp_daemon || config.bmp_daemon || config.nfacctd_isis || config.telemetry_daemon) {
+      Log(LOG_ERR, "ERROR ( %s/core ): nfacctd_workers is mutual exclusive with bgp_daemon, bmp_daemon, isis_daemon and telemetry_daemon. Exiting...\n\n", config.name);
+      exit_gracefully(1);
+    }
+
+    core_workers_check_plugins("nfacctd_workers");
+#else
+    Log(LOG_ERR, "ERROR ( %s/core ): nfacctd_workers requires SO_REUSEPORT support (Linux). Exiting...\n\n", config.name);
+    exit_gracefully(1);
+#endif
+  }
+
   if (config.nfacctd_templates_receiver) {
     if (!config.nfacctd_port && !config.nfacctd_ip && capture_methods) {
       Log(LOG_ERR, "ERROR ( %s/core ): nfacctd_templates_receiver only applies to live UDP collection (nfacctd_ip, nfacctd_port). Exiting...\n\n", config.name);
@@ -908,6 +939,17 @@ int main(int argc,char **argv, char **envp)
       }
     }
 
+    if (config.nfacctd_recv_batch > 1) {
+      if (config.nfacctd_templates_port || config.nfacctd_dtls_port) {
+	Log(LOG_WARNING, "WARN ( %s/core ): nfacctd_recv_batch is not supported in conjunction with nfacctd_templates_port and nfacctd_dtls_port. Ignored.\n", config.name);
+      }
+      else if (pm_recv_batch_init(&recv_batch, config.nfacctd_recv_batch, NETFLOW_MSG_SIZE) == ERR) {
+	Log(LOG_ERR, "ERROR ( %s/core ): Unable to allocate nfacctd_recv_batch buffers. Exiting.\n", config.name);
+	exit_gracefully(1);
+      }
+      else Log(LOG_INFO, "INFO ( %s/core ): nfacctd_recv_batch: batch depth set to %d.\n", config.name, recv_batch.depth);
+    }
+
     memset(&tee_templates, 0, sizeof(struct tee_receiver));
 
     if (config.nfacctd_templates_receiver) {
@@ -1094,6 +1136,8 @@ int main(int argc,char **argv, char **envp)
       }
     }
 #endif
+
+    if (config.nfacctd_workers > 1) NF_workers_spawn((struct sockaddr *) &server, slen);
   }
 
   init_classifiers(NULL);
@@ -1111,8 +1155,9 @@ int main(int argc,char **argv, char **envp)
   load_plugins(&req);
   load_plugin_filters(1);
   evaluate_packet_handlers();
-  pm_setproctitle("%s [%s]", "Core Process", config.proc_name);
-  if (config.pidfile) write_pid_file(config.pidfile);
+  if (core_workers_num) pm_setproctitle("%s [%s] (worker #%d)", "Core Process", config.proc_name, core_worker_id);
+  else pm_setproctitle("%s [%s]", "Core Process", config.proc_name);
+  if (config.pidfile && !core_workers_num) write_pid_file(config.pidfile);
   load_networks(config.networks_file, &nt, &nc);
 
   /* signals to be handled only by the core process;
@@ -1129,8 +1174,8 @@ int main(int argc,char **argv, char **envp)
   kill(getpid(), SIGCHLD);
 
   /* initializing template cache */ 
-  memset(&tpl_cache, 0, sizeof(tpl_cache));
-  tpl_cache.num = TEMPLATE_CACHE_ENTRIES;
+  init_template_cache(TEMPLATE_CACHE_ENTRIES);
+  xflow_status_table.print_ext = print_template_cache_status;
 
   if (config.nfacctd_templates_file) {
     load_templates_from_file(config.nfacctd_templates_file);
@@ -1327,6 +1372,9 @@ int main(int argc,char **argv, char **envp)
   for (;;) {
     sigprocmask(SIG_BLOCK, &signal_set, NULL);
 
+    if (config.bgp_daemon || config.bmp_daemon) bgp_lookup_offline();
+    if (config.nfacctd_isis) isis_lookup_offline();
+
     if (config.pcap_savefile) {
       ret = recvfrom_savefile(&device, (void **) &netflow_packet, (struct sockaddr *) &client, NULL, &pm_pcap_savefile_round, &recv_pptrs);
     }
@@ -1386,7 +1434,10 @@ int main(int argc,char **argv, char **envp)
     }
 #endif
     else {
-      if (!config.nfacctd_templates_port && !config.nfacctd_dtls_port) {
+      if (recv_batch.depth) {
+	ret = pm_recv_batch_next(&recv_batch, config.sock, &netflow_packet, (struct sockaddr *) &client, &clen);
+      }
+      else if (!config.nfacctd_templates_port && !config.nfacctd_dtls_port) {
         ret = recvfrom(config.sock, (unsigned char *)netflow_packet, NETFLOW_MSG_SIZE, 0, (struct sockaddr *) &client, &clen);
       }
       else {
@@ -1484,6 +1535,7 @@ int main(int argc,char **argv, char **envp)
       time_t now = time(NULL);
 
       print_status_table(&xflow_status_table, now, XFLOW_STATUS_TABLE_SZ);
+      pm_recv_batch_print_stats(&recv_batch, now);
       print_stats = FALSE;
     }
 
@@ -1864,7 +1916,8 @@ void process_v9_packet(unsigned char *pkt, u_int16_t len, struct packet_ptrs_vec
     pkt += NfDataHdrV9Sz;
     flowoff += NfDataHdrV9Sz;
 
-    tpl = find_template(data_hdr->flow_id, (struct sockaddr *) pptrs->f_agent, fid, SourceId);
+    tpl = find_template_cached((struct xflow_status_entry *) pptrs->f_status, data_hdr->flow_id,
+			       (struct sockaddr *) pptrs->f_agent, fid, SourceId);
     if (!tpl) {
       sa_to_addr((struct sockaddr *)pptrs->f_agent, &debug_a, &debug_agent_port);
       addr_to_str(debug_agent_addr, &debug_a);
@@ -2827,6 +2880,142 @@ void NF_compute_once()
   IP6TlSz = sizeof(struct ip6_hdr)+sizeof(struct pm_tlhdr);
 }
 
+/* NF_workers_spawn(): splits the Core Process in 'nfacctd_workers' processes,
+   each owning one socket of the SO_REUSEPORT group and, from this point on,
+   its own template cache, xflow status table and set of plugins (and hence
+   core -> plugin rings). The calling process stays on as supervisor, see
+   core_workers_spawn(): since it keeps all sockets of the group open, a dead
+   worker does not shift the exporter -> socket mapping of the filter and
+   its respawned replacement picks up the very same socket */
+void NF_workers_spawn(struct sockaddr *server, socklen_t slen)
+{
+  int socks[MAX_NFACCTD_WORKERS], idx, idx2;
+
+  memset(socks, 0, sizeof(socks));
+
+  socks[0] = config.sock;
+  for (idx = 1; idx < config.nfacctd_workers; idx++) {
+    socks[idx] = NF_workers_prepare_sock(server, slen);
+  }
+
+  /* socket order into the reuseport group is bind() order, hence
+     the filter result indexes the socks[] array above */
+  NF_workers_attach_reuseport_filter(config.sock, config.nfacctd_workers);
+
+  idx = core_workers_spawn(config.nfacctd_workers);
+
+  for (idx2 = 0; idx2 < config.nfacctd_workers; idx2++) {
+    if (idx2 != idx) close(socks[idx2]);
+  }
+
+  config.sock = socks[idx];
+  memset(&xflow_status_table, 0, sizeof(xflow_status_table));
+}
+
+int NF_workers_prepare_sock(struct sockaddr *server, socklen_t slen)
+{
+  int sock, rc, yes = 1, idx;
+
+  sock = socket(server->sa_family, SOCK_DGRAM, 0);
+  if (sock < 0) {
+    Log(LOG_ERR, "ERROR ( %s/core ): nfacctd_workers: socket() failed.\n", config.name);
+    exit_gracefully(1);
+  }
+
+#if (defined LINUX) && (defined HAVE_SO_REUSEPORT)
+  rc = setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (char *) &yes, (socklen_t) sizeof(yes));
+  if (rc < 0) Log(LOG_ERR, "WARN ( %s/core ): nfacctd_workers: setsockopt() failed for SO_REUSEPORT.\n", config.name);
+#endif
+
+#if (defined IPV6_BINDV6ONLY)
+  {
+    int no=0;
+
+    rc = setsockopt(sock, IPPROTO_IPV6, IPV6_BINDV6ONLY, (char *) &no, (socklen_t) sizeof(no));
+    if (rc < 0) Log(LOG_ERR, "WARN ( %s/core ): nfacctd_workers: setsockopt() failed for IPV6_BINDV6ONLY.\n", config.name);
+  }
+#endif
+
+  if (config.nfacctd_pipe_size) {
+    Setsocksize(sock, SOL_SOCKET, SO_RCVBUF, &config.nfacctd_pipe_size, (socklen_t) sizeof(config.nfacctd_pipe_size));
+  }
+
+  for (idx = 0; mcast_groups[idx].family && idx < MAX_MCAST_GROUPS; idx++) {
+    if (mcast_groups[idx].family == AF_INET) {
+      struct ip_mreq multi_req4;
+
+      memset(&multi_req4, 0, sizeof(multi_req4));
+      multi_req4.imr_multiaddr.s_addr = mcast_groups[idx].address.ipv4.s_addr;
+      if (setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, (char *)&multi_req4, (socklen_t) sizeof(multi_req4)) < 0) {
+	Log(LOG_ERR, "ERROR ( %s/core ): IPv4 multicast address - ADD membership failed.\n", config.name);
+	exit_gracefully(1);
+      }
+    }
+    if (mcast_groups[idx].family == AF_INET6) {
+      struct ipv6_mreq multi_req6;
+
+      memset(&multi_req6, 0, sizeof(multi_req6));
+      ip6_addr_cpy(&multi_req6.ipv6mr_multiaddr, &mcast_groups[idx].address.ipv6);
+      if (setsockopt(sock, IPPROTO_IPV6, IPV6_JOIN_GROUP, (char *)&multi_req6, (socklen_t) sizeof(multi_req6)) < 0) {
+	Log(LOG_ERR, "ERROR ( %s/core ): IPv6 multicast address - ADD membership failed.\n", config.name);
+	exit_gracefully(1);
+      }
+    }
+  }
+
+  rc = bind(sock, server, slen);
+  if (rc < 0) {
+    Log(LOG_ERR, "ERROR ( %s/core ): nfacctd_workers: bind() to ip=%s port=%d/udp failed (errno: %d).\n", config.name, config.nfacctd_ip, config.nfacctd_port, errno);
+    exit_gracefully(1);
+  }
+
+  return sock;
+}
+
+/* Steers datagrams to workers by exporter source address (instead of the
+   kernel default 4-tuple hash), so that all datagrams, and templates, of
+   an exporter are consistently handled by the same worker */
+void NF_workers_attach_reuseport_filter(int sock, int workers)
+{
+#if (defined LINUX) && (defined SO_ATTACH_REUSEPORT_CBPF)
+  struct sock_filter code[] = {
+    /* A = IP version */
+    { BPF_LD  | BPF_B   | BPF_ABS,  0, 0, SKF_NET_OFF },
+    { BPF_ALU | BPF_RSH | BPF_K,    0, 0, 4 },
+    { BPF_JMP | BPF_JEQ | BPF_K,    0, 2, 4 },
+    /* IPv4: A = source address */
+    { BPF_LD  | BPF_W   | BPF_ABS,  0, 0, SKF_NET_OFF + 12 },
+    { BPF_JMP | BPF_JA,             0, 0, 10 },
+    /* IPv6: A = XOR of the source address words */
+    { BPF_LD  | BPF_W   | BPF_ABS,  0, 0, SKF_NET_OFF + 8 },
+    { BPF_MISC | BPF_TAX,           0, 0, 0 },
+    { BPF_LD  | BPF_W   | BPF_ABS,  0, 0, SKF_NET_OFF + 12 },
+    { BPF_ALU | BPF_XOR | BPF_X,    0, 0, 0 },
+    { BPF_MISC | BPF_TAX,           0, 0, 0 },
+    { BPF_LD  | BPF_W   | BPF_ABS,  0, 0, SKF_NET_OFF + 16 },
+    { BPF_ALU | BPF_XOR | BPF_X,    0, 0, 0 },
+    { BPF_MISC | BPF_TAX,           0, 0, 0 },
+    { BPF_LD  | BPF_W   | BPF_ABS,  0, 0, SKF_NET_OFF + 20 },
+    { BPF_ALU | BPF_XOR | BPF_X,    0, 0, 0 },
+    /* A = (multiplicative hash of A) % workers */
+    { BPF_ALU | BPF_MUL | BPF_K,    0, 0, 0x9E3779B1 },
+    { BPF_ALU | BPF_RSH | BPF_K,    0, 0, 16 },
+    { BPF_ALU | BPF_MOD | BPF_K,    0, 0, (u_int32_t) workers },
+    { BPF_RET | BPF_A,              0, 0, 0 },
+  };
+  struct sock_fprog prog;
+
+  prog.len = (sizeof(code) / sizeof(struct sock_filter));
+  prog.filter = code;
+
+  if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+    Log(LOG_WARNING, "WARN ( %s/core ): nfacctd_workers: unable to pin exporters to workers, falling back to kernel hashing (errno: %d).\n", config.name, errno);
+  }
+#else
+  Log(LOG_WARNING, "WARN ( %s/core ): nfacctd_workers: SO_ATTACH_REUSEPORT_CBPF not supported, falling back to kernel hashing.\n", config.name);
+#endif
+}
+
 u_int8_t NF_evaluate_flow_type(struct template_cache_entry *tpl, struct packet_ptrs *pptrs)
 {
   u_int8_t ret = PM_FTYPE_TRAFFIC;
@@ -2994,6 +3183,11 @@ int NF_find_id(struct id_table *t, struct packet_ptrs *pptrs, pm_id_t *tag, pm_i
     goto exit_lane;
   }
 
+  if (t->cls.num) {
+    ret = pretag_cls_find_id(t, pptrs, sa, tag, tag2);
+    goto exit_lane;
+  }
+
   if (sa->sa_family == AF_INET) {
     begin = 0;
     end = t->ipv4_num;
@@ -109,7 +109,7 @@ struct data_hdr_v9 {
 #define DEFAULT_NFACCTD_PORT 2100
 #define NETFLOW_MSG_SIZE PKT_MSG_SIZE
 #define V5_MAXFLOWS 30  /* max records in V5 packet */
-#define TEMPLATE_CACHE_ENTRIES 1021
+#define TEMPLATE_CACHE_ENTRIES 1024 /* initial slots, power of 2 */
 
 #define NF_TIME_MSECS 0 /* times are in msecs */
 #define NF_TIME_SECS 1 /* times are in secs */ 
@@ -131,6 +131,26 @@ struct data_hdr_v9 {
 #define TPL_TYPE_LEGACY                 0
 #define TPL_TYPE_EXT_DB                 1
 
+/* Pre-compiled template decoder: primitives and operations */
+#define TPL_DEC_OPS_MAX			16
+#define TPL_DEC_SRC_HOST		0x00000001
+#define TPL_DEC_DST_HOST		0x00000002
+#define TPL_DEC_SRC_PORT		0x00000004
+#define TPL_DEC_DST_PORT		0x00000008
+#define TPL_DEC_IP_PROTO		0x00000010
+#define TPL_DEC_TCP_FLAGS		0x00000020
+#define TPL_DEC_IN_IFACE		0x00000040
+#define TPL_DEC_OUT_IFACE		0x00000080
+#define TPL_DEC_ALL			0x000000FF
+
+#define TPL_DEC_OP_U8			1
+#define TPL_DEC_OP_U8_TO_U32		2
+#define TPL_DEC_OP_U16			3
+#define TPL_DEC_OP_U16_TO_U32		4
+#define TPL_DEC_OP_U32			5
+#define TPL_DEC_OP_IPV4			6
+#define TPL_DEC_OP_IPV6			7
+
 /* Flowset record types the we care about */
 #define NF9_IN_BYTES			1
 #define NF9_IN_PACKETS			2
@@ -455,6 +475,22 @@ struct tpl_field_list {
   char *ptr;
 };
 
+/* Pre-compiled template decoder: one operation per primitive */
+struct tpl_dec_op {
+  u_int16_t src_off;			/* offset of the field into the data record */
+  u_int16_t dst_off;			/* offset of the primitive into struct pkt_data */
+  u_int16_t l3_proto;			/* if non-zero, apply only to records of this ethertype */
+  u_int8_t op;				/* TPL_DEC_OP_* */
+  u_int32_t prim;			/* TPL_DEC_* this operation belongs to */
+};
+
+struct tpl_decoder {
+  u_int8_t compiled;			/* decoder can be used for this template */
+  u_int8_t num;				/* number of operations */
+  u_int32_t fallback;			/* TPL_DEC_* primitives left to generic handlers */
+  struct tpl_dec_op ops[TPL_DEC_OPS_MAX];
+};
+
 struct template_cache_entry {
   struct host_addr agent;               /* NetFlow Exporter agent */
   u_int32_t source_id;                  /* Exporter Observation Domain */
@@ -466,12 +502,19 @@ struct template_cache_entry {
   struct otpl_field tpl[NF9_MAX_DEFINED_FIELD];
   struct tpl_field_db ext_db[TPL_EXT_DB_ENTRIES];
   struct tpl_field_list list[TPL_LIST_ENTRIES];
-  struct template_cache_entry *next;
+  struct tpl_decoder dec;		/* pre-compiled decoder, data templates only */
 };
 
+/* Open-addressing (linear probing) cache keyed on agent, source ID, template ID */
 struct template_cache {
-  u_int16_t num;
-  struct template_cache_entry *c[TEMPLATE_CACHE_ENTRIES];
+  u_int32_t num;			/* slots, power of 2 */
+  u_int32_t count;			/* cached templates */
+  u_int32_t resizes;
+  u_int32_t max_probes;
+  u_int64_t lookups;
+  u_int64_t probes;
+  u_int64_t last_hits;			/* lookups served by the exporter last-hit template */
+  struct template_cache_entry **c;
 };
 
 struct NF_dissect {
@@ -503,6 +546,9 @@ extern void reset_dummy_v4(struct packet_ptrs *, u_char *);
 extern void notify_malf_packet(short int, char *, char *, struct sockaddr *, u_int32_t);
 extern int NF_find_id(struct id_table *, struct packet_ptrs *, pm_id_t *, pm_id_t *);
 extern void NF_compute_once();
+extern void NF_workers_spawn(struct sockaddr *, socklen_t);
+extern int NF_workers_prepare_sock(struct sockaddr *, socklen_t);
+extern void NF_workers_attach_reuseport_filter(int, int);
 
 extern struct xflow_status_entry *nfv5_check_status(struct packet_ptrs *);
 extern struct xflow_status_entry *nfv9_check_status(struct packet_ptrs *, u_int32_t, u_int32_t, u_int32_t, u_int8_t);
@@ -513,9 +559,11 @@ extern struct host_addr debug_a;
 extern char debug_agent_addr[50];
 extern u_int16_t debug_agent_port;
 
-extern u_int16_t modulo_template(u_int16_t, struct sockaddr *, u_int16_t);
+extern void init_template_cache(u_int32_t);
+extern void print_template_cache_status(time_t);
 extern struct template_cache_entry *handle_template(struct template_hdr_v9 *, struct packet_ptrs *, u_int16_t, u_int32_t, u_int16_t *, u_int16_t, u_int32_t);
 extern struct template_cache_entry *find_template(u_int16_t, struct sockaddr *, u_int16_t, u_int32_t);
+extern struct template_cache_entry *find_template_cached(struct xflow_status_entry *, u_int16_t, struct sockaddr *, u_int16_t, u_int32_t);
 extern struct template_cache_entry *insert_template(struct template_hdr_v9 *, struct packet_ptrs *, u_int16_t, u_int32_t, u_int16_t *, u_int8_t, u_int16_t, u_int32_t);
 extern struct template_cache_entry *refresh_template(struct template_hdr_v9 *, struct template_cache_entry *, struct packet_ptrs *, u_int16_t, u_int32_t, u_int16_t *, u_int8_t, u_int16_t, u_int32_t);
 extern void log_template_header(struct template_cache_entry *, struct packet_ptrs *, u_int16_t, u_int32_t, u_int8_t);
@@ -528,6 +576,7 @@ extern struct utpl_field *ext_db_get_ie(struct template_cache_entry *, u_int32_t
 extern struct utpl_field *ext_db_get_next_ie(struct template_cache_entry *, u_int16_t, u_int8_t *);
 
 extern int resolve_vlen_template(u_char *, u_int16_t, struct template_cache_entry *);
+extern void compile_template_decoder(struct template_cache_entry *);
 extern int get_ipfix_vlen(u_char *, u_int16_t, u_int16_t *);
 
 extern struct template_cache_entry *nfacctd_offline_read_json_template(char *, char *, int);
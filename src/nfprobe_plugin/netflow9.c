@@ -32,7 +32,6 @@
 /* $Id$ */
 
 #include "common.h"
-#include "treetype.h"
 #include "nfprobe_plugin.h"
 #include "ip_flow.h"
 #include "classifier.h"
@@ -49,11 +49,10 @@
  */
 #include "common.h"
 #include "addr.h"
-#include "sys-tree.h"
 #include "convtime.h"
 #include "nfacctd.h"
 #include "nfprobe_plugin.h"
-#include "treetype.h"
+#include "jhash.h"
 
 #include "pmacct-data.h"
 #include "net_aggr.h"
@@ -159,12 +158,191 @@ flow_compare(struct FLOW *a, struct FLOW *b)
 	return (0);
 }
 
-/* Generate functions for flow tree */
-FLOW_PROTOTYPE(FLOWS, FLOW, trp, flow_compare);
-FLOW_GENERATE(FLOWS, FLOW, trp, flow_compare);
+/*
+ * Hash of the flow identity, ie. of the fields looked at by flow_compare()
+ */
+static u_int32_t
+flow_hash(struct FLOW *flow)
+{
+	u_int32_t key[13];
+
+	memcpy(&key[0], &flow->addr[0], sizeof(flow->addr[0]));
+	memcpy(&key[4], &flow->addr[1], sizeof(flow->addr[1]));
+	key[8] = flow->af;
+	key[9] = flow->protocol;
+	key[10] = ((u_int32_t)flow->port[0] << 16) | flow->port[1];
+	key[11] = flow->ifindex[0];
+	key[12] = flow->ifindex[1];
+
+	return (jhash2(key, 13, 0));
+}
+
+static int
+flow_table_alloc(struct FLOW_TABLE *table, u_int32_t max_flows)
+{
+	u_int32_t size;
+
+	/* Keep the load factor at or below 1/2 with max_flows active */
+	for (size = FLOW_TABLE_MIN_SLOTS; size < max_flows && size < (1U << 30); size <<= 1);
+	size <<= 1;
+
+	if ((table->slots = calloc(size, sizeof(*table->slots))) == NULL)
+		return (-1);
+
+	table->size = size;
+	table->num = 0;
+
+	return (0);
+}
+
+static struct FLOW *
+flow_table_find(struct FLOW_TABLE *table, struct FLOW *key)
+{
+	struct FLOW *flow;
+	u_int32_t mask = table->size - 1, i;
+
+	for (i = key->hash & mask; (flow = table->slots[i]) != NULL; i = (i + 1) & mask) {
+		if (flow->hash == key->hash && flow_compare(flow, key) == 0)
+			return (flow);
+	}
+
+	return (NULL);
+}
+
+static int
+flow_table_grow(struct FLOW_TABLE *table)
+{
+	struct FLOW **slots;
+	u_int32_t size = table->size << 1, mask = size - 1, i, j;
+
+	if ((slots = calloc(size, sizeof(*slots))) == NULL)
+		return (-1);
+
+	for (i = 0; i < table->size; i++) {
+		if (table->slots[i] == NULL)
+			continue;
+
+		for (j = table->slots[i]->hash & mask; slots[j] != NULL; j = (j + 1) & mask);
+		slots[j] = table->slots[i];
+	}
+
+	free(table->slots);
+	table->slots = slots;
+	table->size = size;
+
+	Log(LOG_INFO, "INFO ( %s/%s ): Flow table grown to %u slots\n", config.name, config.type, size);
+
+	return (0);
+}
+
+static int
+flow_table_insert(struct FLOW_TABLE *table, struct FLOW *flow)
+{
+	u_int32_t mask, i;
+
+	/* Flows beyond max_flows are only evicted at the next expiry run */
+	if (table->num + 1 > table->size - (table->size >> 2)) {
+		if (flow_table_grow(table) == -1)
+			return (-1);
+	}
+
+	mask = table->size - 1;
+	for (i = flow->hash & mask; table->slots[i] != NULL; i = (i + 1) & mask);
+	table->slots[i] = flow;
+	table->num++;
+
+	return (0);
+}
+
+static void
+flow_table_remove(struct FLOW_TABLE *table, struct FLOW *flow)
+{
+	u_int32_t mask = table->size - 1, i, j, k;
+
+	for (i = flow->hash & mask; table->slots[i] != flow; i = (i + 1) & mask) {
+		if (table->slots[i] == NULL)
+			return;
+	}
+
+	table->slots[i] = NULL;
+	table->num--;
+
+	/*
+	 * Backward shift deletion: move back into the hole the flows of
+	 * the probe sequence which would not be found past it otherwise
+	 */
+	for (j = (i + 1) & mask; table->slots[j] != NULL; j = (j + 1) & mask) {
+		k = table->slots[j]->hash & mask;
+
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+
+		table->slots[i] = table->slots[j];
+		table->slots[j] = NULL;
+		i = j;
+	}
+}
+
+/* Flow record chunk header, keeps flow records aligned */
+struct FLOW_CHUNK {
+	void *next;
+	u_int64_t pad;
+};
+
+static struct FLOW *
+flow_alloc(struct FLOW_SLAB *slab)
+{
+	struct FLOW_CHUNK *chunk;
+	struct FLOW *flow;
+
+	if (slab->free_list != NULL) {
+		flow = slab->free_list;
+		slab->free_list = (struct FLOW *)flow->expiry_ev.next;
+	}
+	else {
+		if (slab->carve_left == 0) {
+			chunk = malloc(sizeof(*chunk) + sizeof(struct FLOW) * FLOW_SLAB_CHUNK);
+			if (chunk == NULL)
+				return (NULL);
+
+			chunk->next = slab->chunks;
+			slab->chunks = chunk;
+			slab->carve_ptr = (struct FLOW *)(chunk + 1);
+			slab->carve_left = FLOW_SLAB_CHUNK;
+		}
+
+		flow = slab->carve_ptr++;
+		slab->carve_left--;
+	}
+
+	slab->num++;
+
+	return (flow);
+}
+
+static void
+flow_free(struct FLOW_SLAB *slab, struct FLOW *flow)
+{
+	struct FLOW_CHUNK *chunk, *next;
+
+	flow->expiry_ev.next = (struct EXPIRY *)slab->free_list;
+	slab->free_list = flow;
+	slab->num--;
+
+	/* Give memory back once the flow table empties */
+	if (slab->num == 0) {
+		for (chunk = slab->chunks; chunk != NULL; chunk = next) {
+			next = chunk->next;
+			free(chunk);
+		}
+
+		memset(slab, 0, sizeof(*slab));
+	}
+}
 
 /*
- * This is the expiry comparison function.
+ * This is the expiry comparison function, ie. the order in which
+ * expired flows are exported.
  */
 static int
 expiry_compare(struct EXPIRY *a, struct EXPIRY *b)
@@ -179,9 +357,126 @@ expiry_compare(struct EXPIRY *a, struct EXPIRY *b)
 	return (0);
 }
 
-/* Generate functions for flow tree */
-EXPIRY_PROTOTYPE(EXPIRIES, EXPIRY, trp, expiry_compare);
-EXPIRY_GENERATE(EXPIRIES, EXPIRY, trp, expiry_compare);
+static int
+flow_expiry_compare(const void *a, const void *b)
+{
+	return (expiry_compare((*(struct FLOW **)a)->expiry, (*(struct FLOW **)b)->expiry));
+}
+
+static void
+expiry_link(struct EXPIRY **head, struct EXPIRY *e, u_int8_t where)
+{
+	e->where = where;
+	e->pprev = head;
+	if ((e->next = *head) != NULL)
+		e->next->pprev = &e->next;
+	*head = e;
+}
+
+/* File an expiry event in the wheel according to its expires_at */
+static void
+expiry_insert(struct EXPIRY_WHEEL *w, struct EXPIRY *e)
+{
+	u_int32_t delta, shift, idx;
+	int level;
+
+	if (e->expires_at == 0) {
+		expiry_link(&w->immediate, e, EXPIRY_WHEEL_NOW);
+		return;
+	}
+
+	if (e->expires_at < w->now) {
+		expiry_link(&w->due, e, EXPIRY_WHEEL_DUE);
+		return;
+	}
+
+	delta = e->expires_at - w->now;
+
+	for (level = 0; level < EXPIRY_WHEEL_LEVELS - 1; level++) {
+		if (delta < (1U << EXPIRY_WHEEL_SHIFT(level + 1)))
+			break;
+	}
+
+	shift = EXPIRY_WHEEL_SHIFT(level);
+
+	/* Beyond the span of the wheel: park in the slot to turn last */
+	if (level == EXPIRY_WHEEL_LEVELS - 1 && (delta >> (shift + EXPIRY_WHEEL_LN_BITS)))
+		idx = (w->now >> shift) - 1;
+	else
+		idx = e->expires_at >> shift;
+
+	idx &= EXPIRY_WHEEL_LEVEL_SLOTS(level) - 1;
+
+	expiry_link(&w->slot[EXPIRY_WHEEL_BASE(level) + idx], e, level);
+	w->num[level]++;
+}
+
+static void
+expiry_remove(struct EXPIRY_WHEEL *w, struct EXPIRY *e)
+{
+	if (e->where < EXPIRY_WHEEL_LEVELS)
+		w->num[e->where]--;
+
+	if ((*e->pprev = e->next) != NULL)
+		e->next->pprev = e->pprev;
+
+	e->next = NULL;
+	e->pprev = NULL;
+}
+
+/* Re-file the events of a slot, ie. one level down once its time has come */
+static void
+expiry_wheel_cascade(struct EXPIRY_WHEEL *w, int level, u_int32_t idx)
+{
+	struct EXPIRY *e, *next;
+
+	for (e = w->slot[EXPIRY_WHEEL_BASE(level) + idx]; e != NULL; e = next) {
+		next = e->next;
+		expiry_remove(w, e);
+		expiry_insert(w, e);
+	}
+}
+
+/*
+ * Turn the wheel up to 'now': events with expires_at < now end up on
+ * the due list. Stretches of empty slots are skipped over.
+ */
+static void
+expiry_wheel_advance(struct EXPIRY_WHEEL *w, u_int32_t now)
+{
+	struct EXPIRY *e, *next;
+	u_int32_t shift, span, turn;
+	int level;
+
+	while (w->now < now) {
+		for (level = EXPIRY_WHEEL_LEVELS - 1; level > 0; level--) {
+			shift = EXPIRY_WHEEL_SHIFT(level);
+
+			if (w->num[level] && (w->now & ((1U << shift) - 1)) == 0)
+				expiry_wheel_cascade(w, level, (w->now >> shift) & (EXPIRY_WHEEL_LEVEL_SLOTS(level) - 1));
+		}
+
+		for (e = w->slot[w->now & (EXPIRY_WHEEL_LEVEL_SLOTS(0) - 1)]; e != NULL; e = next) {
+			next = e->next;
+			expiry_remove(w, e);
+			expiry_link(&w->due, e, EXPIRY_WHEEL_DUE);
+		}
+
+		w->now++;
+
+		for (level = 0; level < EXPIRY_WHEEL_LEVELS && w->num[level] == 0; level++);
+
+		if (level == EXPIRY_WHEEL_LEVELS) {
+			w->now = now;
+		}
+		else if (level > 0) {
+			span = 1U << EXPIRY_WHEEL_SHIFT(level);
+			turn = (w->now + span - 1) & ~(span - 1);
+			if (turn > w->now)
+				w->now = MIN(turn, now);
+		}
+	}
+}
 
 /* Format a time in an ISOish format */
 static const char *
@@ -612,7 +907,7 @@ ipv6_to_flowrec_update(struct FLOW *flow, struct primitives_ptrs *prim_ptrs, int
 static void
 flow_update_expiry(struct FLOWTRACK *ft, struct FLOW *flow)
 {
-	EXPIRY_REMOVE(EXPIRIES, &ft->expiries, flow->expiry);
+	expiry_remove(&ft->expiries, flow->expiry);
 
         if (config.nfprobe_version == 9 || config.nfprobe_version == 10) {
 	  if (flow->octets[0] > (1ULL << 63) || flow->octets[1] > (1ULL << 63)) { 
@@ -692,7 +987,7 @@ flow_update_expiry(struct FLOWTRACK *ft, struct FLOW *flow)
 	flow->expiry->reason = R_GENERAL;
 
  out:
-	EXPIRY_INSERT(EXPIRIES, &ft->expiries, flow->expiry);
+	expiry_insert(&ft->expiries, flow->expiry);
 }
 
 void free_flow_allocs(struct FLOW *flow)
@@ -746,23 +1041,31 @@ process_packet(struct FLOWTRACK *ft, struct primitives_ptrs *prim_ptrs, const st
     ft->frag_packets += data->pkt_num;
 
   /* If a matching flow does not exist, create and insert one */
-  if (config.nfprobe_dont_cache || ((flow = FLOW_FIND(FLOWS, &ft->flows, &tmp)) == NULL)) {
+  if (!config.nfprobe_dont_cache) tmp.hash = flow_hash(&tmp);
+
+  if (config.nfprobe_dont_cache || ((flow = flow_table_find(&ft->flows, &tmp)) == NULL)) {
     /* Allocate and fill in the flow */
-    if ((flow = malloc(sizeof(*flow))) == NULL) return (PP_MALLOC_FAIL);
+    if ((flow = flow_alloc(&ft->flow_slab)) == NULL) {
+      free_flow_allocs(&tmp);
+      return (PP_MALLOC_FAIL);
+    }
     memcpy(flow, &tmp, sizeof(*flow));
     memcpy(&flow->flow_start, received_time, sizeof(flow->flow_start));
     flow->flow_seq = ft->next_flow_seq++;
-    FLOW_INSERT(FLOWS, &ft->flows, flow);
-
-    /* Allocate and fill in the associated expiry event */
-    if ((flow->expiry = malloc(sizeof(*flow->expiry))) == NULL)
+    if (!config.nfprobe_dont_cache && flow_table_insert(&ft->flows, flow) == -1) {
+      free_flow_allocs(flow);
+      flow_free(&ft->flow_slab, flow);
       return (PP_MALLOC_FAIL);
+    }
+
+    /* Fill in the associated expiry event */
+    flow->expiry = &flow->expiry_ev;
     flow->expiry->flow = flow;
     /* Expiration note: 0 means expire immediately */
     if (!config.nfprobe_dont_cache) flow->expiry->expires_at = 1;
     else flow->expiry->expires_at = 0;
     flow->expiry->reason = R_GENERAL;
-    EXPIRY_INSERT(EXPIRIES, &ft->expiries, flow->expiry);
+    expiry_insert(&ft->expiries, flow->expiry);
 
     if (data->flo_num) ft->num_flows += data->flo_num;
     else ft->num_flows++;
@@ -911,41 +1214,72 @@ update_expiry_stats(struct FLOWTRACK *ft, struct EXPIRY *e)
 	}	
 }
 
-/* How long before the next expiry event in millisecond */
+/*
+ * How long before the next expiry event in millisecond: zero if some
+ * flow is due for expiry, a lower bound to the wait otherwise
+ */
 static int
 next_expire(struct FLOWTRACK *ft)
 {
+	struct EXPIRY_WHEEL *w = &ft->expiries;
 	struct EXPIRY *expiry;
 	struct timeval now;
-	u_int32_t expires_at, ret, fudge;
+	u_int32_t until, level;
 
 	gettimeofday(&now, NULL);
 
-	if ((expiry = EXPIRY_MIN(EXPIRIES, &ft->expiries)) == NULL)
-		return (-1); /* indefinite */
+	if (w->immediate != NULL)
+		return (0); /* Now */
 
-	expires_at = expiry->expires_at;
+	/*
+	 * Cluster expiries by expiry_interval: flows are due once the
+	 * interval their expires_at rounds up to has elapsed
+	 */
+	until = now.tv_sec;
+	if (ft->expiry_interval > 1)
+		until = ((until - 1) / ft->expiry_interval) * ft->expiry_interval + 1;
 
-	/* Don't cluster urgent expiries */
-	if (expires_at == 0 && (expiry->reason == R_OVERBYTES || 
-	    expiry->reason == R_OVERFLOWS || expiry->reason == R_FLUSH))
-		return (0); /* Now */
+	expiry_wheel_advance(w, until);
 
-	/* Cluster expiries by expiry_interval */
-	if (ft->expiry_interval > 1) {
-		if ((fudge = expires_at % ft->expiry_interval) > 0)
-			expires_at += ft->expiry_interval - fudge;
+	for (expiry = w->due; expiry != NULL; expiry = expiry->next) {
+		if (expiry->expires_at < until)
+			return (0); /* Now */
 	}
 
-	if (expires_at < now.tv_sec)
-		return (0); /* Now */
+	for (level = 0; level < EXPIRY_WHEEL_LEVELS && w->num[level] == 0; level++);
+	if (level == EXPIRY_WHEEL_LEVELS && w->due == NULL)
+		return (-1); /* indefinite */
 
-	ret = 999 + (expires_at - now.tv_sec) * 1000;
-	return (ret);
+	if (ft->expiry_interval > 1)
+		return (999 + (until - 1 + ft->expiry_interval - now.tv_sec) * 1000);
+
+	return (999);
+}
+
+/* Append the flows of an expiry list to an array, growing it as needed */
+static int
+expiry_gather(struct EXPIRY *expiry, struct FLOW ***flowv, int *num, int *max)
+{
+	struct FLOW **new_flowv;
+
+	for (; expiry != NULL; expiry = expiry->next) {
+		if (*num == *max) {
+			new_flowv = realloc(*flowv, sizeof(**flowv) * (*max ? *max * 2 : 64));
+			if (new_flowv == NULL)
+				return (-1);
+
+			*flowv = new_flowv;
+			*max = (*max ? *max * 2 : 64);
+		}
+
+		(*flowv)[(*num)++] = expiry->flow;
+	}
+
+	return (0);
 }
 
 /*
- * Scan the tree of expiry events and process expired flows. If zap_all
+ * Scan the wheel of expiry events and process expired flows. If zap_all
  * is set, then forcibly expire all flows.
  */
 #define CE_EXPIRE_NORMAL	0  /* Normal expiry processing */
@@ -954,58 +1288,63 @@ next_expire(struct FLOWTRACK *ft)
 static int
 check_expired(struct FLOWTRACK *ft, struct NETFLOW_TARGET *target, int ex, u_int8_t engine_type, u_int32_t engine_id)
 {
-	struct FLOW **expired_flows, **oldexp;
-	int num_expired, i, r;
+	struct EXPIRY_WHEEL *w = &ft->expiries;
+	struct FLOW **expired_flows;
+	int num_expired, max_expired, i, r, level, idx;
 	struct timeval now;
 
-	struct EXPIRY *expiry, *nexpiry;
+	struct EXPIRY *expiry;
 
 	gettimeofday(&now, NULL);
 
 	r = 0;
-	num_expired = 0;
+	num_expired = max_expired = 0;
 	expired_flows = NULL;
 
 	if (verbose_flag)
 	  Log(LOG_DEBUG, "DEBUG ( %s/%s ): Starting expiry scan: mode %d\n", config.name, config.type, ex);
 
-	for(expiry = EXPIRY_MIN(EXPIRIES, &ft->expiries);
-	    expiry != NULL;
-	    expiry = nexpiry) {
-		nexpiry = EXPIRY_NEXT(EXPIRIES, &ft->expiries, expiry);
-		if ((expiry->expires_at == 0) || (ex == CE_EXPIRE_ALL) || 
-		    (ex != CE_EXPIRE_FORCED &&
-		    (expiry->expires_at < now.tv_sec))) {
-			/* Flow has expired */
-			if (verbose_flag)
-				Log(LOG_DEBUG, "DEBUG ( %s/%s ): Queuing flow seq:%" PRIu64 " (%p) for expiry\n",
-				   config.name, config.type, expiry->flow->flow_seq, expiry->flow);
-
-			/* Add to array of expired flows */
-			oldexp = expired_flows;
-			expired_flows = realloc(expired_flows,
-			    sizeof(*expired_flows) * (num_expired + 1));
-			/* Don't fatal on realloc failures */
-			if (expired_flows == NULL)
-				expired_flows = oldexp;
-			else {
-				expired_flows[num_expired] = expiry->flow;
-				num_expired++;
+	if (ex == CE_EXPIRE_NORMAL)
+		expiry_wheel_advance(w, now.tv_sec);
+
+	/* Don't fatal on realloc failures: flows left out wait for the next scan */
+	if (expiry_gather(w->immediate, &expired_flows, &num_expired, &max_expired) == 0 &&
+	    ex != CE_EXPIRE_FORCED &&
+	    expiry_gather(w->due, &expired_flows, &num_expired, &max_expired) == 0 &&
+	    ex == CE_EXPIRE_ALL) {
+		for (level = 0; level < EXPIRY_WHEEL_LEVELS; level++) {
+			for (idx = 0; idx < EXPIRY_WHEEL_LEVEL_SLOTS(level); idx++) {
+				if (expiry_gather(w->slot[EXPIRY_WHEEL_BASE(level) + idx], &expired_flows, &num_expired, &max_expired) == -1)
+					goto gathered;
 			}
+		}
+	}
 
-			if (ex == CE_EXPIRE_ALL)
-				expiry->reason = R_FLUSH;
+ gathered:
+	/* Expired flows are processed in (expires_at, flow_seq) order */
+	if (num_expired > 1)
+		qsort(expired_flows, num_expired, sizeof(*expired_flows), flow_expiry_compare);
 
-			update_expiry_stats(ft, expiry);
+	for (i = 0; i < num_expired; i++) {
+		expiry = expired_flows[i]->expiry;
 
-			/* Remove from flow tree, destroy expiry event */
-			FLOW_REMOVE(FLOWS, &ft->flows, expiry->flow);
-			EXPIRY_REMOVE(EXPIRIES, &ft->expiries, expiry);
-			expiry->flow->expiry = NULL;
-			free(expiry);
+		/* Flow has expired */
+		if (verbose_flag)
+			Log(LOG_DEBUG, "DEBUG ( %s/%s ): Queuing flow seq:%" PRIu64 " (%p) for expiry\n",
+			   config.name, config.type, expiry->flow->flow_seq, expiry->flow);
 
-			ft->num_flows--;
-		}
+		if (ex == CE_EXPIRE_ALL)
+			expiry->reason = R_FLUSH;
+
+		update_expiry_stats(ft, expiry);
+
+		/* Remove from flow table and expiry wheel */
+		if (!config.nfprobe_dont_cache)
+			flow_table_remove(&ft->flows, expiry->flow);
+		expiry_remove(w, expiry);
+		expiry->flow->expiry = NULL;
+
+		ft->num_flows--;
 	}
 
 	if (verbose_flag)
@@ -1018,7 +1357,7 @@ check_expired(struct FLOWTRACK *ft, struct NETFLOW_TARGET *target, int ex, u_int
 			  Log(LOG_WARNING, "WARN ( %s/%s ): No connection to collector, discarding flows\n", config.name, config.type);
 			  for (i = 0; i < num_expired; i++) {
 				  free_flow_allocs(expired_flows[i]);
-				  free(expired_flows[i]);
+				  flow_free(&ft->flow_slab, expired_flows[i]);
 			  }
 			  free(expired_flows);
 			  return -1;
@@ -1046,23 +1385,64 @@ check_expired(struct FLOWTRACK *ft, struct NETFLOW_TARGET *target, int ex, u_int
 			update_statistics(ft, expired_flows[i]);
 
 			free_flow_allocs(expired_flows[i]);
-			free(expired_flows[i]);
+			flow_free(&ft->flow_slab, expired_flows[i]);
 		}
-	
-		free(expired_flows);
 	}
 
+	if (expired_flows != NULL)
+		free(expired_flows);
+
 	return (r == -1 ? -1 : num_expired);
 }
 
+/* A wheel slot and the earliest time its expiry events can be due at */
+struct EXPIRY_SPAN {
+	u_int32_t start;
+	int level;
+	int idx;
+};
+
+static int
+expiry_span_compare(const void *a, const void *b)
+{
+	const struct EXPIRY_SPAN *sa = a, *sb = b;
+
+	if (sa->start != sb->start)
+		return (sa->start > sb->start ? 1 : -1);
+
+	return (0);
+}
+
+/* Reschedule all events of an expiry list for immediate disposal */
+static u_int64_t
+expiry_force_all(struct EXPIRY_WHEEL *w, struct EXPIRY **head)
+{
+	struct EXPIRY *expiry;
+	u_int64_t num = 0;
+
+	while ((expiry = *head) != NULL) {
+		expiry_remove(w, expiry);
+		expiry->expires_at = 0;
+		expiry->reason = R_OVERFLOWS;
+		expiry_insert(w, expiry);
+		num++;
+	}
+
+	return (num);
+}
+
 /*
  * Force expiry of num_to_expire flows (e.g. when flow table overfull) 
  */
 static void
 force_expire(struct FLOWTRACK *ft, u_int32_t num_to_expire)
 {
-	struct EXPIRY *expiry, **expiryv;
-	int i;
+	struct EXPIRY_WHEEL *w = &ft->expiries;
+	struct EXPIRY_SPAN spans[EXPIRY_WHEEL_SLOTS];
+	struct EXPIRY *expiry;
+	struct FLOW **flowv;
+	u_int32_t shift, base, i;
+	int num, max, num_spans, s, level, idx;
 
 	/* XXX move all overflow processing here (maybe) */
 	if (verbose_flag)
@@ -1070,50 +1450,89 @@ force_expire(struct FLOWTRACK *ft, u_int32_t num_to_expire)
 		    config.name, config.type, num_to_expire);
 
 	/*
-	 * Do this in two steps, as it is dangerous to change a key on 
-	 * a tree entry without first removing it and then re-adding it.
-	 * It is even worse when this has to be done during a FOREACH :)
-	 * To get around this, we make a list of expired flows and _then_ 
-	 * alter them 
+	 * The flows to expire are the first num_to_expire ones in
+	 * (expires_at, flow_seq) order. Flows are gathered from the lists
+	 * first, then from the wheel slots in order of their earliest
+	 * possible expires_at, until no further slot can hold a flow
+	 * preceding the num_to_expire-th one gathered so far.
 	 */
-	 
-	if ((expiryv = malloc(sizeof(*expiryv) * num_to_expire)) == NULL) {
-		/*
-		 * On malloc failure, expire ALL flows. I assume that 
-		 * setting all the keys in a tree to the same value is 
-		 * safe.
-		 */
-		Log(LOG_ERR, "ERROR ( %s/%s ): Out of memory while expiring flows\n", config.name, config.type);
-		EXPIRY_FOREACH(expiry, EXPIRIES, &ft->expiries) {
-			expiry->expires_at = 0;
-			expiry->reason = R_OVERFLOWS;
-			ft->flows_force_expired++;
+	flowv = NULL;
+	num = max = 0;
+
+	if (expiry_gather(w->immediate, &flowv, &num, &max) == -1 ||
+	    expiry_gather(w->due, &flowv, &num, &max) == -1)
+		goto malloc_failed;
+
+	for (level = 0, num_spans = 0; level < EXPIRY_WHEEL_LEVELS; level++) {
+		shift = EXPIRY_WHEEL_SHIFT(level);
+		base = w->now >> shift;
+
+		for (idx = 0; idx < EXPIRY_WHEEL_LEVEL_SLOTS(level); idx++) {
+			if (w->slot[EXPIRY_WHEEL_BASE(level) + idx] == NULL)
+				continue;
+
+			spans[num_spans].start = (base + ((idx - base) & (EXPIRY_WHEEL_LEVEL_SLOTS(level) - 1))) << shift;
+			spans[num_spans].start = MAX(spans[num_spans].start, w->now);
+			spans[num_spans].level = level;
+			spans[num_spans].idx = idx;
+			num_spans++;
 		}
-		return;
 	}
-	
-	/* Make the list of flows to expire */
-	i = 0;
-	EXPIRY_FOREACH(expiry, EXPIRIES, &ft->expiries) {
-		if (i >= num_to_expire)
-			break;
-		expiryv[i++] = expiry;
+
+	qsort(spans, num_spans, sizeof(*spans), expiry_span_compare);
+
+	for (s = 0; s < num_spans; s++) {
+		if (num >= num_to_expire) {
+			qsort(flowv, num, sizeof(*flowv), flow_expiry_compare);
+
+			if (spans[s].start > flowv[num_to_expire - 1]->expiry->expires_at)
+				break;
+		}
+
+		if (expiry_gather(w->slot[EXPIRY_WHEEL_BASE(spans[s].level) + spans[s].idx], &flowv, &num, &max) == -1)
+			goto malloc_failed;
 	}
-	if (i < num_to_expire) {
+
+	if (num > 1)
+		qsort(flowv, num, sizeof(*flowv), flow_expiry_compare);
+
+	if (num < num_to_expire) {
 		Log(LOG_ERR, "ERROR ( %s/%s ): Needed to expire %d flows, but only %d active.\n",
-				config.name, config.type, num_to_expire, i);
-		num_to_expire = i;
+				config.name, config.type, num_to_expire, num);
+		num_to_expire = num;
 	}
 
-	for(i = 0; i < num_to_expire; i++) {
-		EXPIRY_REMOVE(EXPIRIES, &ft->expiries, expiryv[i]);
-		expiryv[i]->expires_at = 0;
-		expiryv[i]->reason = R_OVERFLOWS;
-		EXPIRY_INSERT(EXPIRIES, &ft->expiries, expiryv[i]);
+	for (i = 0; i < num_to_expire; i++) {
+		expiry = flowv[i]->expiry;
+		expiry_remove(w, expiry);
+		expiry->expires_at = 0;
+		expiry->reason = R_OVERFLOWS;
+		expiry_insert(w, expiry);
 	}
+
 	ft->flows_force_expired += num_to_expire;
-	free(expiryv);
-	/* XXX - this is overcomplicated, perhaps use a separate queue */
+	free(flowv);
+
+	return;
+
+ malloc_failed:
+	/* On malloc failure, expire ALL flows */
+	Log(LOG_ERR, "ERROR ( %s/%s ): Out of memory while expiring flows\n", config.name, config.type);
+
+	if (flowv != NULL)
+		free(flowv);
+
+	for (expiry = w->immediate; expiry != NULL; expiry = expiry->next) {
+		expiry->reason = R_OVERFLOWS;
+		ft->flows_force_expired++;
+	}
+
+	ft->flows_force_expired += expiry_force_all(w, &w->due);
+
+	for (level = 0; level < EXPIRY_WHEEL_LEVELS; level++) {
+		for (idx = 0; idx < EXPIRY_WHEEL_LEVEL_SLOTS(level); idx++)
+			ft->flows_force_expired += expiry_force_all(w, &w->slot[EXPIRY_WHEEL_BASE(level) + idx]);
+	}
 }
 
 /*
@@ -1230,11 +1649,13 @@ connsock(struct sockaddr_storage *addr, socklen_t len, int hoplimit)
 static void
 init_flowtrack(struct FLOWTRACK *ft)
 {
+	struct timeval now;
+
 	/* Set up flow-tracking structure */
 	memset(ft, '\0', sizeof(*ft));
 	ft->next_flow_seq = 1;
-	FLOW_INIT(&ft->flows);
-	EXPIRY_INIT(&ft->expiries);
+	gettimeofday(&now, NULL);
+	ft->expiries.now = now.tv_sec;
 	
 	ft->tcp_timeout = DEFAULT_TCP_TIMEOUT;
 	ft->tcp_rst_timeout = DEFAULT_TCP_RST_TIMEOUT;
@@ -1353,19 +1774,16 @@ void nfprobe_plugin(int pipe_fd, struct configuration *cfgptr, void *ptr)
   struct pkt_bgp_primitives dummy_pbgp;
   struct ports_table pt;
   struct pollfd pfd;
-  unsigned char *pipebuf;
+  unsigned char *pipebuf = NULL;
   int refresh_timeout, ret, num, recv_budget, poll_bypass;
   char default_receiver[] = "127.0.0.1:2100";
   char default_engine_v5[] = "0:0", default_engine_v9[] = "0";
-  struct ring *rg = &((struct channels_list_entry *)ptr)->rg;
-  struct ch_status *status = ((struct channels_list_entry *)ptr)->status;
+  struct channels_list_entry *chptr = (struct channels_list_entry *) ptr;
   int datasize = ((struct channels_list_entry *)ptr)->datasize;
-  u_int32_t bufsz = ((struct channels_list_entry *)ptr)->bufsize;
   struct networks_file_data nfd;
 
-  unsigned char *rgptr, *dataptr;
-  int pollagain = TRUE;
-  u_int32_t seq = 1, rg_err_count = 0;
+  unsigned char *dataptr;
+  u_int32_t seq = 1;
 
   char *capfile = NULL, dest_addr[256], dest_serv[256];
   int linktype = 0, i, r, err, always_v6;
@@ -1443,6 +1861,11 @@ void nfprobe_plugin(int pipe_fd, struct configuration *cfgptr, void *ptr)
   if (!config.nfprobe_maxflows) max_flows = DEFAULT_MAX_FLOWS;
   else max_flows = config.nfprobe_maxflows;
 
+  if (flow_table_alloc(&flowtrack.flows, max_flows) == -1) {
+    Log(LOG_ERR, "ERROR ( %s/%s ): Unable to allocate the flow table (%d flows). Exiting.\n", config.name, config.type, max_flows);
+    exit_gracefully(1);
+  }
+
   if (config.debug) verbose_flag = TRUE;
   if (config.pcap_savefile) capfile = config.pcap_savefile;
 
@@ -1501,8 +1924,10 @@ sort_version:
 
   if (config.ports_file) load_ports(config.ports_file, &pt);
 
-  pipebuf = (unsigned char *) pm_malloc(config.buffer_size);
-  memset(pipebuf, 0, config.buffer_size);
+  if (config.pipe_zmq) {
+    pipebuf = (unsigned char *) pm_malloc(config.buffer_size);
+    memset(pipebuf, 0, config.buffer_size);
+  }
 
   if (config.pipe_zmq) P_zmq_pipe_init(zmq_host, &pipe_fd, &seq);
   else setnonblocking(pipe_fd);
@@ -1535,13 +1960,13 @@ sort_version:
 #endif
 
   for(;;) {
-    status->wakeup = TRUE;
     poll_bypass = FALSE;
 
     pfd.fd = pipe_fd;
     pfd.events = POLLIN;
 
-    ret = poll(&pfd, (pfd.fd == ERR ? 0 : 1), refresh_timeout);
+    if (config.pipe_homegrown && !arm_pipe_wakeup(chptr)) ret = TRUE; /* data is pending, do not sleep */
+    else ret = poll(&pfd, (pfd.fd == ERR ? 0 : 1), refresh_timeout);
 
     /* Flags set by signal handlers or control socket */
     if (graceful_shutdown_request) {
@@ -1584,40 +2009,16 @@ sort_version:
       }
 
       if (config.pipe_homegrown) {
-        if (!pollagain) {
-          seq++;
-          seq %= MAX_SEQNUM;
-          if (seq == 0) rg_err_count = FALSE;
-        }
-        else {
-          if ((ret = read(pipe_fd, &rgptr, sizeof(rgptr))) == 0)
-            exit_gracefully(1); /* we exit silently; something happened at the write end */
-        }
-  
-        if ((rg->ptr + bufsz) > rg->end) rg->ptr = rg->base;
-  
-        if (((struct ch_buf_hdr *)rg->ptr)->seq != seq) {
-  	  if (!pollagain) {
-  	    pollagain = TRUE;
-  	    goto handle_flow_expiration;
-  	  }
-  	  else {
-  	    rg_err_count++;
-  	    if (config.debug || (rg_err_count > MAX_RG_COUNT_ERR)) {
-              Log(LOG_WARNING, "WARN ( %s/%s ): Missing data detected (plugin_buffer_size=%" PRIu64 " plugin_pipe_size=%" PRIu64 ").\n",
-                        config.name, config.type, config.buffer_size, config.pipe_size);
-              Log(LOG_WARNING, "WARN ( %s/%s ): Increase values or look for plugin_buffer_size, plugin_pipe_size in CONFIG-KEYS document.\n\n",
-                        config.name, config.type);
-  	    }
-
-	    rg->ptr = (rg->base + status->last_buf_off);
-  	    seq = ((struct ch_buf_hdr *)rg->ptr)->seq;
-  	  }
-        }
-  
-        pollagain = FALSE;
-        memcpy(pipebuf, rg->ptr, bufsz);
-        rg->ptr += bufsz;
+	if (!recv_budget) {
+	  if (drain_pipe_wakeup(pipe_fd) == ERR)
+	    exit_gracefully(1); /* we exit silently; something happened at the write end */
+
+	  check_pipe_lost_data(chptr);
+	}
+
+	/* buffers are read in place and released to the Core Process once processed */
+	if (!(pipebuf = get_pipe_buffer(chptr))) goto handle_flow_expiration;
+	seq = ((struct ch_buf_hdr *)pipebuf)->seq;
       }
 #ifdef WITH_ZMQ
       else if (config.pipe_zmq) {
@@ -1666,6 +2067,7 @@ sort_version:
 	}
       }
 
+      if (config.pipe_homegrown) release_pipe_buffer(chptr);
       recv_budget++;
       goto read_data;
     }
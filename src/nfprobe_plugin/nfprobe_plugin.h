@@ -33,8 +33,6 @@
 #define _SOFTFLOWD_H
 
 #include "common.h"
-#include "sys-tree.h"
-#include "treetype.h"
 
 /* User to setuid to and directory to chroot to when we drop privs */
 #ifndef PRIVDROP_USER
@@ -68,6 +66,26 @@
  */
 #define DEFAULT_MAX_FLOWS	8192
 
+/* Flow table and flow records allocation */
+#define FLOW_TABLE_MIN_SLOTS	1024	/* power of 2 */
+#define FLOW_SLAB_CHUNK		1024	/* flow records per slab chunk */
+
+/*
+ * Expiry timer wheel: level 0 has one slot per second and spans the
+ * default timeouts, each slot of level n > 0 spans a whole turn of
+ * level n - 1. Deadlines further away than the wheel spans (~34 years)
+ * are parked in the last slot of the top level and re-filed as it turns.
+ */
+#define EXPIRY_WHEEL_LEVELS	4
+#define EXPIRY_WHEEL_L0_BITS	12
+#define EXPIRY_WHEEL_LN_BITS	6
+#define EXPIRY_WHEEL_SHIFT(l)	((l) ? (EXPIRY_WHEEL_L0_BITS + (((l) - 1) * EXPIRY_WHEEL_LN_BITS)) : 0)
+#define EXPIRY_WHEEL_LEVEL_SLOTS(l)	(1 << ((l) ? EXPIRY_WHEEL_LN_BITS : EXPIRY_WHEEL_L0_BITS))
+#define EXPIRY_WHEEL_BASE(l)	((l) ? ((1 << EXPIRY_WHEEL_L0_BITS) + (((l) - 1) << EXPIRY_WHEEL_LN_BITS)) : 0)
+#define EXPIRY_WHEEL_SLOTS	EXPIRY_WHEEL_BASE(EXPIRY_WHEEL_LEVELS)
+#define EXPIRY_WHEEL_DUE	EXPIRY_WHEEL_LEVELS		/* 'where': due list */
+#define EXPIRY_WHEEL_NOW	(EXPIRY_WHEEL_LEVELS + 1)	/* 'where': immediate list */
+
 /* Return values from process_packet */
 #define PP_OK           0
 #define PP_BAD_PACKET   -2
@@ -78,15 +96,50 @@ struct STATISTIC {
 	double min, mean, max;
 };
 
+/*
+ * Open addressing, linear probing hash table of active flows. It is
+ * sized off the maximum number of flows to track and only grows if
+ * that is overrun between two expiry runs.
+ */
+struct FLOW_TABLE {
+	struct FLOW **slots;
+	u_int32_t size;				/* # of slots, power of 2 */
+	u_int32_t num;				/* # of flows */
+};
+
+/* Flow records are carved out of chunks and recycled via a free list */
+struct FLOW_SLAB {
+	void *chunks;				/* linked via their first word */
+	struct FLOW *free_list;			/* linked via expiry.next */
+	u_int32_t carve_left;
+	struct FLOW *carve_ptr;
+	u_int64_t num;				/* # of records in use */
+};
+
+/*
+ * Hierarchical timer wheel of expiry events: see EXPIRY_WHEEL_*. Events
+ * due before 'now' are moved onto the 'due' list as the wheel turns,
+ * events to be disposed of immediately (expires_at == 0) are kept on the
+ * 'immediate' list.
+ */
+struct EXPIRY_WHEEL {
+	u_int32_t now;
+	struct EXPIRY *slot[EXPIRY_WHEEL_SLOTS];	/* all levels, see EXPIRY_WHEEL_BASE() */
+	u_int32_t num[EXPIRY_WHEEL_LEVELS];	/* # of events per level */
+	struct EXPIRY *due;
+	struct EXPIRY *immediate;
+};
+
 /*
  * This structure is the root of the flow tracking system.
- * It holds the root of the tree of active flows and the head of the
- * tree of expiry events. It also collects miscellaneous statistics
+ * It holds the table of active flows and the wheel of expiry
+ * events. It also collects miscellaneous statistics
  */
 struct FLOWTRACK {
 	/* The flows and their expiry events */
-	FLOW_HEAD(FLOWS, FLOW) flows;		/* Top of flow tree */
-	EXPIRY_HEAD(EXPIRIES, EXPIRY) expiries;	/* Top of expiries tree */
+	struct FLOW_TABLE flows;		/* Table of flows */
+	struct FLOW_SLAB flow_slab;		/* Flow records */
+	struct EXPIRY_WHEEL expiries;		/* Wheel of expiry events */
 
 	unsigned int num_flows;			/* # of active flows */
 	u_int64_t next_flow_seq;		/* Next flow ID */
@@ -139,7 +192,32 @@ struct FLOWTRACK {
 };
 
 /*
- * This structure is an entry in the tree of flows that we are 
+ * This is an expiry event, embedded in the flow it refers to.
+ * "expires_at" is the time at which the flow should be discarded,
+ * or zero if it is scheduled for immediate disposal. 
+ *
+ * When a flow which hasn't been scheduled for immediate expiry registers 
+ * traffic, it is unlinked from its current slot in the wheel and re-filed
+ * (subject to its updated timeout).
+ *
+ * Expiry scans operate by turning the wheel up to the current time and
+ * expiring the events found due, in (expires_at, flow_seq) order.
+ */
+struct EXPIRY {
+	struct EXPIRY *next;			/* Wheel slot or list linkage */
+	struct EXPIRY **pprev;
+	u_int8_t where;				/* Wheel level or list */
+	struct FLOW *flow;			/* pointer to flow */
+
+	u_int32_t expires_at;			/* time_t */
+	enum { 
+		R_GENERAL, R_TCP, R_TCP_RST, R_TCP_FIN, R_UDP, R_ICMP, 
+		R_MAXLIFE, R_OVERBYTES, R_OVERFLOWS, R_FLUSH
+	} reason;
+};
+
+/*
+ * This structure is an entry in the table of flows that we are 
  * currently tracking. 
  *
  * Because flows are matched _bi-directionally_, they must be stored in
@@ -149,7 +227,8 @@ struct FLOWTRACK {
 struct FLOW {
 	/* Housekeeping */
 	struct EXPIRY *expiry;			/* Pointer to expiry record */
-	FLOW_ENTRY(FLOW) trp;			/* Tree pointer */
+	struct EXPIRY expiry_ev;		/* Storage for the above */
+	u_int32_t hash;				/* Flow table hash */
 
 	/* Flow identity (all are in network byte order) */
 	int af;					/* Address family of flow */
@@ -200,31 +279,6 @@ struct FLOW {
 	struct pkt_vlen_hdr_primitives *pvlen[2]; 	/* space for vlen primitives */
 };
 
-/*
- * This is an entry in the tree of expiry events. The tree is used to 
- * avoid traversion the whole tree of active flows looking for ones to
- * expire. "expires_at" is the time at which the flow should be discarded,
- * or zero if it is scheduled for immediate disposal. 
- *
- * When a flow which hasn't been scheduled for immediate expiry registers 
- * traffic, it is deleted from its current position in the tree and 
- * re-inserted (subject to its updated timeout).
- *
- * Expiry scans operate by starting at the head of the tree and expiring
- * each entry with expires_at < now
- * 
- */
-struct EXPIRY {
-	EXPIRY_ENTRY(EXPIRY) trp;		/* Tree pointer */
-	struct FLOW *flow;			/* pointer to flow */
-
-	u_int32_t expires_at;			/* time_t */
-	enum { 
-		R_GENERAL, R_TCP, R_TCP_RST, R_TCP_FIN, R_UDP, R_ICMP, 
-		R_MAXLIFE, R_OVERBYTES, R_OVERFLOWS, R_FLUSH
-	} reason;
-};
-
 /* Prototype for functions shared from softflowd.c */
 u_int32_t timeval_sub_ms(const struct timeval *, const struct timeval *);
 
@@ -24,6 +24,7 @@
 #include "addr.h"
 #include "nfacctd.h"
 #include "pmacct-data.h"
+#include "jhash.h"
 
 struct template_cache_entry *handle_template(struct template_hdr_v9 *hdr, struct packet_ptrs *pptrs, u_int16_t tpl_type,
 						u_int32_t sid, u_int16_t *pens, u_int16_t len, u_int32_t seq)
@@ -52,46 +53,160 @@ struct template_cache_entry *handle_template(struct template_hdr_v9 *hdr, struct
   return tpl;
 }
 
-u_int16_t modulo_template(u_int16_t template_id, struct sockaddr *agent, u_int16_t buckets)
+static u_int32_t hash_template(u_int16_t template_id, struct host_addr *agent, u_int32_t sid)
 {
-  return hash_status_table(ntohs(template_id), agent, buckets);
+  u_int32_t a[4];
+
+  if (agent->family == AF_INET)
+    return jhash_3words(agent->address.ipv4.s_addr, sid, template_id, 0);
+  else if (agent->family == AF_INET6) {
+    memcpy(a, &agent->address.ipv6, 16);
+
+    /* IPv4-mapped IPv6 agents hash as their IPv4 counterpart, see sa_addr_cmp() */
+    if (!a[0] && !a[1] && a[2] == htonl(0xffff))
+      return jhash_3words(a[3], sid, template_id, 0);
+
+    return jhash2(a, 4, jhash_2words(sid, template_id, 0));
+  }
+
+  return jhash_2words(sid, template_id, 0);
+}
+
+static int resize_template_cache(u_int32_t slots)
+{
+  struct template_cache_entry **c, *ptr;
+  u_int32_t idx, pos, mask = (slots - 1);
+
+  c = malloc(slots * sizeof(struct template_cache_entry *));
+  if (!c) {
+    Log(LOG_ERR, "ERROR ( %s/core ): resize_template_cache(): unable to allocate %u slots.\n", config.name, slots);
+    return ERR;
+  }
+
+  memset(c, 0, slots * sizeof(struct template_cache_entry *));
+
+  for (idx = 0; idx < tpl_cache.num; idx++) {
+    if ((ptr = tpl_cache.c[idx])) {
+      pos = hash_template(ptr->template_id, &ptr->agent, ptr->source_id) & mask;
+      while (c[pos]) pos = ((pos + 1) & mask);
+      c[pos] = ptr;
+    }
+  }
+
+  if (tpl_cache.c) {
+    free(tpl_cache.c);
+    tpl_cache.resizes++;
+  }
+
+  tpl_cache.c = c;
+  tpl_cache.num = slots;
+
+  return SUCCESS;
+}
+
+void init_template_cache(u_int32_t slots)
+{
+  if (tpl_cache.c) free(tpl_cache.c);
+  memset(&tpl_cache, 0, sizeof(tpl_cache));
+
+  if (resize_template_cache(slots) == ERR) exit_gracefully(1);
+}
+
+/* add_template_cache(): the caller must have checked the template is not cached yet */
+static int add_template_cache(struct template_cache_entry *tpl)
+{
+  u_int32_t pos, mask;
+
+  /* keep load factor at or below 0.5: slots are just pointers and linear probing degrades fast beyond that */
+  if ((tpl_cache.count + 1) * 2 > tpl_cache.num) {
+    if (resize_template_cache(tpl_cache.num * 2) == ERR && (tpl_cache.count + 1) >= tpl_cache.num)
+      return ERR;
+  }
+
+  mask = (tpl_cache.num - 1);
+  pos = hash_template(tpl->template_id, &tpl->agent, tpl->source_id) & mask;
+  while (tpl_cache.c[pos]) pos = ((pos + 1) & mask);
+
+  tpl_cache.c[pos] = tpl;
+  tpl_cache.count++;
+
+  return SUCCESS;
 }
 
 struct template_cache_entry *find_template(u_int16_t id, struct sockaddr *agent, u_int16_t tpl_type, u_int32_t sid)
 {
   struct template_cache_entry *ptr;
-  u_int16_t modulo = modulo_template(id, agent, tpl_cache.num);
+  struct host_addr agent_addr;
+  u_int32_t pos, mask, probes = 0;
+  u_int16_t port;
+
+  if (!tpl_cache.c) return NULL;
 
-  ptr = tpl_cache.c[modulo];
+  sa_to_addr(agent, &agent_addr, &port);
+  mask = (tpl_cache.num - 1);
+  pos = hash_template(id, &agent_addr, sid) & mask;
+  tpl_cache.lookups++;
 
-  while (ptr) {
-    if ((ptr->template_id == id) && (!sa_addr_cmp((struct sockaddr *)agent, &ptr->agent)) &&
-	(ptr->source_id == sid))
+  while ((ptr = tpl_cache.c[pos])) {
+    probes++;
+
+    if ((ptr->template_id == id) && (ptr->source_id == sid) && (!sa_addr_cmp(agent, &ptr->agent)))
+      break;
+
+    pos = ((pos + 1) & mask);
+  }
+
+  tpl_cache.probes += probes;
+  if (probes > tpl_cache.max_probes) tpl_cache.max_probes = probes;
+
+  return ptr;
+}
+
+/*
+   find_template_cached(): as find_template() but first tries the last
+   template hit by the exporter, ie. (agent, source ID), the status entry
+   belongs to. Templates are never freed nor moved in memory (refresh
+   happens in place) hence the pointer can be safely retained.
+*/
+struct template_cache_entry *find_template_cached(struct xflow_status_entry *entry, u_int16_t id, struct sockaddr *agent,
+						 u_int16_t tpl_type, u_int32_t sid)
+{
+  struct template_cache_entry *ptr;
+
+  if (entry && entry->last_tpl) {
+    ptr = (struct template_cache_entry *) entry->last_tpl;
+
+    if (ptr->template_id == id && ptr->source_id == sid) {
+      tpl_cache.last_hits++;
       return ptr;
-    else ptr = ptr->next;
+    }
   }
 
-  return NULL;
+  ptr = find_template(id, agent, tpl_type, sid);
+  if (entry && ptr) entry->last_tpl = ptr;
+
+  return ptr;
+}
+
+void print_template_cache_status(time_t now)
+{
+  Log(LOG_NOTICE, "NOTICE ( %s/%s ): stats [templates] time=%ld entries=%u slots=%u load=%.2f resizes=%u lookups=%" PRIu64 " last_hits=%" PRIu64 " avg_probes=%.2f max_probes=%u\n",
+	config.name, config.type, (long)now, tpl_cache.count, tpl_cache.num,
+	tpl_cache.num ? ((float) tpl_cache.count / tpl_cache.num) : 0, tpl_cache.resizes,
+	tpl_cache.lookups, tpl_cache.last_hits,
+	tpl_cache.lookups ? ((float) tpl_cache.probes / tpl_cache.lookups) : 0, tpl_cache.max_probes);
 }
 
 struct template_cache_entry *insert_template(struct template_hdr_v9 *hdr, struct packet_ptrs *pptrs, u_int16_t tpl_type,
 						u_int32_t sid, u_int16_t *pens, u_int8_t version, u_int16_t len, u_int32_t seq)
 {
-  struct template_cache_entry *ptr, *prevptr = NULL;
+  struct template_cache_entry *ptr;
   struct template_field_v9 *field;
-  u_int16_t modulo = modulo_template(hdr->template_id, (struct sockaddr *) pptrs->f_agent, tpl_cache.num);
   u_int16_t num = ntohs(hdr->num), type, port, off, count;
   u_int32_t *pen;
   u_int8_t ipfix_ebit;
   u_char *tpl;
 
-  ptr = tpl_cache.c[modulo];
-
-  while (ptr) {
-    prevptr = ptr;
-    ptr = ptr->next;
-  }
-
   ptr = malloc(sizeof(struct template_cache_entry));
   if (!ptr) {
     Log(LOG_ERR, "ERROR ( %s/core ): insert_template(): unable to allocate new Data Template Cache Entry.\n", config.name);
@@ -201,8 +316,13 @@ struct template_cache_entry *insert_template(struct template_hdr_v9 *hdr, struct
     field++;
   }
 
-  if (prevptr) prevptr->next = ptr;
-  else tpl_cache.c[modulo] = ptr;
+  compile_template_decoder(ptr);
+
+  if (add_template_cache(ptr) == ERR) {
+    Log(LOG_ERR, "ERROR ( %s/core ): insert_template(): unable to add Data Template to the cache.\n", config.name);
+    free(ptr);
+    return NULL;
+  }
 
   log_template_footer(ptr, ptr->len, version);
 
@@ -217,11 +337,10 @@ struct template_cache_entry *insert_template(struct template_hdr_v9 *hdr, struct
 #ifdef WITH_JANSSON
 void load_templates_from_file(char *path)
 {
-  struct template_cache_entry *tpl, *prev_ptr = NULL, *ptr = NULL;
+  struct template_cache_entry *tpl;
   FILE *tmp_file = fopen(path, "r");
   char errbuf[SRVBUFLEN], tmpbuf[LARGEBUFLEN];
   int line = 1;
-  u_int16_t modulo;
 
   struct sockaddr_storage agent;
 
@@ -243,25 +362,21 @@ void load_templates_from_file(char *path)
       if (find_template(tpl->template_id, (struct sockaddr *) &agent, tpl->template_type, tpl->source_id)) {
 	Log(LOG_WARNING, "WARN ( %s/core ): load_templates_from_file(): template %u already cached. Skipping.\n",
 	    config.name, tpl->template_id);
+	free(tpl);
       }
       else {
-        modulo = modulo_template(tpl->template_id, (struct sockaddr *) &agent, tpl_cache.num);
-        ptr = tpl_cache.c[modulo];
+        compile_template_decoder(tpl);
 
-        while (ptr) {
-          prev_ptr = ptr;
-          ptr = ptr->next;
-        }
-
-        if (prev_ptr) prev_ptr->next = tpl;
-        else tpl_cache.c[modulo] = tpl;
-
-        Log(LOG_DEBUG, "DEBUG ( %s/core ): load_templates_from_file(): loaded template %u into cache.\n",
-	    config.name, tpl->template_id);
+        if (add_template_cache(tpl) == ERR) {
+	  Log(LOG_WARNING, "WARN ( %s/core ): load_templates_from_file(): unable to cache template %u. Skipping.\n",
+	      config.name, tpl->template_id);
+	  free(tpl);
+	}
+        else Log(LOG_DEBUG, "DEBUG ( %s/core ): load_templates_from_file(): loaded template %u into cache.\n",
+	         config.name, tpl->template_id);
       }
     }
 
-    prev_ptr = NULL;
     line++;
   }
 
@@ -469,10 +584,6 @@ void save_template(struct template_cache_entry *tpl, char *file)
     json_object_set_new(root, "tpl", tpl_array);
   }
 
-  /* NB: member `next` is willingly excluded from serialisation, since
-     it would make more sense for it to be computed when de-serializing,
-     to prevent the template cache from being corrupted. */
-
   if (root) {
       write_and_free_json(tpl_file, root);
       Log(LOG_DEBUG, "DEBUG ( %s/core ): save_template(): saved template %u into file.\n", config.name, tpl->template_id);
@@ -775,14 +886,13 @@ struct template_cache_entry *nfacctd_offline_read_json_template(char *buf, char
 struct template_cache_entry *refresh_template(struct template_hdr_v9 *hdr, struct template_cache_entry *tpl, struct packet_ptrs *pptrs, u_int16_t tpl_type,
 						u_int32_t sid, u_int16_t *pens, u_int8_t version, u_int16_t len, u_int32_t seq)
 {
-  struct template_cache_entry backup, *next;
+  struct template_cache_entry backup;
   struct template_field_v9 *field;
   u_int16_t count, num = ntohs(hdr->num), type, port, off;
   u_int32_t *pen;
   u_int8_t ipfix_ebit;
   u_char *ptr;
 
-  next = tpl->next;
   memcpy(&backup, tpl, sizeof(struct template_cache_entry));
   memset(tpl, 0, sizeof(struct template_cache_entry));
   sa_to_addr((struct sockaddr *)pptrs->f_agent, &tpl->agent, &port);
@@ -790,7 +900,6 @@ struct template_cache_entry *refresh_template(struct template_hdr_v9 *hdr, struc
   tpl->template_id = hdr->template_id;
   tpl->template_type = 0;
   tpl->num = num;
-  tpl->next = next;
 
   log_template_header(tpl, pptrs, tpl_type, sid, version);
 
@@ -882,6 +991,8 @@ struct template_cache_entry *refresh_template(struct template_hdr_v9 *hdr, struc
     field++;
   }
 
+  compile_template_decoder(tpl);
+
   log_template_footer(tpl, tpl->len, version);
 
 #ifdef WITH_JANSSON
@@ -960,23 +1071,21 @@ struct template_cache_entry *insert_opt_template(void *hdr, struct packet_ptrs *
 {
   struct options_template_hdr_v9 *hdr_v9 = (struct options_template_hdr_v9 *) hdr;
   struct options_template_hdr_ipfix *hdr_v10 = (struct options_template_hdr_ipfix *) hdr;
-  struct template_cache_entry *ptr, *prevptr = NULL;
+  struct template_cache_entry *ptr;
   struct template_field_v9 *field;
-  u_int16_t modulo, count, slen, olen, type, port, tid, off;
+  u_int16_t count, slen, olen, type, port, tid, off;
   u_int32_t *pen;
   u_int8_t ipfix_ebit;
   u_char *tpl;
 
   /* NetFlow v9 */
   if (tpl_type == 1) {
-    modulo = modulo_template(hdr_v9->template_id, (struct sockaddr *) pptrs->f_agent, tpl_cache.num);
     tid = hdr_v9->template_id;
     slen = ntohs(hdr_v9->scope_len)/sizeof(struct template_field_v9);
     olen = ntohs(hdr_v9->option_len)/sizeof(struct template_field_v9);
   }
   /* IPFIX */
   else if (tpl_type == 3) {
-    modulo = modulo_template(hdr_v10->template_id, (struct sockaddr *) pptrs->f_agent, tpl_cache.num);
     tid = hdr_v10->template_id;
     slen = ntohs(hdr_v10->scope_count);
     olen = ntohs(hdr_v10->option_count)-slen;
@@ -986,13 +1095,6 @@ struct template_cache_entry *insert_opt_template(void *hdr, struct packet_ptrs *
     return NULL;
   }
 
-  ptr = tpl_cache.c[modulo];
-
-  while (ptr) {
-    prevptr = ptr;
-    ptr = ptr->next;
-  }
-
   ptr = malloc(sizeof(struct template_cache_entry));
   if (!ptr) {
     Log(LOG_ERR, "ERROR ( %s/core ): insert_opt_template(): unable to allocate new Options Template Cache Entry.\n", config.name);
@@ -1077,8 +1179,11 @@ struct template_cache_entry *insert_opt_template(void *hdr, struct packet_ptrs *
     field++;
   }
 
-  if (prevptr) prevptr->next = ptr;
-  else tpl_cache.c[modulo] = ptr;
+  if (add_template_cache(ptr) == ERR) {
+    Log(LOG_ERR, "ERROR ( %s/core ): insert_opt_template(): unable to add Options Template to the cache.\n", config.name);
+    free(ptr);
+    return NULL;
+  }
 
   log_template_footer(ptr, ptr->len, version);
 
@@ -1095,7 +1200,7 @@ struct template_cache_entry *refresh_opt_template(void *hdr, struct template_cac
 {
   struct options_template_hdr_v9 *hdr_v9 = (struct options_template_hdr_v9 *) hdr;
   struct options_template_hdr_ipfix *hdr_v10 = (struct options_template_hdr_ipfix *) hdr;
-  struct template_cache_entry backup, *next;
+  struct template_cache_entry backup;
   struct template_field_v9 *field;
   u_int16_t slen, olen, count, type, port, tid, off;
   u_int32_t *pen;
@@ -1119,7 +1224,6 @@ struct template_cache_entry *refresh_opt_template(void *hdr, struct template_cac
     return NULL;
   }
 
-  next = tpl->next;
   memcpy(&backup, tpl, sizeof(struct template_cache_entry));
   memset(tpl, 0, sizeof(struct template_cache_entry));
   sa_to_addr((struct sockaddr *)pptrs->f_agent, &tpl->agent, &port);
@@ -1127,7 +1231,6 @@ struct template_cache_entry *refresh_opt_template(void *hdr, struct template_cac
   tpl->template_id = tid;
   tpl->template_type = 1;
   tpl->num = olen+slen;
-  tpl->next = next;
 
   log_template_header(tpl, pptrs, tpl_type, sid, version);  
 
@@ -1293,6 +1396,118 @@ int get_ipfix_vlen(u_char *base, u_int16_t remlen, u_int16_t *len)
   return ret;
 }
 
+static u_int16_t tpl_dec_pick(struct template_cache_entry *tpl, u_int16_t a, u_int16_t b, u_int16_t c)
+{
+  if (a && tpl->tpl[a].len) return a;
+  if (b && tpl->tpl[b].len) return b;
+  if (c && tpl->tpl[c].len) return c;
+
+  return 0;
+}
+
+static void tpl_dec_add(struct tpl_decoder *dec, u_int32_t prim, u_int8_t op, u_int16_t src_off, u_int16_t dst_off, u_int16_t l3_proto)
+{
+  struct tpl_dec_op *dop;
+
+  if (dec->num >= TPL_DEC_OPS_MAX) {
+    dec->fallback |= prim;
+    return;
+  }
+
+  dop = &dec->ops[dec->num];
+  dop->src_off = src_off;
+  dop->dst_off = dst_off;
+  dop->l3_proto = l3_proto;
+  dop->op = op;
+  dop->prim = prim;
+  dec->num++;
+}
+
+static void tpl_dec_host(struct template_cache_entry *tpl, u_int32_t prim, u_int16_t v4_addr, u_int16_t v4_pfx,
+			 u_int16_t v6_addr, u_int16_t v6_pfx, u_int16_t dst_off, u_int8_t datalink)
+{
+  u_int16_t f4 = tpl_dec_pick(tpl, v4_addr, v4_pfx, 0);
+  u_int16_t f6 = tpl_dec_pick(tpl, v6_addr, v6_pfx, 0);
+
+  /* odd field lengths or datalink-based decoding: leave it to generic handlers */
+  if ((f4 && tpl->tpl[f4].len != 4) || (f6 && tpl->tpl[f6].len != 16) || ((!f4 || !f6) && datalink)) {
+    tpl->dec.fallback |= prim;
+    return;
+  }
+
+  if (f4) tpl_dec_add(&tpl->dec, prim, TPL_DEC_OP_IPV4, tpl->tpl[f4].off, dst_off, ETHERTYPE_IP);
+  if (f6) tpl_dec_add(&tpl->dec, prim, TPL_DEC_OP_IPV6, tpl->tpl[f6].off, dst_off, ETHERTYPE_IPV6);
+}
+
+static void tpl_dec_port(struct template_cache_entry *tpl, u_int32_t prim, u_int16_t l4, u_int16_t udp,
+			 u_int16_t tcp, u_int16_t dst_off, u_int8_t datalink)
+{
+  u_int16_t f = tpl_dec_pick(tpl, l4, udp, tcp);
+
+  if (f) {
+    if (tpl->tpl[f].len >= 2) tpl_dec_add(&tpl->dec, prim, TPL_DEC_OP_U16, tpl->tpl[f].off, dst_off, 0);
+    else tpl->dec.fallback |= prim;
+  }
+  else if (datalink) tpl->dec.fallback |= prim;
+}
+
+static void tpl_dec_iface(struct template_cache_entry *tpl, u_int32_t prim, u_int16_t snmp, u_int16_t physint, u_int16_t dst_off)
+{
+  if (tpl->tpl[snmp].len == 2)
+    tpl_dec_add(&tpl->dec, prim, TPL_DEC_OP_U16_TO_U32, tpl->tpl[snmp].off, dst_off, 0);
+  else if (tpl->tpl[snmp].len == 4)
+    tpl_dec_add(&tpl->dec, prim, TPL_DEC_OP_U32, tpl->tpl[snmp].off, dst_off, 0);
+  else if (tpl->tpl[physint].len == 4)
+    tpl_dec_add(&tpl->dec, prim, TPL_DEC_OP_U32, tpl->tpl[physint].off, dst_off, 0);
+}
+
+/*
+   compile_template_decoder(): resolves, once per template, which field
+   feeds each of the most common primitives (hosts, ports, protocol, TCP
+   flags, interfaces) and at which offset; the resulting program is then
+   run by NF_tpl_decoder_handler() for every data record, saving all the
+   per-record template lookups done by the generic NF_*_handler()s. Only
+   fixed-length data templates are compiled; primitives that need the
+   datalink section or odd field lengths are marked for fallback.
+*/
+void compile_template_decoder(struct template_cache_entry *tpl)
+{
+  u_int8_t datalink;
+
+  if (!tpl) return;
+
+  memset(&tpl->dec, 0, sizeof(struct tpl_decoder));
+
+  if (tpl->template_type == 1 || tpl->vlen) return;
+
+  datalink = (tpl->tpl[NF9_DATALINK_FRAME_SECTION].len || tpl->tpl[NF9_LAYER2_PKT_SECTION_DATA].len);
+
+  tpl_dec_host(tpl, TPL_DEC_SRC_HOST, NF9_IPV4_SRC_ADDR, NF9_IPV4_SRC_PREFIX, NF9_IPV6_SRC_ADDR, NF9_IPV6_SRC_PREFIX,
+	       offsetof(struct pkt_data, primitives.src_ip), datalink);
+  tpl_dec_host(tpl, TPL_DEC_DST_HOST, NF9_IPV4_DST_ADDR, NF9_IPV4_DST_PREFIX, NF9_IPV6_DST_ADDR, NF9_IPV6_DST_PREFIX,
+	       offsetof(struct pkt_data, primitives.dst_ip), datalink);
+
+  tpl_dec_port(tpl, TPL_DEC_SRC_PORT, NF9_L4_SRC_PORT, NF9_UDP_SRC_PORT, NF9_TCP_SRC_PORT,
+	       offsetof(struct pkt_data, primitives.src_port), datalink);
+  tpl_dec_port(tpl, TPL_DEC_DST_PORT, NF9_L4_DST_PORT, NF9_UDP_DST_PORT, NF9_TCP_DST_PORT,
+	       offsetof(struct pkt_data, primitives.dst_port), datalink);
+
+  if (tpl->tpl[NF9_L4_PROTOCOL].len)
+    tpl_dec_add(&tpl->dec, TPL_DEC_IP_PROTO, TPL_DEC_OP_U8, tpl->tpl[NF9_L4_PROTOCOL].off,
+		offsetof(struct pkt_data, primitives.proto), 0);
+  else if (datalink) tpl->dec.fallback |= TPL_DEC_IP_PROTO;
+
+  if (tpl->tpl[NF9_TCP_FLAGS].len == 1)
+    tpl_dec_add(&tpl->dec, TPL_DEC_TCP_FLAGS, TPL_DEC_OP_U8_TO_U32, tpl->tpl[NF9_TCP_FLAGS].off,
+		offsetof(struct pkt_data, tcp_flags), 0);
+  else if (datalink) tpl->dec.fallback |= TPL_DEC_TCP_FLAGS;
+
+  tpl_dec_iface(tpl, TPL_DEC_IN_IFACE, NF9_INPUT_SNMP, NF9_INPUT_PHYSINT, offsetof(struct pkt_data, primitives.ifindex_in));
+  tpl_dec_iface(tpl, TPL_DEC_OUT_IFACE, NF9_OUTPUT_SNMP, NF9_OUTPUT_PHYSINT, offsetof(struct pkt_data, primitives.ifindex_out));
+
+  tpl->dec.compiled = TRUE;
+}
+
 struct utpl_field *ext_db_get_ie(struct template_cache_entry *ptr, u_int32_t pen, u_int16_t type, u_int8_t repeat_id)
 {
   u_int16_t ie_idx, ext_db_modulo = (type % TPL_EXT_DB_ENTRIES);
@@ -34,6 +34,7 @@
 #include "isis/isis.h"
 #include "bgp/bgp.h"
 #include "bmp/bmp.h"
+#include "afpacket.h"
 #if defined (WITH_NDPI)
 #include "ndpi/ndpi.h"
 #endif
@@ -168,6 +169,8 @@ void pm_pcap_cb(u_char *user, const struct pcap_pkthdr *pkthdr, const u_char *bu
 	set_index_pkt_ptrs(&pptrs);
         PM_evaluate_flow_type(&pptrs);
         exec_plugins(&pptrs, &req);
+
+        if (config.bgp_daemon || config.bmp_daemon) bgp_lookup_offline();
       }
     }
   }
@@ -549,6 +552,8 @@ int PM_find_id(struct id_table *t, struct packet_ptrs *pptrs, pm_id_t *tag, pm_i
     return ret;
   }
 
+  if (t->cls.num) return pretag_cls_find_id(t, pptrs, NULL, tag, tag2);
+
   for (x = 0; x < t->ipv4_num; x++) {
     ret = pretag_entry_process(&t->e[x], pptrs, tag, tag2);
 
@@ -572,6 +577,11 @@ void PM_print_stats(time_t now)
 
   if (config.pcap_if || config.pcap_interfaces_map) {
     for (device_idx = 0; device_idx < devices.num; device_idx++) {
+      if (devices.list[device_idx].afpacket) {
+	PM_afpacket_print_stats(&devices.list[device_idx], now);
+	continue;
+      }
+
       if (pcap_stats(devices.list[device_idx].dev_desc, &ps) < 0) {
 	Log(LOG_INFO, "INFO ( %s/%s ): stats [%s,%u] time=%ld error='pcap_stats(): %s'\n",
 	    config.name, config.type, devices.list[device_idx].str, devices.list[device_idx].id,
@@ -584,6 +594,9 @@ void PM_print_stats(time_t now)
     }
   }
 
+  if (config.handle_fragments) print_ip_fragment_stats(now);
+  if (config.handle_flows) print_ip_flow_stats(now);
+
   Log(LOG_NOTICE, "NOTICE ( %s/%s ): ---\n", config.name, config.type);
 }
 
@@ -888,6 +901,11 @@ void pm_pcap_add_filter(struct pm_pcap_device *dev_ptr)
   /* pcap library stuff */
   struct bpf_program filter;
 
+  if (dev_ptr->afpacket) {
+    PM_afpacket_add_filter(dev_ptr);
+    return;
+  }
+
   memset(&filter, 0, sizeof(filter));
   if (pcap_compile(dev_ptr->dev_desc, &filter, config.clbuf, 0, PCAP_NETMASK_UNKNOWN) < 0) {
     Log(LOG_WARNING, "WARN ( %s/core ): %s (going on without a filter)\n", config.name, pcap_geterr(dev_ptr->dev_desc));
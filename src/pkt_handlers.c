@@ -41,6 +41,23 @@
 struct channels_list_entry channels_list[MAX_N_PLUGINS];
 pkt_handler phandler[N_PRIMITIVES];
 
+/* NF_*_handler()s which can be replaced by the pre-compiled template decoder */
+static const struct {
+  u_int32_t prim;
+  pkt_handler handler;
+} tpl_dec_handlers[] = {
+  { TPL_DEC_SRC_HOST, NF_src_host_handler },
+  { TPL_DEC_DST_HOST, NF_dst_host_handler },
+  { TPL_DEC_SRC_PORT, NF_src_port_handler },
+  { TPL_DEC_DST_PORT, NF_dst_port_handler },
+  { TPL_DEC_IP_PROTO, NF_ip_proto_handler },
+  { TPL_DEC_TCP_FLAGS, NF_tcp_flags_handler },
+  { TPL_DEC_IN_IFACE, NF_in_iface_handler },
+  { TPL_DEC_OUT_IFACE, NF_out_iface_handler },
+  { 0, NULL }
+};
+
+static void fold_tpl_decoder_handlers(struct channels_list_entry *, int *);
 
 
 /* functions */
@@ -959,12 +976,49 @@ void evaluate_packet_handlers()
       primitives++;
     }
 
+    if (config.acct_type == ACCT_NF) fold_tpl_decoder_handlers(&channels_list[index], &primitives);
+
     index++;
   }
 
   assert(primitives < N_PRIMITIVES);
 }
 
+/*
+   fold_tpl_decoder_handlers(): replaces the NF_*_handler()s listed in
+   tpl_dec_handlers[] with a single NF_tpl_decoder_handler(), placed where
+   the first of them was; relative order of the remaining handlers is kept.
+*/
+static void fold_tpl_decoder_handlers(struct channels_list_entry *chptr, int *primitives)
+{
+  int idx, dst, tidx, first = ERR;
+
+  chptr->tpl_dec_prims = 0;
+
+  for (idx = 0, dst = 0; idx < (*primitives); idx++) {
+    for (tidx = 0; tpl_dec_handlers[tidx].handler; tidx++) {
+      if (chptr->phandler[idx] == tpl_dec_handlers[tidx].handler) break;
+    }
+
+    if (tpl_dec_handlers[tidx].handler) {
+      chptr->tpl_dec_prims |= tpl_dec_handlers[tidx].prim;
+
+      if (first == ERR) {
+	first = dst;
+	chptr->phandler[dst] = NF_tpl_decoder_handler;
+	dst++;
+      }
+    }
+    else {
+      chptr->phandler[dst] = chptr->phandler[idx];
+      dst++;
+    }
+  }
+
+  for (idx = dst; idx < (*primitives); idx++) chptr->phandler[idx] = NULL;
+  (*primitives) = dst;
+}
+
 #if defined (HAVE_L2)
 void src_mac_handler(struct channels_list_entry *chptr, struct packet_ptrs *pptrs, char **data)
 {
@@ -1103,28 +1157,28 @@ void bgp_peer_dst_ip_handler(struct channels_list_entry *chptr, struct packet_pt
 void igp_src_nmask_handler(struct channels_list_entry *chptr, struct packet_ptrs *pptrs, char **data)
 {
   struct pkt_data *pdata = (struct pkt_data *) *data;
-  struct route_node *ret = (struct route_node *) pptrs->igp_src;
+  struct isis_prefix *ret = (struct isis_prefix *) pptrs->igp_src;
 
   /* check network-related primitives against fallback scenarios */
   if (!evaluate_lm_method(pptrs, FALSE, chptr->plugin->cfg.nfacctd_net, NF_NET_IGP)) return;
 
-  if (ret) pdata->primitives.src_nmask = ret->p.prefixlen;
+  if (ret) pdata->primitives.src_nmask = ret->prefixlen;
 }
 
 void igp_dst_nmask_handler(struct channels_list_entry *chptr, struct packet_ptrs *pptrs, char **data)
 {
   struct pkt_data *pdata = (struct pkt_data *) *data;
-  struct route_node *ret = (struct route_node *) pptrs->igp_dst;
+  struct isis_prefix *ret = (struct isis_prefix *) pptrs->igp_dst;
 
   /* check network-related primitives against fallback scenarios */
   if (!evaluate_lm_method(pptrs, TRUE, chptr->plugin->cfg.nfacctd_net, NF_NET_IGP)) return;
 
-  if (ret) pdata->primitives.dst_nmask = ret->p.prefixlen;
+  if (ret) pdata->primitives.dst_nmask = ret->prefixlen;
 }
 
 void igp_peer_dst_ip_handler(struct channels_list_entry *chptr, struct packet_ptrs *pptrs, char **data)
 {
-  struct route_node *ret = (struct route_node *) pptrs->igp_dst;
+  struct isis_prefix *ret = (struct isis_prefix *) pptrs->igp_dst;
   struct pkt_bgp_primitives *pbgp = (struct pkt_bgp_primitives *) ((*data) + chptr->extras.off_pkt_bgp_primitives);
 
   /* check network-related primitives against fallback scenarios */
@@ -1132,7 +1186,7 @@ void igp_peer_dst_ip_handler(struct channels_list_entry *chptr, struct packet_pt
 
   if (ret) {
     pbgp->peer_dst_ip.family = AF_INET;
-    memcpy(&pbgp->peer_dst_ip.address.ipv4, &ret->p.adv_router, 4);
+    memcpy(&pbgp->peer_dst_ip.address.ipv4, &ret->adv_router, 4);
   }
 }
 
@@ -1878,6 +1932,80 @@ void NF_etype_handler(struct channels_list_entry *chptr, struct packet_ptrs *ppt
 }
 #endif
 
+void NF_tpl_decoder_handler(struct channels_list_entry *chptr, struct packet_ptrs *pptrs, char **data)
+{
+  struct pkt_data *pdata = (struct pkt_data *) *data;
+  struct struct_header_v5 *hdr = (struct struct_header_v5 *) pptrs->f_header;
+  struct template_cache_entry *tpl = (struct template_cache_entry *) pptrs->f_tpl;
+  u_int32_t fallback = chptr->tpl_dec_prims, t32;
+  u_int16_t t16;
+  u_int8_t idx, nat_event;
+
+  if ((hdr->version == 9 || hdr->version == 10) && tpl && tpl->dec.compiled) {
+    struct tpl_dec_op *op;
+    struct host_addr *addr;
+    u_char *src, *dst;
+
+    nat_event = (pptrs->flow_type == NF9_FTYPE_NAT_EVENT); /* NAT64 case */
+
+    for (idx = 0; idx < tpl->dec.num; idx++) {
+      op = &tpl->dec.ops[idx];
+
+      if (!(op->prim & chptr->tpl_dec_prims)) continue;
+      if (op->l3_proto && op->l3_proto != pptrs->l3_proto && !nat_event) continue;
+
+      src = pptrs->f_data + op->src_off;
+      dst = (u_char *) pdata + op->dst_off;
+
+      switch (op->op) {
+      case TPL_DEC_OP_U8:
+	memcpy(dst, src, 1);
+	break;
+      case TPL_DEC_OP_U8_TO_U32:
+	t32 = (*src);
+	memcpy(dst, &t32, 4);
+	break;
+      case TPL_DEC_OP_U16:
+	memcpy(&t16, src, 2);
+	t16 = ntohs(t16);
+	memcpy(dst, &t16, 2);
+	break;
+      case TPL_DEC_OP_U16_TO_U32:
+	memcpy(&t16, src, 2);
+	t32 = ntohs(t16);
+	memcpy(dst, &t32, 4);
+	break;
+      case TPL_DEC_OP_U32:
+	memcpy(&t32, src, 4);
+	t32 = ntohl(t32);
+	memcpy(dst, &t32, 4);
+	break;
+      case TPL_DEC_OP_IPV4:
+	addr = (struct host_addr *) dst;
+	memcpy(&addr->address.ipv4, src, 4);
+	addr->family = AF_INET;
+	break;
+      case TPL_DEC_OP_IPV6:
+	addr = (struct host_addr *) dst;
+	memcpy(&addr->address.ipv6, src, 16);
+	addr->family = AF_INET6;
+	break;
+      default:
+	break;
+      }
+    }
+
+    fallback &= tpl->dec.fallback;
+  }
+
+  /* NetFlow v5, non-compiled templates, primitives needing the datalink section */
+  if (fallback) {
+    for (idx = 0; tpl_dec_handlers[idx].handler; idx++) {
+      if (fallback & tpl_dec_handlers[idx].prim) tpl_dec_handlers[idx].handler(chptr, pptrs, data);
+    }
+  }
+}
+
 void NF_src_host_handler(struct channels_list_entry *chptr, struct packet_ptrs *pptrs, char **data)
 {
   struct pkt_data *pdata = (struct pkt_data *) *data;
@@ -2759,12 +2887,14 @@ void pre_tag2_handler(struct channels_list_entry *chptr, struct packet_ptrs *ppt
 void pre_tag_label_handler(struct channels_list_entry *chptr, struct packet_ptrs *pptrs, char **data)
 {
   struct pkt_vlen_hdr_primitives *pvlen = (struct pkt_vlen_hdr_primitives *) ((*data) + chptr->extras.off_pkt_vlen_hdr_primitives);
+  /* label.len excludes the terminating null, which is shipped along */
+  int len = (pptrs->label.len ? (pptrs->label.len + 1) : 0);
 
-  if (check_pipe_buffer_space(chptr, pvlen, PmLabelTSz + pptrs->label.len)) {
+  if (check_pipe_buffer_space(chptr, pvlen, PmLabelTSz + len)) {
     vlen_prims_init(pvlen, 0);
     return;
   }
-  else vlen_prims_insert(pvlen, COUNT_INT_LABEL, pptrs->label.len, (u_char *) pptrs->label.val, PM_MSG_STR_COPY);
+  else vlen_prims_insert(pvlen, COUNT_INT_LABEL, len, (u_char *) pptrs->label.val, PM_MSG_STR_COPY);
 }
 
 void NF_flows_handler(struct channels_list_entry *chptr, struct packet_ptrs *pptrs, char **data)
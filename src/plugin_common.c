@@ -27,14 +27,20 @@
 #include "plugin_hooks.h"
 #include "ip_flow.h"
 #include "classifier.h"
-#include "crc32.h"
 #include "preprocess-internal.h"
+#include "thread_pool.h"
 
 /* Global variables */
 void (*insert_func)(struct primitives_ptrs *, struct insert_data *); /* pointer to INSERT function */
 void (*purge_func)(struct chained_cache *[], int, int); /* pointer to purge function */ 
 struct scratch_area sa;
-struct chained_cache *cache;
+struct chained_cache_table cache_tbl;
+struct p_key_layout p_key;
+/* pending_queries_queue, pqq_ptr and pqq_container are owned by the main
+   loop: with print_writer_thread / kafka_writer_thread, the writer thread
+   is only handed a generation of the cache (p_gen_writing) and its purge
+   function must not touch them, as the main loop re-uses them, ie. via
+   P_cache_mark_flush(), before joining the thread at the next purge */
 struct chained_cache **queries_queue, **pending_queries_queue, *pqq_container;
 struct timeval flushtime;
 int qq_ptr, pqq_ptr, pp_size, pb_size, pn_size, pm_size, pt_size, pc_size;
@@ -48,6 +54,15 @@ struct timeval basetime, ibasetime, new_basetime;
 time_t timeslot;
 int dyn_table, dyn_table_time_only;
 
+static struct scratch_area *sa_cur;
+static u_int32_t sa_chunks, p_qq_size;
+
+/* print_writer_thread, kafka_writer_thread: generation being purged by the
+   writer thread and flushed generation ready to be swapped in */
+static struct p_cache_gen p_gen_spare, p_gen_writing;
+static pthread_t p_writer_thread;
+static int p_writer_state, p_writer_safe_action;
+
 /* Functions */
 void P_set_signals()
 {
@@ -59,6 +74,133 @@ void P_set_signals()
   signal(SIGCHLD, SIG_IGN);
 }
  
+/* allocates a fresh, empty, generation of the cache as the current one */
+static void P_cache_gen_alloc()
+{
+  memset(&sa, 0, sizeof(struct scratch_area));
+  sa.num = config.print_cache_entries;
+  sa.size = sa.num*dbc_size;
+
+  memset(&cache_tbl, 0, sizeof(cache_tbl));
+  for (cache_tbl.size = 1; cache_tbl.size < config.print_cache_entries; cache_tbl.size <<= 1);
+
+  cache_tbl.bucket = (struct chained_cache **) pm_malloc(cache_tbl.size*sizeof(struct chained_cache *));
+  queries_queue = (struct chained_cache **) pm_malloc(p_qq_size*sizeof(struct chained_cache *));
+  sa.base = (unsigned char *) pm_malloc(sa.size);
+  sa.ptr = sa.base;
+  sa.next = NULL;
+  sa_cur = &sa;
+  sa_chunks = 1;
+  qq_ptr = 0;
+
+  memset(cache_tbl.bucket, 0, cache_tbl.size*sizeof(struct chained_cache *));
+  memset(queries_queue, 0, p_qq_size*sizeof(struct chained_cache *));
+  memset(sa.base, 0, sa.size);
+}
+
+static void P_cache_gen_reset()
+{
+  struct scratch_area *chunk;
+
+  if (cache_tbl.old_bucket) {
+    free(cache_tbl.old_bucket);
+    cache_tbl.old_bucket = NULL;
+    cache_tbl.old_size = 0;
+    cache_tbl.rehash_idx = 0;
+  }
+
+  memset(cache_tbl.bucket, 0, cache_tbl.size*sizeof(struct chained_cache *));
+  cache_tbl.entries = 0;
+
+  for (chunk = &sa; chunk; chunk = chunk->next) chunk->ptr = chunk->base;
+  sa_cur = &sa;
+  qq_ptr = 0;
+}
+
+static void P_cache_gen_save(struct p_cache_gen *gen)
+{
+  gen->tbl = cache_tbl;
+  gen->sa = sa;
+  gen->sa_cur = (sa_cur == &sa) ? &gen->sa : sa_cur;
+  gen->sa_chunks = sa_chunks;
+  gen->queue = queries_queue;
+  gen->qq_ptr = qq_ptr;
+}
+
+static void P_cache_gen_load(struct p_cache_gen *gen)
+{
+  cache_tbl = gen->tbl;
+  sa = gen->sa;
+  sa_cur = (gen->sa_cur == &gen->sa) ? &sa : gen->sa_cur;
+  sa_chunks = gen->sa_chunks;
+  queries_queue = gen->queue;
+  qq_ptr = gen->qq_ptr;
+}
+
+static void *P_cache_writer_thread(void *arg)
+{
+  (*purge_func)(p_gen_writing.queue, p_gen_writing.qq_ptr, p_writer_safe_action);
+
+  return NULL;
+}
+
+/* waits for the writer thread, if any, and recycles the generation it was
+   purging as the spare one; this is what bounds memory to two generations */
+void P_cache_writer_wait()
+{
+  struct p_cache_gen current;
+
+  if (p_writer_state == P_WRITER_IDLE) return;
+
+  if (p_writer_state == P_WRITER_RUNNING) pthread_join(p_writer_thread, NULL);
+
+  /* purge functions re-arrange the queue, hence the generation is reset
+     as a whole rather than via P_cache_flush() */
+  P_cache_gen_save(&current);
+  P_cache_gen_load(&p_gen_writing);
+  P_cache_gen_reset();
+  P_cache_gen_save(&p_gen_spare);
+  P_cache_gen_load(&current);
+
+  memset(&p_gen_writing, 0, sizeof(p_gen_writing));
+  p_writer_state = P_WRITER_IDLE;
+}
+
+/* freezes the current generation for the writer thread and swaps in the
+   spare one (allocated on first use); entries must be already marked via
+   P_cache_mark_flush() and the writer must be idle */
+static void P_cache_gen_swap()
+{
+  P_cache_gen_save(&p_gen_writing);
+
+  if (p_gen_spare.queue) {
+    P_cache_gen_load(&p_gen_spare);
+    memset(&p_gen_spare, 0, sizeof(p_gen_spare));
+  }
+  else P_cache_gen_alloc();
+}
+
+static void P_cache_writer_start(int safe_action)
+{
+  sigset_t mask, saved_mask;
+  int ret;
+
+  p_writer_safe_action = safe_action;
+
+  /* signals are to be served by the main thread only */
+  sigfillset(&mask);
+  pthread_sigmask(SIG_SETMASK, &mask, &saved_mask);
+  ret = pthread_create(&p_writer_thread, NULL, P_cache_writer_thread, NULL);
+  pthread_sigmask(SIG_SETMASK, &saved_mask, NULL);
+
+  if (!ret) p_writer_state = P_WRITER_RUNNING;
+  else {
+    Log(LOG_WARNING, "WARN ( %s/%s ): Unable to start writer thread: %s. Purging inline.\n", config.name, config.type, strerror(ret));
+    P_cache_writer_thread(NULL);
+    p_writer_state = P_WRITER_DONE;
+  }
+}
+
 void P_init_default_values()
 {
   if (config.pidfile) write_pid_file_plugin(config.pidfile, config.type, config.name);
@@ -88,6 +230,10 @@ void P_init_default_values()
   if (!config.print_cache_entries) config.print_cache_entries = PRINT_CACHE_ENTRIES;
   if (!config.dump_max_writers) config.dump_max_writers = DEFAULT_PLUGIN_COMMON_WRITERS_NO;
 
+  /* other purge functions, ie. MongoDB_cache_purge(), make use of the
+     pending queries queue and are not fit for the writer thread */
+  if (config.type_id != PLUGIN_ID_PRINT && config.type_id != PLUGIN_ID_KAFKA) config.dump_writer_thread = FALSE;
+
   dump_writers.list = malloc(config.dump_max_writers * sizeof(pid_t));
   dump_writers_init();
 
@@ -99,25 +245,26 @@ void P_init_default_values()
   pc_size = config.cpptrs.len;
   dbc_size = sizeof(struct chained_cache);
 
-  memset(&sa, 0, sizeof(struct scratch_area));
-  sa.num = config.print_cache_entries*AVERAGE_CHAIN_LEN;
-  sa.size = sa.num*dbc_size;
+  P_key_layout_init(&p_key, config.what_to_count, config.what_to_count_2);
 
-  Log(LOG_INFO, "INFO ( %s/%s ): cache entries=%d base cache memory=%" PRIu64 " bytes\n", config.name, config.type,
-	config.print_cache_entries, ((config.print_cache_entries * dbc_size) + (2 * ((sa.num +
-	config.print_cache_entries) * sizeof(struct chained_cache *))) + sa.size));
+  /* cache entries are carved out of a chain of scratch areas (slabs), each
+     worth print_cache_entries elements and allocated on demand, up to
+     PRINT_CACHE_CHUNKS_MAX of them: as many entries as the former embedded
+     buckets plus chains of average depth AVERAGE_CHAIN_LEN. Buckets start at
+     the next power of two and are doubled incrementally as the cache fills up */
+  p_qq_size = config.print_cache_entries*PRINT_CACHE_CHUNKS_MAX;
+  P_cache_gen_alloc();
 
-  cache = (struct chained_cache *) pm_malloc(config.print_cache_entries*dbc_size);
-  queries_queue = (struct chained_cache **) pm_malloc((sa.num+config.print_cache_entries)*sizeof(struct chained_cache *));
-  pending_queries_queue = (struct chained_cache **) pm_malloc((sa.num+config.print_cache_entries)*sizeof(struct chained_cache *));
-  sa.base = (unsigned char *) pm_malloc(sa.size);
-  sa.ptr = sa.base;
-  sa.next = NULL;
+  Log(LOG_INFO, "INFO ( %s/%s ): cache entries=%d buckets=%u base cache memory=%" PRIu64 " bytes\n", config.name, config.type,
+	config.print_cache_entries, cache_tbl.size, ((cache_tbl.size * sizeof(struct chained_cache *)) +
+	(2 * (p_qq_size * sizeof(struct chained_cache *))) + sa.size));
+
+  pending_queries_queue = (struct chained_cache **) pm_malloc(p_qq_size*sizeof(struct chained_cache *));
+  memset(pending_queries_queue, 0, p_qq_size*sizeof(struct chained_cache *));
+  memset(&p_gen_spare, 0, sizeof(p_gen_spare));
+  memset(&p_gen_writing, 0, sizeof(p_gen_writing));
+  p_writer_state = P_WRITER_IDLE;
 
-  memset(cache, 0, config.print_cache_entries*sizeof(struct chained_cache));
-  memset(queries_queue, 0, (sa.num+config.print_cache_entries)*sizeof(struct chained_cache *));
-  memset(pending_queries_queue, 0, (sa.num+config.print_cache_entries)*sizeof(struct chained_cache *));
-  memset(sa.base, 0, sa.size);
   memset(&flushtime, 0, sizeof(flushtime));
   memset(empty_mem_area_256b, 0, sizeof(empty_mem_area_256b));
 
@@ -138,7 +285,7 @@ exit_lane:
   exit_gracefully(1);
 }
 
-unsigned int P_cache_modulo(struct primitives_ptrs *prim_ptrs)
+u_int64_t P_cache_hash(struct primitives_ptrs *prim_ptrs)
 {
   struct pkt_data *pdata = prim_ptrs->data;
   struct pkt_primitives *srcdst = &pdata->primitives;
@@ -148,83 +295,264 @@ unsigned int P_cache_modulo(struct primitives_ptrs *prim_ptrs)
   struct pkt_tunnel_primitives *ptun = prim_ptrs->ptun;
   u_char *pcust = prim_ptrs->pcust;
   struct pkt_vlen_hdr_primitives *pvlen = prim_ptrs->pvlen;
-  register unsigned int modulo;
-
-  modulo = cache_crc32((unsigned char *)srcdst, pp_size);
-  if (pbgp) modulo ^= cache_crc32((unsigned char *)pbgp, pb_size);
-  if (pnat) modulo ^= cache_crc32((unsigned char *)pnat, pn_size);
-  if (pmpls) modulo ^= cache_crc32((unsigned char *)pmpls, pm_size);
-  if (ptun) modulo ^= cache_crc32((unsigned char *)ptun, pt_size);
-  if (pcust) modulo ^= cache_crc32((unsigned char *)pcust, pc_size);
-  if (pvlen) modulo ^= cache_crc32((unsigned char *)pvlen, (PvhdrSz + pvlen->tot_len));
+  u_char key[sizeof(struct pkt_primitives)];
+  u_int16_t key_len;
+  u_int64_t hash;
+
+  key_len = P_key_pack(&p_key, srcdst, key);
+  hash = hash_mem64(key, key_len, 0);
+  if (pbgp) hash = hash_mem64(pbgp, pb_size, hash);
+  if (pnat) hash = hash_mem64(pnat, pn_size, hash);
+  if (pmpls) hash = hash_mem64(pmpls, pm_size, hash);
+  if (ptun) hash = hash_mem64(ptun, pt_size, hash);
+  if (pcust) hash = hash_mem64(pcust, pc_size, hash);
+  if (pvlen) hash = hash_mem64(pvlen, (PvhdrSz + pvlen->tot_len), hash);
+
+  return hash;
+}
 
-  return modulo %= config.print_cache_entries;
+static void P_key_add(struct p_key_layout *layout, size_t off, size_t len)
+{
+  if (layout->num < P_KEY_MAX_RANGES) {
+    layout->range[layout->num].off = off;
+    layout->range[layout->num].len = len;
+    layout->num++;
+  }
 }
 
-struct chained_cache *P_cache_search(struct primitives_ptrs *prim_ptrs)
+#define P_KEY_ADD(layout, field) P_key_add(layout, offsetof(struct pkt_primitives, field), \
+					sizeof(((struct pkt_primitives *) 0)->field))
+
+/* Only primitives selected by the aggregation method end up being output,
+   hence only those take part in hashing and comparing cache entries; the
+   mapping follows mask_elem() in server.c. Ranges close to each other are
+   coalesced: bridging a few unused (zeroed) bytes costs less than an extra
+   memcmp(). If the layout can't be built the whole structure is used. */
+void P_key_layout_init(struct p_key_layout *layout, pm_cfgreg_t w, pm_cfgreg_t w2)
 {
-  struct pkt_data *pdata = prim_ptrs->data;
-  struct pkt_primitives *data = &pdata->primitives;
-  struct pkt_bgp_primitives *pbgp = prim_ptrs->pbgp;
-  struct pkt_nat_primitives *pnat = prim_ptrs->pnat;
-  struct pkt_mpls_primitives *pmpls = prim_ptrs->pmpls;
-  struct pkt_tunnel_primitives *ptun = prim_ptrs->ptun;
-  u_char *pcust = prim_ptrs->pcust;
-  struct pkt_vlen_hdr_primitives *pvlen = prim_ptrs->pvlen;
-  unsigned int modulo = P_cache_modulo(prim_ptrs);
-  struct chained_cache *cache_ptr = &cache[modulo];
-  int res_data = TRUE, res_bgp = TRUE, res_nat = TRUE, res_mpls = TRUE, res_tun = TRUE;
-  int res_time = TRUE, res_cust = TRUE, res_vlen = TRUE;
+  struct p_key_range tmp;
+  int idx, idx2, num;
 
-  start:
-  res_data = memcmp(&cache_ptr->primitives, data, sizeof(struct pkt_primitives));
+  memset(layout, 0, sizeof(struct p_key_layout));
 
-  if (basetime_cmp) {
-    res_time = (*basetime_cmp)(&cache_ptr->basetime, &ibasetime);
+#if defined (HAVE_L2)
+  if (w & (COUNT_SRC_MAC|COUNT_SUM_MAC)) P_KEY_ADD(layout, eth_shost);
+  if (w & (COUNT_DST_MAC|COUNT_SUM_MAC)) P_KEY_ADD(layout, eth_dhost);
+  if (w & COUNT_VLAN) P_KEY_ADD(layout, vlan_id);
+  if (w & COUNT_COS) P_KEY_ADD(layout, cos);
+  if (w & COUNT_ETHERTYPE) P_KEY_ADD(layout, etype);
+#endif
+  if (w & (COUNT_SRC_HOST|COUNT_SUM_HOST|COUNT_SUM_NET)) P_KEY_ADD(layout, src_ip);
+  if (w & (COUNT_DST_HOST|COUNT_SUM_HOST|COUNT_SUM_NET)) P_KEY_ADD(layout, dst_ip);
+  if (w & (COUNT_SRC_NET|COUNT_SUM_NET)) P_KEY_ADD(layout, src_net);
+  if (w & (COUNT_DST_NET|COUNT_SUM_NET)) P_KEY_ADD(layout, dst_net);
+  if (w & (COUNT_SRC_NMASK|COUNT_SRC_NET|COUNT_SUM_NET)) P_KEY_ADD(layout, src_nmask);
+  if (w & (COUNT_DST_NMASK|COUNT_DST_NET|COUNT_SUM_NET)) P_KEY_ADD(layout, dst_nmask);
+  if (w & (COUNT_SRC_AS|COUNT_SUM_AS)) P_KEY_ADD(layout, src_as);
+  if (w & (COUNT_DST_AS|COUNT_SUM_AS)) P_KEY_ADD(layout, dst_as);
+  if (w & (COUNT_SRC_PORT|COUNT_SUM_PORT)) P_KEY_ADD(layout, src_port);
+  if (w & (COUNT_DST_PORT|COUNT_SUM_PORT)) P_KEY_ADD(layout, dst_port);
+  if (w & COUNT_IP_TOS) P_KEY_ADD(layout, tos);
+  if (w & COUNT_IP_PROTO) P_KEY_ADD(layout, proto);
+  if (w & COUNT_IN_IFACE) P_KEY_ADD(layout, ifindex_in);
+  if (w & COUNT_OUT_IFACE) P_KEY_ADD(layout, ifindex_out);
+#if defined (WITH_GEOIP) || defined (WITH_GEOIPV2)
+  if (w2 & COUNT_SRC_HOST_COUNTRY) P_KEY_ADD(layout, src_ip_country);
+  if (w2 & COUNT_DST_HOST_COUNTRY) P_KEY_ADD(layout, dst_ip_country);
+  if (w2 & COUNT_SRC_HOST_POCODE) P_KEY_ADD(layout, src_ip_pocode);
+  if (w2 & COUNT_DST_HOST_POCODE) P_KEY_ADD(layout, dst_ip_pocode);
+  if (w2 & COUNT_SRC_HOST_COORDS) {
+    P_KEY_ADD(layout, src_ip_lat);
+    P_KEY_ADD(layout, src_ip_lon);
   }
-  else res_time = FALSE;
-
-  if (pbgp) {
-    if (cache_ptr->pbgp) res_bgp = memcmp(cache_ptr->pbgp, pbgp, sizeof(struct pkt_bgp_primitives));
+  if (w2 & COUNT_DST_HOST_COORDS) {
+    P_KEY_ADD(layout, dst_ip_lat);
+    P_KEY_ADD(layout, dst_ip_lon);
   }
-  else res_bgp = FALSE;
+#endif
+#if defined (WITH_NDPI)
+  if (w2 & COUNT_NDPI_CLASS) P_KEY_ADD(layout, ndpi_class);
+#endif
+  if (w & COUNT_TAG) P_KEY_ADD(layout, tag);
+  if (w & COUNT_TAG2) P_KEY_ADD(layout, tag2);
+  if (w & COUNT_CLASS) P_KEY_ADD(layout, class);
+  if (w2 & COUNT_SAMPLING_RATE) P_KEY_ADD(layout, sampling_rate);
+  if (w2 & COUNT_SAMPLING_DIRECTION) P_KEY_ADD(layout, sampling_direction);
+  if (w2 & COUNT_EXPORT_PROTO_SEQNO) P_KEY_ADD(layout, export_proto_seqno);
+  if (w2 & COUNT_EXPORT_PROTO_VERSION) P_KEY_ADD(layout, export_proto_version);
+  if (w2 & COUNT_EXPORT_PROTO_SYSID) P_KEY_ADD(layout, export_proto_sysid);
+
+  if (layout->num == P_KEY_MAX_RANGES) {
+    layout->num = 1;
+    layout->range[0].off = 0;
+    layout->range[0].len = sizeof(struct pkt_primitives);
+  }
+
+  /* sort by offset (few elements, insertion sort) and coalesce */
+  for (idx = 1; idx < layout->num; idx++) {
+    tmp = layout->range[idx];
 
-  if (pnat) {
-    if (cache_ptr->pnat) res_nat = memcmp(cache_ptr->pnat, pnat, sizeof(struct pkt_nat_primitives));
+    for (idx2 = idx; idx2 > 0 && layout->range[idx2 - 1].off > tmp.off; idx2--)
+      layout->range[idx2] = layout->range[idx2 - 1];
+
+    layout->range[idx2] = tmp;
   }
-  else res_nat = FALSE;
 
-  if (pmpls) {
-    if (cache_ptr->pmpls) res_mpls = memcmp(cache_ptr->pmpls, pmpls, sizeof(struct pkt_mpls_primitives));
+  for (idx = 1, num = (layout->num ? 1 : 0); idx < layout->num; idx++) {
+    struct p_key_range *last = &layout->range[num - 1];
+
+    if (layout->range[idx].off <= (last->off + last->len + P_KEY_MAX_GAP)) {
+      last->len = MAX(last->off + last->len, layout->range[idx].off + layout->range[idx].len) - last->off;
+    }
+    else layout->range[num++] = layout->range[idx];
   }
-  else res_mpls = FALSE;
 
-  if (ptun) {
-    if (cache_ptr->ptun) res_tun = memcmp(cache_ptr->ptun, ptun, sizeof(struct pkt_tunnel_primitives));
+  layout->num = num;
+
+  for (idx = 0, layout->len = 0; idx < layout->num; idx++) layout->len += layout->range[idx].len;
+}
+
+/* gathers the aggregation key into buf, sized after struct pkt_primitives */
+u_int16_t P_key_pack(struct p_key_layout *layout, struct pkt_primitives *prim, u_char *buf)
+{
+  u_char *src = (u_char *) prim;
+  int idx;
+
+  for (idx = 0; idx < layout->num; idx++) {
+    memcpy(buf, (src + layout->range[idx].off), layout->range[idx].len);
+    buf += layout->range[idx].len;
   }
-  else res_tun = FALSE;
 
-  if (pcust) {
-    if (cache_ptr->pcust) res_cust = memcmp(cache_ptr->pcust, pcust, config.cpptrs.len);
+  return layout->len;
+}
+
+int P_key_cmp(struct p_key_layout *layout, struct pkt_primitives *a, struct pkt_primitives *b)
+{
+  int idx, ret;
+
+  for (idx = 0; idx < layout->num; idx++) {
+    ret = memcmp(((u_char *) a + layout->range[idx].off), ((u_char *) b + layout->range[idx].off), layout->range[idx].len);
+    if (ret) return ret;
   }
-  else res_cust = FALSE;
 
-  if (pvlen) {
-    if (cache_ptr->pvlen) res_vlen = vlen_prims_cmp(cache_ptr->pvlen, pvlen);
+  return FALSE;
+}
+
+/* returns the chain an entry with the given hash lives in: buckets of the
+   old table not yet migrated are still authoritative while rehashing */
+static struct chained_cache **P_cache_bucket(u_int64_t hash)
+{
+  u_int32_t idx;
+
+  if (cache_tbl.old_bucket) {
+    idx = (hash & (cache_tbl.old_size - 1));
+    if (idx >= cache_tbl.rehash_idx) return &cache_tbl.old_bucket[idx];
   }
-  else res_vlen = FALSE;
 
-  if (res_data || res_bgp || res_nat || res_mpls || res_tun || res_time || res_cust || res_vlen) {
-    if (cache_ptr->valid == PRINT_CACHE_INUSE) {
-      if (cache_ptr->next) {
-        cache_ptr = cache_ptr->next;
-        goto start;
-      }
+  return &cache_tbl.bucket[hash & (cache_tbl.size - 1)];
+}
+
+static void P_cache_rehash_step()
+{
+  struct chained_cache *elem, *next;
+  u_int32_t idx, steps;
+
+  for (steps = 0; steps < PRINT_CACHE_REHASH_STEP && cache_tbl.rehash_idx < cache_tbl.old_size; steps++) {
+    for (elem = cache_tbl.old_bucket[cache_tbl.rehash_idx]; elem; elem = next) {
+      next = elem->next;
+      idx = (elem->hash & (cache_tbl.size - 1));
+      elem->next = cache_tbl.bucket[idx];
+      cache_tbl.bucket[idx] = elem;
     }
+
+    cache_tbl.old_bucket[cache_tbl.rehash_idx] = NULL;
+    cache_tbl.rehash_idx++;
   }
-  else return cache_ptr; 
 
-  return NULL;
+  if (cache_tbl.rehash_idx == cache_tbl.old_size) {
+    free(cache_tbl.old_bucket);
+    cache_tbl.old_bucket = NULL;
+    cache_tbl.old_size = 0;
+    cache_tbl.rehash_idx = 0;
+  }
+}
+
+static void P_cache_grow()
+{
+  struct chained_cache **bucket;
+  u_int32_t size = (cache_tbl.size << 1);
+
+  bucket = (struct chained_cache **) malloc(size*sizeof(struct chained_cache *));
+  if (!bucket) {
+    Log(LOG_WARNING, "WARN ( %s/%s ): Unable to grow cache to %u buckets. Chains will get longer.\n", config.name, config.type, size);
+    return;
+  }
+
+  memset(bucket, 0, size*sizeof(struct chained_cache *));
+
+  cache_tbl.old_bucket = cache_tbl.bucket;
+  cache_tbl.old_size = cache_tbl.size;
+  cache_tbl.rehash_idx = 0;
+  cache_tbl.bucket = bucket;
+  cache_tbl.size = size;
+  cache_tbl.resizes++;
+}
+
+static void P_cache_link(struct chained_cache *elem)
+{
+  struct chained_cache **head = P_cache_bucket(elem->hash);
+
+  elem->next = (*head);
+  (*head) = elem;
+  cache_tbl.entries++;
+
+  if (!cache_tbl.old_bucket && cache_tbl.entries > (cache_tbl.size * PRINT_CACHE_MAX_LOAD)) P_cache_grow();
+}
+
+/* returns zero if the entry matches the primitives being accounted */
+static int P_cache_cmp(struct chained_cache *cache_ptr, struct primitives_ptrs *prim_ptrs)
+{
+  struct pkt_data *pdata = prim_ptrs->data;
+  struct pkt_bgp_primitives *pbgp = prim_ptrs->pbgp;
+  struct pkt_nat_primitives *pnat = prim_ptrs->pnat;
+  struct pkt_mpls_primitives *pmpls = prim_ptrs->pmpls;
+  struct pkt_tunnel_primitives *ptun = prim_ptrs->ptun;
+  u_char *pcust = prim_ptrs->pcust;
+  struct pkt_vlen_hdr_primitives *pvlen = prim_ptrs->pvlen;
+
+  if (P_key_cmp(&p_key, &cache_ptr->primitives, &pdata->primitives)) return TRUE;
+  if (basetime_cmp && (*basetime_cmp)(&cache_ptr->basetime, &ibasetime)) return TRUE;
+
+  if (pbgp && (!cache_ptr->pbgp || memcmp(cache_ptr->pbgp, pbgp, sizeof(struct pkt_bgp_primitives)))) return TRUE;
+  if (pnat && (!cache_ptr->pnat || memcmp(cache_ptr->pnat, pnat, sizeof(struct pkt_nat_primitives)))) return TRUE;
+  if (pmpls && (!cache_ptr->pmpls || memcmp(cache_ptr->pmpls, pmpls, sizeof(struct pkt_mpls_primitives)))) return TRUE;
+  if (ptun && (!cache_ptr->ptun || memcmp(cache_ptr->ptun, ptun, sizeof(struct pkt_tunnel_primitives)))) return TRUE;
+  if (pcust && (!cache_ptr->pcust || memcmp(cache_ptr->pcust, pcust, config.cpptrs.len))) return TRUE;
+  if (pvlen && (!cache_ptr->pvlen || vlen_prims_cmp(cache_ptr->pvlen, pvlen))) return TRUE;
+
+  return FALSE;
+}
+
+static struct chained_cache *P_cache_lookup(struct primitives_ptrs *prim_ptrs, u_int64_t hash)
+{
+  struct chained_cache *cache_ptr;
+  u_int32_t chain = 0;
+
+  for (cache_ptr = (*P_cache_bucket(hash)); cache_ptr; cache_ptr = cache_ptr->next) {
+    chain++;
+    if (cache_ptr->hash == hash && !P_cache_cmp(cache_ptr, prim_ptrs)) break;
+  }
+
+  cache_tbl.lookups++;
+  cache_tbl.walked += chain;
+  if (chain > cache_tbl.max_chain) cache_tbl.max_chain = chain;
+
+  return cache_ptr;
+}
+
+struct chained_cache *P_cache_search(struct primitives_ptrs *prim_ptrs)
+{
+  return P_cache_lookup(prim_ptrs, P_cache_hash(prim_ptrs));
 }
 
 void P_cache_insert(struct primitives_ptrs *prim_ptrs, struct insert_data *idata)
@@ -236,10 +564,9 @@ void P_cache_insert(struct primitives_ptrs *prim_ptrs, struct insert_data *idata
   struct pkt_tunnel_primitives *ptun = prim_ptrs->ptun;
   u_char *pcust = prim_ptrs->pcust;
   struct pkt_vlen_hdr_primitives *pvlen = prim_ptrs->pvlen;
-  unsigned int modulo = P_cache_modulo(prim_ptrs);
-  struct chained_cache *cache_ptr = &cache[modulo];
+  struct chained_cache *cache_ptr;
   struct pkt_primitives *srcdst = &data->primitives;
-  int res_data, res_bgp, res_nat, res_mpls, res_tun, res_time, res_cust, res_vlen;
+  u_int64_t hash;
 
   /* pro_rating vars */
   int time_delta = 0, time_total = 0;
@@ -299,66 +626,19 @@ void P_cache_insert(struct primitives_ptrs *prim_ptrs, struct insert_data *idata
     else memset(&data->cst, 0, CSSz);
   }
 
-  start:
-  res_data = res_bgp = res_nat = res_mpls = res_tun = res_time = res_cust = res_vlen = TRUE;
-
-  res_data = memcmp(&cache_ptr->primitives, srcdst, sizeof(struct pkt_primitives)); 
-
-  if (basetime_cmp) {
-    res_time = (*basetime_cmp)(&cache_ptr->basetime, &ibasetime);
-  }
-  else res_time = FALSE;
-
-  if (pbgp) {
-    if (cache_ptr->pbgp) res_bgp = memcmp(cache_ptr->pbgp, pbgp, sizeof(struct pkt_bgp_primitives));
-  }
-  else res_bgp = FALSE;
+  if (cache_tbl.old_bucket) P_cache_rehash_step();
 
-  if (pnat) {
-    if (cache_ptr->pnat) res_nat = memcmp(cache_ptr->pnat, pnat, sizeof(struct pkt_nat_primitives));
-  }
-  else res_nat = FALSE;
+  hash = P_cache_hash(prim_ptrs);
+  cache_ptr = P_cache_lookup(prim_ptrs, hash);
 
-  if (pmpls) {
-    if (cache_ptr->pmpls) res_mpls = memcmp(cache_ptr->pmpls, pmpls, sizeof(struct pkt_mpls_primitives));
-  }
-  else res_mpls = FALSE;
+  if (!cache_ptr) {
+    cache_ptr = P_cache_alloc_node();
+    if (!cache_ptr) goto safe_action;
 
-  if (ptun) {
-    if (cache_ptr->ptun) res_tun = memcmp(cache_ptr->ptun, ptun, sizeof(struct pkt_tunnel_primitives));
-  }
-  else res_tun = FALSE;
-
-  if (pcust) {
-    if (cache_ptr->pcust) res_cust = memcmp(cache_ptr->pcust, pcust, config.cpptrs.len); 
-  }
-  else res_cust = FALSE;
-
-  if (pvlen) {
-    if (cache_ptr->pvlen) res_vlen = vlen_prims_cmp(cache_ptr->pvlen, pvlen);
-  }
-  else res_vlen = FALSE;
-
-  if (res_data || res_bgp || res_nat || res_mpls || res_tun || res_time || res_cust || res_vlen) {
-    /* aliasing of entries */
-    if (cache_ptr->valid == PRINT_CACHE_INUSE) { 
-      if (cache_ptr->next) {
-	cache_ptr = cache_ptr->next;
-	goto start;
-      }
-      else {
-	cache_ptr = P_cache_attach_new_node(cache_ptr); 
-	if (!cache_ptr) goto safe_action;
-	else {
-	  queries_queue[qq_ptr] = cache_ptr;
-	  qq_ptr++;
-	}
-      }
-    }
-    else {
-      queries_queue[qq_ptr] = cache_ptr;
-      qq_ptr++;
-    }
+    cache_ptr->hash = hash;
+    P_cache_link(cache_ptr);
+    queries_queue[qq_ptr] = cache_ptr;
+    qq_ptr++;
 
     /* we add the new entry in the cache */
     memcpy(&cache_ptr->primitives, srcdst, sizeof(struct pkt_primitives));
@@ -531,6 +811,23 @@ void P_cache_insert(struct primitives_ptrs *prim_ptrs, struct insert_data *idata
     if (config.type_id == PLUGIN_ID_PRINT && config.sql_table && !config.print_output_file_append)
       Log(LOG_WARNING, "WARN ( %s/%s ): Make sure print_output_file_append is set to true.\n", config.name, config.type);
 
+    if (config.dump_writer_thread) {
+      P_cache_writer_wait();
+      if (qq_ptr) P_cache_mark_flush(queries_queue, qq_ptr, FALSE);
+      P_cache_gen_swap();
+
+      if (pqq_ptr) {
+	P_cache_insert_pending(pending_queries_queue, pqq_ptr, pqq_container);
+	pqq_ptr = 0;
+      }
+
+      P_cache_writer_start(TRUE);
+
+      /* try to insert again */
+      (*insert_func)(prim_ptrs, idata);
+      return;
+    }
+
     if (qq_ptr) P_cache_mark_flush(queries_queue, qq_ptr, FALSE);
 
     /* Writing out to replenish cache space */
@@ -568,44 +865,23 @@ void P_cache_insert(struct primitives_ptrs *prim_ptrs, struct insert_data *idata
 void P_cache_insert_pending(struct chained_cache *queue[], int index, struct chained_cache *container)
 {
   struct chained_cache *cache_ptr;
-  struct primitives_ptrs prim_ptrs;
-  struct pkt_data pdata;
-  unsigned int modulo, j;
+  unsigned int j;
 
   if (!index || !container) return;
 
+  /* queue[] points to container[] elements; the hash computed upon first
+     insertion is retained by the copy and is re-used to link entries back */
   for (j = 0; j < index; j++) {
-    memset(&prim_ptrs, 0, sizeof(prim_ptrs));
-    prim_ptrs.data = &pdata;
-    primptrs_set_all_from_chained_cache(&prim_ptrs, queue[j]);
-
-    modulo = P_cache_modulo(&prim_ptrs);
-    cache_ptr = &cache[modulo];
-
-    start:
-    if (cache_ptr->valid == PRINT_CACHE_INUSE) {
-      if (cache_ptr->next) {
-        cache_ptr = cache_ptr->next;
-        goto start;
-      }
-      else {
-        cache_ptr = P_cache_attach_new_node(cache_ptr);
-        if (!cache_ptr) {
-          Log(LOG_WARNING, "WARN ( %s/%s ): Finished cache entries. Pending entries will be lost.\n", config.name, config.type);
-          Log(LOG_WARNING, "WARN ( %s/%s ): You may want to set a larger print_cache_entries value.\n", config.name, config.type);
-          break;
-        }
-        else {
-          queries_queue[qq_ptr] = cache_ptr;
-          qq_ptr++;
-        }
-      }
-    }
-    else {
-      queries_queue[qq_ptr] = cache_ptr;
-      qq_ptr++;
+    cache_ptr = P_cache_alloc_node();
+    if (!cache_ptr) {
+      Log(LOG_WARNING, "WARN ( %s/%s ): Finished cache entries. Pending entries will be lost.\n", config.name, config.type);
+      Log(LOG_WARNING, "WARN ( %s/%s ): You may want to set a larger print_cache_entries value.\n", config.name, config.type);
+      break;
     }
 
+    queries_queue[qq_ptr] = cache_ptr;
+    qq_ptr++;
+
     if (cache_ptr->pbgp) free(cache_ptr->pbgp);
     if (cache_ptr->pnat) free(cache_ptr->pnat);
     if (cache_ptr->pmpls) free(cache_ptr->pmpls);
@@ -625,7 +901,7 @@ void P_cache_insert_pending(struct chained_cache *queue[], int index, struct cha
     container[j].stitch = NULL;
 
     cache_ptr->valid = PRINT_CACHE_INUSE;
-    cache_ptr->next = NULL;
+    P_cache_link(cache_ptr);
   }
 
   free(container);
@@ -635,6 +911,23 @@ void P_cache_handle_flush_event(struct ports_table *pt)
 {
   pid_t ret;
 
+  if (cache_tbl.lookups) {
+    Log(LOG_INFO, "INFO ( %s/%s ): cache entries=%u buckets=%u load_factor=%.2f avg_chain=%.2f max_chain=%u resizes=%u\n",
+	config.name, config.type, cache_tbl.entries, cache_tbl.size, ((float) cache_tbl.entries / cache_tbl.size),
+	((float) cache_tbl.walked / cache_tbl.lookups), cache_tbl.max_chain, cache_tbl.resizes);
+
+    cache_tbl.lookups = 0;
+    cache_tbl.walked = 0;
+    cache_tbl.max_chain = 0;
+  }
+
+  if (config.dump_writer_thread) {
+    P_cache_writer_wait();
+    if (qq_ptr) P_cache_mark_flush(queries_queue, qq_ptr, FALSE);
+    P_cache_gen_swap();
+    goto flushed;
+  }
+
   if (qq_ptr) P_cache_mark_flush(queries_queue, qq_ptr, FALSE);
 
   dump_writers_count();
@@ -658,6 +951,7 @@ void P_cache_handle_flush_event(struct ports_table *pt)
 
   P_cache_flush(queries_queue, qq_ptr);
 
+  flushed:
   gettimeofday(&flushtime, NULL);
   refresh_deadline += config.sql_refresh_time;
   qq_ptr = FALSE;
@@ -678,6 +972,8 @@ void P_cache_handle_flush_event(struct ports_table *pt)
     reload_logs();
     reload_log = FALSE;
   }
+
+  if (config.dump_writer_thread) P_cache_writer_start(FALSE);
 }
 
 void P_cache_mark_flush(struct chained_cache *queue[], int index, int exiting)
@@ -742,23 +1038,64 @@ void P_cache_flush(struct chained_cache *queue[], int index)
 {
   int j;
 
+  /* every linked entry is also queued: resetting the heads of the chains
+     they belong to empties the cache without walking all buckets */
   for (j = 0; j < index; j++) {
+    cache_tbl.bucket[queue[j]->hash & (cache_tbl.size - 1)] = NULL;
+    if (cache_tbl.old_bucket) cache_tbl.old_bucket[queue[j]->hash & (cache_tbl.old_size - 1)] = NULL;
+
     queue[j]->valid = PRINT_CACHE_FREE;
     queue[j]->next = NULL;
   }
 
+  if (cache_tbl.old_bucket) {
+    free(cache_tbl.old_bucket);
+    cache_tbl.old_bucket = NULL;
+    cache_tbl.old_size = 0;
+    cache_tbl.rehash_idx = 0;
+  }
+
+  cache_tbl.entries = 0;
+
   /* rewinding scratch area stuff */
   sa.ptr = sa.base;
+  sa_cur = &sa;
 }
 
-struct chained_cache *P_cache_attach_new_node(struct chained_cache *elem)
+struct chained_cache *P_cache_alloc_node()
 {
-  if ((sa.ptr + (2 * sizeof(struct chained_cache))) <= (sa.base + sa.size)) {
-    sa.ptr += sizeof(struct chained_cache);
-    elem->next = (struct chained_cache *) sa.ptr;
-    return (struct chained_cache *) sa.ptr;
+  struct scratch_area *chunk;
+  struct chained_cache *elem;
+
+  while ((sa_cur->ptr + dbc_size) > (sa_cur->base + sa_cur->size)) {
+    if (!sa_cur->next) {
+      if (sa_chunks >= PRINT_CACHE_CHUNKS_MAX) return NULL;
+
+      chunk = (struct scratch_area *) malloc(sizeof(struct scratch_area));
+      if (!chunk) return NULL;
+
+      memset(chunk, 0, sizeof(struct scratch_area));
+      chunk->num = sa.num;
+      chunk->size = sa.size;
+      chunk->base = (unsigned char *) malloc(chunk->size);
+      if (!chunk->base) {
+	free(chunk);
+	return NULL;
+      }
+
+      memset(chunk->base, 0, chunk->size);
+      sa_cur->next = chunk;
+      sa_chunks++;
+    }
+
+    sa_cur = sa_cur->next;
+    sa_cur->ptr = sa_cur->base;
   }
-  else return NULL;
+
+  elem = (struct chained_cache *) sa_cur->ptr;
+  sa_cur->ptr += dbc_size;
+
+  return elem;
 }
 
 void P_sum_host_insert(struct primitives_ptrs *prim_ptrs, struct insert_data *idata)
@@ -813,6 +1150,8 @@ void P_sum_mac_insert(struct primitives_ptrs *prim_ptrs, struct insert_data *ida
 
 void P_exit_now(int signum)
 {
+  if (config.dump_writer_thread) P_cache_writer_wait();
+
   if (qq_ptr) P_cache_mark_flush(queries_queue, qq_ptr, TRUE);
 
   dump_writers_count();
@@ -34,7 +34,17 @@
 #define DEFAULT_PLUGIN_COMMON_RECV_BUDGET 100
 
 #define AVERAGE_CHAIN_LEN 10
+#define PRINT_CACHE_CHUNKS_MAX (AVERAGE_CHAIN_LEN + 1) /* buckets used to embed an entry each */
 #define PRINT_CACHE_ENTRIES 16411
+#define PRINT_CACHE_MAX_LOAD 1		/* entries per bucket before growing */
+#define PRINT_CACHE_REHASH_STEP 8	/* old buckets migrated per insert */
+/* writer thread states */
+#define P_WRITER_IDLE		0
+#define P_WRITER_RUNNING	1
+#define P_WRITER_DONE		2
+
+#define P_KEY_MAX_RANGES 48
+#define P_KEY_MAX_GAP 8			/* bytes of unused primitives worth bridging */
 
 /* cache element states */
 #define PRINT_CACHE_FREE	0
@@ -74,10 +84,58 @@ struct chained_cache {
   u_int8_t prep_valid;
   struct timeval basetime;
   struct pkt_stitching *stitch;
+  u_int64_t hash;
   struct chained_cache *next;
 };
 #endif
 
+/* chained_cache hash table: power of two buckets, doubled by migrating
+   a few old buckets on each insert while lookups consult both tables */
+#ifndef STRUCT_CHAINED_CACHE_TABLE
+#define STRUCT_CHAINED_CACHE_TABLE
+struct chained_cache_table {
+  struct chained_cache **bucket;
+  struct chained_cache **old_bucket;
+  u_int32_t size;
+  u_int32_t old_size;
+  u_int32_t rehash_idx;
+  u_int32_t entries;
+  u_int32_t resizes;
+  u_int32_t max_chain;
+  u_int64_t lookups;
+  u_int64_t walked;
+};
+#endif
+
+/* a generation of the cache: what is swapped when purging via a thread */
+#ifndef STRUCT_P_CACHE_GEN
+#define STRUCT_P_CACHE_GEN
+struct p_cache_gen {
+  struct chained_cache_table tbl;
+  struct scratch_area sa;
+  struct scratch_area *sa_cur;
+  u_int32_t sa_chunks;
+  struct chained_cache **queue;
+  int qq_ptr;
+};
+#endif
+
+/* compact aggregation key: the areas of struct pkt_primitives selected by
+   the aggregation method, coalesced and sorted by offset */
+#ifndef STRUCT_P_KEY_LAYOUT
+#define STRUCT_P_KEY_LAYOUT
+struct p_key_range {
+  u_int16_t off;
+  u_int16_t len;
+};
+
+struct p_key_layout {
+  u_int16_t num;
+  u_int16_t len;
+  struct p_key_range range[P_KEY_MAX_RANGES];
+};
+#endif
+
 #ifndef P_TABLE_RR
 #define P_TABLE_RR
 struct p_table_rr {
@@ -92,8 +150,11 @@ struct p_table_rr {
 extern void P_set_signals();
 extern void P_init_default_values();
 extern void P_config_checks();
-extern struct chained_cache *P_cache_attach_new_node(struct chained_cache *);
-extern unsigned int P_cache_modulo(struct primitives_ptrs *);
+extern struct chained_cache *P_cache_alloc_node();
+extern u_int64_t P_cache_hash(struct primitives_ptrs *);
+extern void P_key_layout_init(struct p_key_layout *, pm_cfgreg_t, pm_cfgreg_t);
+extern u_int16_t P_key_pack(struct p_key_layout *, struct pkt_primitives *, u_char *);
+extern int P_key_cmp(struct p_key_layout *, struct pkt_primitives *, struct pkt_primitives *);
 extern void P_sum_host_insert(struct primitives_ptrs *, struct insert_data *);
 extern void P_sum_port_insert(struct primitives_ptrs *, struct insert_data *);
 extern void P_sum_as_insert(struct primitives_ptrs *, struct insert_data *);
@@ -106,6 +167,7 @@ extern void P_cache_insert_pending(struct chained_cache *[], int, struct chained
 extern void P_cache_mark_flush(struct chained_cache *[], int, int);
 extern void P_cache_flush(struct chained_cache *[], int);
 extern void P_cache_handle_flush_event(struct ports_table *);
+extern void P_cache_writer_wait();
 extern void P_exit_now(int);
 extern int P_trigger_exec(char *);
 extern void primptrs_set_all_from_chained_cache(struct primitives_ptrs *, struct chained_cache *);
@@ -121,7 +183,8 @@ extern void P_update_time_reference(struct insert_data *);
 extern void (*insert_func)(struct primitives_ptrs *, struct insert_data *); /* pointer to INSERT function */
 extern void (*purge_func)(struct chained_cache *[], int, int); /* pointer to purge function */ 
 extern struct scratch_area sa;
-extern struct chained_cache *cache;
+extern struct chained_cache_table cache_tbl;
+extern struct p_key_layout p_key;
 extern struct chained_cache **queries_queue, **pending_queries_queue, *pqq_container;
 extern struct timeval flushtime;
 extern int qq_ptr, pqq_ptr, pp_size, pb_size, pn_size, pm_size, pt_size, pc_size;
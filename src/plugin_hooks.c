@@ -32,17 +32,14 @@
 /* load_plugins() starts plugin processes; creates pipes
    and handles them inserting in channels_list structure */
 
-/* no AMQP: when not using map_shared, 'pipe_size' is the size of the pipe
-   created with socketpair(); when map_shared is enabled, it refers to the
-   size of the shared memory area */
+/* 'pipe_size' is the size of the shared memory ring between the Core Process
+   and a plugin, 'buffer_size' the size of each of the ring slots */
 void load_plugins(struct plugin_requests *req)
 {
-  u_int64_t buf_pipe_ratio_sz = 0, pipe_idx = 0;
-  int snd_buflen = 0, rcv_buflen = 0, socklen = 0, target_buflen = 0;
+  u_int64_t pipe_idx = 0;
 
   int nfprobe_id = 0, min_sz = 0, extra_sz = 0, offset = 0;
   struct plugins_list_entry *list = plugins_list;
-  socklen_t l = sizeof(list->cfg.pipe_size);
   struct channels_list_entry *chptr = NULL;
 
  
@@ -115,52 +112,17 @@ void load_plugins(struct plugin_requests *req)
 #endif
 
       if (!list->cfg.pipe_zmq) {
-        /* creating communication channel */
-        socketpair(AF_UNIX, SOCK_DGRAM, 0, list->pipe);
-
-        /* checking SO_RCVBUF and SO_SNDBUF values; if different we take the smaller one */
-        getsockopt(list->pipe[0], SOL_SOCKET, SO_RCVBUF, &rcv_buflen, &l);
-        getsockopt(list->pipe[1], SOL_SOCKET, SO_SNDBUF, &snd_buflen, &l);
-        socklen = (rcv_buflen < snd_buflen) ? rcv_buflen : snd_buflen;
-
-        buf_pipe_ratio_sz = (list->cfg.pipe_size/list->cfg.buffer_size)*sizeof(char *);
-        if (buf_pipe_ratio_sz > INT_MAX) {
-	  Log(LOG_ERR, "ERROR ( %s/%s ): Current plugin_buffer_size elems per plugin_pipe_size: %llu. Max: %d.\nExiting.\n",
-		list->name, list->type.string, (unsigned long long)(list->cfg.pipe_size/list->cfg.buffer_size),
-		(INT_MAX/(int)sizeof(char *)));
-          exit_gracefully(1);
-        }
-        else target_buflen = buf_pipe_ratio_sz;
-
-        if (target_buflen > socklen) {
-	  Setsocksize(list->pipe[0], SOL_SOCKET, SO_RCVBUF, &target_buflen, l);
-	  Setsocksize(list->pipe[1], SOL_SOCKET, SO_SNDBUF, &target_buflen, l);
-        }
-
-        getsockopt(list->pipe[0], SOL_SOCKET, SO_RCVBUF, &rcv_buflen, &l);
-        getsockopt(list->pipe[1], SOL_SOCKET, SO_SNDBUF, &snd_buflen, &l);
-        if (rcv_buflen < snd_buflen) snd_buflen = rcv_buflen;
+	/* the ring needs room for at least a committed buffer plus the one being written */
+	if (list->cfg.pipe_size < (2 * list->cfg.buffer_size)) list->cfg.pipe_size = (2 * list->cfg.buffer_size);
 
-        if (snd_buflen < socklen) {
-	  Setsocksize(list->pipe[0], SOL_SOCKET, SO_RCVBUF, &socklen, l);
-	  Setsocksize(list->pipe[1], SOL_SOCKET, SO_SNDBUF, &socklen, l);
-
-          getsockopt(list->pipe[0], SOL_SOCKET, SO_RCVBUF, &rcv_buflen, &l);
-          getsockopt(list->pipe[1], SOL_SOCKET, SO_SNDBUF, &snd_buflen, &l);
-          if (rcv_buflen < snd_buflen) snd_buflen = rcv_buflen;
-        }
+        /* creating communication channel: buffers are exchanged via the ring in shared
+	   memory, the socket is only used to wake up a sleeping plugin */
+        socketpair(AF_UNIX, SOCK_DGRAM, 0, list->pipe);
 
         if (list->cfg.debug || (list->cfg.pipe_size > WARNING_PIPE_SIZE)) {
-	  Log(LOG_INFO, "INFO ( %s/%s ): plugin_pipe_size=%" PRIu64 " bytes plugin_buffer_size=%" PRIu64 " bytes\n", 
-		list->name, list->type.string, list->cfg.pipe_size, list->cfg.buffer_size);
-	  if (target_buflen <= snd_buflen) 
-            Log(LOG_INFO, "INFO ( %s/%s ): ctrl channel: obtained=%d bytes target=%d bytes\n",
-		list->name, list->type.string, snd_buflen, target_buflen);
-	  else
-	    /* This should return an error and exit but we fallback to a
-	       warning in order to be backward compatible */
-            Log(LOG_WARNING, "WARN ( %s/%s ): ctrl channel: obtained=%d bytes target=%d bytes\n",
-		list->name, list->type.string, snd_buflen, target_buflen);
+	  Log(LOG_INFO, "INFO ( %s/%s ): plugin_pipe_size=%" PRIu64 " bytes plugin_buffer_size=%" PRIu64 " bytes ring_slots=%" PRIu64 "\n", 
+		list->name, list->type.string, list->cfg.pipe_size, list->cfg.buffer_size,
+		(list->cfg.pipe_size / list->cfg.buffer_size));
         }
       }
       else {
@@ -178,9 +140,6 @@ void load_plugins(struct plugin_requests *req)
       }
       else chptr->plugin = list;
 
-      /* sets new value to be assigned to 'wakeup'; 'TRUE' disables on-request wakeup */ 
-      if (list->type.id == PLUGIN_ID_MEMORY) chptr->request = TRUE; 
-
       /* sets fixed/vlen offsets and cleaner routine; XXX: we should refine the cleaner
 	 part: 1) ie. extras assumes it's automagically piled with metadata; 2) what if
 	 multiple vlen components are stacked up? */
@@ -352,14 +311,14 @@ void exec_plugins(struct packet_ptrs *pptrs, struct plugin_requests *req)
 {
   int saved_have_tag = FALSE, saved_have_tag2 = FALSE, saved_have_label = FALSE;
   pm_id_t saved_tag = 0, saved_tag2 = 0;
-  pt_label_t *saved_label = malloc(sizeof(pt_label_t));
+  pt_label_t saved_label;
 
   int num, fixed_size;
   u_int32_t savedptr;
   char *bptr;
   int index, got_tags = FALSE;
 
-  pretag_init_label(saved_label);
+  pretag_init_label(&saved_label);
 
 #if defined WITH_GEOIPV2
   if (reload_geoipv2_file && config.geoipv2_file) {
@@ -389,7 +348,7 @@ void exec_plugins(struct packet_ptrs *pptrs, struct plugin_requests *req)
       if (p->cfg.ptm_global && got_tags) {
         pptrs->tag = saved_tag;
         pptrs->tag2 = saved_tag2;
-	pretag_copy_label(&pptrs->label, saved_label);
+	pptrs->label = saved_label; /* by reference, owned by saved_label */
 
         pptrs->have_tag = saved_have_tag;
         pptrs->have_tag2 = saved_have_tag2;
@@ -403,7 +362,7 @@ void exec_plugins(struct packet_ptrs *pptrs, struct plugin_requests *req)
 	  if (p->cfg.ptm_global) {
 	    saved_tag = pptrs->tag;
 	    saved_tag2 = pptrs->tag2;
-	    pretag_copy_label(saved_label, &pptrs->label);
+	    saved_label = pptrs->label; /* take ownership, see cleanup below */
 
 	    saved_have_tag = pptrs->have_tag;
 	    saved_have_tag2 = pptrs->have_tag2;
@@ -481,13 +440,11 @@ reprocess:
 	((struct ch_buf_hdr *)channels_list[index].rg.ptr)->seq = channels_list[index].hdr.seq;
 	((struct ch_buf_hdr *)channels_list[index].rg.ptr)->num = channels_list[index].hdr.num;
 
-	channels_list[index].status->last_buf_off = (u_int64_t)(channels_list[index].rg.ptr - channels_list[index].rg.base);
-
         if (config.debug_internal_msg) {
 	  struct plugins_list_entry *list = channels_list[index].plugin;
 	  Log(LOG_DEBUG, "DEBUG ( %s/%s ): buffer released len=%" PRIu64 " seq=%u num_entries=%u off=%" PRIu64 "\n",
 		list->name, list->type.string, channels_list[index].bufptr, channels_list[index].hdr.seq,
-		channels_list[index].hdr.num, channels_list[index].status->last_buf_off);
+		channels_list[index].hdr.num, (u_int64_t)(channels_list[index].rg.ptr - channels_list[index].rg.base));
 	}
 
 	/* sending buffer to connected ZMQ subscriber(s) */
@@ -498,21 +455,12 @@ reprocess:
 	  int ret = p_zmq_topic_send(&chptr->zmq_host, chptr->rg.ptr, chptr->bufsize);
           (void)ret; //Check error?
 #endif
-	}
-	else {
-	  if (channels_list[index].status->wakeup) {
-	    channels_list[index].status->wakeup = channels_list[index].request;
-	    if (write(channels_list[index].pipe, &channels_list[index].rg.ptr, CharPtrSz) != CharPtrSz) {
-	      struct plugins_list_entry *list = channels_list[index].plugin;
-	      Log(LOG_WARNING, "WARN ( %s/%s ): Failed during write: %s\n", list->name, list->type.string, strerror(errno));
-	    }
-	  }
-	}
-
-	channels_list[index].rg.ptr += channels_list[index].bufsize;
+	  channels_list[index].rg.ptr += channels_list[index].bufsize;
 
-	if ((channels_list[index].rg.ptr+channels_list[index].bufsize) > channels_list[index].rg.end)
-	  channels_list[index].rg.ptr = channels_list[index].rg.base;
+	  if ((channels_list[index].rg.ptr+channels_list[index].bufsize) > channels_list[index].rg.end)
+	    channels_list[index].rg.ptr = channels_list[index].rg.base;
+	}
+	else commit_pipe_buffer(&channels_list[index]);
 
 	/* let's protect the buffer we are going to write */
         ((struct ch_buf_hdr *)channels_list[index].rg.ptr)->seq = -1;
@@ -532,7 +480,10 @@ reprocess:
 
     pptrs->tag = 0;
     pptrs->tag2 = 0;
-    pretag_free_label(&pptrs->label);
+
+    /* labels shared from a global pre_tag_map are released once, at the end */
+    if (saved_label.val && pptrs->label.val == saved_label.val) pretag_init_label(&pptrs->label);
+    else pretag_free_label(&pptrs->label);
   }
 
   /* check if we have to reload the map: new loop is to
@@ -563,8 +514,7 @@ reprocess:
 
   /* cleanups */
   reload_map_exec_plugins = FALSE;
-  pretag_free_label(saved_label);
-  if (saved_label) free(saved_label);
+  pretag_free_label(&saved_label);
 }
 
 struct channels_list_entry *insert_pipe_channel(int plugin_type, struct configuration *cfg, int pipe)
@@ -617,6 +567,7 @@ struct channels_list_entry *insert_pipe_channel(int plugin_type, struct configur
         exit_gracefully(1);
       }
       memset(chptr->status, 0, sizeof(struct ch_status));
+      chptr->status->slots = (cfg->pipe_size / cfg->buffer_size);
 
       break;
     }
@@ -822,13 +773,99 @@ void fill_pipe_buffer()
       p_zmq_topic_send(&chptr->zmq_host, chptr->rg.ptr, chptr->bufsize);
 #endif
     }
-    else {
-      if (chptr->status->wakeup) {
-        chptr->status->wakeup = chptr->request;
-        if (write(chptr->pipe, &chptr->rg.ptr, CharPtrSz) != CharPtrSz)
-	  Log(LOG_WARNING, "WARN ( %s/%s ): Failed during write: %s\n", chptr->plugin->cfg.name, chptr->plugin->cfg.type, strerror(errno));
-      }
-    }
+    else commit_pipe_buffer(chptr);
+  }
+}
+
+/* commit_pipe_buffer(): Core Process side of the ring. The buffer rg.ptr
+   points to is published by advancing head and rg.ptr is moved onto the
+   next slot. Slots between tail and head belong to the plugin, which reads
+   them in place: if no free slot is left, the buffer just written is
+   discarded, its slot reused and the loss accounted for. The plugin is
+   woken up only if it went to sleep waiting for data. */
+void commit_pipe_buffer(struct channels_list_entry *chptr)
+{
+  struct ch_status *status = chptr->status;
+  u_int64_t head = status->head, tail;
+  char token = 0;
+
+  tail = __atomic_load_n(&status->tail, __ATOMIC_ACQUIRE);
+
+  if ((head + 1 - tail) >= status->slots) {
+    __atomic_store_n(&status->overwritten, (status->overwritten + 1), __ATOMIC_RELAXED);
+    return;
+  }
+
+  head++;
+  __atomic_store_n(&status->head, head, __ATOMIC_SEQ_CST);
+
+  if (__atomic_exchange_n(&status->wakeup, FALSE, __ATOMIC_SEQ_CST)) {
+    if (write(chptr->pipe, &token, sizeof(token)) != sizeof(token) && errno != EAGAIN)
+      Log(LOG_WARNING, "WARN ( %s/%s ): Failed during write: %s\n", chptr->plugin->cfg.name, chptr->plugin->cfg.type, strerror(errno));
+  }
+
+  chptr->rg.ptr = chptr->rg.base + ((head % status->slots) * chptr->bufsize);
+}
+
+/* get_pipe_buffer(): plugin side of the ring; returns the oldest committed
+   buffer, to be read in place, or NULL if the ring is empty. The slot is
+   given back to the Core Process via release_pipe_buffer() */
+unsigned char *get_pipe_buffer(struct channels_list_entry *chptr)
+{
+  struct ch_status *status = chptr->status;
+  u_int64_t tail = status->tail;
+
+  if (__atomic_load_n(&status->head, __ATOMIC_ACQUIRE) == tail) return NULL;
+
+  return (unsigned char *) (chptr->rg.base + ((tail % status->slots) * chptr->bufsize));
+}
+
+void release_pipe_buffer(struct channels_list_entry *chptr)
+{
+  __atomic_store_n(&chptr->status->tail, (chptr->status->tail + 1), __ATOMIC_RELEASE);
+}
+
+/* arm_pipe_wakeup(): to be called by the plugin before going to sleep; returns
+   FALSE if data was committed in the meanwhile, ie. it is not safe to sleep */
+int arm_pipe_wakeup(struct channels_list_entry *chptr)
+{
+  struct ch_status *status = chptr->status;
+
+  __atomic_store_n(&status->wakeup, TRUE, __ATOMIC_SEQ_CST);
+
+  if (__atomic_load_n(&status->head, __ATOMIC_SEQ_CST) != status->tail) {
+    __atomic_store_n(&status->wakeup, FALSE, __ATOMIC_RELAXED);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* drain_pipe_wakeup(): consumes pending wakeups; returns ERR if the write
+   end of the channel went away */
+int drain_pipe_wakeup(int pipe_fd)
+{
+  char tokens[SRVBUFLEN];
+  ssize_t ret;
+
+  while ((ret = read(pipe_fd, tokens, sizeof(tokens))) > 0);
+
+  if (!ret) return ERR;
+
+  return SUCCESS;
+}
+
+void check_pipe_lost_data(struct channels_list_entry *chptr)
+{
+  u_int64_t overwritten = __atomic_load_n(&chptr->status->overwritten, __ATOMIC_RELAXED);
+
+  if (overwritten != chptr->overwritten) {
+    Log(LOG_WARNING, "WARN ( %s/%s ): Missing data detected: %" PRIu64 " buffers lost, %" PRIu64 " in total (plugin_buffer_size=%" PRIu64 " plugin_pipe_size=%" PRIu64 ").\n",
+	config.name, config.type, (overwritten - chptr->overwritten), overwritten, config.buffer_size, config.pipe_size);
+    Log(LOG_WARNING, "WARN ( %s/%s ): Increase values or look for plugin_buffer_size, plugin_pipe_size in CONFIG-KEYS document.\n\n",
+	config.name, config.type);
+
+    chptr->overwritten = overwritten;
   }
 }
 
@@ -29,7 +29,6 @@
 #define WARNING_PIPE_SIZE 16384000 /* 16 Mb */
 #define MAX_FAILS 5 
 #define MAX_SEQNUM 65536 
-#define MAX_RG_COUNT_ERR 3 
 
 struct channels_list_entry;
 typedef void (*pkt_handler) (struct channels_list_entry *, struct packet_ptrs *, char **);
@@ -48,9 +47,14 @@ struct ch_buf_hdr {
   u_int32_t num;
 };
 
+/* shared between the Core Process (single producer) and the plugin (single
+   consumer); head is written by the Core Process only, tail by the plugin only */
 struct ch_status {
   u_int8_t wakeup;		/* plugin is polling */ 
-  u_int64_t last_buf_off;	/* offset of last committed buffer */
+  u_int64_t slots;		/* ring size, in buffers */
+  u_int64_t head;		/* buffers committed by the Core Process */
+  u_int64_t tail;		/* buffers released by the plugin */
+  u_int64_t overwritten;	/* buffers lost because of a full ring */
 };
 
 struct sampling {
@@ -96,7 +100,7 @@ struct channels_list_entry {
   struct ch_buf_hdr hdr;
   struct ch_status *status;
   ring_cleaner clean_func;
-  u_int8_t request;					/* does the plugin support on-request wakeup ? */
+  u_int64_t overwritten;				/* plugin side: lost buffers already reported */
   u_int8_t reprocess;					/* do we need to jump back for packet reprocessing ? */
   u_int8_t already_reprocessed;				/* loop avoidance for packet reprocessing */
   int datasize;
@@ -105,6 +109,7 @@ struct channels_list_entry {
   int buffer_immediate;
   int same_aggregate;
   pkt_handler phandler[N_PRIMITIVES];
+  u_int32_t tpl_dec_prims;				/* NetFlow/IPFIX: primitives served by the template decoder */
   int pipe;
   pid_t core_pid;
   pm_id_t tag;						/* post-tagging tag */
@@ -137,6 +142,12 @@ extern int evaluate_filters(struct aggregate_filter *, u_char *, struct pcap_pkt
 extern void recollect_pipe_memory(struct channels_list_entry *);
 extern void init_random_seed();
 extern void fill_pipe_buffer();
+extern void commit_pipe_buffer(struct channels_list_entry *);
+extern unsigned char *get_pipe_buffer(struct channels_list_entry *);
+extern void release_pipe_buffer(struct channels_list_entry *);
+extern int arm_pipe_wakeup(struct channels_list_entry *);
+extern int drain_pipe_wakeup(int);
+extern void check_pipe_lost_data(struct channels_list_entry *);
 extern int check_pipe_buffer_space(struct channels_list_entry *, struct pkt_vlen_hdr_primitives *, int); 
 extern void return_pipe_buffer_space(struct channels_list_entry *, int);
 extern int check_shadow_status(struct packet_ptrs *, struct channels_list_entry *);
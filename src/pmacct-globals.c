@@ -31,7 +31,7 @@ int reload_map_bmp_thread, reload_log_bmp_thread;
 int reload_map_rpki_thread, reload_log_rpki_thread;
 int reload_map_telemetry_thread, reload_log_telemetry_thread;
 int reload_map_pmacctd;
-int print_stats;
+int print_stats, print_stats_bgp_thread;
 int reload_log_sf_cnt;
 int data_plugins, tee_plugins;
 int collector_port;
@@ -41,6 +41,9 @@ int debug;
 struct configuration config; /* global configuration structure */
 struct plugins_list_entry *plugins_list; /* linked list of each plugin configuration */
 pid_t failed_plugins[MAX_N_PLUGINS]; /* plugins failed during startup phase */
+pid_t core_workers[MAX_NFACCTD_WORKERS]; /* core worker processes (nfacctd_workers) */
+pid_t core_workers_supervisor;
+int core_workers_num, core_worker_id;
 u_char dummy_tlhdr[16], empty_mem_area_256b[SRVBUFLEN];
 struct pm_pcap_device device;
 struct pm_pcap_devices devices, bkp_devices;
@@ -61,6 +61,7 @@
 #include <sys/stat.h>
 #include <sys/select.h>
 #include <signal.h>
+#include <pthread.h>
 #include <syslog.h>
 #include <sys/resource.h>
 #include <dirent.h>
@@ -255,6 +256,7 @@ typedef struct {
 #include "log.h"
 #include "once.h"
 #include "mpls.h"
+#include "lpm_trie.h"
 
 /*
  * htonvl(): host to network (byte ordering) variable length
@@ -264,6 +266,9 @@ typedef struct {
 #define ntohvl(x) pm_ntohll(x)
 #define CACHE_THRESHOLD UINT64T_THRESHOLD
 
+#define MAX_NFACCTD_WORKERS 64
+#define CORE_WORKERS_RESPAWN_INTERVAL 1
+
 /* structures */
 struct pm_pcap_interface {
   u_int32_t ifindex;
@@ -286,6 +291,7 @@ struct pm_pcap_device {
   int fd;
   struct _devices_struct *data; 
   struct pm_pcap_interface *pcap_if;
+  struct pm_afpacket *afpacket; /* native AF_PACKET capture, in place of dev_desc */
 };
 
 struct pm_pcap_devices {
@@ -376,6 +382,7 @@ extern int pm_pcap_device_getindex_byifname(struct pm_pcap_devices *, char *);
 extern pcap_t *pm_pcap_open(const char *, int, int, int, int, int, char *);
 extern void pm_pcap_add_filter(struct pm_pcap_device *);
 extern int pm_pcap_add_interface(struct pm_pcap_device *, char *, struct pm_pcap_interface *, int);
+extern void PM_workers_spawn();
 
 extern void null_handler(const struct pcap_pkthdr *, register struct packet_ptrs *);
 extern void eth_handler(const struct pcap_pkthdr *, register struct packet_ptrs *);
@@ -428,7 +435,7 @@ extern int reload_map_bmp_thread, reload_log_bmp_thread;
 extern int reload_map_rpki_thread, reload_log_rpki_thread;
 extern int reload_map_telemetry_thread, reload_log_telemetry_thread;
 extern int reload_map_pmacctd;
-extern int print_stats;
+extern int print_stats, print_stats_bgp_thread;
 extern int reload_log_sf_cnt;
 extern int data_plugins, tee_plugins;
 extern int collector_port;
@@ -438,6 +445,9 @@ extern int debug;
 extern struct configuration config; /* global configuration structure */
 extern struct plugins_list_entry *plugins_list; /* linked list of each plugin configuration */
 extern pid_t failed_plugins[MAX_N_PLUGINS]; /* plugins failed during startup phase */
+extern pid_t core_workers[]; /* core worker processes (nfacctd_workers) */
+extern pid_t core_workers_supervisor;
+extern int core_workers_num, core_worker_id;
 extern u_char dummy_tlhdr[16], empty_mem_area_256b[SRVBUFLEN];
 extern struct pm_pcap_device device;
 extern struct pm_pcap_devices devices, bkp_devices;
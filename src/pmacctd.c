@@ -39,6 +39,8 @@
 #include "ndpi/ndpi_util.h"
 #endif
 #include "jhash.h"
+#include "nfacctd.h"
+#include "afpacket.h"
 
 /* Functions */
 void usage_daemon(char *prog_name)
@@ -183,7 +185,20 @@ int pm_pcap_add_interface(struct pm_pcap_device *dev_ptr, char *ifname, struct p
 
   throttle_startup:
   if (attempts < PCAP_MAX_ATTEMPTS) {
-    if ((dev_ptr->dev_desc = pm_pcap_open(ifname, psize, config.promisc, 1000, config.pcap_protocol, direction, errbuf)) == NULL) {
+    if (config.pmacctd_afpacket) {
+      if (PM_afpacket_open(dev_ptr, ifname, psize, config.promisc, config.pcap_protocol, direction, errbuf) == ERR) {
+	if (!config.pcap_if_wait) {
+	  Log(LOG_ERR, "ERROR ( %s/core ): [%s] PM_afpacket_open(): %s. Exiting.\n", config.name, ifname, errbuf);
+	  exit_gracefully(1);
+	}
+	else {
+	  sleep(PCAP_RETRY_PERIOD);
+	  attempts++;
+	  goto throttle_startup;
+	}
+      }
+    }
+    else if ((dev_ptr->dev_desc = pm_pcap_open(ifname, psize, config.promisc, 1000, config.pcap_protocol, direction, errbuf)) == NULL) {
       if (!config.pcap_if_wait) {
 	Log(LOG_ERR, "ERROR ( %s/core ): [%s] pm_pcap_open(): %s. Exiting.\n", config.name, ifname, errbuf);
 	exit_gracefully(1);
@@ -214,20 +229,20 @@ int pm_pcap_add_interface(struct pm_pcap_device *dev_ptr, char *ifname, struct p
     }
     else dev_ptr->id = 0;
 
-    dev_ptr->fd = pcap_fileno(dev_ptr->dev_desc);
+    if (!dev_ptr->afpacket) dev_ptr->fd = pcap_fileno(dev_ptr->dev_desc);
 
     if (config.nfacctd_pipe_size) {
 #if defined (PCAP_TYPE_linux) || (PCAP_TYPE_snoop)
       socklen_t slen = sizeof(config.nfacctd_pipe_size);
       int x;
 
-      Setsocksize(pcap_fileno(dev_ptr->dev_desc), SOL_SOCKET, SO_RCVBUF, &config.nfacctd_pipe_size, slen);
-      getsockopt(pcap_fileno(dev_ptr->dev_desc), SOL_SOCKET, SO_RCVBUF, &x, &slen);
+      Setsocksize(dev_ptr->fd, SOL_SOCKET, SO_RCVBUF, &config.nfacctd_pipe_size, slen);
+      getsockopt(dev_ptr->fd, SOL_SOCKET, SO_RCVBUF, &x, &slen);
       Log(LOG_DEBUG, "DEBUG ( %s/core ): pmacctd_pipe_size: obtained=%d target=%d.\n", config.name, x, config.nfacctd_pipe_size);
 #endif
     }
 
-    dev_ptr->link_type = pcap_datalink(dev_ptr->dev_desc);
+    if (!dev_ptr->afpacket) dev_ptr->link_type = pcap_datalink(dev_ptr->dev_desc);
     for (index = 0; _devices[index].link_type != -1; index++) {
       if (dev_ptr->link_type == _devices[index].link_type)
         dev_ptr->data = &_devices[index];
@@ -860,6 +875,28 @@ int main(int argc,char **argv, char **envp)
     list = list->next;
   }
 
+  if (config.pmacctd_afpacket && (config.pcap_savefile || config.pcap_interfaces_map)) {
+    Log(LOG_ERR, "ERROR ( %s/core ): pmacctd_afpacket only applies to live capture off a single interface (-i). Exiting...\n\n", config.name);
+    exit_gracefully(1);
+  }
+
+  if (config.nfacctd_workers > 1) {
+    if (!config.pmacctd_afpacket) {
+      Log(LOG_ERR, "ERROR ( %s/core ): pmacctd_workers requires pmacctd_afpacket. Exiting...\n\n", config.name);
+      exit_gracefully(1);
+    }
+
+    /* BGP, BMP and IS-IS daemons are threads of the Core Process
+       and would not be inherited by forked workers */
+    if (config.bgp_daemon || config.bmp_daemon || config.nfacctd_isis) {
+      Log(LOG_ERR, "ERROR ( %s/core ): pmacctd_workers is mutual exclusive with bgp_daemon, bmp_daemon and isis_daemon. Exiting...\n\n", config.name);
+      exit_gracefully(1);
+    }
+
+    /* each worker loads its own set of plugins */
+    core_workers_check_plugins("pmacctd_workers");
+  }
+
   /* plugins glue: creation (since 094) */
   if (config.classifiers_path) {
     init_classifiers(config.classifiers_path);
@@ -889,6 +926,7 @@ int main(int argc,char **argv, char **envp)
     list = list->next;
   }
 
+  if (config.nfacctd_workers > 1) PM_workers_spawn();
   load_plugins(&req);
 
   if (config.handle_fragments) init_ip_fragment_handler();
@@ -1143,8 +1181,9 @@ int main(int argc,char **argv, char **envp)
 
   /* plugins glue: creation (until 093) */
   evaluate_packet_handlers();
-  pm_setproctitle("%s [%s]", "Core Process", config.proc_name);
-  if (config.pidfile) write_pid_file(config.pidfile);
+  if (core_workers_num) pm_setproctitle("%s [%s] (worker #%d)", "Core Process", config.proc_name, core_worker_id);
+  else pm_setproctitle("%s [%s]", "Core Process", config.proc_name);
+  if (config.pidfile && !core_workers_num) write_pid_file(config.pidfile);
 
   /* signals to be handled only by the core process;
      we set proper handlers after plugin creation */
@@ -1204,8 +1243,14 @@ int main(int argc,char **argv, char **envp)
       }
 
       read_packet:
-      pcap_loop(devices.list[0].dev_desc, -1, pm_pcap_cb, (u_char *) &cb_data);
-      pcap_close(devices.list[0].dev_desc);
+      if (devices.list[0].afpacket) {
+	PM_afpacket_loop(&devices.list[0], &cb_data);
+	PM_afpacket_close(&devices.list[0]);
+      }
+      else {
+	pcap_loop(devices.list[0].dev_desc, -1, pm_pcap_cb, (u_char *) &cb_data);
+	pcap_close(devices.list[0].dev_desc);
+      }
 
       if (config.pcap_savefile) {
 	if (config.pcap_sf_replay < 0 ||
@@ -1320,3 +1365,13 @@ int main(int argc,char **argv, char **envp)
     }
   }
 }
+
+/* PM_workers_spawn(): splits the Core Process in 'pmacctd_workers' processes
+   before plugins are loaded, so that each gets its own set of plugins (and
+   hence core -> plugin rings), flow and fragment tables. Each worker then
+   opens its own AF_PACKET socket and joins the PACKET_FANOUT group keyed on
+   the pid of the supervisor, ie. the calling process (core_workers_spawn()) */
+void PM_workers_spawn()
+{
+  core_workers_spawn(config.nfacctd_workers);
+}
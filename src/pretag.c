@@ -33,6 +33,7 @@
 #include "bgp/bgp_xcs.h"
 #include "bgp/bgp_xcs-data.h"
 #include "crc32.h"
+#include "jhash.h"
 #include "pmacct-data.h"
 
 //Global variables
@@ -50,6 +51,10 @@ int sampling_map_caching;
 
 int (*find_id_func)(struct id_table *, struct packet_ptrs *, pm_id_t *, pm_id_t *);
 
+/* One per process, not thread-safe: the Core Process and each of its
+   workers, being forked, own their copy; labels are only set there */
+static struct pretag_label_arena pt_label_arena;
+
 /*
    XXX: load_id_file() interface cleanup pending:
    - if a table is tag-related then it is passed as argument t
@@ -127,6 +132,7 @@ void load_id_file(int acct_type, char *filename, struct id_table *t, struct plug
         if (config.maps_index && pretag_index_have_one(t)) {
 	  pretag_index_destroy(t);
 	}
+	pretag_cls_destroy(t);
 	for (index = 0; index < t->num; index++) {
 	  pcap_freecode(&t->e[index].key.filter);
 	  pretag_free_label(&t->e[index].label);
@@ -619,8 +625,16 @@ void load_id_file(int acct_type, char *filename, struct id_table *t, struct plug
 
       t->filename = filename;
 
-      /* pre_tag_map indexing here */
-      if (config.maps_index &&
+      /* compiling map into the classifier used by *_find_id() */
+      if (acct_type == ACCT_NF || acct_type == ACCT_SF || acct_type == ACCT_PM ||
+	  acct_type == MAP_BGP_PEER_AS_SRC || acct_type == MAP_BGP_TO_XFLOW_AGENT ||
+	  acct_type == MAP_BGP_SRC_LOCAL_PREF || acct_type == MAP_BGP_SRC_MED ||
+	  acct_type == MAP_FLOW_TO_RD || acct_type == MAP_SAMPLING) {
+	pretag_cls_build(t);
+      }
+
+      /* pre_tag_map indexing here, only if the map could not be compiled */
+      if (config.maps_index && !t->cls.num &&
 	  (acct_type == ACCT_NF || acct_type == ACCT_SF || acct_type == ACCT_PM ||
 	   acct_type == MAP_BGP_PEER_AS_SRC || acct_type == MAP_FLOW_TO_RD)) {
 	pt_bitmap_t idx_bmap;
@@ -757,11 +771,80 @@ int pretag_malloc_label(pt_label_t *label, int len)
   return SUCCESS;
 }
 
+static char *pretag_label_arena_alloc(u_int32_t len)
+{
+  struct pretag_label_arena *a = &pt_label_arena;
+  char *ptr;
+
+  if (!a->base) {
+    a->base = malloc(PRETAG_LABEL_ARENA_SZ);
+    if (a->base) a->size = PRETAG_LABEL_ARENA_SZ;
+  }
+
+  if (a->base && (a->size - a->used) >= len) {
+    ptr = (a->base + a->used);
+    a->used += len;
+    a->live++;
+
+    return ptr;
+  }
+
+  /* arena exhausted: fall back to the heap, the arena is grown on rewind */
+  a->overflows++;
+
+  return malloc(len);
+}
+
+static int pretag_label_arena_owns(char *ptr)
+{
+  struct pretag_label_arena *a = &pt_label_arena;
+
+  return (a->base && ptr >= a->base && ptr < (a->base + a->size));
+}
+
+static void pretag_label_arena_release(void)
+{
+  struct pretag_label_arena *a = &pt_label_arena;
+  char *new_base;
+
+  if (a->live) a->live--;
+  if (a->live) return;
+
+  a->used = 0;
+
+  if (a->overflows && a->size < PRETAG_LABEL_ARENA_MAX_SZ) {
+    new_base = realloc(a->base, (a->size * 2));
+    if (new_base) {
+      a->base = new_base;
+      a->size *= 2;
+    }
+  }
+
+  a->overflows = 0;
+}
+
+void pretag_label_arena_stats(u_int32_t *size, u_int32_t *live)
+{
+  if (size) (*size) = pt_label_arena.size;
+  if (live) (*live) = pt_label_arena.live;
+}
+
 int pretag_realloc_label(pt_label_t *label, int len)
 {
   if (!label) return ERR;
 
-  label->val = realloc(label->val, len);
+  if (label->val && pretag_label_arena_owns(label->val)) {
+    char *new_val = pretag_label_arena_alloc(len);
+
+    if (new_val) {
+      memcpy(new_val, label->val, MIN((label->len + 1), (u_int32_t) len));
+      pretag_label_arena_release();
+    }
+
+    label->val = new_val;
+  }
+  else label->val = realloc(label->val, len);
+
   if (!label->val) {
     Log(LOG_ERR, "ERROR ( %s/%s ): malloc() failed (pretag_realloc_label).\n", config.name, config.type);
     return ERR;
@@ -787,6 +870,7 @@ int pretag_copy_label(pt_label_t *dst, pt_label_t *src)
         return ERR;
       }
 
+      dst->len = src->len; /* length excludes the terminating null */
       strncpy(dst->val, src->val, src->len);
       dst->val[dst->len] = '\0';
     }
@@ -795,6 +879,34 @@ int pretag_copy_label(pt_label_t *dst, pt_label_t *src)
   return SUCCESS;
 }
 
+/* pretag_copy_label_arena(): same as pretag_copy_label() for labels that
+   only live for the time of a record (ie. pre_tag_map results): storage
+   is taken from the label arena instead of the heap */
+int pretag_copy_label_arena(pt_label_t *dst, pt_label_t *src)
+{
+  if (!src || !dst) return ERR;
+
+  if (dst->val) {
+    Log(LOG_WARNING, "WARN ( %s/%s ): pretag_copy_label_arena failed: dst->val not null\n", config.name, config.type);
+    return ERR;
+  }
+  else {
+    if (src->len) {
+      dst->val = pretag_label_arena_alloc(src->len + 1);
+      if (!dst->val) {
+        Log(LOG_ERR, "ERROR ( %s/%s ): malloc() failed (pretag_copy_label_arena).\n", config.name, config.type);
+        return ERR;
+      }
+
+      dst->len = src->len; /* length excludes the terminating null */
+      memcpy(dst->val, src->val, src->len);
+      dst->val[dst->len] = '\0';
+    }
+  }
+
+  return SUCCESS;
+}
+
 int pretag_move_label(pt_label_t *dst, pt_label_t *src)
 {
   if (!src || !dst) return ERR;
@@ -828,7 +940,9 @@ int pretag_append_label(pt_label_t *dst, pt_label_t *src)
   }
   else {
     if (src->len) {
-      pretag_realloc_label(dst, (dst->len + src->len + 1 /* sep */ + 1 /* null */));
+      int len = (dst->len + 1 /* sep */ + src->len);
+
+      pretag_realloc_label(dst, (len + 1 /* null */));
       if (!dst->val) {
         Log(LOG_ERR, "ERROR ( %s/%s ): malloc() failed (pretag_append_label).\n", config.name, config.type);
         return ERR;
@@ -836,6 +950,7 @@ int pretag_append_label(pt_label_t *dst, pt_label_t *src)
 
       strncat(dst->val, default_sep, 1);
       strncat(dst->val, src->val, src->len);
+      dst->len = len;
       dst->val[dst->len] = '\0';
     }
   }
@@ -846,7 +961,9 @@ int pretag_append_label(pt_label_t *dst, pt_label_t *src)
 void pretag_free_label(pt_label_t *label)
 {
   if (label && label->val) {
-    free(label->val); 
+    if (pretag_label_arena_owns(label->val)) pretag_label_arena_release();
+    else free(label->val); 
+
     label->val = NULL;
     label->len = 0;
   }
@@ -856,15 +973,15 @@ int pretag_entry_process(struct id_entry *e, struct packet_ptrs *pptrs, pm_id_t
 {
   int j = 0;
   pm_id_t id = 0, stop = 0, ret = 0;
-  pt_label_t *label_local = malloc(sizeof(pt_label_t));
+  pt_label_t label_local;
 
-  pretag_init_label(label_local);
+  pretag_init_label(&label_local);
 
   e->last_matched = FALSE;
 
   for (j = 0, stop = 0, ret = 0; ((!ret || ret > TRUE) && (*e->func[j])); j++) {
     if (e->func_type[j] == PRETAG_SET_LABEL) {
-      ret = (*e->func[j])(pptrs, label_local, e);
+      ret = (*e->func[j])(pptrs, &label_local, e);
     }
     else {
       ret = (*e->func[j])(pptrs, &id, e);
@@ -887,10 +1004,10 @@ int pretag_entry_process(struct id_entry *e, struct packet_ptrs *pptrs, pm_id_t
     } 
     else if (stop & PRETAG_MAP_RCODE_LABEL) {
       if (pptrs->label.len) {
-	pretag_append_label(&pptrs->label, label_local);
+	pretag_append_label(&pptrs->label, &label_local);
       }
       else {
-	pretag_copy_label(&pptrs->label, label_local);
+	pretag_move_label(&pptrs->label, &label_local);
       }
 
       pptrs->have_label = TRUE;
@@ -919,8 +1036,7 @@ int pretag_entry_process(struct id_entry *e, struct packet_ptrs *pptrs, pm_id_t
     }
   }
 
-  pretag_free_label(label_local);
-  if (label_local) free(label_local);
+  pretag_free_label(&label_local);
 
   return stop;
 }
@@ -1304,3 +1420,313 @@ int pretag_index_have_one(struct id_table *t)
 {
   return t->index[0].entries;
 }
+
+static void pretag_cls_key_mask(struct pretag_cls_key *key, struct pretag_cls_tuple *tuple)
+{
+  int idx;
+
+  if (tuple->family == AF_INET) key->agent[0] &= tuple->mask.mask.m4;
+  else {
+    u_int8_t *agent = (u_int8_t *) key->agent;
+
+    for (idx = 0; idx < 16; idx++) agent[idx] &= tuple->mask.mask.m6[idx];
+  }
+
+  if (!(tuple->fields & PRETAG_CLS_IN_IFACE)) key->input = 0;
+  if (!(tuple->fields & PRETAG_CLS_OUT_IFACE)) key->output = 0;
+}
+
+static u_int32_t pretag_cls_key_hash(struct pretag_cls_key *key)
+{
+  return jhash2((u_int32_t *) key, (sizeof(struct pretag_cls_key) / sizeof(u_int32_t)), 0);
+}
+
+/* which of the PRETAG_CLS_* fields entry 'e' can be looked up by */
+static u_int8_t pretag_cls_entry_fields(struct id_entry *e)
+{
+  u_int8_t fields = 0;
+  int j;
+
+  for (j = 0; e->func[j]; j++) {
+    /* negations and values not fitting NetFlow v5 / 2-bytes v9 fields, which
+       the NetFlow handlers compare truncated, are left to the handlers */
+    if (e->func_type[j] == PRETAG_IN_IFACE && !e->key.input.neg &&
+	(config.acct_type != ACCT_NF || e->key.input.n <= UINT16_MAX)) fields |= PRETAG_CLS_IN_IFACE;
+    else if (e->func_type[j] == PRETAG_OUT_IFACE && !e->key.output.neg &&
+	(config.acct_type != ACCT_NF || e->key.output.n <= UINT16_MAX)) fields |= PRETAG_CLS_OUT_IFACE;
+  }
+
+  return fields;
+}
+
+static struct pretag_cls_tuple *pretag_cls_get_tuple(struct id_table *t, struct id_entry *e, int *tuple_max)
+{
+  struct pretag_cls_tuple *tuple;
+  struct host_mask mask;
+  u_int8_t fields = pretag_cls_entry_fields(e);
+  u_int32_t idx;
+
+  /* pmacctd does not match on agent address */
+  memset(&mask, 0, sizeof(mask));
+  mask.family = e->key.agent_ip.a.family;
+  if (config.acct_type != ACCT_PM && e->key.agent_mask.family == mask.family) {
+    memcpy(&mask, &e->key.agent_mask, sizeof(struct host_mask));
+  }
+
+  for (idx = 0; idx < t->cls.num; idx++) {
+    tuple = &t->cls.tuple[idx];
+
+    if (tuple->family == mask.family && tuple->mask.len == mask.len && tuple->fields == fields) return tuple;
+  }
+
+  if (t->cls.num == (*tuple_max)) {
+    struct pretag_cls_tuple *new_tuple;
+
+    (*tuple_max) = ((*tuple_max) ? ((*tuple_max) * 2) : 8);
+    new_tuple = realloc(t->cls.tuple, ((*tuple_max) * sizeof(struct pretag_cls_tuple)));
+    if (!new_tuple) return NULL;
+
+    t->cls.tuple = new_tuple;
+  }
+
+  tuple = &t->cls.tuple[t->cls.num];
+  memset(tuple, 0, sizeof(struct pretag_cls_tuple));
+  tuple->family = mask.family;
+  tuple->fields = fields;
+  tuple->first = e->pos;
+  memcpy(&tuple->mask, &mask, sizeof(struct host_mask));
+  t->cls.num++;
+
+  return tuple;
+}
+
+static void pretag_cls_entry_key(struct id_entry *e, struct pretag_cls_tuple *tuple, struct pretag_cls_key *key)
+{
+  memset(key, 0, sizeof(struct pretag_cls_key));
+
+  if (e->key.agent_ip.a.family == AF_INET) memcpy(key->agent, &e->key.agent_ip.a.address.ipv4, 4);
+  else if (e->key.agent_ip.a.family == AF_INET6) memcpy(key->agent, &e->key.agent_ip.a.address.ipv6, 16);
+
+  key->input = e->key.input.n;
+  key->output = e->key.output.n;
+
+  pretag_cls_key_mask(key, tuple);
+}
+
+/*
+  Compiles the map into the classifier, see struct pretag_cls. Lookups
+  cost at most one hash probe per tuple, regardless of the number of
+  entries, and yield a superset of the entries that may match; these are
+  then processed in map order so that first match and JEQ semantics are
+  preserved. Tuples are created, hence sorted, in order of their first
+  entry.
+*/
+int pretag_cls_build(struct id_table *t)
+{
+  struct pretag_cls_tuple *tuple;
+  struct pretag_cls_node *node, **new_table;
+  struct pretag_cls_key key;
+  struct id_entry **new_entries;
+  u_int32_t *tuple_entries = NULL, idx, bucket;
+  int tuple_max = 0, x;
+
+  if (!t) return ERR;
+
+  pretag_cls_destroy(t);
+
+  /* first pass: tuples */
+  for (x = 0; x < t->num; x++) {
+    if (!pretag_cls_get_tuple(t, &t->e[x], &tuple_max)) goto malloc_failed;
+  }
+
+  if (t->cls.num) {
+    tuple_entries = calloc(t->cls.num, sizeof(u_int32_t));
+    t->cls.cursor = calloc(t->cls.num, sizeof(struct pretag_cls_cursor));
+    if (!tuple_entries || !t->cls.cursor) goto malloc_failed;
+  }
+
+  for (x = 0; x < t->num; x++) {
+    tuple = pretag_cls_get_tuple(t, &t->e[x], &tuple_max);
+    tuple_entries[tuple - t->cls.tuple]++;
+  }
+
+  for (idx = 0; idx < t->cls.num; idx++) {
+    tuple = &t->cls.tuple[idx];
+
+    for (tuple->buckets = 16; tuple->buckets < (tuple_entries[idx] * 2); tuple->buckets *= 2);
+    new_table = calloc(tuple->buckets, sizeof(struct pretag_cls_node *));
+    if (!new_table) goto malloc_failed;
+
+    tuple->table = new_table;
+  }
+
+  /* second pass: entries, in map order */
+  for (x = 0; x < t->num; x++) {
+    tuple = pretag_cls_get_tuple(t, &t->e[x], &tuple_max);
+    pretag_cls_entry_key(&t->e[x], tuple, &key);
+    bucket = (pretag_cls_key_hash(&key) & (tuple->buckets - 1));
+
+    for (node = tuple->table[bucket]; node; node = node->next) {
+      if (!memcmp(&node->key, &key, sizeof(struct pretag_cls_key))) break;
+    }
+
+    if (!node) {
+      node = calloc(1, sizeof(struct pretag_cls_node));
+      if (!node) goto malloc_failed;
+
+      memcpy(&node->key, &key, sizeof(struct pretag_cls_key));
+      node->next = tuple->table[bucket];
+      tuple->table[bucket] = node;
+    }
+
+    if (node->num == node->max) {
+      node->max = (node->max ? (node->max * 2) : 4);
+      new_entries = realloc(node->entries, (node->max * sizeof(struct id_entry *)));
+      if (!new_entries) goto malloc_failed;
+
+      node->entries = new_entries;
+    }
+
+    node->entries[node->num] = &t->e[x];
+    node->num++;
+  }
+
+  free(tuple_entries);
+
+  Log(LOG_INFO, "INFO ( %s/%s ): [%s] map compiled (%u entries, %u tuples).\n",
+	config.name, config.type, t->filename, t->num, t->cls.num);
+
+  return SUCCESS;
+
+  malloc_failed:
+  Log(LOG_WARNING, "WARN ( %s/%s ): [%s] malloc() failed while compiling map. Falling back to linear lookups.\n",
+	config.name, config.type, t->filename);
+  if (tuple_entries) free(tuple_entries);
+  pretag_cls_destroy(t);
+
+  return ERR;
+}
+
+void pretag_cls_destroy(struct id_table *t)
+{
+  struct pretag_cls_node *node, *next;
+  u_int32_t idx, bucket;
+
+  if (!t) return;
+
+  for (idx = 0; idx < t->cls.num; idx++) {
+    if (!t->cls.tuple[idx].table) continue;
+
+    for (bucket = 0; bucket < t->cls.tuple[idx].buckets; bucket++) {
+      for (node = t->cls.tuple[idx].table[bucket]; node; node = next) {
+	next = node->next;
+	if (node->entries) free(node->entries);
+	free(node);
+      }
+    }
+
+    free(t->cls.tuple[idx].table);
+  }
+
+  if (t->cls.tuple) free(t->cls.tuple);
+  if (t->cls.cursor) free(t->cls.cursor);
+  memset(&t->cls, 0, sizeof(struct pretag_cls));
+}
+
+static int pretag_cls_probe(struct pretag_cls_tuple *tuple, struct pretag_cls_key *flow_key, struct pretag_cls_cursor *cursor)
+{
+  struct pretag_cls_node *node;
+  struct pretag_cls_key key;
+
+  memcpy(&key, flow_key, sizeof(struct pretag_cls_key));
+  pretag_cls_key_mask(&key, tuple);
+
+  for (node = tuple->table[pretag_cls_key_hash(&key) & (tuple->buckets - 1)]; node; node = node->next) {
+    if (!memcmp(&node->key, &key, sizeof(struct pretag_cls_key))) {
+      cursor->entries = node->entries;
+      cursor->num = node->num;
+      cursor->cur = 0;
+
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+/*
+  Classifier equivalent of the linear map walk of the *_find_id() functions:
+  'sa' is the agent address, NULL if not to be matched against (pmacctd).
+  A tuple is probed only once the next candidate lies past its first entry,
+  so that lookups matching early in the map do not pay for all the tuples.
+*/
+pm_id_t pretag_cls_find_id(struct id_table *t, struct packet_ptrs *pptrs, struct sockaddr *sa, pm_id_t *tag, pm_id_t *tag2)
+{
+  struct pretag_cls_tuple *tuple;
+  struct pretag_cls_cursor *cursor, *next_cursor;
+  struct pretag_cls_key flow_key;
+  struct id_entry *e;
+  u_int32_t idx, num_cursors = 0, num_probed = 0;
+  u_int8_t family, flow_fields;
+  pm_id_t ret = 0, min_pos = 0;
+
+  memset(&flow_key, 0, sizeof(flow_key));
+  flow_fields = pretag_cls_fdata(pptrs, &flow_key.input, &flow_key.output);
+
+  if (sa) {
+    family = sa->sa_family;
+    if (family == AF_INET) memcpy(flow_key.agent, &((struct sockaddr_in *) sa)->sin_addr, 4);
+    else if (family == AF_INET6) memcpy(flow_key.agent, &((struct sockaddr_in6 *) sa)->sin6_addr, 16);
+  }
+  else family = AF_INET;
+
+  for (;;) {
+    next_cursor = NULL;
+
+    for (idx = 0; idx < num_cursors; idx++) {
+      cursor = &t->cls.cursor[idx];
+
+      while (cursor->cur < cursor->num && cursor->entries[cursor->cur]->pos < min_pos) cursor->cur++;
+      if (cursor->cur == cursor->num) continue;
+
+      if (!next_cursor || cursor->entries[cursor->cur]->pos < next_cursor->entries[next_cursor->cur]->pos) {
+	next_cursor = cursor;
+      }
+    }
+
+    /* probing the tuples that may yield an earlier candidate */
+    for (; num_probed < t->cls.num; num_probed++) {
+      tuple = &t->cls.tuple[num_probed];
+
+      if (next_cursor && tuple->first > next_cursor->entries[next_cursor->cur]->pos) break;
+      if (tuple->family != family || (tuple->fields & flow_fields) != tuple->fields) continue;
+
+      cursor = &t->cls.cursor[num_cursors];
+      if (!pretag_cls_probe(tuple, &flow_key, cursor)) continue;
+      num_cursors++;
+
+      while (cursor->cur < cursor->num && cursor->entries[cursor->cur]->pos < min_pos) cursor->cur++;
+      if (cursor->cur == cursor->num) continue;
+
+      if (!next_cursor || cursor->entries[cursor->cur]->pos < next_cursor->entries[next_cursor->cur]->pos) {
+	next_cursor = cursor;
+      }
+    }
+
+    if (!next_cursor) break;
+
+    e = next_cursor->entries[next_cursor->cur];
+    min_pos = (e->pos + 1);
+
+    if (sa && host_addr_mask_sa_cmp(&e->key.agent_ip.a, &e->key.agent_mask, sa)) continue;
+
+    ret = pretag_entry_process(e, pptrs, tag, tag2);
+
+    if (!ret || ret > TRUE) {
+      if (ret & PRETAG_MAP_RCODE_JEQ) min_pos = e->jeq.ptr->pos;
+      else break;
+    }
+  }
+
+  return ret;
+}
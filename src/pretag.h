@@ -27,6 +27,11 @@
 #define MAX_LABEL_LEN 32
 #define MAX_BITMAP_ENTRIES 64 /* pt_bitmap_t -> u_int64_t */
 #define MAX_PRETAG_MAP_ENTRIES 384 
+#define PRETAG_LABEL_ARENA_SZ 4096
+#define PRETAG_LABEL_ARENA_MAX_SZ 65536
+
+#define PRETAG_CLS_IN_IFACE		0x01
+#define PRETAG_CLS_OUT_IFACE		0x02
 
 #define MAX_ID_TABLE_INDEXES 8
 #define ID_TABLE_INDEX_DEPTH 8
@@ -230,6 +235,46 @@ struct id_table_index {
   struct id_index_entry *idx_t;
 };
 
+/*
+  Map classifier: entries are grouped in tuples sharing agent address family,
+  agent prefix length and the set of exact-match fields (PRETAG_CLS_*) they
+  can be hashed on; each tuple is a hash of keys to entries, in map order.
+*/
+struct pretag_cls_key {
+  u_int32_t agent[4];
+  u_int32_t input;
+  u_int32_t output;
+};
+
+struct pretag_cls_node {
+  struct pretag_cls_key key;
+  struct pretag_cls_node *next;
+  u_int32_t num;
+  u_int32_t max;
+  struct id_entry **entries;
+};
+
+struct pretag_cls_tuple {
+  u_int8_t family;
+  u_int8_t fields;
+  struct host_mask mask;
+  u_int32_t first; /* position of the first entry of the tuple */
+  u_int32_t buckets; /* power of 2 */
+  struct pretag_cls_node **table;
+};
+
+struct pretag_cls_cursor {
+  struct id_entry **entries;
+  u_int32_t num;
+  u_int32_t cur;
+};
+
+struct pretag_cls {
+  struct pretag_cls_tuple *tuple;
+  struct pretag_cls_cursor *cursor; /* lookup scratch space, one per tuple */
+  u_int32_t num;
+};
+
 struct id_table {
   char *filename;
   int type;
@@ -241,6 +286,7 @@ struct id_table {
   struct id_entry *e;
   struct id_table_index index[MAX_ID_TABLE_INDEXES];
   unsigned int index_num;
+  struct pretag_cls cls;
   time_t timestamp;
   u_int32_t flags;
 };
@@ -265,6 +311,17 @@ struct pretag_label_filter {
   ptlt_t table[MAX_PRETAG_MAP_ENTRIES/4];
 };
 
+/* per-record labels are carved out of this arena; it is rewound as soon
+   as the last outstanding label is released and, if it overflowed in
+   the meanwhile, grown so that the next rounds fit */
+struct pretag_label_arena {
+  char *base;
+  u_int32_t size;
+  u_int32_t used;
+  u_int32_t live;
+  u_int32_t overflows;
+};
+
 /* prototypes */
 extern void load_id_file(int, char *, struct id_table *, struct plugin_requests *, int *);
 extern void load_pre_tag_map(int, char *, struct id_table *, struct plugin_requests *, int *, int, int);
@@ -275,9 +332,11 @@ extern void pretag_init_label(pt_label_t *);
 extern int pretag_malloc_label(pt_label_t *, int);
 extern int pretag_realloc_label(pt_label_t *, int);
 extern int pretag_copy_label(pt_label_t *, pt_label_t *);
+extern int pretag_copy_label_arena(pt_label_t *, pt_label_t *);
 extern int pretag_move_label(pt_label_t *, pt_label_t *);
 extern int pretag_append_label(pt_label_t *, pt_label_t *);
 extern void pretag_free_label(pt_label_t *);
+extern void pretag_label_arena_stats(u_int32_t *, u_int32_t *);
 extern int pretag_entry_process(struct id_entry *, struct packet_ptrs *, pm_id_t *, pm_id_t *);
 extern pt_bitmap_t pretag_index_build_bitmap(struct id_entry *, int);
 extern int pretag_index_insert_bitmap(struct id_table *, pt_bitmap_t);
@@ -291,6 +350,9 @@ extern void pretag_index_results_sort(struct id_entry **, int);
 extern void pretag_index_results_compress(struct id_entry **, int);
 extern void pretag_index_results_compress_jeqs(struct id_entry **, int);
 extern int pretag_index_have_one(struct id_table *);
+extern int pretag_cls_build(struct id_table *);
+extern void pretag_cls_destroy(struct id_table *);
+extern pm_id_t pretag_cls_find_id(struct id_table *, struct packet_ptrs *, struct sockaddr *, pm_id_t *, pm_id_t *);
 
 extern int bpas_map_allocated;
 extern int blp_map_allocated;
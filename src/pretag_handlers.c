@@ -2314,7 +2314,7 @@ int pretag_label_handler(struct packet_ptrs *pptrs, void *id, void *e)
   pt_label_t *out_label = (pt_label_t *) id;
 
   if (out_label) {
-    pretag_copy_label(out_label, &entry->label);
+    pretag_copy_label_arena(out_label, &entry->label);
   }
 
   return PRETAG_MAP_RCODE_LABEL; /* cap */
@@ -3804,6 +3804,78 @@ int PT_map_index_fdata_fwdstatus_handler(struct id_entry *e, pm_hash_serial_t *h
   return FALSE;
 }
 
+static int pretag_cls_fdata_nf9_iface(struct packet_ptrs *pptrs, struct template_cache_entry *tpl,
+				      u_int16_t snmp_type, u_int16_t physint_type, u_int32_t *iface)
+{
+  u_int16_t iface16 = 0;
+  u_int32_t iface32 = 0;
+
+  if (tpl->tpl[snmp_type].len == 2) {
+    memcpy(&iface16, pptrs->f_data+tpl->tpl[snmp_type].off, 2);
+    *iface = ntohs(iface16);
+  }
+  else if (tpl->tpl[snmp_type].len == 4) {
+    memcpy(&iface32, pptrs->f_data+tpl->tpl[snmp_type].off, 4);
+    *iface = ntohl(iface32);
+  }
+  else if (tpl->tpl[physint_type].len == 4) {
+    memcpy(&iface32, pptrs->f_data+tpl->tpl[physint_type].off, 4);
+    *iface = ntohl(iface32);
+  }
+  else return FALSE;
+
+  return TRUE;
+}
+
+/*
+  Extracts the flow fields the map classifier hashes on, consistently with
+  the 'in' and 'out' match handlers; returns the PRETAG_CLS_* fields that
+  are available: map entries hashed on the others can not match.
+*/
+u_int8_t pretag_cls_fdata(struct packet_ptrs *pptrs, u_int32_t *input, u_int32_t *output)
+{
+  u_int8_t fields = 0;
+
+  if (config.acct_type == ACCT_NF) {
+    struct struct_header_v5 *hdr = (struct struct_header_v5 *) pptrs->f_header;
+    struct template_cache_entry *tpl = (struct template_cache_entry *) pptrs->f_tpl;
+
+    if (!pptrs->f_data || !hdr) return fields;
+
+    switch(hdr->version) {
+    case 10:
+    case 9:
+      if (!tpl) break;
+      if (pretag_cls_fdata_nf9_iface(pptrs, tpl, NF9_INPUT_SNMP, NF9_INPUT_PHYSINT, input)) fields |= PRETAG_CLS_IN_IFACE;
+      if (pretag_cls_fdata_nf9_iface(pptrs, tpl, NF9_OUTPUT_SNMP, NF9_OUTPUT_PHYSINT, output)) fields |= PRETAG_CLS_OUT_IFACE;
+      break;
+    case 5:
+      *input = ntohs(((struct struct_export_v5 *) pptrs->f_data)->input);
+      *output = ntohs(((struct struct_export_v5 *) pptrs->f_data)->output);
+      fields |= (PRETAG_CLS_IN_IFACE | PRETAG_CLS_OUT_IFACE);
+      break;
+    default:
+      break;
+    }
+  }
+  else if (config.acct_type == ACCT_SF) {
+    SFSample *sample = (SFSample *) pptrs->f_data;
+
+    if (!sample) return fields;
+
+    *input = sample->inputPort;
+    *output = sample->outputPort;
+    fields |= (PRETAG_CLS_IN_IFACE | PRETAG_CLS_OUT_IFACE);
+  }
+  else if (config.acct_type == ACCT_PM) {
+    *input = pptrs->ifindex_in;
+    *output = pptrs->ifindex_out;
+    fields |= (PRETAG_CLS_IN_IFACE | PRETAG_CLS_OUT_IFACE);
+  }
+
+  return fields;
+}
+
 void pm_pcap_interfaces_map_validate(char *filename, struct plugin_requests *req)
 {
   struct pm_pcap_interfaces *table = (struct pm_pcap_interfaces *) req->key_value_table;
@@ -100,6 +100,7 @@ extern int PT_map_index_fdata_dst_mac_handler(struct id_entry *, pm_hash_serial_
 extern int PT_map_index_fdata_vlan_id_handler(struct id_entry *, pm_hash_serial_t *, void *);
 extern int PT_map_index_fdata_cvlan_id_handler(struct id_entry *, pm_hash_serial_t *, void *);
 extern int PT_map_index_fdata_fwdstatus_handler(struct id_entry *, pm_hash_serial_t *, void *);
+extern u_int8_t pretag_cls_fdata(struct packet_ptrs *, u_int32_t *, u_int32_t *);
 
 /* BPAS_*: bgp_peer_as_src map specific handlers */
 extern int BPAS_map_bgp_nexthop_handler(char *, struct id_entry *, char *, struct plugin_requests *, int);
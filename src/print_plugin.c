@@ -50,21 +50,17 @@ void print_plugin(int pipe_fd, struct configuration *cfgptr, void *ptr)
 {
   struct pkt_data *data;
   struct ports_table pt;
-  unsigned char *pipebuf;
+  unsigned char *pipebuf = NULL;
   struct pollfd pfd;
   struct insert_data idata;
   int refresh_timeout, ret, num, recv_budget, poll_bypass;
-  struct ring *rg = &((struct channels_list_entry *)ptr)->rg;
-  struct ch_status *status = ((struct channels_list_entry *)ptr)->status;
+  struct channels_list_entry *chptr = (struct channels_list_entry *) ptr;
   int datasize = ((struct channels_list_entry *)ptr)->datasize;
-  u_int32_t bufsz = ((struct channels_list_entry *)ptr)->bufsize;
   pid_t core_pid = ((struct channels_list_entry *)ptr)->core_pid;
   struct networks_file_data nfd;
   char default_sep[] = ",", spacing_sep[2];
 
-  unsigned char *rgptr;
-  int pollagain = TRUE;
-  u_int32_t seq = 1, rg_err_count = 0;
+  u_int32_t seq = 1;
 
   struct extra_primitives extras;
   struct primitives_ptrs prim_ptrs;
@@ -88,8 +84,10 @@ void print_plugin(int pipe_fd, struct configuration *cfgptr, void *ptr)
   P_set_signals();
   P_init_default_values();
   P_config_checks();
-  pipebuf = (unsigned char *) pm_malloc(config.buffer_size);
-  memset(pipebuf, 0, config.buffer_size);
+  if (config.pipe_zmq) {
+    pipebuf = (unsigned char *) pm_malloc(config.buffer_size);
+    memset(pipebuf, 0, config.buffer_size);
+  }
 
   if (!config.print_output) config.print_output = PRINT_OUTPUT_FORMATTED;
 
@@ -212,14 +210,14 @@ void print_plugin(int pipe_fd, struct configuration *cfgptr, void *ptr)
   /* plugin main loop */
   for(;;) {
     poll_again:
-    status->wakeup = TRUE;
     poll_bypass = FALSE;
     calc_refresh_timeout(refresh_deadline, idata.now, &refresh_timeout);
     
     pfd.fd = pipe_fd;
     pfd.events = POLLIN;
 
-    ret = poll(&pfd, (pfd.fd == ERR ? 0 : 1), refresh_timeout);
+    if (config.pipe_homegrown && !arm_pipe_wakeup(chptr)) ret = TRUE; /* data is pending, do not sleep */
+    else ret = poll(&pfd, (pfd.fd == ERR ? 0 : 1), refresh_timeout);
 
     if (ret <= 0) {
       if (getppid() != core_pid) {
@@ -238,7 +236,7 @@ void print_plugin(int pipe_fd, struct configuration *cfgptr, void *ptr)
 
       saved_qq_ptr = qq_ptr;
       P_cache_handle_flush_event(&pt);
-      if (saved_qq_ptr) print_output_stdout_header = FALSE;
+      if (saved_qq_ptr && !config.dump_writer_thread) print_output_stdout_header = FALSE;
     }
 
     recv_budget = 0;
@@ -258,40 +256,16 @@ void print_plugin(int pipe_fd, struct configuration *cfgptr, void *ptr)
       }
 
       if (config.pipe_homegrown) {
-        if (!pollagain) {
-          seq++;
-          seq %= MAX_SEQNUM;
-          if (seq == 0) rg_err_count = FALSE;
-        }
-        else {
-          if ((ret = read(pipe_fd, &rgptr, sizeof(rgptr))) == 0) 
+	if (!recv_budget) {
+	  if (drain_pipe_wakeup(pipe_fd) == ERR)
 	    exit_gracefully(1); /* we exit silently; something happened at the write end */
-        }
-
-        if ((rg->ptr + bufsz) > rg->end) rg->ptr = rg->base;
-
-	if (((struct ch_buf_hdr *)rg->ptr)->seq != seq) {
-	  if (!pollagain) {
-	    pollagain = TRUE;
-	    goto poll_again;
-	  }
-          else {
-            rg_err_count++;
-            if (config.debug || (rg_err_count > MAX_RG_COUNT_ERR)) {
-              Log(LOG_WARNING, "WARN ( %s/%s ): Missing data detected (plugin_buffer_size=%" PRIu64 " plugin_pipe_size=%" PRIu64 ").\n",
-                        config.name, config.type, config.buffer_size, config.pipe_size);
-              Log(LOG_WARNING, "WARN ( %s/%s ): Increase values or look for plugin_buffer_size, plugin_pipe_size in CONFIG-KEYS document.\n\n",
-                        config.name, config.type);
-            }
 
-	    rg->ptr = (rg->base + status->last_buf_off);
-            seq = ((struct ch_buf_hdr *)rg->ptr)->seq;
-          }
-        }
+	  check_pipe_lost_data(chptr);
+	}
 
-        pollagain = FALSE;
-        memcpy(pipebuf, rg->ptr, bufsz);
-        rg->ptr += bufsz;
+	/* buffers are read in place and released to the Core Process once processed */
+	if (!(pipebuf = get_pipe_buffer(chptr))) goto poll_again;
+	seq = ((struct ch_buf_hdr *)pipebuf)->seq;
       }
 #ifdef WITH_ZMQ
       else if (config.pipe_zmq) {
@@ -339,6 +313,7 @@ void print_plugin(int pipe_fd, struct configuration *cfgptr, void *ptr)
 	}
       }
 
+      if (config.pipe_homegrown) release_pipe_buffer(chptr);
       recv_budget++;
       goto read_data;
     }
@@ -534,6 +509,9 @@ void P_cache_purge(struct chained_cache *queue[], int index, int safe_action)
         P_write_stats_header_formatted(stdout, is_event);
       else if (config.print_output & PRINT_OUTPUT_CSV)
         P_write_stats_header_csv(stdout, is_event);
+
+      /* writer thread: no one else is going to clear it */
+      if (config.dump_writer_thread) print_output_stdout_header = FALSE;
     }
   }
 
@@ -1357,6 +1335,7 @@ void P_cache_purge(struct chained_cache *queue[], int index, int safe_action)
   if (config.sql_trigger_exec && !safe_action) P_trigger_exec(config.sql_trigger_exec); 
 
   if (empty_pcust) free(empty_pcust);
+  if (fd_buf) free(fd_buf);
 }
 
 void P_write_stats_header_formatted(FILE *f, int is_event)
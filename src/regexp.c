@@ -27,6 +27,9 @@
  * (it now uses kmalloc etc..)
  * 
  * Modified slightly by Matthew Strait to use more modern C.
+ *
+ * pm_regliterals() and pm_regfirst() added to export to the pmacct
+ * classifier the literals and first characters a match requires.
  */
 
 #include "pmacct.h"
@@ -179,6 +182,10 @@ STATIC void regc(char b);
 STATIC void reginsert(char op, char *opnd);
 STATIC void regtail(char *p, char *val);
 STATIC void regoptail(char *p, char *val);
+STATIC char *regchoiceend(char *p);
+STATIC int reglit_seq(char *scan, char *stop, char lits[][PM_REGLIT_LEN+1], int depth);
+STATIC int reglit_choice(char *scan, char lits[][PM_REGLIT_LEN+1], int depth);
+STATIC int regfirst_seq(char *scan, char *stop, unsigned char *set, int depth);
 
 
 size_t my_strcspn(const char *s1,const char *s2)
@@ -1057,6 +1064,219 @@ regnext(char *p)
 		return(p+offset);
 }
 
+/*
+ * Requirement analysis, for prefiltering: walks the program the same way
+ * regmatch() does, but without input, to find out what any match needs.
+ */
+#define	REGREQ_DEPTH	16	/* Give up past this nesting of choices. */
+#define	REGSET(set, c)	((set)[UCHARAT(&(c)) >> 3] |= (1 << (UCHARAT(&(c)) & 7)))
+
+/*
+ - regchoiceend - find the node following a set of BRANCHes
+ */
+static char *
+regchoiceend(char *p)
+{
+	register char *next;
+
+	while ((next = regnext(p)) != NULL && OP(next) == BRANCH)
+		p = next;
+
+	return(next);
+}
+
+/*
+ - reglit_seq - literals required by a sequence of nodes up to 'stop'
+ *
+ * Each node of the sequence that always consumes one string out of a known
+ * set is a candidate; the one whose shortest string is the longest wins.
+ * Consecutive EXACTLY nodes (ie. escaped characters) are merged. Returns
+ * the number of literals stored into lits, 0 if none is required.
+ */
+static int
+reglit_seq(char *scan, char *stop, char lits[][PM_REGLIT_LEN+1], int depth)
+{
+	char cur[PM_REGLIT_MAX][PM_REGLIT_LEN+1];
+	char run[PM_REGLIT_LEN+1];
+	register int runlen = 0;
+	register int i, len;
+	int n, shortest, best = 0, bestn = 0;
+
+	run[0] = '\0';
+	for (;;) {
+		if (scan == NULL || scan == stop || OP(scan) != EXACTLY) {
+			/* Flush the current run of EXACTLY nodes. */
+			if (runlen > best || (runlen && runlen == best && bestn > 1)) {
+				memcpy(lits[0], run, runlen+1);
+				best = runlen;
+				bestn = 1;
+			}
+			runlen = 0;
+		}
+
+		if (scan == NULL || scan == stop)
+			break;
+
+		switch (OP(scan)) {
+		case EXACTLY:
+			len = strlen(OPERAND(scan));
+			if (runlen + len > PM_REGLIT_LEN)
+				len = PM_REGLIT_LEN - runlen;
+			memcpy(run+runlen, OPERAND(scan), len);
+			runlen += len;
+			run[runlen] = '\0';
+			break;
+		case BRANCH:
+			n = reglit_choice(scan, cur, depth+1);
+			for (shortest = PM_REGLIT_LEN, i = 0; i < n; i++) {
+				len = strlen(cur[i]);
+				if (len < shortest)
+					shortest = len;
+			}
+			if (n && (shortest > best || (shortest == best && n < bestn))) {
+				memcpy(lits, cur, n * sizeof(cur[0]));
+				best = shortest;
+				bestn = n;
+			}
+			scan = regchoiceend(scan);
+			continue;
+		case BACK:	/* Loops are not followed. */
+		case END:
+			scan = NULL;
+			continue;
+		default:
+			break;
+		}
+
+		scan = regnext(scan);
+	}
+
+	return(bestn);
+}
+
+/*
+ - reglit_choice - literals required by a set of BRANCHes
+ *
+ * Every alternative must require some literals; the result is their union.
+ */
+static int
+reglit_choice(char *scan, char lits[][PM_REGLIT_LEN+1], int depth)
+{
+	char cur[PM_REGLIT_MAX][PM_REGLIT_LEN+1];
+	register char *end;
+	register int n = 0, k;
+
+	if (depth > REGREQ_DEPTH)
+		return(0);
+
+	end = regchoiceend(scan);
+	for (; scan != NULL && scan != end && OP(scan) == BRANCH; scan = regnext(scan)) {
+		k = reglit_seq(OPERAND(scan), end, cur, depth+1);
+		if (k == 0 || n + k > PM_REGLIT_MAX)
+			return(0);
+		memcpy(lits[n], cur, k * sizeof(cur[0]));
+		n += k;
+	}
+
+	return(n);
+}
+
+/*
+ - pm_regliterals - literals, one of which must appear in any match
+ *
+ * Literals are truncated to PM_REGLIT_LEN characters. Returns how many
+ * were stored into lits (up to PM_REGLIT_MAX), 0 if none could be found.
+ */
+int
+pm_regliterals(regexp *prog, char lits[][PM_REGLIT_LEN+1])
+{
+	if (prog == NULL || UCHARAT(prog->program) != REGEXP_MAGIC)
+		return(0);
+
+	return(reglit_seq(prog->program+1, NULL, lits, 0));
+}
+
+/*
+ - regfirst_seq - characters any match of a sequence of nodes starts with
+ *
+ * Returns 1 and adds them to set if the sequence always consumes at least
+ * one character, 0 otherwise.
+ */
+static int
+regfirst_seq(char *scan, char *stop, unsigned char *set, int depth)
+{
+	register char *end;
+	register char *opnd;
+
+	for (; scan != NULL && scan != stop; scan = regnext(scan)) {
+		switch (OP(scan)) {
+		case OPEN+1:
+		case OPEN+2:
+		case OPEN+3:
+		case OPEN+4:
+		case OPEN+5:
+		case OPEN+6:
+		case OPEN+7:
+		case OPEN+8:
+		case OPEN+9:
+		case CLOSE+1:
+		case CLOSE+2:
+		case CLOSE+3:
+		case CLOSE+4:
+		case CLOSE+5:
+		case CLOSE+6:
+		case CLOSE+7:
+		case CLOSE+8:
+		case CLOSE+9:
+		case NOTHING:
+		case BOL:
+			break;
+		case PLUS:
+			scan = OPERAND(scan);
+			if (OP(scan) != EXACTLY && OP(scan) != ANYOF)
+				return(0);
+			/* FALLTHROUGH */
+		case EXACTLY:
+		case ANYOF:
+			for (opnd = OPERAND(scan); *opnd != '\0'; opnd++) {
+				REGSET(set, *opnd);
+				if (OP(scan) == EXACTLY)
+					break;
+			}
+			return(1);
+		case BRANCH:
+			if (depth > REGREQ_DEPTH)
+				return(0);
+			end = regchoiceend(scan);
+			for (; scan != NULL && scan != end && OP(scan) == BRANCH; scan = regnext(scan))
+				if (!regfirst_seq(OPERAND(scan), end, set, depth+1))
+					return(0);
+			return(1);
+		default:
+			return(0);
+		}
+	}
+
+	return(0);
+}
+
+/*
+ - pm_regfirst - for anchored regexps, characters any match starts with
+ *
+ * set is a 256-bit map. Returns 1 if it could be filled in, 0 otherwise.
+ */
+int
+pm_regfirst(regexp *prog, unsigned char *set)
+{
+	if (prog == NULL || UCHARAT(prog->program) != REGEXP_MAGIC || !prog->reganch)
+		return(0);
+
+	memset(set, 0, 32);
+
+	/* reganch means a single top-level choice starting with BOL */
+	return(regfirst_seq(regnext(OPERAND(prog->program+1)), NULL, set, 0));
+}
+
 #ifdef DEBUG
 
 STATIC char *regprop();
@@ -34,8 +34,13 @@ typedef struct regexp {
 	char program[1];	/* Unwarranted chumminess with compiler. */
 } regexp;
 
+#define PM_REGLIT_LEN	16	/* pm_regliterals(): max literal length */
+#define PM_REGLIT_MAX	32	/* pm_regliterals(): max literals */
+
 regexp * pm_regcomp(char *exp, int *patternsize);
 int pm_regexec(regexp *prog, char *string);
 void pm_regerror(char *s);
+int pm_regliterals(regexp *prog, char lits[][PM_REGLIT_LEN+1]);
+int pm_regfirst(regexp *prog, unsigned char *set);
 
 #endif
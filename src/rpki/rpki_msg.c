@@ -200,7 +200,7 @@ int rpki_info_delete(struct bgp_peer *peer, struct prefix *p, as_t asn, u_int8_t
     if (attr.aspath) aspath_unintern(peer, attr.aspath);
 
     /* Check previously received route. */
-    for (ri = route->info[modulo]; ri; ri = ri->next) {
+    for (ri = BGP_NODE_INFO(route, modulo); ri; ri = ri->next) {
       if (ri->peer == peer && rpki_attrhash_cmp(ri->attr, attr_new)) {
 	bgp_info_delete(peer, route, ri, modulo);
 	break;
@@ -213,6 +213,8 @@ int rpki_info_delete(struct bgp_peer *peer, struct prefix *p, as_t asn, u_int8_t
     bgp_unlock_node(peer, route);
   }
 
+  bgp_peer_retired_commit(peer);
+
   return SUCCESS;
 }
 
@@ -62,6 +62,9 @@ void rpki_ribs_free(struct bgp_peer *peer, struct bgp_table *rib_v4, struct bgp_
   bgp_table_info_delete(peer, rib_v4, AFI_IP, SAFI_UNICAST);
   bgp_table_info_delete(peer, rib_v6, AFI_IP6, SAFI_UNICAST);
 
+  /* paths are only retired, their nodes have to be there when freed */
+  bgp_peer_retired_flush(peer);
+
   bgp_table_free(rib_v4);
   bgp_table_free(rib_v6);
 }
@@ -156,6 +156,7 @@ int main(int argc,char **argv, char **envp)
 
   struct packet_ptrs recv_pptrs;
   struct pcap_pkthdr recv_pkthdr;
+  struct pm_recv_batch recv_batch;
 
   sigset_t signal_set;
 
@@ -225,6 +226,7 @@ int main(int argc,char **argv, char **envp)
 
   memset(&recv_pptrs, 0, sizeof(recv_pptrs));
   memset(&recv_pkthdr, 0, sizeof(recv_pkthdr));
+  memset(&recv_batch, 0, sizeof(recv_batch));
 
   /* getting commandline values */
   while (!errflag && ((cp = getopt(argc, argv, ARGS_SFACCTD)) != -1)) {
@@ -754,6 +756,14 @@ int main(int argc,char **argv, char **envp)
 	}
       }
     }
+
+    if (config.nfacctd_recv_batch > 1) {
+      if (pm_recv_batch_init(&recv_batch, config.nfacctd_recv_batch, SFLOW_MAX_MSG_SIZE) == ERR) {
+	Log(LOG_ERR, "ERROR ( %s/core ): Unable to allocate sfacctd_recv_batch buffers. Exiting.\n", config.name);
+	exit_gracefully(1);
+      }
+      else Log(LOG_INFO, "INFO ( %s/core ): sfacctd_recv_batch: batch depth set to %d.\n", config.name, recv_batch.depth);
+    }
   }
 
   if (config.nfacctd_allow_file) load_allow_file(config.nfacctd_allow_file, &allow);
@@ -1175,6 +1185,9 @@ int main(int argc,char **argv, char **envp)
   for (;;) {
     sigprocmask(SIG_BLOCK, &signal_set, NULL);
 
+    if (config.bgp_daemon || config.bmp_daemon) bgp_lookup_offline();
+    if (config.nfacctd_isis) isis_lookup_offline();
+
     if (config.pcap_savefile) {
       ret = recvfrom_savefile(&device, (void **) &sflow_packet, (struct sockaddr *) &client, &spp.ts, &pm_pcap_savefile_round, &recv_pptrs);
     }
@@ -1233,6 +1246,9 @@ int main(int argc,char **argv, char **envp)
       ret = recvfrom_rawip(sflow_packet, ret, (struct sockaddr *) &client, &recv_pptrs);
     }
 #endif
+    else if (recv_batch.depth) {
+      ret = pm_recv_batch_next(&recv_batch, config.sock, &sflow_packet, (struct sockaddr *) &client, &clen);
+    }
     else {
       ret = recvfrom(config.sock, (unsigned char *)sflow_packet, SFLOW_MAX_MSG_SIZE, 0, (struct sockaddr *) &client, &clen);
     }
@@ -1301,6 +1317,7 @@ int main(int argc,char **argv, char **envp)
       time_t now = time(NULL);
 
       print_status_table(&xflow_status_table, now, XFLOW_STATUS_TABLE_SZ);
+      pm_recv_batch_print_stats(&recv_batch, now);
       print_stats = FALSE;
     }
 
@@ -2066,7 +2083,7 @@ void finalizeSample(SFSample *sample, struct packet_ptrs_vector *pptrsv, struct
 
 int SF_find_id(struct id_table *t, struct packet_ptrs *pptrs, pm_id_t *tag, pm_id_t *tag2)
 {
-  struct sockaddr sa_local;
+  struct sockaddr_storage sa_local;
   struct sockaddr_in *sa4 = (struct sockaddr_in *) &sa_local;
   struct sockaddr_in6 *sa6 = (struct sockaddr_in6 *) &sa_local;
   SFSample *sample = (SFSample *)pptrs->f_data; 
@@ -2075,6 +2092,8 @@ int SF_find_id(struct id_table *t, struct packet_ptrs *pptrs, pm_id_t *tag, pm_i
 
   if (!t) return 0;
 
+  memset(&sa_local, 0, sizeof(sa_local));
+
   /* The id_table is shared between by IPv4 and IPv6 sFlow collectors.
      IPv4 ones are in the lower part (0..x), IPv6 ones are in the upper
      part (x+1..end)
@@ -2107,18 +2126,20 @@ int SF_find_id(struct id_table *t, struct packet_ptrs *pptrs, pm_id_t *tag, pm_i
   if (sample->agent_addr.type == SFLADDRESSTYPE_IP_V4) {
     begin = 0;
     end = t->ipv4_num;
-    sa_local.sa_family = AF_INET;
+    sa_local.ss_family = AF_INET;
     sa4->sin_addr.s_addr = sample->agent_addr.address.ip_v4.s_addr;
   }
   else if (sample->agent_addr.type == SFLADDRESSTYPE_IP_V6) {
     begin = t->num-t->ipv6_num;
     end = t->num;
-    sa_local.sa_family = AF_INET6;
+    sa_local.ss_family = AF_INET6;
     ip6_addr_cpy(&sa6->sin6_addr, &sample->agent_addr.address.ip_v6);
   }
 
+  if (t->cls.num) return pretag_cls_find_id(t, pptrs, (struct sockaddr *) &sa_local, tag, tag2);
+
   for (x = begin; x < end; x++) {
-    if (host_addr_mask_sa_cmp(&t->e[x].key.agent_ip.a, &t->e[x].key.agent_mask, &sa_local) == 0) {
+    if (host_addr_mask_sa_cmp(&t->e[x].key.agent_ip.a, &t->e[x].key.agent_mask, (struct sockaddr *) &sa_local) == 0) {
       ret = pretag_entry_process(&t->e[x], pptrs, tag, tag2);
 
       if (!ret || ret > TRUE) {
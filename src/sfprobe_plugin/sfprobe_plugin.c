@@ -625,14 +625,10 @@ void sfprobe_plugin(int pipe_fd, struct configuration *cfgptr, void *ptr)
   struct pkt_data dummy;
   struct pkt_bgp_primitives dummy_pbgp;
   struct pollfd pfd;
-  unsigned char *pipebuf, *pipebuf_ptr;
+  unsigned char *pipebuf = NULL, *pipebuf_ptr;
   int refresh_timeout, ret, num, recv_budget, poll_bypass;
-  struct ring *rg = &((struct channels_list_entry *)ptr)->rg;
-  struct ch_status *status = ((struct channels_list_entry *)ptr)->status;
-  u_int32_t bufsz = ((struct channels_list_entry *)ptr)->bufsize;
-  unsigned char *rgptr;
-  int pollagain = TRUE;
-  u_int32_t seq = 1, rg_err_count = 0;
+  struct channels_list_entry *chptr = (struct channels_list_entry *) ptr;
+  u_int32_t seq = 1;
   struct networks_file_data nfd;
 
   time_t clk, test_clk;
@@ -709,8 +705,10 @@ void sfprobe_plugin(int pipe_fd, struct configuration *cfgptr, void *ptr)
     set_net_funcs(&nt);
   }
 
-  pipebuf = (unsigned char *) pm_malloc(config.buffer_size);
-  memset(pipebuf, 0, config.buffer_size);
+  if (config.pipe_zmq) {
+    pipebuf = (unsigned char *) pm_malloc(config.buffer_size);
+    memset(pipebuf, 0, config.buffer_size);
+  }
 
   if (config.pipe_zmq) P_zmq_pipe_init(zmq_host, &pipe_fd, &seq);
   else setnonblocking(pipe_fd);
@@ -728,13 +726,13 @@ void sfprobe_plugin(int pipe_fd, struct configuration *cfgptr, void *ptr)
 
   for (;;) {
     poll_again:
-    status->wakeup = TRUE;
     poll_bypass = FALSE;
 
     pfd.fd = pipe_fd;
     pfd.events = POLLIN;
 
-    ret = poll(&pfd, (pfd.fd == ERR ? 0 : 1), refresh_timeout);
+    if (config.pipe_homegrown && !arm_pipe_wakeup(chptr)) ret = TRUE; /* data is pending, do not sleep */
+    else ret = poll(&pfd, (pfd.fd == ERR ? 0 : 1), refresh_timeout);
 
     if (ret < 0) goto poll_again;
 
@@ -763,40 +761,16 @@ void sfprobe_plugin(int pipe_fd, struct configuration *cfgptr, void *ptr)
       }
 
       if (config.pipe_homegrown) {
-        if (!pollagain) {
-          seq++;
-          seq %= MAX_SEQNUM;
-          if (seq == 0) rg_err_count = FALSE;
-        }
-        else {
-          if ((ret = read(pipe_fd, &rgptr, sizeof(rgptr))) == 0)
-            exit_gracefully(1); /* we exit silently; something happened at the write end */
-        }
-  
-        if ((rg->ptr + bufsz) > rg->end) rg->ptr = rg->base;
-  
-        if (((struct ch_buf_hdr *)rg->ptr)->seq != seq) {
-          if (!pollagain) {
-            pollagain = TRUE;
-            goto handle_tick;
-          }
-          else {
-  	    rg_err_count++;
-  	    if (config.debug || (rg_err_count > MAX_RG_COUNT_ERR)) {
-              Log(LOG_WARNING, "WARN ( %s/%s ): Missing data detected (plugin_buffer_size=%" PRIu64 " plugin_pipe_size=%" PRIu64 ").\n",
-                        config.name, config.type, config.buffer_size, config.pipe_size);
-              Log(LOG_WARNING, "WARN ( %s/%s ): Increase values or look for plugin_buffer_size, plugin_pipe_size in CONFIG-KEYS document.\n\n",
-                        config.name, config.type);
-  	    }
-
-	    rg->ptr = (rg->base + status->last_buf_off);
-  	    seq = ((struct ch_buf_hdr *)rg->ptr)->seq;
-  	  }
-        }
-  
-        pollagain = FALSE;
-        memcpy(pipebuf, rg->ptr, bufsz);
-        rg->ptr += bufsz;
+	if (!recv_budget) {
+	  if (drain_pipe_wakeup(pipe_fd) == ERR)
+	    exit_gracefully(1); /* we exit silently; something happened at the write end */
+
+	  check_pipe_lost_data(chptr);
+	}
+
+	/* buffers are read in place and released to the Core Process once processed */
+	if (!(pipebuf = get_pipe_buffer(chptr))) goto handle_tick;
+	seq = ((struct ch_buf_hdr *)pipebuf)->seq;
       }
 #ifdef WITH_ZMQ
       else if (config.pipe_zmq) {
@@ -867,6 +841,7 @@ void sfprobe_plugin(int pipe_fd, struct configuration *cfgptr, void *ptr)
 	}
       }
 
+      if (config.pipe_homegrown) release_pipe_buffer(chptr);
       recv_budget++;
       goto read_data;
     }
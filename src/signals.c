@@ -24,6 +24,7 @@
 #include "pmacct-data.h"
 #include "plugin_hooks.h"
 #include "bgp/bgp.h"
+#include "afpacket.h"
 
 /* extern */
 extern struct plugins_list_entry *plugin_list;
@@ -63,13 +64,13 @@ void handle_falling_child()
         ret = delete_plugin_by_id(list->id);
         if (!ret) {
           Log(LOG_WARNING, "WARN ( %s/%s ): no more plugins active. Shutting down.\n", config.name, config.type);
-	  if (config.pidfile) remove_pid_file(config.pidfile);
+	  if (config.pidfile && !core_workers_num) remove_pid_file(config.pidfile);
           exit(1);
         }
 	else {
 	  if (config.plugin_exit_any) {
             Log(LOG_WARNING, "WARN ( %s/%s ): one or more plugins did exit (plugin_exit_any). Shutting down.\n", config.name, config.type);
-	    if (config.pidfile) remove_pid_file(config.pidfile);
+	    if (config.pidfile && !core_workers_num) remove_pid_file(config.pidfile);
 	    exit_all(1);
 	  }
 	}
@@ -89,13 +90,13 @@ void handle_falling_child()
     ret = delete_plugin_by_id(list->id);
     if (!ret) {
       Log(LOG_WARNING, "WARN ( %s/%s ): no more plugins active. Shutting down.\n", config.name, config.type);
-      if (config.pidfile) remove_pid_file(config.pidfile);
+      if (config.pidfile && !core_workers_num) remove_pid_file(config.pidfile);
       exit(1);
     }
     else {
       if (config.plugin_exit_any) {
 	Log(LOG_WARNING, "WARN ( %s/%s ): one or more plugins did exit (plugin_exit_any). Shutting down.\n", config.name, config.type);
-	if (config.pidfile) remove_pid_file(config.pidfile);
+	if (config.pidfile && !core_workers_num) remove_pid_file(config.pidfile);
 	exit_all(1);
       }
     }
@@ -167,7 +168,10 @@ void PM_sigint_handler(int signum)
       printf("NOTICE ( %s/%s ): +++\n", config.name, config.type);
 
       for (device_idx = 0; device_idx < devices.num; device_idx++) {
-        if (pcap_stats(devices.list[device_idx].dev_desc, &ps) < 0) {
+        if (devices.list[device_idx].afpacket) {
+	  PM_afpacket_stats(&devices.list[device_idx], &ps);
+	}
+        else if (pcap_stats(devices.list[device_idx].dev_desc, &ps) < 0) {
 	  printf("INFO ( %s/%s ): [%s,%u] error='pcap_stats(): %s'\n",
 		config.name, config.type, devices.list[device_idx].str,
 		devices.list[device_idx].id,
@@ -182,7 +186,7 @@ void PM_sigint_handler(int signum)
     }
   }
 
-  if (config.pidfile) remove_pid_file(config.pidfile);
+  if (config.pidfile && !core_workers_num) remove_pid_file(config.pidfile);
   exit(0);
 }
 
@@ -210,6 +214,7 @@ void push_stats()
     print_stats = TRUE;
   }
 
+  print_stats_bgp_thread = TRUE;
 }
 
 void reload_maps()
@@ -221,7 +226,7 @@ void reload_maps()
   reload_geoipv2_file = FALSE;
 
   if (config.maps_refresh) {
-    reload_map = TRUE; 
+    reload_map = TRUE;
     reload_map_bgp_thread = TRUE;
     reload_map_rpki_thread = TRUE;
     reload_map_exec_plugins = TRUE;
@@ -229,5 +234,4 @@ void reload_maps()
 
     if (config.acct_type == ACCT_PM) reload_map_pmacctd = TRUE;
   }
-  
 }
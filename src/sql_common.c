@@ -25,7 +25,6 @@
 #include "plugin_hooks.h"
 #include "sql_common.h"
 #include "sql_common_m.h"
-#include "crc32.h"
 
 /* Global variables */
 char sql_data[LARGEBUFLEN];
@@ -129,17 +128,18 @@ void sql_init_global_buffers()
         config.sql_cache_entries, (unsigned long)(((config.sql_cache_entries * sizeof(struct db_cache)) +
 	(2 * (qq_size * sizeof(struct db_cache *))))));
 
-  pipebuf = (unsigned char *) malloc(config.buffer_size);
+  /* homegrown pipe buffers are read in place off the ring */
+  if (config.pipe_zmq) pipebuf = (unsigned char *) malloc(config.buffer_size);
   sql_cache = (struct db_cache *) malloc(config.sql_cache_entries*sizeof(struct db_cache));
   sql_queries_queue = (struct db_cache **) malloc(qq_size*sizeof(struct db_cache *));
   sql_pending_queries_queue = (struct db_cache **) malloc(qq_size*sizeof(struct db_cache *));
 
-  if (!pipebuf || !sql_cache || !sql_queries_queue || !sql_pending_queries_queue) {
+  if ((config.pipe_zmq && !pipebuf) || !sql_cache || !sql_queries_queue || !sql_pending_queries_queue) {
     Log(LOG_ERR, "ERROR ( %s/%s ): malloc() failed (sql_init_global_buffers). Exiting ..\n", config.name, config.type);
     exit_gracefully(1);
   }
 
-  memset(pipebuf, 0, config.buffer_size);
+  if (pipebuf) memset(pipebuf, 0, config.buffer_size);
   memset(sql_cache, 0, config.sql_cache_entries*sizeof(struct db_cache));
   memset(sql_queries_queue, 0, qq_size*sizeof(struct db_cache *));
   memset(sql_pending_queries_queue, 0, qq_size*sizeof(struct db_cache *));
@@ -206,6 +206,8 @@ void sql_init_default_values(struct extra_primitives *extras)
   sql_pc_size = config.cpptrs.len;
   sql_dbc_size = sizeof(struct db_cache);
 
+  P_key_layout_init(&p_key, config.what_to_count, config.what_to_count_2);
+
   /* handling purge preprocessor */
   set_preprocess_funcs(config.sql_preprocess, &prep, PREP_DICT_SQL);
 }
@@ -327,14 +329,20 @@ void sql_cache_modulo(struct primitives_ptrs *prim_ptrs, struct insert_data *ida
   u_char *pcust = prim_ptrs->pcust;
   struct pkt_vlen_hdr_primitives *pvlen = prim_ptrs->pvlen;
 
-  idata->hash = cache_crc32((unsigned char *)srcdst, sql_pp_size);
-  if (pbgp) idata->hash ^= cache_crc32((unsigned char *)pbgp, sql_pb_size);
-  if (pnat) idata->hash ^= cache_crc32((unsigned char *)pnat, sql_pn_size);
-  if (pmpls) idata->hash ^= cache_crc32((unsigned char *)pmpls, sql_pm_size);
-  if (ptun) idata->hash ^= cache_crc32((unsigned char *)ptun, sql_pt_size);
-  if (pcust) idata->hash ^= cache_crc32((unsigned char *)pcust, sql_pc_size);
-  if (pvlen) idata->hash ^= cache_crc32((unsigned char *)pvlen, (PvhdrSz + pvlen->tot_len));
+  u_char key[sizeof(struct pkt_primitives)];
+  u_int16_t key_len;
+  u_int64_t hash;
+
+  key_len = P_key_pack(&p_key, srcdst, key);
+  hash = hash_mem64(key, key_len, 0);
+  if (pbgp) hash = hash_mem64(pbgp, sql_pb_size, hash);
+  if (pnat) hash = hash_mem64(pnat, sql_pn_size, hash);
+  if (pmpls) hash = hash_mem64(pmpls, sql_pm_size, hash);
+  if (ptun) hash = hash_mem64(ptun, sql_pt_size, hash);
+  if (pcust) hash = hash_mem64(pcust, sql_pc_size, hash);
+  if (pvlen) hash = hash_mem64(pvlen, (PvhdrSz + pvlen->tot_len), hash);
 
+  idata->hash = (unsigned int) (hash ^ (hash >> 32));
   idata->modulo = idata->hash % config.sql_cache_entries;
 }
 
@@ -542,7 +550,7 @@ struct db_cache *sql_cache_search(struct primitives_ptrs *prim_ptrs, time_t base
   else {
     if (Cursor->valid == SQL_CACHE_INUSE) {
       /* checks: pkt_primitives and pkt_bgp_primitives */
-      res_data = memcmp(&Cursor->primitives, data, sizeof(struct pkt_primitives));
+      res_data = P_key_cmp(&p_key, &Cursor->primitives, data);
 
       if (pbgp && Cursor->pbgp) {
         res_bgp = memcmp(Cursor->pbgp, pbgp, sizeof(struct pkt_bgp_primitives));
@@ -726,7 +734,7 @@ void sql_cache_insert(struct primitives_ptrs *prim_ptrs, struct insert_data *ida
       int res_cust = TRUE, res_vlen = TRUE;
 
       /* checks: pkt_primitives and pkt_bgp_primitives */
-      res_data = memcmp(&Cursor->primitives, srcdst, sizeof(struct pkt_primitives));
+      res_data = P_key_cmp(&p_key, &Cursor->primitives, srcdst);
 
       if (pbgp && Cursor->pbgp) {
         res_bgp = memcmp(Cursor->pbgp, pbgp, sizeof(struct pkt_bgp_primitives));
@@ -19,6 +19,9 @@
     Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 */
 
+/* sendmmsg() and struct mmsghdr */
+#define _GNU_SOURCE
+
 #include "pmacct.h"
 #include "addr.h"
 #ifdef WITH_KAFKA
@@ -30,27 +33,30 @@
 #include "tee_plugin.h"
 #include "nfacctd.h"
 #include "crc32.h"
+#if defined HAVE_UDP_SEGMENT
+#include <netinet/udp.h>
+#endif
 
 /* Global variables */
 char tee_send_buf[65535];
 struct tee_receivers receivers; 
 
+/* Signal handler flags */
+static int exit_request = FALSE;
+
 void tee_plugin(int pipe_fd, struct configuration *cfgptr, void *ptr)
 {
   struct pkt_msg *msg;
-  unsigned char *pipebuf;
+  unsigned char *pipebuf = NULL;
   struct pollfd pfd;
-  int refresh_timeout, ret, pool_idx, recv_idx, recv_budget, poll_bypass;
-  struct ring *rg = &((struct channels_list_entry *)ptr)->rg;
-  struct ch_status *status = ((struct channels_list_entry *)ptr)->status;
-  u_int32_t bufsz = ((struct channels_list_entry *)ptr)->bufsize;
+  int refresh_timeout, poll_timeout, ret, pool_idx, recv_idx, recv_budget, poll_bypass;
+  struct channels_list_entry *chptr = (struct channels_list_entry *) ptr;
+  pid_t core_pid = chptr->core_pid;
   unsigned char *dataptr;
   struct tee_receiver *target = NULL;
   struct plugin_requests req;
 
-  unsigned char *rgptr;
-  int pollagain = TRUE;
-  u_int32_t seq = 1, rg_err_count = 0;
+  u_int32_t seq = 1;
 
 #ifdef WITH_ZMQ
   struct p_zmq_host *zmq_host = &((struct channels_list_entry *)ptr)->zmq_host;
@@ -133,13 +139,14 @@ void tee_plugin(int pipe_fd, struct configuration *cfgptr, void *ptr)
   config.sql_refresh_time = DEFAULT_TEE_REFRESH_TIME;
   refresh_timeout = config.sql_refresh_time*1000;
 
-  pipebuf = (unsigned char *) pm_malloc(config.buffer_size);
+  if (config.pipe_zmq) {
+    pipebuf = (unsigned char *) pm_malloc(config.buffer_size);
+    memset(pipebuf, 0, config.buffer_size);
 
-  if (config.pipe_zmq) P_zmq_pipe_init(zmq_host, &pipe_fd, &seq);
+    P_zmq_pipe_init(zmq_host, &pipe_fd, &seq);
+  }
   else setnonblocking(pipe_fd);
 
-  memset(pipebuf, 0, config.buffer_size);
-
   /* Arrange send socket */
   Tee_init_socks();
 
@@ -155,17 +162,31 @@ void tee_plugin(int pipe_fd, struct configuration *cfgptr, void *ptr)
   /* plugin main loop */
   for (;;) {
     poll_again:
-    status->wakeup = TRUE;
     poll_bypass = FALSE;
 
+    if (exit_request) goto exit_lane;
+
     pfd.fd = pipe_fd;
     pfd.events = POLLIN;
 
-    ret = poll(&pfd, (pfd.fd == ERR ? 0 : 1), refresh_timeout);
+    /* don't sleep past the moment the oldest queued datagram is due */
+    poll_timeout = Tee_send_queues_expire(refresh_timeout);
+
+    if (config.pipe_homegrown && !arm_pipe_wakeup(chptr)) ret = TRUE; /* data is pending, do not sleep */
+    else ret = poll(&pfd, (pfd.fd == ERR ? 0 : 1), poll_timeout);
 
-    if (ret < 0) goto poll_again;
+    if (ret <= 0) {
+      if (getppid() != core_pid) {
+        Log(LOG_ERR, "ERROR ( %s/%s ): Core process *seems* gone. Exiting.\n", config.name, config.type);
+        exit_gracefully(1);
+      }
+
+      if (ret < 0) goto poll_again;
+    }
 
     poll_ops:
+    if (exit_request) goto exit_lane;
+
     if (reload_map) {
       if (config.tee_receivers) {
         int recvs_allocated = FALSE;
@@ -192,7 +213,7 @@ void tee_plugin(int pipe_fd, struct configuration *cfgptr, void *ptr)
 
     switch (ret) {
     case 0: /* timeout */
-      /* reserved for future since we don't currently cache/batch/etc */
+      /* send queues that are due get flushed right before polling again */
       break;
     default: /* we received data */
       read_data:
@@ -202,40 +223,18 @@ void tee_plugin(int pipe_fd, struct configuration *cfgptr, void *ptr)
       }
 
       if (config.pipe_homegrown) {
-        if (!pollagain) {
-          seq++;
-          seq %= MAX_SEQNUM;
-          if (seq == 0) rg_err_count = FALSE;
-        }
-        else {
-          if ((ret = read(pipe_fd, &rgptr, sizeof(rgptr))) == 0)
-            exit_gracefully(1); /* we exit silently; something happened at the write end */
-        }
-  
-        if ((rg->ptr + bufsz) > rg->end) rg->ptr = rg->base;
-  
-        if (((struct ch_buf_hdr *)rg->ptr)->seq != seq) {
-          if (!pollagain) {
-            pollagain = TRUE;
-            goto poll_again;
-          }
-          else {
-            rg_err_count++;
-            if (config.debug || (rg_err_count > MAX_RG_COUNT_ERR)) {
-              Log(LOG_WARNING, "WARN ( %s/%s ): Missing data detected (plugin_buffer_size=%" PRIu64 " plugin_pipe_size=%" PRIu64 ").\n",
-                        config.name, config.type, config.buffer_size, config.pipe_size);
-              Log(LOG_WARNING, "WARN ( %s/%s ): Increase values or look for plugin_buffer_size, plugin_pipe_size in CONFIG-KEYS document.\n\n",
-                        config.name, config.type);
-            }
-
-	    rg->ptr = (rg->base + status->last_buf_off);
-            seq = ((struct ch_buf_hdr *)rg->ptr)->seq;
-          }
-        }
-  
-        pollagain = FALSE;
-        memcpy(pipebuf, rg->ptr, bufsz);
-        rg->ptr += bufsz;
+	if (!recv_budget) {
+	  if (drain_pipe_wakeup(pipe_fd) == ERR) {
+	    Tee_send_queues_flush_all();
+	    exit_gracefully(1); /* we exit silently; something happened at the write end */
+	  }
+
+	  check_pipe_lost_data(chptr);
+	}
+
+	/* buffers are read in place and released to the Core Process once processed */
+	if (!(pipebuf = get_pipe_buffer(chptr))) goto poll_again;
+	seq = ((struct ch_buf_hdr *)pipebuf)->seq;
       }
 #ifdef WITH_ZMQ
       else if (config.pipe_zmq) {
@@ -266,7 +265,8 @@ void tee_plugin(int pipe_fd, struct configuration *cfgptr, void *ptr)
 	    if (!receivers.pools[pool_idx].balance.func) {
 	      for (recv_idx = 0; recv_idx < receivers.pools[pool_idx].num; recv_idx++) {
 	        target = &receivers.pools[pool_idx].receivers[recv_idx];
-	        Tee_send(msg, (struct sockaddr *) &target->dest, target->fd, config.tee_transparent);
+	        if (target->queue) Tee_send_queue(msg, target, config.tee_transparent);
+	        else Tee_send(msg, (struct sockaddr *) &target->dest, target->fd, config.tee_transparent);
 	      }
 
 #ifdef WITH_KAFKA
@@ -285,7 +285,8 @@ void tee_plugin(int pipe_fd, struct configuration *cfgptr, void *ptr)
 	    }
 	    else {
 	      target = receivers.pools[pool_idx].balance.func(&receivers.pools[pool_idx], msg);
-	      Tee_send(msg, (struct sockaddr *) &target->dest, target->fd, config.tee_transparent);
+	      if (target->queue) Tee_send_queue(msg, target, config.tee_transparent);
+	      else Tee_send(msg, (struct sockaddr *) &target->dest, target->fd, config.tee_transparent);
 	    }
 	  }
 	}
@@ -299,21 +300,29 @@ void tee_plugin(int pipe_fd, struct configuration *cfgptr, void *ptr)
 	}
       }
 
+      if (config.pipe_homegrown) release_pipe_buffer(chptr);
+      Tee_send_queues_expire(refresh_timeout);
       recv_budget++;
       goto read_data;
     }
   }  
+
+  /* queued datagrams are sent out here rather than from Tee_exit_now(),
+     which may have interrupted an update of the send queues */
+  exit_lane:
+  Tee_send_queues_flush_all();
+  wait(NULL);
+  exit_gracefully(0);
 }
 
 void Tee_exit_now(int signum)
 {
-  wait(NULL);
-  exit_gracefully(0);
+  exit_request = TRUE;
 }
 
-size_t Tee_craft_transparent_msg(struct pkt_msg *msg, struct sockaddr *target)
+size_t Tee_craft_transparent_msg(struct pkt_msg *msg, struct sockaddr *target, char *buf)
 {
-  char *buf_ptr = tee_send_buf;
+  char *buf_ptr = buf;
   struct sockaddr *sa = (struct sockaddr *) &msg->agent;
   struct sockaddr_in *sa4 = (struct sockaddr_in *) &msg->agent;
   struct pm_iphdr *i4h = (struct pm_iphdr *) buf_ptr;
@@ -404,31 +413,34 @@ size_t Tee_craft_transparent_msg(struct pkt_msg *msg, struct sockaddr *target)
   return msglen;
 }
 
-void Tee_send(struct pkt_msg *msg, struct sockaddr *target, int fd, int transparent)
+void Tee_send_log(struct pkt_msg *msg, struct sockaddr *target)
 {
-  struct host_addr r;
-  char recv_addr[50];
-  u_int16_t recv_port;
+  char *flow = NULL, netflow[] = "NetFlow/IPFIX", sflow[] = "sFlow";
+  struct host_addr a, r;
+  char agent_addr[50], recv_addr[50];
+  u_int16_t agent_port, recv_port;
 
-  if (config.debug) {
-    char *flow = NULL, netflow[] = "NetFlow/IPFIX", sflow[] = "sFlow";
-    struct host_addr a;
-    char agent_addr[50];
-    u_int16_t agent_port;
+  sa_to_addr((struct sockaddr *)msg, &a, &agent_port);
+  addr_to_str(agent_addr, &a);
 
-    sa_to_addr((struct sockaddr *)msg, &a, &agent_port);
-    addr_to_str(agent_addr, &a);
+  sa_to_addr((struct sockaddr *)target, &r, &recv_port);
+  addr_to_str(recv_addr, &r);
 
-    sa_to_addr((struct sockaddr *)target, &r, &recv_port);
-    addr_to_str(recv_addr, &r);
+  if (config.acct_type == ACCT_NF) flow = netflow;
+  else if (config.acct_type == ACCT_SF) flow = sflow;
 
-    if (config.acct_type == ACCT_NF) flow = netflow;
-    else if (config.acct_type == ACCT_SF) flow = sflow;
+  Log(LOG_DEBUG, "DEBUG ( %s/%s ): Sending %s packet from [%s:%u] seqno [%u] to [%s:%u]\n",
+                      config.name, config.type, flow, agent_addr, agent_port, msg->seqno,
+		      recv_addr, recv_port);
+}
 
-    Log(LOG_DEBUG, "DEBUG ( %s/%s ): Sending %s packet from [%s:%u] seqno [%u] to [%s:%u]\n",
-                        config.name, config.type, flow, agent_addr, agent_port, msg->seqno,
-			recv_addr, recv_port);
-  }
+void Tee_send(struct pkt_msg *msg, struct sockaddr *target, int fd, int transparent)
+{
+  struct host_addr r;
+  char recv_addr[50];
+  u_int16_t recv_port;
+
+  if (config.debug) Tee_send_log(msg, target);
 
   if (!transparent) {
     if (send(fd, msg->payload, msg->len, 0) == -1) {
@@ -450,7 +462,7 @@ void Tee_send(struct pkt_msg *msg, struct sockaddr *target, int fd, int transpar
   else {
     size_t msglen;
 
-    msglen = Tee_craft_transparent_msg(msg, target);
+    msglen = Tee_craft_transparent_msg(msg, target, tee_send_buf);
 
     if (msglen && send(fd, tee_send_buf, msglen, 0) == -1) {
       struct host_addr a;
@@ -470,6 +482,261 @@ void Tee_send(struct pkt_msg *msg, struct sockaddr *target, int fd, int transpar
   }
 }
 
+struct tee_send_queue *Tee_send_queue_init(struct tee_receiver *target, int depth, int transparent)
+{
+#if defined HAVE_SENDMMSG
+  struct tee_send_queue *q;
+
+  if (depth > PM_SEND_BATCH_MAX) depth = PM_SEND_BATCH_MAX;
+
+  q = malloc(sizeof(struct tee_send_queue));
+  if (!q) {
+    Log(LOG_ERR, "ERROR ( %s/%s ): unable to allocate send queue. Exiting ...\n", config.name, config.type);
+    exit_gracefully(1);
+  }
+  else memset(q, 0, sizeof(struct tee_send_queue));
+
+  q->depth = depth;
+  q->bufsz = MAX(depth * TEE_SEND_QUEUE_AVG_DGRAM, TEE_SEND_QUEUE_MAX_DGRAM);
+  q->buf = malloc(q->bufsz);
+  q->lens = malloc(depth * sizeof(u_int32_t));
+  q->offs = malloc(depth * sizeof(u_int32_t));
+  q->target = target;
+
+  if (!q->buf || !q->lens || !q->offs) {
+    Log(LOG_ERR, "ERROR ( %s/%s ): unable to allocate send queue. Exiting ...\n", config.name, config.type);
+    exit_gracefully(1);
+  }
+
+#if defined HAVE_UDP_SEGMENT
+  /* the option is only known to kernels supporting UDP GSO */
+  if (!transparent) {
+    socklen_t l = sizeof(int);
+    int gso_size = 0;
+
+    if (!getsockopt(target->fd, IPPROTO_UDP, UDP_SEGMENT, &gso_size, &l)) {
+      q->gso = TRUE;
+      q->gso_max = TEE_GSO_MAX_BYTES;
+    }
+  }
+#endif
+
+  return q;
+#else
+  return NULL;
+#endif
+}
+
+void Tee_send_queue_destroy(struct tee_receiver *target)
+{
+  struct tee_send_queue *q = target->queue;
+
+  Tee_send_queue_flush(q);
+
+  free(q->buf);
+  free(q->lens);
+  free(q->offs);
+  free(q);
+
+  target->queue = NULL;
+}
+
+void Tee_send_queue(struct pkt_msg *msg, struct tee_receiver *target, int transparent)
+{
+  struct tee_send_queue *q = target->queue;
+  size_t msglen;
+
+  if (config.debug) Tee_send_log(msg, (struct sockaddr *) &target->dest);
+
+  /* worst case: transparent mode alignment and IPv6 + UDP headers */
+  if ((q->used + 7 + IP6HdrSz + UDPHdrSz + msg->len) > q->bufsz) Tee_send_queue_flush(q);
+
+  if (!transparent) {
+    memcpy(q->buf + q->used, msg->payload, msg->len);
+    msglen = msg->len;
+  }
+  else {
+    /* IP headers are crafted in place: keep them aligned */
+    q->used = ((q->used + 7) & ~((size_t) 7));
+
+    msglen = Tee_craft_transparent_msg(msg, (struct sockaddr *) &target->dest, (char *) (q->buf + q->used));
+    if (!msglen) return;
+  }
+
+  if (!q->num) {
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    q->first = ((u_int64_t) now.tv_sec * 1000000 + now.tv_usec);
+
+    q->prev = receivers.pending_tail;
+    q->next = NULL;
+    if (receivers.pending_tail) receivers.pending_tail->next = q;
+    else receivers.pending_head = q;
+    receivers.pending_tail = q;
+  }
+
+  q->lens[q->num] = msglen;
+  q->offs[q->num] = q->used;
+  q->used += msglen;
+  q->num++;
+
+  if (q->num == q->depth) Tee_send_queue_flush(q);
+}
+
+void Tee_send_queue_error(struct tee_send_queue *q, int num)
+{
+  struct host_addr r;
+  char recv_addr[50];
+  u_int16_t recv_port;
+
+  sa_to_addr((struct sockaddr *) &q->target->dest, &r, &recv_port);
+  addr_to_str(recv_addr, &r);
+
+  Log(LOG_ERR, "ERROR ( %s/%s ): %ssendmmsg() of %d datagram(s) to [%s:%u] failed (%s)\n",
+      config.name, config.type, (config.tee_transparent ? "raw " : ""), num, recv_addr,
+      recv_port, strerror(errno));
+}
+
+/*
+  Sends all datagrams queued for a receiver with a single sendmmsg() call
+  (more if the kernel accepts only part of the batch). Where UDP GSO is
+  available, runs of datagrams of the same size, the last one possibly
+  shorter, are sent as a single message segmented by the kernel.
+*/
+void Tee_send_queue_flush(struct tee_send_queue *q)
+{
+#if defined HAVE_SENDMMSG
+  static struct mmsghdr msgs[PM_SEND_BATCH_MAX];
+  static struct iovec iovs[PM_SEND_BATCH_MAX];
+  static int first[PM_SEND_BATCH_MAX], segs[PM_SEND_BATCH_MAX];
+#if defined HAVE_UDP_SEGMENT
+  static union {
+    char buf[CMSG_SPACE(sizeof(u_int16_t))];
+    struct cmsghdr align;
+  } cbufs[PM_SEND_BATCH_MAX];
+#endif
+  int idx, last, num_msgs, sent, ret;
+  size_t bytes;
+
+  if (!q->num) return;
+
+  for (idx = 0, num_msgs = 0; idx < q->num; idx = last, num_msgs++) {
+    last = (idx + 1);
+    bytes = q->lens[idx];
+
+#if defined HAVE_UDP_SEGMENT
+    if (q->gso && q->lens[idx] <= q->gso_max) {
+      while (last < q->num && (last - idx) < TEE_GSO_MAX_SEGS && q->lens[last] <= q->lens[idx] &&
+	     (bytes + q->lens[last]) <= TEE_GSO_MAX_BYTES) {
+	bytes += q->lens[last];
+	last++;
+
+	/* only the last segment can be shorter */
+	if (q->lens[last - 1] < q->lens[idx]) break;
+      }
+    }
+#endif
+
+    memset(&msgs[num_msgs], 0, sizeof(struct mmsghdr));
+    iovs[num_msgs].iov_base = (q->buf + q->offs[idx]);
+    iovs[num_msgs].iov_len = bytes;
+    msgs[num_msgs].msg_hdr.msg_iov = &iovs[num_msgs];
+    msgs[num_msgs].msg_hdr.msg_iovlen = 1;
+
+#if defined HAVE_UDP_SEGMENT
+    if ((last - idx) > 1) {
+      struct cmsghdr *cmsg;
+      u_int16_t gso_size = q->lens[idx];
+
+      msgs[num_msgs].msg_hdr.msg_control = cbufs[num_msgs].buf;
+      msgs[num_msgs].msg_hdr.msg_controllen = sizeof(cbufs[num_msgs].buf);
+
+      cmsg = CMSG_FIRSTHDR(&msgs[num_msgs].msg_hdr);
+      cmsg->cmsg_level = IPPROTO_UDP;
+      cmsg->cmsg_type = UDP_SEGMENT;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(u_int16_t));
+      memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(u_int16_t));
+    }
+#endif
+
+    first[num_msgs] = idx;
+    segs[num_msgs] = (last - idx);
+  }
+
+  for (sent = 0; sent < num_msgs;) {
+    ret = sendmmsg(q->target->fd, &msgs[sent], (num_msgs - sent), 0);
+    if (ret > 0) {
+      sent += ret;
+      continue;
+    }
+
+#if defined HAVE_UDP_SEGMENT
+    /* EIO: no checksum offload on the egress device; EINVAL: segments exceed the path MTU */
+    if (segs[sent] > 1 && (errno == EIO || errno == EINVAL)) {
+      if (errno == EIO) q->gso = FALSE;
+      else q->gso_max = (q->lens[first[sent]] - 1);
+
+      for (idx = first[sent]; idx < (first[sent] + segs[sent]); idx++) {
+	if (send(q->target->fd, (q->buf + q->offs[idx]), q->lens[idx], 0) == -1) Tee_send_queue_error(q, 1);
+      }
+
+      sent++;
+      continue;
+    }
+#endif
+
+    Tee_send_queue_error(q, segs[sent]);
+    sent++;
+  }
+#endif
+
+  q->num = 0;
+  q->used = 0;
+
+  if (q->prev || receivers.pending_head == q) {
+    if (q->prev) q->prev->next = q->next;
+    else receivers.pending_head = q->next;
+
+    if (q->next) q->next->prev = q->prev;
+    else receivers.pending_tail = q->prev;
+
+    q->prev = NULL;
+    q->next = NULL;
+  }
+}
+
+/* flushes send queues that are due; returns the msecs until the next one is */
+int Tee_send_queues_expire(int timeout)
+{
+  struct tee_send_queue *q;
+  struct timeval tv;
+  u_int64_t now, batch_time = (config.tee_send_batch_time * 1000);
+
+  if (!receivers.pending_head) return timeout;
+
+  gettimeofday(&tv, NULL);
+  now = ((u_int64_t) tv.tv_sec * 1000000 + tv.tv_usec);
+
+  while ((q = receivers.pending_head)) {
+    /* pending list is sorted oldest first; a clock stepping back flushes as well */
+    if (now >= q->first && (now - q->first) < batch_time) {
+      int left = ((batch_time - (now - q->first)) + 999) / 1000;
+
+      return MIN(left, timeout);
+    }
+
+    Tee_send_queue_flush(q);
+  }
+
+  return timeout;
+}
+
+void Tee_send_queues_flush_all()
+{
+  while (receivers.pending_head) Tee_send_queue_flush(receivers.pending_head);
+}
+
 #ifdef WITH_KAFKA
 void Tee_kafka_send(struct pkt_msg *msg, struct tee_receivers_pool *pool)
 {
@@ -577,6 +844,7 @@ void Tee_destroy_recvs()
   for (pool_idx = 0; pool_idx < receivers.num; pool_idx++) {
     for (recv_idx = 0; recv_idx < receivers.pools[pool_idx].num; recv_idx++) {
       target = &receivers.pools[pool_idx].receivers[recv_idx];
+      if (target->queue) Tee_send_queue_destroy(target);
       if (target->fd) close(target->fd);
     }
 
@@ -628,6 +896,8 @@ void Tee_init_socks()
       target->fd = Tee_prepare_sock((struct sockaddr *) &target->dest, target->dest_len, receivers.pools[pool_idx].src_port,
 				    config.tee_transparent, config.tee_pipe_size);
 
+      if (config.tee_send_batch > 1) target->queue = Tee_send_queue_init(target, config.tee_send_batch, config.tee_transparent);
+
       if (config.debug) {
 	struct host_addr recv_addr;
         char recv_addr_str[INET6_ADDRSTRLEN];
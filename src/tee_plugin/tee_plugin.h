@@ -37,13 +37,43 @@
 #define TEE_BALANCE_HASH_AGENT	2
 #define TEE_BALANCE_HASH_TAG	3
 
+/* send queues: room for datagrams of this average size, never less than the largest one */
+#define TEE_SEND_QUEUE_AVG_DGRAM	2048
+#define TEE_SEND_QUEUE_MAX_DGRAM	(7 + IP6HdrSz + UDPHdrSz + 65535)
+/* UDP GSO: max segments and payload bytes per super-datagram */
+#define TEE_GSO_MAX_SEGS		64
+#define TEE_GSO_MAX_BYTES		(65535 - IP6HdrSz - UDPHdrSz)
+
 typedef struct tee_receiver *(*tee_balance_algorithm) (void *, struct pkt_msg *);
 
 /* structures */
+/*
+  Per-receiver queue of datagrams pending replication: datagrams are copied
+  back to back in buf and flushed with a single sendmmsg() call as soon as
+  the queue is full or its oldest datagram is tee_send_batch_time old.
+  Queues holding datagrams are chained, oldest first, in a pending list.
+*/
+struct tee_send_queue {
+  unsigned char *buf;
+  size_t bufsz;
+  size_t used;
+  u_int32_t *lens;
+  u_int32_t *offs;
+  int depth;				/* max datagrams queued */
+  int num;				/* datagrams queued */
+  u_int64_t first;			/* usecs: when the oldest datagram was queued */
+  int gso;				/* UDP GSO usable on the socket */
+  u_int32_t gso_max;			/* largest segment size GSO is attempted with */
+  struct tee_receiver *target;
+  struct tee_send_queue *prev;
+  struct tee_send_queue *next;
+};
+
 struct tee_receiver {
   struct sockaddr_storage dest;
   socklen_t dest_len;
   int fd;
+  struct tee_send_queue *queue;		/* NULL if datagrams are sent straight away */
 };
 
 struct tee_balance {
@@ -76,14 +106,25 @@ struct tee_receivers_pool {
 struct tee_receivers {
   struct tee_receivers_pool *pools;
   int num;
+
+  struct tee_send_queue *pending_head;	/* send queues holding datagrams, oldest first */
+  struct tee_send_queue *pending_tail;
 };
 
 /* prototypes */
 extern void Tee_exit_now(int);
 extern void Tee_init_socks();
 extern void Tee_destroy_recvs();
-extern size_t Tee_craft_transparent_msg(struct pkt_msg *, struct sockaddr *);
+extern size_t Tee_craft_transparent_msg(struct pkt_msg *, struct sockaddr *, char *);
+extern void Tee_send_log(struct pkt_msg *, struct sockaddr *);
 extern void Tee_send(struct pkt_msg *, struct sockaddr *, int, int);
+extern struct tee_send_queue *Tee_send_queue_init(struct tee_receiver *, int, int);
+extern void Tee_send_queue_destroy(struct tee_receiver *);
+extern void Tee_send_queue(struct pkt_msg *, struct tee_receiver *, int);
+extern void Tee_send_queue_error(struct tee_send_queue *, int);
+extern void Tee_send_queue_flush(struct tee_send_queue *);
+extern int Tee_send_queues_expire(int);
+extern void Tee_send_queues_flush_all();
 extern int Tee_prepare_sock(struct sockaddr *, socklen_t, u_int16_t, int, int);
 extern int Tee_parse_hostport(const char *, struct sockaddr *, socklen_t *, int);
 extern struct tee_receiver *Tee_rr_balance(void *, struct pkt_msg *);
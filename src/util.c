@@ -1244,13 +1244,13 @@ void stop_all_childs()
 void pm_strftime(char *s, int max, char *format, const time_t *time_ref, int utc)
 {
   time_t time_loc;  
-  struct tm *tm_loc;
+  struct tm tm_buf, *tm_loc;
 
   if (time_ref && (*time_ref)) time_loc = (*time_ref);
   else time_loc = time(NULL);
 
-  if (!utc) tm_loc = localtime(&time_loc);
-  else tm_loc = gmtime(&time_loc);
+  if (!utc) tm_loc = localtime_r(&time_loc, &tm_buf);
+  else tm_loc = gmtime_r(&time_loc, &tm_buf);
 
   strftime(s, max, format, tm_loc);
   insert_rfc3339_timezone(s, max, tm_loc);
@@ -1261,13 +1261,13 @@ void pm_strftime(char *s, int max, char *format, const time_t *time_ref, int utc
 void pm_strftime_same(char *s, int max, char *tmp, const time_t *time_ref, int utc)
 {
   time_t time_loc;
-  struct tm *tm_loc;
+  struct tm tm_buf, *tm_loc;
 
   if (time_ref && (*time_ref)) time_loc = (*time_ref);
   else time_loc = time(NULL);
 
-  if (!utc) tm_loc = localtime(&time_loc);
-  else tm_loc = gmtime(&time_loc);
+  if (!utc) tm_loc = localtime_r(&time_loc, &tm_buf);
+  else tm_loc = gmtime_r(&time_loc, &tm_buf);
 
   strftime(tmp, max, s, tm_loc);
   insert_rfc3339_timezone(tmp, max, tm_loc);
@@ -1438,7 +1438,7 @@ void exit_all(int status)
   }
 
   wait(NULL);
-  if (config.pidfile) remove_pid_file(config.pidfile);
+  if (config.pidfile && !core_workers_num) remove_pid_file(config.pidfile);
 
   exit(status);
 }
@@ -1461,6 +1461,166 @@ void exit_gracefully(int status)
   else exit(status);
 }
 
+/* core_workers_check_plugins(): with nfacctd_workers / pmacctd_workers each
+   worker runs its own instance of every plugin; only plugins whose backend
+   consolidates partial aggregates written concurrently by several producers
+   are hence allowed. Files (print), in-memory tables (memory, sqlite3) and
+   re-exported flows (nfprobe, sfprobe) would be clobbered or duplicated */
+void core_workers_check_plugins(char *key)
+{
+  struct plugins_list_entry *list;
+
+  for (list = plugins_list; list; list = list->next) {
+    switch (list->type.id) {
+    case PLUGIN_ID_CORE:
+    case PLUGIN_ID_TEE:
+    case PLUGIN_ID_AMQP:
+    case PLUGIN_ID_KAFKA:
+    case PLUGIN_ID_MONGODB:
+      break;
+    case PLUGIN_ID_MYSQL:
+    case PLUGIN_ID_PGSQL:
+      /* partial aggregates are summed up by UPDATE statements */
+      if (list->cfg.sql_dont_try_update || list->cfg.sql_use_copy) {
+	Log(LOG_ERR, "ERROR ( %s/%s ): sql_dont_try_update and sql_use_copy are not supported in conjunction with %s. Exiting...\n\n",
+	    list->name, list->type.string, key);
+	exit_gracefully(1);
+      }
+      break;
+    default:
+      Log(LOG_ERR, "ERROR ( %s/%s ): '%s' plugin is not supported in conjunction with %s: each worker would write its own partial output. Exiting...\n\n",
+	  list->name, list->type.string, list->type.string, key);
+      exit_gracefully(1);
+    }
+  }
+}
+
+static int core_workers_exit;
+static int core_workers_signals[] = { SIGINT, SIGTERM, SIGHUP, SIGUSR1, SIGUSR2, SIGCHLD, 0 };
+static struct sigaction core_workers_sa[NSIG];
+
+static void core_workers_sig_exit(int signum)
+{
+  core_workers_exit = TRUE;
+}
+
+static void core_workers_sig_relay(int signum)
+{
+  int idx;
+
+  for (idx = 0; idx < core_workers_num; idx++) {
+    if (core_workers[idx]) kill(core_workers[idx], signum);
+  }
+}
+
+static pid_t core_workers_fork(int idx)
+{
+  int idx2, signum;
+  pid_t pid;
+
+  switch (pid = fork()) {
+  case -1:
+    Log(LOG_ERR, "ERROR ( %s/core ): Unable to spawn core worker #%d: %s\n", config.name, idx, strerror(errno));
+    break;
+  case 0: /* Child */
+    /* back to the handlers set up by the daemon before spawning */
+    for (idx2 = 0; (signum = core_workers_signals[idx2]); idx2++) sigaction(signum, &core_workers_sa[signum], NULL);
+
+    core_worker_id = idx;
+    Log(LOG_INFO, "INFO ( %s/core ): core worker #%d started.\n", config.name, core_worker_id);
+    break;
+  default: /* Parent */
+    core_workers[idx] = pid;
+    break;
+  }
+
+  return pid;
+}
+
+/* core_workers_spawn(): forks 'num' core workers off the calling process and
+   returns in each of them with its worker id. The calling process does not
+   return: it stays on as a supervisor that owns the pidfile, relays signals
+   to the workers and respawns any worker that exits unexpectedly. Resources
+   opened before the call and kept open by the supervisor, ie. the sockets of
+   a SO_REUSEPORT group, hence retain their position across respawns */
+int core_workers_spawn(int num)
+{
+  struct sigaction sa;
+  time_t spawned[MAX_NFACCTD_WORKERS];
+  int idx, status;
+  pid_t pid;
+
+  memset(core_workers, 0, (sizeof(pid_t) * MAX_NFACCTD_WORKERS));
+  memset(core_workers_sa, 0, sizeof(core_workers_sa));
+  memset(spawned, 0, sizeof(spawned));
+  core_workers_supervisor = getpid();
+  core_workers_num = num;
+
+  memset(&sa, 0, sizeof(sa));
+  sigemptyset(&sa.sa_mask);
+
+  sa.sa_handler = core_workers_sig_exit;
+  sigaction(SIGINT, &sa, &core_workers_sa[SIGINT]);
+  sigaction(SIGTERM, &sa, &core_workers_sa[SIGTERM]);
+
+  sa.sa_handler = core_workers_sig_relay;
+  sa.sa_flags = SA_RESTART;
+  sigaction(SIGHUP, &sa, &core_workers_sa[SIGHUP]);
+  sigaction(SIGUSR1, &sa, &core_workers_sa[SIGUSR1]);
+  sigaction(SIGUSR2, &sa, &core_workers_sa[SIGUSR2]);
+
+  sa.sa_handler = SIG_DFL;
+  sigaction(SIGCHLD, &sa, &core_workers_sa[SIGCHLD]);
+
+  for (idx = 0; idx < num; idx++) {
+    pid = core_workers_fork(idx);
+    if (!pid) return idx;
+    else if (pid < 0) {
+      core_workers_sig_relay(SIGINT);
+      exit(1);
+    }
+
+    spawned[idx] = time(NULL);
+  }
+
+  pm_setproctitle("%s [%s] (supervisor)", "Core Process", config.proc_name);
+  if (config.pidfile) write_pid_file(config.pidfile);
+  Log(LOG_INFO, "INFO ( %s/core ): spawned %d core workers.\n", config.name, num);
+
+  while (!core_workers_exit) {
+    pid = waitpid(-1, &status, 0);
+    if (pid < 0) {
+      if (errno == EINTR) continue;
+      else break;
+    }
+
+    for (idx = 0; idx < num; idx++) {
+      if (core_workers[idx] != pid) continue;
+
+      core_workers[idx] = 0;
+      Log(LOG_WARNING, "WARN ( %s/core ): core worker #%d (pid %u) exited (status %d). Respawning.\n",
+	  config.name, idx, pid, status);
+
+      /* a worker failing right away would otherwise fork-loop */
+      if (time(NULL) - spawned[idx] < CORE_WORKERS_RESPAWN_INTERVAL) sleep(CORE_WORKERS_RESPAWN_INTERVAL);
+      if (core_workers_exit) break;
+
+      pid = core_workers_fork(idx);
+      if (!pid) return idx;
+
+      spawned[idx] = time(NULL);
+      break;
+    }
+  }
+
+  core_workers_sig_relay(SIGINT);
+  while ((pid = wait(NULL)) > 0 || (pid < 0 && errno == EINTR));
+
+  Log(LOG_INFO, "INFO ( %s/core ): OK, Exiting ...\n", config.name);
+  if (config.pidfile) remove_pid_file(config.pidfile);
+  exit(0);
+}
+
 void reset_tag_label_status(struct packet_ptrs_vector *pptrsv)
 {
   pptrsv->v4.tag = FALSE;
@@ -1825,13 +1985,13 @@ int evaluate_tags(struct pretag_filter *filter, pm_id_t tag)
 int evaluate_labels(struct pretag_label_filter *filter, pt_label_t *label)
 {
   int index;
-  char *null_label = "null";
+  char *null_label = "null", *val;
 
   if (filter->num == 0) return FALSE; /* no entries in the filter array: tag filtering disabled */
-  if (!label->val) label->val = strdup(null_label);
+  val = (label->val ? label->val : null_label);
 
   for (index = 0; index < filter->num; index++) {
-    if (!memcmp(filter->table[index].v, label->val, filter->table[index].len)) return (FALSE | filter->table[index].neg);
+    if (!memcmp(filter->table[index].v, val, filter->table[index].len)) return (FALSE | filter->table[index].neg);
     else {
       if (filter->table[index].neg) return FALSE;
     }
@@ -2008,7 +2168,7 @@ void compose_timestamp(char *buf, int buflen, struct timeval *tv, int usec, int
 {
   int slen;
   time_t time1;
-  struct tm *time2;
+  struct tm tm_buf, *time2;
 
   if (buflen < VERYSHORTBUFLEN) return; 
 
@@ -2018,8 +2178,9 @@ void compose_timestamp(char *buf, int buflen, struct timeval *tv, int usec, int
   }
   else {
     time1 = tv->tv_sec;
-    if (!utc) time2 = localtime(&time1);
-    else time2 = gmtime(&time1);
+    /* reentrant variants: this is called concurrently by plugin worker threads */
+    if (!utc) time2 = localtime_r(&time1, &tm_buf);
+    else time2 = gmtime_r(&time1, &tm_buf);
     
     if (tv->tv_sec) {
       if (!rfc3339) slen = strftime(buf, buflen, "%Y-%m-%d %H:%M:%S", time2);
@@ -2837,6 +2998,50 @@ int hash_key_cmp(pm_hash_key_t *a, pm_hash_key_t *b)
   return memcmp(a->val, b->val, b->len);
 }
 
+/* 64-bit MurmurHash2 (MurmurHash64A) by Austin Appleby, public domain;
+   seed can be chained across calls to hash non-contiguous areas */
+u_int64_t hash_mem64(const void *key, u_int32_t len, u_int64_t seed)
+{
+  const u_int64_t m = 0xc6a4a7935bd1e995ULL;
+  const int r = 47;
+  const u_char *data = key, *end = (data + (len & ~7));
+  u_int64_t h = seed ^ (len * m), k;
+
+  for (; data != end; data += 8) {
+    memcpy(&k, data, sizeof(k));
+
+    k *= m;
+    k ^= k >> r;
+    k *= m;
+
+    h ^= k;
+    h *= m;
+  }
+
+  switch (len & 7) {
+  case 7: h ^= (u_int64_t) data[6] << 48;
+	  /* fallthrough */
+  case 6: h ^= (u_int64_t) data[5] << 40;
+	  /* fallthrough */
+  case 5: h ^= (u_int64_t) data[4] << 32;
+	  /* fallthrough */
+  case 4: h ^= (u_int64_t) data[3] << 24;
+	  /* fallthrough */
+  case 3: h ^= (u_int64_t) data[2] << 16;
+	  /* fallthrough */
+  case 2: h ^= (u_int64_t) data[1] << 8;
+	  /* fallthrough */
+  case 1: h ^= (u_int64_t) data[0];
+	  h *= m;
+  };
+
+  h ^= h >> r;
+  h *= m;
+  h ^= h >> r;
+
+  return h;
+}
+
 void dump_writers_init()
 {
   dump_writers.active = 0;
@@ -73,6 +73,8 @@ extern int timeval_cmp(struct timeval *, struct timeval *);
 extern void exit_all(int);
 extern void exit_plugin(int);
 extern void exit_gracefully(int);
+extern void core_workers_check_plugins(char *);
+extern int core_workers_spawn(int);
 extern void reset_tag_label_status(struct packet_ptrs_vector *);
 extern void reset_net_status(struct packet_ptrs *);
 extern void reset_net_status_v(struct packet_ptrs_vector *);
@@ -167,6 +169,7 @@ extern u_int16_t hash_serial_get_off(pm_hash_serial_t *);
 extern u_int16_t hash_key_get_len(pm_hash_key_t *);
 extern u_char *hash_key_get_val(pm_hash_key_t *);
 extern int hash_key_cmp(pm_hash_key_t *, pm_hash_key_t *);
+extern u_int64_t hash_mem64(const void *, u_int32_t, u_int64_t);
 
 extern void dump_writers_init();
 extern void dump_writers_count();
@@ -22,6 +22,8 @@
 /* includes */
 #include "pmacct.h"
 #include "addr.h"
+#include "bgp/bgp.h"
+#include "isis/isis.h"
 
 /* Global variables */
 xflow_status_table_t xflow_status_table;
@@ -154,6 +156,11 @@ void print_status_table(xflow_status_table_t *table, time_t now, int buckets)
     } 
   }
 
+  if (table->print_ext) table->print_ext(now);
+
+  if (config.bgp_daemon || config.bmp_daemon) bgp_lookup_cache_print_status(now);
+  if (config.nfacctd_isis) isis_lookup_cache_print_status(now);
+
   Log(LOG_NOTICE, "NOTICE ( %s/%s ): stats [%s:%u] time=%ld discarded_packets=%u\n",
 		config.name, config.type, collector_ip_address, collector_port,
 		(long)now, table->tot_bad_datagrams);
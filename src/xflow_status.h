@@ -65,6 +65,12 @@ struct xflow_status_map_cache
   struct timeval stamp;
 };
 
+struct xflow_status_peer_miss {
+  u_int32_t gen;		/* peers cache generation the miss is valid for; 0 if none */
+  u_int16_t port;
+  struct host_addr addr;
+};
+
 struct xflow_status_entry
 {
   struct host_addr agent_addr;  /* NetFlow/IPFIX: socket IP address
@@ -81,6 +87,8 @@ struct xflow_status_entry
   u_int16_t inc;		/* increment, NetFlow v5: required by flow sequence number */
   u_int32_t peer_v4_idx;        /* last known BGP peer index for ipv4 address family */
   u_int32_t peer_v6_idx;        /* last known BGP peer index for ipv6 address family */
+  struct xflow_status_peer_miss peer_v4_miss;	/* last failed BGP peer lookup for ipv4 address family */
+  struct xflow_status_peer_miss peer_v6_miss;	/* last failed BGP peer lookup for ipv6 address family */
   struct xflow_status_map_cache bta_v4;			/* last known bgp_agent_map IPv4 result */
   struct xflow_status_map_cache bta_v6;			/* last known bgp_agent_map IPv6 result */
   struct xflow_status_map_cache st;			/* last known sampling_map result */
@@ -88,6 +96,7 @@ struct xflow_status_entry
   struct xflow_status_entry_sampling *sampling;
   struct xflow_status_entry_class *class;
   void *sf_cnt;			/* struct (ab)used for sFlow counters logging */
+  void *last_tpl;		/* NetFlow v9/IPFIX: last template hit by this exporter */
 
 #ifdef WITH_GNUTLS
   pm_dtls_peer_t dtls;
@@ -105,6 +114,7 @@ typedef struct {
   u_int8_t class_entry_status_table_memerr;
 
   struct xflow_status_entry *t[XFLOW_STATUS_TABLE_SZ];
+  void (*print_ext)(time_t);	/* daemon-specific stats, printed by print_status_table() */
 } xflow_status_table_t;
 
 /* prototypes */
@@ -0,0 +1,197 @@
+#!/bin/sh
+#
+# test_afpacket_workers.sh: checks pmacctd_afpacket on a veth pair. Packets
+# of many flows are sent into one end of the pair while pmacctd captures
+# off the other.
+#
+# - fanout: with pmacctd_workers, per-worker capture counters, as logged on
+#   SIGUSR1, must add up to what was sent, with every worker getting a share
+#   and no drops.
+# - vlan: with a 'vlan 100' pcap_filter, tagged (VLAN 100 and 200) and
+#   untagged packets are sent; the print plugin, aggregating on VLAN, must
+#   report all and only the VLAN 100 ones. TPACKET_V3 strips the tags,
+#   which have to be put back for both the filter and the VLAN field. The
+#   print plugin can't be used with pmacctd_workers, hence a single core
+#   process here.
+#
+# Usage: test_afpacket_workers.sh <path to pmacctd> [workers] [packets] [flows]
+#
+# Needs root, iproute2 and python3. Plugin output is not checked in the
+# fanout run: the plugin is only there for the Core Process to run and
+# never gets to write within the test. It must be one of the plugins
+# supported with pmacctd_workers (kafka, amqp, mongodb, mysql, pgsql): the
+# first one pmacctd was compiled with is picked, unless set via the PLUGIN
+# environment variable; if none, the fanout run is skipped.
+#
+# Exit status: 0 passed, 1 failed, 77 skipped (as for automake tests) for
+# lack of root.
+
+PMACCTD=$1
+WORKERS=${2:-4}
+PACKETS=${3:-40000}
+FLOWS=${4:-256}
+
+TX_IF=pmtest0
+RX_IF=pmtest1
+
+if [ -z "$PMACCTD" ] || [ ! -x "$PMACCTD" ]; then
+  echo "Usage: $0 <path to pmacctd> [workers] [packets] [flows]"
+  exit 1
+fi
+
+if [ "$(id -u)" -ne 0 ]; then
+  echo "SKIP: root is required to set up the veth pair"
+  exit 77
+fi
+
+if [ -z "$PLUGIN" ]; then
+  for opt in kafka:kafka rabbitmq:amqp mongodb:mongodb mysql:mysql pgsql:pgsql; do
+    if ("$PMACCTD" -V) 2>/dev/null | grep -q -- "--enable-${opt%%:*}"; then
+      PLUGIN=${opt#*:}
+      break
+    fi
+  done
+fi
+
+TMPDIR=$(mktemp -d /tmp/test_afpacket_workers.XXXXXX) || exit 1
+FAILED=0
+
+cleanup() {
+  [ -f "$TMPDIR/pmacctd.pid" ] && kill -INT "$(cat "$TMPDIR/pmacctd.pid")" 2>/dev/null
+  ip link del "$TX_IF" 2>/dev/null
+  rm -rf "$TMPDIR"
+}
+trap cleanup EXIT
+
+ip link add "$TX_IF" type veth peer name "$RX_IF" || exit 1
+# no IPv6 autoconfiguration traffic on top of the test one
+sysctl -qw "net.ipv6.conf.$TX_IF.disable_ipv6=1" "net.ipv6.conf.$RX_IF.disable_ipv6=1" 2>/dev/null
+ip link set "$TX_IF" up
+ip link set "$RX_IF" up
+# no VLAN offload on the sending end: tags stay in the frames sent
+ethtool -K "$TX_IF" txvlan off >/dev/null 2>&1
+
+# sender: <packets> <flows> <vlan id, 0 for none>
+cat > "$TMPDIR/tx.py" << EOF
+import socket, struct, sys
+
+s = socket.socket(socket.AF_PACKET, socket.SOCK_RAW)
+s.bind(("$TX_IF", 0))
+packets, flows, vlan = int(sys.argv[1]), int(sys.argv[2]), int(sys.argv[3])
+
+for i in range(packets):
+    f = i % flows
+    payload = b'x' * 60
+    udp = struct.pack('!HHHH', 10000 + f, 53, 8 + len(payload), 0) + payload
+    ip = struct.pack('!BBHHHBBH4s4s', 0x45, 0, 20 + len(udp), i & 0xffff, 0, 64, 17, 0,
+                     socket.inet_aton('10.0.%d.%d' % (f // 250, f % 250 + 1)), socket.inet_aton('192.168.0.1'))
+    eth = b'\x02\x00\x00\x00\x00\x02' + b'\x02\x00\x00\x00\x00\x01'
+    if vlan: eth += struct.pack('!HH', 0x8100, vlan)
+    s.send(eth + b'\x08\x00' + ip + udp)
+EOF
+
+# run_start <name>: starts pmacctd off $TMPDIR/<name>.conf, leaving its log
+# in $TMPDIR/<name>.log
+run_start() {
+  cat >> "$TMPDIR/$1.conf" << EOF
+daemonize: false
+pidfile: $TMPDIR/pmacctd.pid
+pcap_interface: $RX_IF
+pmacctd_afpacket: true
+pmacctd_afpacket_block_size: 65536
+pmacctd_afpacket_block_num: 64
+EOF
+
+  "$PMACCTD" -f "$TMPDIR/$1.conf" > "$TMPDIR/$1.log" 2>&1 &
+  sleep 3
+}
+
+# run_stop: logs stats via SIGUSR1, stops pmacctd
+run_stop() {
+  sleep 2
+  kill -USR1 "$(cat "$TMPDIR/pmacctd.pid")"
+  sleep 2
+  kill -INT "$(cat "$TMPDIR/pmacctd.pid")"
+  sleep 2
+  rm -f "$TMPDIR/pmacctd.pid"
+}
+
+# check_workers <name> <expected packets>: per-worker counters against the
+# expected total
+check_workers() {
+  awk -v name="$1" -v expected="$2" -v workers="$WORKERS" '
+    / stats \[/ {
+      for (i = 1; i <= NF; i++) {
+        split($i, kv, "=");
+        if (kv[1] == "worker") w = kv[2];
+        else if (kv[1] == "received_packets") recv[w] = kv[2];
+        else if (kv[1] == "dropped_packets") drops[w] = kv[2];
+      }
+    }
+    END {
+      seen = 0; total = 0; dropped = 0; failed = 0;
+      for (w in recv) {
+        printf("%s: worker %s received %u dropped %u\n", name, w, recv[w], drops[w]);
+        seen++; total += recv[w]; dropped += drops[w];
+        if (!recv[w] && expected >= workers * 100) failed = 1;
+      }
+      if (seen != workers || total != expected || dropped) failed = 1;
+      printf("%s: %u workers, %u received, %u expected, %u dropped: %s\n", name, seen, total, expected,
+             dropped, (failed ? "FAILED" : "OK"));
+      exit(failed);
+    }' "$TMPDIR/$1.log" || FAILED=1
+}
+
+# check_vlan <name> <vlan> <expected packets>: print plugin CSV output, one
+# line per VLAN and refresh, against the expected VLAN and packets
+check_vlan() {
+  awk -F, -v name="$1" -v vlan="$2" -v expected="$3" '
+    $1 == "VLAN" { for (i = 1; i <= NF; i++) col[$i] = i; next }
+    NF { packets[$col["VLAN"]] += $col["PACKETS"] }
+    END {
+      failed = 0;
+      for (v in packets) {
+        printf("%s: VLAN %s %u packets\n", name, v, packets[v]);
+        if (v != vlan) failed = 1;
+      }
+      if (packets[vlan] != expected) failed = 1;
+      printf("%s: VLAN %s, %u packets, %u expected: %s\n", name, vlan, packets[vlan], expected,
+             (failed ? "FAILED" : "OK"));
+      exit(failed);
+    }' "$TMPDIR/$1.csv" || FAILED=1
+}
+
+if [ -n "$PLUGIN" ]; then
+  cat > "$TMPDIR/fanout.conf" << EOF
+pmacctd_workers: $WORKERS
+plugins: $PLUGIN
+sql_refresh_time: 3600
+aggregate: src_host, dst_host, src_port, dst_port, proto
+EOF
+  run_start fanout
+  python3 "$TMPDIR/tx.py" "$PACKETS" "$FLOWS" 0
+  run_stop
+  check_workers fanout "$PACKETS"
+else
+  echo "fanout: SKIPPED, pmacctd is compiled with none of the plugins supported by pmacctd_workers"
+  echo "        (kafka, amqp, mongodb, mysql, pgsql); set PLUGIN to force one"
+fi
+
+cat > "$TMPDIR/vlan.conf" << EOF
+pcap_filter: vlan 100
+plugins: print
+print_output: csv
+print_output_file: $TMPDIR/vlan.csv
+print_output_file_append: true
+print_refresh_time: 60
+aggregate: vlan
+EOF
+run_start vlan
+python3 "$TMPDIR/tx.py" "$PACKETS" "$FLOWS" 100
+python3 "$TMPDIR/tx.py" "$PACKETS" "$FLOWS" 200
+python3 "$TMPDIR/tx.py" "$PACKETS" "$FLOWS" 0
+run_stop
+check_vlan vlan 100 "$PACKETS"
+
+[ "$FAILED" -ne 0 ] && cat "$TMPDIR"/*.log
+exit $FAILED